@@ -0,0 +1,164 @@
+//  frametest - Check the BSRR table the DMA sender puts out (ps2frame.h).
+//  ----------------------------------------------------------------------
+//
+//	The simulator doesn't model TIM4-paced DMA, so PS2_DMA_TX isn't
+//	run there; this plays each byte's table onto a pair of pins
+//	instead, a word per quarter clock period, and checks what a host
+//	would see:
+//
+//	  - the clock high and low for half a period each, 11 times;
+//	  - the data never moving with a clock edge, and only a quarter
+//	    period after the clock rises and before it falls, which is
+//	    inside the spec's 5 us and 25 us at every rate we use;
+//	  - start, the byte LSB first, odd parity and stop read on the
+//	    falling edges, and both lines released at the end;
+//	  - PS2_FRAME_OWN_FALL true just after each of our falling edges,
+//	    and PS2_FRAME_CLK_UP once a bit, when we let go of the clock
+//	    a word ago and haven't pulled it down since.
+//
+//	Usage: irkey-frametest
+//
+//	Exits 0 if all pass.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "ps2.h"
+#include "ps2frame.h"
+
+#define CLK 0x40			// any two bits will do
+#define DATA 0x80
+
+#define CHECK( cond) Check( (cond), #cond, What, Word, __LINE__)
+
+static int
+  Failures;
+
+static void Check( int Ok, const char *Cond, int What, int Word, int Line);
+static int CheckFrame( int What);
+
+int main( void)
+{
+
+  int
+    what;
+
+  double
+    quarter;
+
+  quarter = 1e6 / (4.0 * PS2_RATE_MIN);	// us, longest
+  printf( "Quarter period %.1f to %.1f us\n",
+    1e6 / (4.0 * PS2_RATE_MAX), quarter);
+  if ( quarter > 25.0 || 1e6 / (4.0 * PS2_RATE_MAX) < 5.0)
+  {
+    printf( "  outside 5 to 25 us\n");
+    Failures++;
+  }
+
+  for ( what = 0; what < 256 && Failures < 20; what++)
+    CheckFrame( what);
+  printf( "%s\n", Failures ? "FAIL" : "PASS");
+  return Failures ? 1 : 0;
+} // main
+
+//	Check - Count and report a failed check.
+//	----------------------------------------
+
+static void Check( int Ok, const char *Cond, int What, int Word, int Line)
+{
+
+  if ( Ok)
+    return;
+  printf( "  byte %02X word %d, line %d: %s\n", What, Word, Line, Cond);
+  Failures++;
+  return;
+} // Check
+
+//	CheckFrame - Play one byte's table and check it.
+//	------------------------------------------------
+//
+//	Returns nonzero if it all checked out.
+//
+
+static int CheckFrame( int What)
+{
+
+  uint32_t
+    table[ PS2_FRAME_WORDS],
+    set,
+    reset;
+
+  int
+    before,
+    Word,
+    pins,
+    last,
+    since,			// words since the clock last changed
+    edges,
+    ups,
+    bits,
+    parity,
+    frame,
+    i;
+
+  before = Failures;
+  PS2FrameBuild( table, (uint8_t) What, CLK, DATA);
+  pins = CLK | DATA;			// idle: both released
+  since = 0;
+  edges = 0;
+  ups = 0;
+  bits = 0;
+  frame = 0;
+  for ( Word = 0; Word < PS2_FRAME_WORDS; Word++)
+  {
+    set = table[ Word] & 0xffff;
+    reset = table[ Word] >> 16;
+    CHECK( !(set & reset));
+    CHECK( !((set | reset) & ~(CLK | DATA)));
+    last = pins;
+    pins = (pins | set) & ~reset;
+    since++;
+
+    if ( (pins ^ last) & CLK)
+    { // an edge: half a period since the last
+      CHECK( since == 2 || !edges);
+      CHECK( !((pins ^ last) & DATA) || Word == PS2_FRAME_WORDS - 1);
+      since = 0;
+      edges++;
+      if ( !(pins & CLK))
+      { // falling: the host reads the data
+        if ( bits < 16)
+          frame |= ((pins & DATA) != 0) << bits;
+        bits++;
+      }
+    }
+    if ( ((pins ^ last) & DATA) && Word < PS2_FRAME_WORDS - 1)
+    { // a quarter after the rise, a quarter before the fall
+      CHECK( pins & CLK);
+      CHECK( since == 1 || !edges);	// the clock was up already
+      CHECK( !(table[ Word + 1] & BSRR_SET( CLK)));
+      CHECK( table[ Word + 1] & BSRR_RESET( CLK));
+    }
+    CHECK( !PS2_FRAME_OWN_FALL( Word + 1) == !((last & CLK) && !(pins & CLK)));
+    if ( PS2_FRAME_CLK_UP( Word + 1))
+    {
+      CHECK( (last & CLK) && (pins & CLK));
+      CHECK( table[ Word - 1] & BSRR_SET( CLK));
+      ups++;
+    }
+  } // for each word
+
+  Word = PS2_FRAME_WORDS;
+  CHECK( pins == (CLK | DATA));
+  CHECK( bits == PS2_FRAME_BITS && edges == 2 * PS2_FRAME_BITS);
+  CHECK( ups == PS2_FRAME_BITS);
+  CHECK( !(frame & 1));			// start
+  CHECK( ((frame >> 1) & 0xff) == What);
+  parity = 0;
+  for ( i = 1; i < 10; i++)
+    parity ^= (frame >> i) & 1;
+  CHECK( parity == 1);			// odd, with the parity bit
+  CHECK( frame & (1 << 10));		// stop
+  return Failures == before;
+} // CheckFrame
@@ -0,0 +1,20 @@
+#ifndef _FUZZ_DEFINED
+#define _FUZZ_DEFINED
+
+#include <stddef.h>
+#include <stdint.h>
+
+//	Fuzzing harnesses.
+//
+//	Each harness (fuzzdecode.c, fuzzsim.c) is a libFuzzer entry point,
+//	LLVMFuzzerTestOneInput, that runs one input through and calls
+//	FuzzFail if anything it checks is wrong.  Built with
+//	-fsanitize=fuzzer, libFuzzer drives it.  Otherwise fuzzmain.c
+//	supplies a main that runs the files named--which is all AFL
+//	needs--or makes up random inputs.  Either way a failure is an
+//	abort(), so the engine keeps the input.
+
+int LLVMFuzzerTestOneInput( const uint8_t *Data, size_t Size);
+void FuzzFail( const char *Format, ...);
+
+#endif // _FUZZ_DEFINED
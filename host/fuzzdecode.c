@@ -0,0 +1,284 @@
+//  fuzzdecode - Fuzz the IR frame decoder and the host command processor.
+//  ----------------------------------------------------------------------
+//
+//	Both are plain C with no hardware in them (irdecode.c and
+//	hostcmd.c), so they're run here directly, millions of bytes a
+//	second.  An input is a string of two-byte records:
+//
+//	  op, byte	op bits 0-1 say what to do with the byte:
+//			  0  the IR sensor receives it
+//			  1  the IR sensor receives it and its check byte
+//			  2  the host sends it
+//			  3  the IR sensor receives a repeat code and check
+//			op bits 2-7 are the gap before it, g: g ms up to 51,
+//			then (g - 51) * 200 ms, which gets past both of the
+//			decoder's timeouts.
+//
+//	IR stamps are in CPU cycles, as the firmware's are, starting a
+//	few seconds short of where they wrap.
+//
+//	After each IR byte, the event (if any) is checked against the
+//	bytes that came in: a key only from a byte and its check byte
+//	in time, of the type the first byte says, and a repeat only of
+//	the last key made, with no release since and not too late.
+//
+//	After each host byte, the reply is checked for sense: no longer
+//	than the buffer, an ACK, resend or echo first, and FA AA after a
+//	reset.  A byte from ED up must be taken as a command even when a
+//	parameter is due, so it's also run through a copy that wasn't
+//	waiting, and the two must agree.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "keydef.h"
+#include "ps2.h"
+#include "irdecode.h"
+#include "hostcmd.h"
+#include "fuzz.h"
+
+#define TICKS_PER_MS 72000	// the firmware's CYCLES_PER_MS
+#define STAMP_START ((uint32_t) -(5000 * TICKS_PER_MS))
+#define IR_CHECK( b) ((uint8_t) ((~(b) & 0xf8) | ((b) & 0x07)))
+
+//  What we know of the IR stream so far.
+
+typedef struct
+{
+  IR_DECODER
+    Dec;
+  uint32_t
+    Stamp,			// now
+    PrevStamp,			// of the byte before this one
+    KeyStamp,			// last make or repeat event
+    Frames;			// key events seen
+  uint8_t
+    Prev,			// the byte before this one
+    LastMake;			// key of the last make; 0 if released since
+  int
+    HavePrev;
+} IR_MODEL;
+
+static void FeedIR( IR_MODEL *Ir, uint8_t What);
+static void CheckEvent( IR_MODEL *Ir, uint8_t What, int Got,
+  IR_EVENT *Event);
+static void FeedHost( HOST_CMD *Cmd, uint8_t What);
+static void CheckReply( HOST_CMD *Cmd, uint8_t What, int Action);
+
+int LLVMFuzzerTestOneInput( const uint8_t *Data, size_t Size)
+{
+
+  IR_MODEL
+    ir;
+
+  HOST_CMD
+    cmd;
+
+  uint32_t
+    gap;
+
+  size_t
+    i;
+
+  memset( &ir, 0, sizeof( ir));
+  IRDecodeInit( &ir.Dec, TICKS_PER_MS);
+  ir.Stamp = STAMP_START;
+  HostCmdInit( &cmd);
+
+  for ( i = 0; i + 1 < Size; i += 2)
+  {
+    gap = Data[ i] >> 2;
+    gap = gap <= 51 ? gap : (gap - 51) * 200;
+    ir.Stamp += gap * TICKS_PER_MS;
+    switch( Data[ i] & 3)
+    {
+      case 0:
+        FeedIR( &ir, Data[ i + 1]);
+        break;
+
+      case 1:
+        FeedIR( &ir, Data[ i + 1]);
+        ir.Stamp += 8 * TICKS_PER_MS;
+        FeedIR( &ir, IR_CHECK( Data[ i + 1]));
+        break;
+
+      case 2:
+        FeedHost( &cmd, Data[ i + 1]);
+        break;
+
+      default:
+        FeedIR( &ir, IR_KEY_REPEAT);
+        ir.Stamp += 8 * TICKS_PER_MS;
+        FeedIR( &ir, IR_CHECK( IR_KEY_REPEAT));
+        break;
+    } // switch
+  } // for each record
+  return 0;
+} // LLVMFuzzerTestOneInput
+
+//	FeedIR - Give the decoder a byte and check what it makes of it.
+//	---------------------------------------------------------------
+
+static void FeedIR( IR_MODEL *Ir, uint8_t What)
+{
+
+  IR_EVENT
+    event;
+
+  int
+    got;
+
+  got = IRDecodeByte( &Ir->Dec, What, Ir->Stamp, &event);
+  CheckEvent( Ir, What, got, &event);
+  if ( Ir->Dec.State > IRD_MOUSE2)
+    FuzzFail( "decoder state %d", Ir->Dec.State);
+  if ( IRDecodePending( &Ir->Dec) != (Ir->Dec.State != IRD_FIRST))
+    FuzzFail( "IRDecodePending disagrees with the state");
+  if ( Ir->Dec.Frames != Ir->Frames)
+    FuzzFail( "%u frames counted, %u events", Ir->Dec.Frames, Ir->Frames);
+
+  Ir->Prev = What;
+  Ir->PrevStamp = Ir->Stamp;
+  Ir->HavePrev = 1;
+  return;
+} // FeedIR
+
+//	CheckEvent - See that an event is what the bytes say it should be.
+//	------------------------------------------------------------------
+
+static void CheckEvent( IR_MODEL *Ir, uint8_t What, int Got,
+  IR_EVENT *Event)
+{
+
+  uint8_t
+    first;
+
+  int
+    live;
+
+  if ( Got != (Event->Type != IR_EVENT_NONE) || Got < 0 || Got > 1)
+    FuzzFail( "IRDecodeByte returned %d with event type %d", Got,
+      Event->Type);
+  if ( Event->Stamp != Ir->Stamp)
+    FuzzFail( "event stamped %u, byte %u", Event->Stamp, Ir->Stamp);
+  if ( Event->Type == IR_EVENT_NONE || Event->Type == IR_EVENT_MOUSE)
+    return;
+
+//  A key: this byte has to be the check byte for the last one, in
+//  time, and the last one says what kind.
+
+  first = Ir->Prev;
+  if ( !Ir->HavePrev || What != IR_CHECK( first) || first == IR_KEY_MOUSE ||
+       Ir->Stamp - Ir->PrevStamp > Ir->Dec.PairGap)
+    FuzzFail( "key event from %02X %02X, %u ms apart", first, What,
+      (Ir->Stamp - Ir->PrevStamp) / TICKS_PER_MS);
+  Ir->Frames++;
+  live = Ir->LastMake && Ir->Stamp - Ir->KeyStamp <= Ir->Dec.RepeatGap;
+
+  switch( Event->Type)
+  {
+    case IR_EVENT_MAKE:
+      if ( !(first & 128) || Event->Key != (first & 127))
+        FuzzFail( "make of %02X from %02X", Event->Key, first);
+      Ir->LastMake = first;
+      Ir->KeyStamp = Ir->Stamp;
+      break;
+
+    case IR_EVENT_REPEAT:
+      if ( first != IR_KEY_REPEAT || !live ||
+           Event->Key != (Ir->LastMake & 127))
+        FuzzFail( "repeat of %02X; last make %02X, %u ms ago",
+          Event->Key, Ir->LastMake,
+          (Ir->Stamp - Ir->KeyStamp) / TICKS_PER_MS);
+      Ir->KeyStamp = Ir->Stamp;
+      break;
+
+    case IR_EVENT_BREAK:
+    case IR_EVENT_CLEAR:
+      if ( (first & 128) || Event->Key != first ||
+           (Event->Type == IR_EVENT_CLEAR) != (first == IR_KEY_CLEAR))
+        FuzzFail( "release type %d of %02X from %02X", Event->Type,
+          Event->Key, first);
+      if ( first == IR_KEY_REPEAT && live)
+        FuzzFail( "repeat of held %02X taken as a release", Ir->LastMake);
+      Ir->LastMake = 0;
+      break;
+
+    default:
+      FuzzFail( "event type %d", Event->Type);
+  } // switch
+  return;
+} // CheckEvent
+
+//	FeedHost - Give the command processor a byte and check the reply.
+//	-----------------------------------------------------------------
+
+static void FeedHost( HOST_CMD *Cmd, uint8_t What)
+{
+
+  HOST_CMD
+    fresh;
+
+  int
+    action,
+    freshAction;
+
+  fresh = *Cmd;
+  fresh.State = HCS_COMMAND;
+  action = HostCmdByte( Cmd, What);
+  CheckReply( Cmd, What, action);
+
+  if ( What > 0xec)
+  { // always a command
+    freshAction = HostCmdByte( &fresh, What);
+    if ( freshAction != action || fresh.ReplyLen != Cmd->ReplyLen ||
+         memcmp( fresh.Reply, Cmd->Reply, Cmd->ReplyLen) ||
+         fresh.State != Cmd->State || fresh.Leds != Cmd->Leds ||
+         fresh.Enabled != Cmd->Enabled || fresh.ScanSet != Cmd->ScanSet ||
+         fresh.Typematic != Cmd->Typematic)
+      FuzzFail( "%02X taken differently with a parameter due", What);
+  }
+  return;
+} // FeedHost
+
+//	CheckReply - See that the reply to a host byte makes sense.
+//	-----------------------------------------------------------
+
+static void CheckReply( HOST_CMD *Cmd, uint8_t What, int Action)
+{
+
+  if ( Action & ~(HC_REPLY | HC_RESET | HC_LEDS))
+    FuzzFail( "%02X: action %X", What, Action);
+  if ( Cmd->ReplyLen > HC_REPLY_MAX ||
+       !(Action & HC_REPLY) != !Cmd->ReplyLen)
+    FuzzFail( "%02X: action %X with a %d byte reply", What, Action,
+      Cmd->ReplyLen);
+  if ( Cmd->ReplyLen && Cmd->Reply[ 0] != KEY_ACK &&
+       Cmd->Reply[ 0] != KEY_RESEND &&
+       !(Cmd->Reply[ 0] == KEY_ECHO && What == HOST_ECHO))
+    FuzzFail( "%02X: reply starts %02X", What, Cmd->Reply[ 0]);
+  if ( What == HOST_RESEND && Action)
+    FuzzFail( "resend request answered here");
+
+  if ( Action & HC_RESET)
+  {
+    if ( Cmd->ReplyLen != 2 || Cmd->Reply[ 0] != KEY_ACK ||
+         Cmd->Reply[ 1] != KEY_BAT || !Cmd->Enabled || Cmd->Leds ||
+         !(Action & HC_LEDS))
+      FuzzFail( "%02X: reset without ACK, BAT, LEDs off and enabled", What);
+  }
+
+  if ( Cmd->State != HCS_COMMAND && (Cmd->State != HCS_PARAM ||
+       (Cmd->Command != HOST_SET_LED && Cmd->Command != HOST_SET_SCAN &&
+        Cmd->Command != HOST_TYPEMATIC)) && (Cmd->State != HCS_KEYS ||
+       Cmd->Command < 0xfb || Cmd->Command > 0xfd))
+    FuzzFail( "%02X: state %d waiting on %02X", What, Cmd->State,
+      Cmd->Command);
+  if ( Cmd->Leds > 7 || Cmd->ScanSet != 2 ||
+       (Cmd->Typematic & 0x80))
+    FuzzFail( "%02X: LEDs %X, scan set %d, typematic %02X", What, Cmd->Leds,
+      Cmd->ScanSet, Cmd->Typematic);
+  return;
+} // CheckReply
@@ -0,0 +1,216 @@
+//  fuzzmain - Run a fuzzing harness without a fuzzing engine.
+//  ----------------------------------------------------------
+//
+//	Linked with one of the harnesses (fuzz.h) when it isn't built for
+//	libFuzzer.  Given files, runs each as one input; a directory
+//	means every file in it, so a corpus from libFuzzer or AFL can be
+//	run through again, and "-" is standard input.  AFL can drive it
+//	as it is, with @@ for the file name.
+//
+//	Given no files, makes up inputs of random bytes instead, from a
+//	seed, so the same run can be had again.  The first one to fail
+//	is written out as fuzz-SEED-RUN.bin before we abort.
+//
+//	Usage: irkey-fuzz-... [-n runs] [-s seed] [-l max-length] [file ...]
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "fuzz.h"
+
+#define FUZZ_MAX_INPUT 65536
+
+static uint8_t
+  Input[ FUZZ_MAX_INPUT];
+
+static char
+  FailName[ 64];		// where a made-up input goes if it fails
+
+static size_t
+  InputLen;
+
+#ifndef FUZZ_NO_MAIN
+static int RunPath( const char *Name);
+static int RunFile( const char *Name);
+static uint32_t Random( uint32_t *Seed, uint32_t Range);
+
+int main( int argc, char *argv[])
+{
+
+  uint32_t
+    seed,
+    state,
+    runs,
+    maxLen,
+    run;
+
+  size_t
+    i;
+
+  int
+    arg,
+    files,
+    failed;
+
+  runs = 1000;
+  seed = 1;
+  maxLen = 256;
+  files = 0;
+  failed = 0;
+  for ( arg = 1; arg < argc; arg++)
+  {
+    if ( !strcmp( argv[ arg], "-n") && arg + 1 < argc)
+      runs = (uint32_t) strtoul( argv[ ++arg], 0, 0);
+    else if ( !strcmp( argv[ arg], "-s") && arg + 1 < argc)
+      seed = (uint32_t) strtoul( argv[ ++arg], 0, 0);
+    else if ( !strcmp( argv[ arg], "-l") && arg + 1 < argc)
+      maxLen = (uint32_t) strtoul( argv[ ++arg], 0, 0);
+    else if ( argv[ arg][ 0] == '-' && argv[ arg][ 1])
+    {
+      fprintf( stderr, "Usage: %s [-n runs] [-s seed] [-l max-length] "
+        "[file ...]\n", argv[ 0]);
+      return 2;
+    } else
+    {
+      files++;
+      failed += RunPath( argv[ arg]);
+    }
+  } // for each argument
+  if ( files)
+    return failed ? 1 : 0;
+
+  if ( maxLen > FUZZ_MAX_INPUT)
+    maxLen = FUZZ_MAX_INPUT;
+  state = seed;
+  for ( run = 0; run < runs; run++)
+  {
+    InputLen = Random( &state, maxLen + 1);
+    for ( i = 0; i < InputLen; i++)
+      Input[ i] = (uint8_t) Random( &state, 256);
+    snprintf( FailName, sizeof( FailName), "fuzz-%lu-%lu.bin",
+      (unsigned long) seed, (unsigned long) run);
+    LLVMFuzzerTestOneInput( Input, InputLen);
+  }
+  printf( "%lu inputs, seed %lu: no failures\n", (unsigned long) runs,
+    (unsigned long) seed);
+  return 0;
+} // main
+
+//	RunPath - Run a file, or every file in a directory.
+//	---------------------------------------------------
+//
+//	Returns the number that couldn't be read.
+//
+
+static int RunPath( const char *Name)
+{
+
+  char
+    path[ 4096];
+
+  struct stat
+    st;
+
+  struct dirent
+    *entry;
+
+  DIR
+    *dir;
+
+  int
+    failed;
+
+  if ( strcmp( Name, "-") && !stat( Name, &st) && S_ISDIR( st.st_mode))
+  {
+    if ( !(dir = opendir( Name)))
+    {
+      perror( Name);
+      return 1;
+    }
+    failed = 0;
+    while ( (entry = readdir( dir)))
+    {
+      snprintf( path, sizeof( path), "%s/%s", Name, entry->d_name);
+      if ( !stat( path, &st) && S_ISREG( st.st_mode))
+        failed += RunFile( path);
+    }
+    closedir( dir);
+    return failed;
+  }
+  return RunFile( Name);
+} // RunPath
+
+//	RunFile - Run one file as an input.
+//	-----------------------------------
+//
+//	Returns 1 if it couldn't be read.  Longer files are cut short.
+//
+
+static int RunFile( const char *Name)
+{
+
+  FILE
+    *in;
+
+  if ( !strcmp( Name, "-"))
+    in = stdin;
+  else if ( !(in = fopen( Name, "rb")))
+  {
+    perror( Name);
+    return 1;
+  }
+  InputLen = fread( Input, 1, sizeof( Input), in);
+  if ( in != stdin)
+    fclose( in);
+  FailName[ 0] = 0;		// it's already on file
+  LLVMFuzzerTestOneInput( Input, InputLen);
+  return 0;
+} // RunFile
+
+//	Random - A number from 0 to Range-1.
+//	------------------------------------
+
+static uint32_t Random( uint32_t *Seed, uint32_t Range)
+{
+
+  *Seed = *Seed * 1103515245 + 12345;
+  return (*Seed >> 8) % Range;		// the low bits aren't much good
+} // Random
+#endif // FUZZ_NO_MAIN
+
+//*	FuzzFail - Report a failed check and abort.
+//	-------------------------------------------
+//
+//	If the input was made up here, it's saved first.
+//
+
+void FuzzFail( const char *Format, ...)
+{
+
+  va_list
+    args;
+
+  FILE
+    *out;
+
+  fprintf( stderr, "fuzz: ");
+  va_start( args, Format);
+  vfprintf( stderr, Format, args);
+  va_end( args);
+  fprintf( stderr, "\n");
+  if ( FailName[ 0] && (out = fopen( FailName, "wb")))
+  {
+    fwrite( Input, 1, InputLen, out);
+    fclose( out);
+    fprintf( stderr, "fuzz: input written to %s\n", FailName);
+  }
+  abort();
+} // FuzzFail
@@ -0,0 +1,595 @@
+//  fuzzsim - Fuzz the whole firmware in the simulator.
+//  ---------------------------------------------------
+//
+//	Each input is played through the firmware from power-up, as in
+//	replay.c, with the IR sensor and the PS/2 host model doing what
+//	it says.  An input is a string of three-byte records:
+//
+//	  op, gap, byte	  op bits 0-2 say what happens:
+//			    0  IR: a frame, the byte and its check byte
+//			    1  IR: a repeat frame
+//			    2  IR: the byte alone
+//			    3  IR: the byte with a framing error
+//			    4  IR: a pointing stick frame with it
+//			    5  host sends the byte
+//			    6  host sends it with bad parity
+//			    7  host holds the clock low for byte % 50 + 1 ms
+//			  gap is the time from the last record: gap * 0.1 ms
+//			  up to 127, then (gap - 128) * 10 ms.
+//
+//	IR bytes go on the line as soon as it's free, from power-up on.
+//	The host waits until after the BAT, and then, as a real one
+//	would, for each reply before it sends or does anything else.  A
+//	clear frame goes last, so every key should be let go of by the
+//	end.
+//
+//	Then the PS/2 bytes the host got are taken apart:
+//
+//	  - BAT first; after that, each reply where it's due and as the
+//	    command processor (hostcmd.c, run alongside) says it should be
+//	  - scan codes well formed: E0 and F0 prefixes each followed by a
+//	    code, E1 only as the whole Pause sequence; a sequence cut
+//	    short only by a reset
+//	  - a break only for a key that's down, nothing while the host
+//	    has us disabled, and, if we're enabled at the end, no key
+//	    left down
+//	  - no bad frames, no host byte unacknowledged, no timing out of
+//	    spec, and the firmware back waiting for interrupts at the end
+//	    rather than stuck
+//
+//	A HOST_RESEND (FE) from the host gets the last byte again; the
+//	host drops that copy, after checking it is one.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libopencm3/stm32/usart.h>
+
+#include "keydef.h"
+#include "irdecode.h"
+#include "ps2.h"
+#include "hostcmd.h"
+#include "hal.h"
+#include "ps2host.h"
+#include "fuzz.h"
+
+#define BOOT_TIME HAL_MS( 400)		// host keeps quiet until the BAT
+#define IR_BYTE_TIME (HAL_CPU_HZ / 120)	// 10 bits at 1200 baud
+#define MAX_RECORDS 512
+#define MAX_SPAN HAL_MS( 10000)		// the rest of a long input is ignored
+#define HOST_POLL HAL_US( 500)		// how often the host looks for a reply
+#define REPLY_TIMEOUT HAL_MS( 250)	// a reply later than this is lost
+#define QUIET_TIME HAL_MS( 100)		// nothing on the line this long: done
+
+#define IR_CHECK( b) ((uint8_t) ((~(b) & 0xf8) | ((b) & 0x07)))
+
+//  Something the host does.
+
+typedef enum
+{
+  OP_SEND,
+  OP_SEND_BAD,			// with bad parity
+  OP_INHIBIT
+} HOST_OP_KIND;
+
+typedef struct
+{
+  uint64_t
+    At;
+  uint8_t
+    Kind,			// HOST_OP_KIND
+    What;
+} HOST_OP;
+
+//  What should come back for a byte the host sent.
+
+typedef struct
+{
+  uint64_t
+    Issued;			// when the host started sending it
+  uint8_t
+    What,
+    Bytes[ HC_REPLY_MAX],
+    Len,
+    Reset,			// reset: all keys up
+    Enabled,			// whether keys may be sent after it
+    Resend;			// HOST_RESEND: the last byte again
+} REPLY;
+
+static PS2_HOST
+  Host;
+
+static HOST_CMD
+  Replica;			// our own command processor
+
+static HOST_OP
+  Ops[ MAX_RECORDS];
+
+static REPLY
+  Replies[ MAX_RECORDS];
+
+static uint8_t
+  Stream[ PS2H_MAX_FRAMES];	// good bytes, less resend copies
+
+static int
+  OpCount,
+  NextOp,
+  ReplyCount,
+  Waiting,			// reply waited for; -1 if none
+  WaitFrom,			// Host.Frames index sent at
+  QuietFrames;			// frame count at the last look
+
+static uint64_t Schedule( const uint8_t *Data, size_t Size);
+static void IrByte( uint64_t *LineFree, uint64_t At, uint8_t What, int Flags);
+static void HostNext( void *Arg, uint32_t Value);
+static int ReplyIn( REPLY *Reply);
+static void Finish( void *Arg, uint32_t Value);
+static int DropResends( void);
+static void CheckStream( int Len);
+static int Sequence( const uint8_t *What, int Len, int *Key, int *Cut);
+
+int LLVMFuzzerTestOneInput( const uint8_t *Data, size_t Size)
+{
+
+  HAL_RESULT
+    result;
+
+  uint64_t
+    end;
+
+  HalInit();
+  PS2HostInit( &Host);
+  HostCmdInit( &Replica);
+  OpCount = 0;
+  NextOp = 0;
+  ReplyCount = 0;
+  Waiting = -1;
+  QuietFrames = -1;
+
+  end = Schedule( Data, Size);
+  HalSchedule( BOOT_TIME, HostNext, 0, 0);
+  HalSchedule( end + QUIET_TIME, Finish, 0, 0);
+  if ( OpCount && Ops[ OpCount - 1].At > end)
+    end = Ops[ OpCount - 1].At;
+  result = HalRun( FirmwareMain, end + HAL_MS( 1000) +
+    (uint64_t) OpCount * (REPLY_TIMEOUT + HAL_MS( 60)));
+
+  if ( result != HAL_STOPPED)
+    FuzzFail( "firmware %s at %.3f ms", result == HAL_STUCK ? "stuck" :
+      result == HAL_RETURNED ? "returned" : "still busy",
+      HalNow() / (double) HAL_MS( 1));
+  if ( Host.Corrupt || Host.NotAcked || Host.Violations)
+    FuzzFail( "%u bad frames, %u host bytes not taken, %u timings out "
+      "of spec", Host.Corrupt, Host.NotAcked, Host.Violations);
+  CheckStream( DropResends());
+  return 0;
+} // LLVMFuzzerTestOneInput
+
+//	Schedule - Set up the IR bytes and the host's doings.
+//	-----------------------------------------------------
+//
+//	Returns when the clear frame is sent.
+//
+
+static uint64_t Schedule( const uint8_t *Data, size_t Size)
+{
+
+  uint64_t
+    at,
+    lineFree;
+
+  size_t
+    i;
+
+  uint8_t
+    what;
+
+  at = 0;
+  lineFree = 0;
+  for ( i = 0; i + 2 < Size && i < 3 * MAX_RECORDS; i += 3)
+  {
+    at += Data[ i + 1] < 128 ? HAL_US( Data[ i + 1] * 100) :
+      HAL_MS( (Data[ i + 1] - 128) * 10);
+    if ( at > MAX_SPAN)
+      break;
+    what = Data[ i + 2];
+    switch( Data[ i] & 7)
+    {
+      case 0:
+        IrByte( &lineFree, at, what, 0);
+        IrByte( &lineFree, at, IR_CHECK( what), 0);
+        break;
+
+      case 1:
+        IrByte( &lineFree, at, IR_KEY_REPEAT, 0);
+        IrByte( &lineFree, at, IR_CHECK( IR_KEY_REPEAT), 0);
+        break;
+
+      case 2:
+      case 3:
+        IrByte( &lineFree, at, what, (Data[ i] & 7) == 3);
+        break;
+
+      case 4:
+        IrByte( &lineFree, at, IR_KEY_MOUSE, 0);
+        IrByte( &lineFree, at, what, 0);
+        IrByte( &lineFree, at, (uint8_t) ~what, 0);
+        break;
+
+      default:
+        Ops[ OpCount].At = at;
+        Ops[ OpCount].What = what;
+        Ops[ OpCount].Kind = (Data[ i] & 7) == 5 ? OP_SEND :
+          (Data[ i] & 7) == 6 ? OP_SEND_BAD : OP_INHIBIT;
+        OpCount++;
+        break;
+    } // switch
+  } // for each record
+
+  at = (lineFree > BOOT_TIME ? lineFree : BOOT_TIME) + HAL_MS( 100);
+  IrByte( &lineFree, at, IR_KEY_CLEAR, 0);
+  IrByte( &lineFree, at, IR_CHECK( IR_KEY_CLEAR), 0);
+  return at;
+} // Schedule
+
+//	IrByte - Put a byte on the IR line.
+//	-----------------------------------
+
+static void IrByte( uint64_t *LineFree, uint64_t At, uint8_t What, int Flags)
+{
+
+  HalUartReceive( USART3, At, What, Flags ? HAL_RX_FRAMING : 0);
+  *LineFree = (At > *LineFree ? At : *LineFree) + IR_BYTE_TIME;
+  return;
+} // IrByte
+
+//	HostNext - The host does the next thing, when it's ready to.
+//	------------------------------------------------------------
+//
+//	A simulator action; runs again whenever there's something to
+//	wait for.
+//
+
+static void HostNext( void *Arg, uint32_t Value)
+{
+
+  HOST_OP
+    *op;
+
+  REPLY
+    *r;
+
+  uint64_t
+    now;
+
+  int
+    action;
+
+  (void) Arg;
+  (void) Value;
+  now = HalNow();
+  if ( Waiting >= 0)
+  {
+    r = &Replies[ Waiting];
+    if ( !ReplyIn( r))
+    {
+      if ( now - r->Issued > REPLY_TIMEOUT)
+        FuzzFail( "no reply to %02X sent at %.3f ms", r->What,
+          r->Issued / (double) HAL_MS( 1));
+      HalSchedule( now + HOST_POLL, HostNext, 0, 0);
+      return;
+    }
+    Waiting = -1;
+  }
+  if ( NextOp == OpCount)
+    return;			// all done
+  op = &Ops[ NextOp];
+  if ( op->At > now)
+  {
+    HalSchedule( op->At, HostNext, 0, 0);
+    return;
+  }
+  NextOp++;
+
+  if ( op->Kind == OP_INHIBIT)
+  {
+    PS2HostInhibit( &Host, now, HAL_MS( op->What % 50 + 1));
+    HalSchedule( now + HAL_MS( op->What % 50 + 2), HostNext, 0, 0);
+    return;
+  }
+
+//  A byte: work out what it should get back, and send it.
+
+  r = &Replies[ ReplyCount];
+  memset( r, 0, sizeof( *r));
+  r->Issued = now;
+  r->What = op->What;
+  if ( op->Kind == OP_SEND_BAD)
+  { // the device asks for it again, and that's all
+    r->Bytes[ 0] = KEY_RESEND;
+    r->Len = 1;
+  } else if ( op->What == HOST_RESEND)
+    r->Resend = 1;
+  else
+  {
+    action = HostCmdByte( &Replica, op->What);
+    memcpy( r->Bytes, Replica.Reply, Replica.ReplyLen);
+    r->Len = Replica.ReplyLen;
+    r->Reset = (action & HC_RESET) != 0;
+  }
+  r->Enabled = Replica.Enabled;
+  Waiting = ReplyCount++;
+  WaitFrom = Host.FrameCount;
+  PS2HostSend( &Host, now, op->What,
+    op->Kind == OP_SEND_BAD ? PS2H_SEND_BAD_PARITY : 0);
+  HalSchedule( now + HOST_POLL, HostNext, 0, 0);
+  return;
+} // HostNext
+
+//	ReplyIn - See if a reply has come in whole.
+//	-------------------------------------------
+//
+//	It's in the good frames that started after the byte was sent,
+//	all together; for a resend, any frame will do.
+//
+
+static int ReplyIn( REPLY *Reply)
+{
+
+  int
+    i,
+    j,
+    n;
+
+  n = 0;
+  for ( i = WaitFrom; i < Host.FrameCount; i++)
+  {
+    if ( Host.Frames[ i].Status != PS2H_OK ||
+         Host.Frames[ i].Start <= Reply->Issued)
+      continue;
+    if ( Reply->Resend)
+      return 1;
+    for ( j = i, n = 0; j < Host.FrameCount && n < Reply->Len; j++)
+    {
+      if ( Host.Frames[ j].Status != PS2H_OK)
+        continue;
+      if ( Host.Frames[ j].What != Reply->Bytes[ n])
+        break;
+      n++;
+    }
+    if ( n == Reply->Len)
+      return 1;
+  } // for each frame since
+  return 0;
+} // ReplyIn
+
+//	Finish - End the run once everything's over.
+//	--------------------------------------------
+//
+//	That's when the host has done all it's going to and the line has
+//	been quiet for a while.
+//
+
+static void Finish( void *Arg, uint32_t Value)
+{
+
+  (void) Arg;
+  (void) Value;
+  if ( NextOp == OpCount && Waiting < 0 && Host.SendState == PS2H_IDLE &&
+       Host.FrameCount == QuietFrames)
+  {
+    HalStop();
+    return;
+  }
+  QuietFrames = Host.FrameCount;
+  HalSchedule( HalNow() + QUIET_TIME, Finish, 0, 0);
+  return;
+} // Finish
+
+//	DropResends - Take the good bytes, less the copies resent.
+//	----------------------------------------------------------
+//
+//	For each HOST_RESEND, the first good frame to start after it is
+//	the copy; it must be the last byte sent before it other than a
+//	KEY_RESEND, as the spec has it.  Returns the number of bytes left
+//	in Stream.
+//
+
+static int DropResends( void)
+{
+
+  PS2H_FRAME
+    *f;
+
+  int
+    len,
+    last,
+    r;
+
+  len = 0;
+  last = -1;
+  r = 0;
+  for ( f = Host.Frames; f < Host.Frames + Host.FrameCount; f++)
+  {
+    if ( f->Status != PS2H_OK)
+      continue;
+    while ( r < ReplyCount && !Replies[ r].Resend)
+      r++;
+    if ( r < ReplyCount && Replies[ r].Issued < f->Start)
+    { // this is the copy
+      if ( f->What != last)
+        FuzzFail( "resend gave %02X, last byte was %02X", f->What, last);
+      r++;
+      continue;
+    }
+    if ( f->What != KEY_RESEND)
+      last = f->What;
+    Stream[ len++] = f->What;
+  } // for each frame
+  return len;
+} // DropResends
+
+//	CheckStream - Take apart what the host got.
+//	-------------------------------------------
+
+static void CheckStream( int Len)
+{
+
+  static uint8_t
+    down[ 512];			// by code, plus 256 with E0
+
+  REPLY
+    *r;
+
+  int
+    enabled,
+    resends,
+    expected,
+    key,
+    cut,
+    n,
+    i;
+
+  if ( !Len || Stream[ 0] != KEY_BAT)
+    FuzzFail( "no BAT first");
+  memset( down, 0, sizeof( down));
+  enabled = 1;
+  r = Replies;
+
+//  A KEY_RESEND can come between any two bytes, even within a
+//  sequence, so those are only counted and taken out; the rest of the
+//  replies come in order, between sequences.
+
+  for ( i = n = 0; i < Len; i++)
+    if ( Stream[ i] != KEY_RESEND)
+      Stream[ n++] = Stream[ i];
+  resends = Len - n;
+  Len = n;
+
+  for ( i = 1; i < Len; )
+  {
+    while ( r < Replies + ReplyCount &&
+            (r->Resend || (r->Len && r->Bytes[ 0] == KEY_RESEND)))
+      r++;
+
+    if ( Stream[ i] == KEY_ACK || Stream[ i] == KEY_ECHO ||
+         Stream[ i] == KEY_BAT)
+    { // a reply
+      if ( r == Replies + ReplyCount || i + r->Len > Len ||
+           memcmp( Stream + i, r->Bytes, r->Len))
+        FuzzFail( "unexpected reply %02X at byte %d", Stream[ i], i);
+      i += r->Len;
+      if ( r->Reset)
+        memset( down, 0, sizeof( down));
+      enabled = r->Enabled;
+      r++;
+      continue;
+    }
+
+    n = Sequence( Stream + i, Len - i, &key, &cut);
+    if ( n < 0)
+      FuzzFail( "bad scan code sequence at byte %d: %02X", i, Stream[ i]);
+    if ( cut)
+    { // only a reset may cut one off
+      if ( i + n == Len || !r->Reset || r == Replies + ReplyCount)
+        FuzzFail( "sequence at byte %d cut short", i);
+      i += n;
+      continue;
+    }
+    if ( !enabled)
+      FuzzFail( "keys sent at byte %d while disabled", i);
+    if ( key >= 1024)
+    { // break
+      if ( !down[ key - 1024])
+        FuzzFail( "break of %03X at byte %d, never made", key - 1024, i);
+      down[ key - 1024] = 0;
+    } else if ( key >= 0)
+      down[ key] = 1;
+    i += n;
+  } // for each sequence
+
+  while ( r < Replies + ReplyCount &&
+          (r->Resend || (r->Len && r->Bytes[ 0] == KEY_RESEND)))
+    r++;
+  if ( r < Replies + ReplyCount)
+    FuzzFail( "reply to %02X never came", r->What);
+  for ( expected = 0, r = Replies; r < Replies + ReplyCount; r++)
+    if ( r->Len && r->Bytes[ 0] == KEY_RESEND)
+      expected++;
+  if ( resends != expected)
+    FuzzFail( "%d resend requests from the device, %d expected", resends,
+      expected);
+  if ( enabled)
+    for ( key = 0; key < 512; key++)
+      if ( down[ key])
+        FuzzFail( "key %03X left down", key);
+  return;
+} // CheckStream
+
+//	Sequence - Take one scan code sequence apart.
+//	---------------------------------------------
+//
+//	Returns its length, with *Key the code (256 more with E0, 1024
+//	more for a break; -1 for Pause).  If it's cut off by an ACK or the
+//	end, *Cut is set and the length is up to there.  Returns -1 if
+//	it's not a sequence at all.
+//
+
+static int Sequence( const uint8_t *What, int Len, int *Key, int *Cut)
+{
+
+  static const uint8_t
+    pauseSeq[] = { 0xe1, 0x14, 0x77, 0xe1, 0xf0, 0x14, 0xf0, 0x77 };
+
+  int
+    n;
+
+  *Cut = 0;
+  *Key = -1;
+  if ( What[ 0] == 0xe1)
+  {
+    for ( n = 1; n < (int) sizeof( pauseSeq); n++)
+    {
+      if ( n == Len || What[ n] == KEY_ACK)
+      {
+        *Cut = 1;
+        return n;
+      }
+      if ( What[ n] != pauseSeq[ n])
+        return -1;
+    }
+    return n;
+  }
+
+  n = 0;
+  *Key = 0;
+  if ( What[ n] == 0xe0)
+  {
+    *Key += 256;
+    n++;
+  }
+  if ( n < Len && What[ n] == 0xf0)
+  {
+    *Key += 1024;
+    n++;
+  }
+  if ( n == Len || What[ n] == KEY_ACK)
+  {
+    *Cut = 1;
+    return n;
+  }
+  switch( What[ n])
+  {
+    case 0x00:			// not a key
+    case 0xe0:
+    case 0xe1:
+    case 0xf0:
+    case KEY_ECHO:
+    case KEY_BAT:
+      return -1;
+  } // switch
+  *Key += What[ n];
+  return n + 1;
+} // Sequence
@@ -0,0 +1,2544 @@
+//  Simulated STM32F103 peripherals for the host build.
+//  ---------------------------------------------------
+//
+//	See hal.h for what's modelled.  Everything is driven from one
+//	cycle count, HalCycles.  Every call the firmware makes into the
+//	stand-in libopencm3 (and every register access) goes through
+//	HalTick, which charges it a few cycles, lets anything that has
+//	come due happen, and takes any interrupt that can be taken.
+//
+//	Things that happen at a known time--a UART bit, a scheduled
+//	action--sit in a heap ordered by time.  The timers aren't in the
+//	heap; each one works out from its registers when its next enabled
+//	flag is due, and catches its counter up whenever it's looked at.
+//	HalNextAt is the earliest of all of these, so most ticks cost no
+//	more than a compare.
+//
+//	Interrupt requests are levels, as on the chip: an ISR is taken
+//	for as long as its flag and enable are both set.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include "ps2.h"
+#include "hal.h"
+
+#ifdef PS2_DMA_TX
+#error "The simulator doesn't model TIM4-paced DMA; build without PS2_DMA_TX"
+#endif
+
+#define EXTI_BASE 0x40010400U
+#define SCB_BASE 0xe000ed00U
+#define PWR_BASE 0x40007000U
+#define BLOCK_SPAN 0x100	// bytes of registers looked after per block
+#define THREAD_PRIORITY 0x100	// below any interrupt
+
+//  Register offsets, for getting at them without a tick.
+
+#define OFF_TIM_CR1 0x00
+#define OFF_TIM_DIER 0x0c
+#define OFF_TIM_SR 0x10
+#define OFF_TIM_CNT 0x24
+#define OFF_TIM_PSC 0x28
+#define OFF_TIM_ARR 0x2c
+#define OFF_TIM_CCR1 0x34
+
+#define OFF_USART_SR 0x00
+#define OFF_USART_DR 0x04
+#define OFF_USART_BRR 0x08
+#define OFF_USART_CR1 0x0c
+#define OFF_USART_CR3 0x14
+
+#define OFF_GPIO_CRL 0x00
+#define OFF_GPIO_CRH 0x04
+#define OFF_GPIO_IDR 0x08
+#define OFF_GPIO_ODR 0x0c
+
+#define OFF_EXTI_IMR 0x00
+#define OFF_EXTI_RTSR 0x08
+#define OFF_EXTI_FTSR 0x0c
+#define OFF_EXTI_PR 0x14
+
+#define OFF_DMA_ISR 0x00
+#define OFF_DMA_CCR( ch) (0x08 + 0x14 * ((ch) - 1))
+#define OFF_DMA_CNDTR( ch) (0x0c + 0x14 * ((ch) - 1))
+#define OFF_DMA_CMAR( ch) (0x14 + 0x14 * ((ch) - 1))
+
+#define REG( base, off) (HalRaw( (base) + (off))[ 0])
+
+#define TIM_CR1_CMS_MASK (3 << 5)
+#define TIM_SR_ALL 0x1f
+
+//  A block of registers.
+
+typedef struct
+{
+  uint32_t
+    Base,
+    Reg[ BLOCK_SPAN / 4];
+} HAL_BLOCK;
+
+//  Something due at a given time.
+
+typedef struct
+{
+  uint64_t
+    At,
+    Seq;			// keeps equal times in order
+  HAL_ACTION
+    Action;
+  void
+    *Arg;
+  uint32_t
+    Value;
+} HAL_EVENT;
+
+typedef struct
+{
+  uint32_t
+    Base;
+  int
+    Irq;
+  uint64_t
+    Phase,			// ticks into the counting cycle
+    Frac,			// CPU cycles into the current tick
+    Synced;			// when Phase was last brought up to date
+} HAL_TIMER;
+
+typedef struct
+{
+  uint64_t
+    At;
+  uint8_t
+    What,
+    Flags;
+} HAL_RX_BYTE;
+
+typedef struct
+{
+  uint32_t
+    Base,
+    RxPort;
+  uint16_t
+    RxPin;
+  int
+    Irq,
+    TxDma,			// DMA channels
+    RxDma;
+  HAL_RX_BYTE
+    *RxQueue;			// bytes still to come in
+  int
+    RxHead,
+    RxTail,
+    RxSize,
+    RxActive;			// a byte is on the line
+  uint32_t
+    RxStarted;			// bytes started, for idle detection
+  int
+    TxBusy,
+    TxHeld,			// usart_send while busy; -1 if none
+    TxHeldByte;
+  HAL_UART_SINK
+    Sink;
+  void
+    *SinkArg;
+} HAL_USART;
+
+typedef struct
+{
+  uint32_t
+    Base;
+  uint16_t
+    External,			// 0 where something outside pulls low
+    Levels;			// what the pins read
+} HAL_PORT;
+
+typedef struct
+{
+  uint32_t
+    Port;
+  uint16_t
+    Pins;
+  HAL_PIN_WATCH
+    Watch;
+  void
+    *Arg;
+} HAL_PIN_WATCHER;
+
+typedef struct
+{
+  HAL_IRQ_WATCH
+    Watch;
+  void
+    *Arg;
+} HAL_IRQ_WATCHER;
+
+typedef struct
+{
+  int
+    Irq;
+  void
+    (*Isr)( void);
+  const char
+    *Name;
+} HAL_VECTOR;
+
+#define HAL_WATCHERS 8
+
+static HAL_BLOCK
+  HalBlocks[] =
+  {
+    { GPIOA, { 0 } }, { GPIOB, { 0 } }, { GPIOC, { 0 } },
+    { TIM1, { 0 } }, { TIM2, { 0 } }, { TIM3, { 0 } }, { TIM4, { 0 } },
+    { USART1, { 0 } }, { USART3, { 0 } }, { DMA1, { 0 } },
+    { EXTI_BASE, { 0 } }, { DWT_BASE, { 0 } }, { SCB_BASE, { 0 } },
+    { PWR_BASE, { 0 } }
+  };
+
+#define HAL_BLOCK_COUNT ((int) (sizeof( HalBlocks) / sizeof( HalBlocks[ 0])))
+
+static HAL_TIMER
+  HalTimers[] =
+  {
+    { TIM1, NVIC_TIM1_UP_IRQ, 0, 0, 0 },
+    { TIM2, NVIC_TIM2_IRQ, 0, 0, 0 },
+    { TIM3, NVIC_TIM3_IRQ, 0, 0, 0 },
+    { TIM4, NVIC_TIM4_IRQ, 0, 0, 0 }
+  };
+
+#define HAL_TIMER_COUNT 4
+
+static HAL_USART
+  HalUsarts[] =
+  {
+    { USART1, GPIOA, GPIO10, NVIC_USART1_IRQ, 4, 5, 0, 0, 0, 0, 0, 0, 0,
+      -1, 0, 0, 0 },
+    { USART3, GPIOB, GPIO11, NVIC_USART3_IRQ, 2, 3, 0, 0, 0, 0, 0, 0, 0,
+      -1, 0, 0, 0 }
+  };
+
+#define HAL_USART_COUNT 2
+
+static HAL_PORT
+  HalPorts[] =
+  {
+    { GPIOA, 0xffff, 0xffff }, { GPIOB, 0xffff, 0xffff },
+    { GPIOC, 0xffff, 0xffff }
+  };
+
+#define HAL_PORT_COUNT 3
+
+static const HAL_VECTOR
+  HalVectors[] =
+  {
+    { NVIC_EXTI9_5_IRQ, exti9_5_isr, "exti9_5" },
+    { NVIC_EXTI15_10_IRQ, exti15_10_isr, "exti15_10" },
+    { NVIC_DMA1_CHANNEL3_IRQ, dma1_channel3_isr, "dma1_ch3" },
+    { NVIC_DMA1_CHANNEL4_IRQ, dma1_channel4_isr, "dma1_ch4" },
+    { NVIC_DMA1_CHANNEL7_IRQ, dma1_channel7_isr, "dma1_ch7" },
+    { NVIC_TIM1_UP_IRQ, tim1_up_isr, "tim1_up" },
+    { NVIC_TIM2_IRQ, tim2_isr, "tim2" },
+    { NVIC_TIM3_IRQ, tim3_isr, "tim3" },
+    { NVIC_TIM4_IRQ, tim4_isr, "tim4" },
+    { NVIC_USART1_IRQ, usart1_isr, "usart1" },
+    { NVIC_USART3_IRQ, usart3_isr, "usart3" }
+  };
+
+#define HAL_VECTOR_COUNT ((int) (sizeof( HalVectors) / sizeof( HalVectors[ 0])))
+
+uint32_t
+  rcc_ahb_frequency = HAL_CPU_HZ,
+  rcc_apb1_frequency = HAL_CPU_HZ / 2,
+  rcc_apb2_frequency = HAL_CPU_HZ;
+
+static uint64_t
+  HalCycles,			// the time
+  HalNextAt,			// when something is next due
+  HalUntil,			// end of the run
+  HalStuckAt,			// give up if still busy at this
+  HalSeq;
+
+static HAL_EVENT
+  *HalHeap;
+
+static int
+  HalHeapLen,
+  HalHeapSize;
+
+static int
+  HalRunning,
+  HalStopping,
+  HalPrimask,
+  HalBasepri,			// 0, or the priority held off from
+  HalActive,			// priority of what's running
+  HalInEvents;
+
+static uint8_t
+  HalIrqEnabled[ NVIC_IRQ_COUNT],
+  HalIrqPriority[ NVIC_IRQ_COUNT];
+
+static uint32_t
+  HalExtiPort[ 16],		// port feeding each EXTI line
+  HalDmaInitial[ 8];		// CNDTR as last set, for circular reloads
+
+//  The firmware's RAM.  The Makefile links the firmware as one object
+//  with its .data and .bss renamed fwdata and fwbss, so the linker
+//  marks where each starts and ends.
+
+extern char
+  __start_fwdata[],
+  __stop_fwdata[],
+  __start_fwbss[],
+  __stop_fwbss[];
+
+static char
+  *HalFwData;			// fwdata as loaded, before anything ran
+
+static HAL_PIN_WATCHER
+  HalPinWatchers[ HAL_WATCHERS];
+
+static HAL_IRQ_WATCHER
+  HalIrqWatchers[ HAL_WATCHERS];
+
+static int
+  HalPinWatcherCount,
+  HalIrqWatcherCount;
+
+static jmp_buf
+  HalExit;
+
+static uint32_t *HalRaw( uint32_t Addr);
+static void HalTick( void);
+static void HalEvents( void);
+static void HalReschedule( void);
+static void HalIrqCheck( void);
+static int HalIrqPending( int Irq);
+static void HeapPush( HAL_EVENT *Event);
+static void HeapPop( HAL_EVENT *Event);
+static HAL_TIMER *TimerFor( uint32_t Base);
+static void TimerReset( HAL_TIMER *Tim);
+static void TimerSync( HAL_TIMER *Tim);
+static uint64_t TimerNextAt( HAL_TIMER *Tim);
+static HAL_PORT *PortFor( uint32_t Base);
+static void GpioUpdate( HAL_PORT *Port);
+static HAL_USART *UsartFor( uint32_t Base);
+static void UsartTxKick( HAL_USART *Usart);
+static void UsartRxNext( HAL_USART *Usart);
+static int DmaReady( int Channel);
+static uint8_t DmaFetch( int Channel);
+static void DmaStore( int Channel, uint8_t What);
+
+//*	HalInit - Put the chip back to reset.
+//	-------------------------------------
+//
+//	Call before setting up each run.  Watchers and sinks are cleared,
+//	and the firmware's variables are put back as the startup code
+//	would leave them, so each run starts from power-up.
+//
+
+void HalInit( void)
+{
+
+  size_t
+    dataLen;
+
+  int
+    i;
+
+  dataLen = __stop_fwdata - __start_fwdata;
+  if ( !HalFwData)
+  { // first time in; keep the initial values
+    if ( !(HalFwData = malloc( dataLen + 1)))
+    {
+      fprintf( stderr, "hal: out of memory\n");
+      exit( 2);
+    }
+    memcpy( HalFwData, __start_fwdata, dataLen);
+  } else
+    memcpy( __start_fwdata, HalFwData, dataLen);
+  memset( __start_fwbss, 0, __stop_fwbss - __start_fwbss);
+
+  for ( i = 0; i < HAL_BLOCK_COUNT; i++)
+    memset( HalBlocks[ i].Reg, 0, sizeof( HalBlocks[ i].Reg));
+  for ( i = 0; i < HAL_PORT_COUNT; i++)
+  {
+    REG( HalPorts[ i].Base, OFF_GPIO_CRL) = 0x44444444;	// floating inputs
+    REG( HalPorts[ i].Base, OFF_GPIO_CRH) = 0x44444444;
+    HalPorts[ i].External = 0xffff;
+    HalPorts[ i].Levels = 0xffff;
+    REG( HalPorts[ i].Base, OFF_GPIO_IDR) = 0xffff;
+  }
+  for ( i = 0; i < HAL_TIMER_COUNT; i++)
+    TimerReset( &HalTimers[ i]);
+  for ( i = 0; i < HAL_USART_COUNT; i++)
+  {
+    HalUsarts[ i].RxHead = 0;
+    HalUsarts[ i].RxTail = 0;
+    HalUsarts[ i].RxActive = 0;
+    HalUsarts[ i].RxStarted = 0;
+    HalUsarts[ i].TxBusy = 0;
+    HalUsarts[ i].TxHeld = -1;
+    HalUsarts[ i].Sink = 0;
+  }
+  for ( i = 0; i < 16; i++)
+    HalExtiPort[ i] = GPIOA;
+  memset( HalDmaInitial, 0, sizeof( HalDmaInitial));
+  memset( HalIrqEnabled, 0, sizeof( HalIrqEnabled));
+  memset( HalIrqPriority, 0, sizeof( HalIrqPriority));
+  HalPinWatcherCount = 0;
+  HalIrqWatcherCount = 0;
+  HalHeapLen = 0;
+  HalCycles = 0;
+  HalSeq = 0;
+  HalNextAt = HAL_NEVER;
+  HalRunning = 0;
+  HalStopping = 0;
+  HalPrimask = 0;
+  HalBasepri = 0;
+  HalActive = THREAD_PRIORITY;
+  HalInEvents = 0;
+  return;
+} // HalInit
+
+//*	HalNow - Return the time in CPU cycles.
+//	---------------------------------------
+
+uint64_t HalNow( void)
+{
+  return HalCycles;
+} // HalNow
+
+//*	HalRun - Run the firmware.
+//	--------------------------
+//
+//	Entry is normally FirmwareMain, which never returns; the run ends
+//	the first time it waits for an interrupt at or after Until, or
+//	after HalStop.  HAL_STUCK means it was still busy well after
+//	Until--a loop that never waits, or an interrupt that never
+//	clears.
+//
+
+HAL_RESULT HalRun( int (*Entry)( void), uint64_t Until)
+{
+
+  int
+    result;
+
+  HalUntil = Until;
+  HalStuckAt = Until + HAL_STUCK_CYCLES;
+  HalStopping = 0;
+  HalPrimask = 0;
+  HalBasepri = 0;
+  HalActive = THREAD_PRIORITY;
+  HalInEvents = 0;
+  if ( !(result = setjmp( HalExit)))
+  {
+    HalRunning = 1;
+    (*Entry)();
+    result = HAL_RETURNED;
+  }
+  HalRunning = 0;
+  return (HAL_RESULT) result;
+} // HalRun
+
+//*	HalStop - End the run at the next WFI.
+//	--------------------------------------
+
+void HalStop( void)
+{
+
+  HalStopping = 1;
+  return;
+} // HalStop
+
+//*	HalSchedule - Have something happen at a given time.
+//	----------------------------------------------------
+//
+//	Action( Arg, Value) is called at At (or now, if that's past).
+//
+
+void HalSchedule( uint64_t At, HAL_ACTION Action, void *Arg, uint32_t Value)
+{
+
+  HAL_EVENT
+    event;
+
+  event.At = (At < HalCycles) ? HalCycles : At;
+  event.Seq = HalSeq++;
+  event.Action = Action;
+  event.Arg = Arg;
+  event.Value = Value;
+  HeapPush( &event);
+  if ( event.At < HalNextAt)
+    HalNextAt = event.At;
+  return;
+} // HalSchedule
+
+//*	HalWait - The firmware's WFI.
+//	-----------------------------
+//
+//	Runs time forward until an enabled interrupt is pending (whether
+//	or not it can be taken yet).  This is where a run ends.
+//
+
+void HalWait( void)
+{
+
+  int
+    i;
+
+  HalTick();
+  for (;;)
+  {
+    if ( HalStopping)
+      longjmp( HalExit, HAL_STOPPED);
+    if ( HalCycles >= HalUntil)
+      longjmp( HalExit, HAL_DONE);
+    for ( i = 0; i < HAL_VECTOR_COUNT; i++)
+    {
+      if ( HalIrqEnabled[ HalVectors[ i].Irq] &&
+           HalIrqPending( HalVectors[ i].Irq))
+        return;
+    }
+    HalCycles = (HalNextAt < HalUntil) ? HalNextAt : HalUntil;
+    HalEvents();
+  } // for
+} // HalWait
+
+//*	HalMask - The firmware's IRQ_MASK (irqprio.h).
+//	----------------------------------------------
+//
+//	Like MSR BASEPRI_MAX: only ever raises the mask.
+//
+
+uint32_t HalMask( uint32_t Priority)
+{
+
+  uint32_t
+    old;
+
+  old = HalBasepri;
+  HalTick();
+  Priority &= 0xf0;
+  if ( Priority && (!HalBasepri || (int) Priority < HalBasepri))
+    HalBasepri = Priority;
+  return old;
+} // HalMask
+
+//*	HalUnmask - The firmware's IRQ_UNMASK.
+//	--------------------------------------
+
+void HalUnmask( uint32_t Was)
+{
+
+  HalBasepri = Was & 0xf0;
+  HalTick();
+  return;
+} // HalUnmask
+
+//*	HalGpioDrive - Drive pins from outside.
+//	---------------------------------------
+//
+//	Level 0 pulls the pins low (as an open-drain driver would);
+//	1 lets them go, so they read whatever the chip drives, or high.
+//
+
+void HalGpioDrive( uint32_t Port, uint16_t Pins, int Level)
+{
+
+  HAL_PORT
+    *port;
+
+  port = PortFor( Port);
+  if ( Level)
+    port->External |= Pins;
+  else
+    port->External &= ~Pins;
+  GpioUpdate( port);
+  return;
+} // HalGpioDrive
+
+//*	HalGpioLevels - Return what a port's pins read.
+//	-----------------------------------------------
+
+uint16_t HalGpioLevels( uint32_t Port)
+{
+  return PortFor( Port)->Levels;
+} // HalGpioLevels
+
+//*	HalWatchPins - Be told when pins change.
+//	----------------------------------------
+
+void HalWatchPins( uint32_t Port, uint16_t Pins, HAL_PIN_WATCH Watch,
+  void *Arg)
+{
+
+  HAL_PIN_WATCHER
+    *w;
+
+  if ( HalPinWatcherCount >= HAL_WATCHERS)
+  {
+    fprintf( stderr, "hal: too many pin watchers\n");
+    exit( 2);
+  }
+  w = &HalPinWatchers[ HalPinWatcherCount++];
+  w->Port = Port;
+  w->Pins = Pins;
+  w->Watch = Watch;
+  w->Arg = Arg;
+  return;
+} // HalWatchPins
+
+//*	HalWatchIrqs - Be told when interrupt handlers start and end.
+//	-------------------------------------------------------------
+
+void HalWatchIrqs( HAL_IRQ_WATCH Watch, void *Arg)
+{
+
+  if ( HalIrqWatcherCount >= HAL_WATCHERS)
+  {
+    fprintf( stderr, "hal: too many interrupt watchers\n");
+    exit( 2);
+  }
+  HalIrqWatchers[ HalIrqWatcherCount].Watch = Watch;
+  HalIrqWatchers[ HalIrqWatcherCount].Arg = Arg;
+  HalIrqWatcherCount++;
+  return;
+} // HalWatchIrqs
+
+//*	HalIrqName - Return the name of an interrupt.
+//	---------------------------------------------
+
+const char *HalIrqName( int Irq)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < HAL_VECTOR_COUNT; i++)
+    if ( HalVectors[ i].Irq == Irq)
+      return HalVectors[ i].Name;
+  return "?";
+} // HalIrqName
+
+//*	HalUartReceive - Have a byte arrive on a USART's RX pin.
+//	--------------------------------------------------------
+//
+//	The start bit begins at At, or as soon as the line is free.
+//	The pin is driven bit by bit, so EXTI on it works too.
+//
+
+void HalUartReceive( uint32_t Usart, uint64_t At, uint8_t What, int Flags)
+{
+
+  HAL_USART
+    *u;
+
+  u = UsartFor( Usart);
+  if ( u->RxTail == u->RxSize)
+  { // make room
+    if ( u->RxHead)
+    {
+      memmove( u->RxQueue, u->RxQueue + u->RxHead,
+        (u->RxTail - u->RxHead) * sizeof( HAL_RX_BYTE));
+      u->RxTail -= u->RxHead;
+      u->RxHead = 0;
+    } else
+    {
+      u->RxSize = u->RxSize ? u->RxSize * 2 : 256;
+      u->RxQueue = realloc( u->RxQueue, u->RxSize * sizeof( HAL_RX_BYTE));
+      if ( !u->RxQueue)
+      {
+        fprintf( stderr, "hal: out of memory\n");
+        exit( 2);
+      }
+    }
+  }
+  u->RxQueue[ u->RxTail].At = At;
+  u->RxQueue[ u->RxTail].What = What;
+  u->RxQueue[ u->RxTail].Flags = (uint8_t) Flags;
+  u->RxTail++;
+  if ( !u->RxActive && (u->RxTail - u->RxHead) == 1)
+    UsartRxNext( u);
+  return;
+} // HalUartReceive
+
+//*	HalUartPending - Return bytes not yet fully received.
+//	-----------------------------------------------------
+
+int HalUartPending( uint32_t Usart)
+{
+
+  HAL_USART
+    *u;
+
+  u = UsartFor( Usart);
+  return u->RxTail - u->RxHead + u->RxActive;
+} // HalUartPending
+
+//*	HalUartSink - Say where a USART's output goes.
+//	----------------------------------------------
+//
+//	Sink( Arg, byte) is called as each byte's stop bit ends.
+//
+
+void HalUartSink( uint32_t Usart, HAL_UART_SINK Sink, void *Arg)
+{
+
+  HAL_USART
+    *u;
+
+  u = UsartFor( Usart);
+  u->Sink = Sink;
+  u->SinkArg = Arg;
+  return;
+} // HalUartSink
+
+//*	HalRegister - Get at a register for the firmware.
+//	-------------------------------------------------
+//
+//	What MMIO32 comes to.  Brings the peripheral up to date first;
+//	reading a USART's DR clears its receive flags.
+//
+
+volatile uint32_t *HalRegister( uint32_t Addr)
+{
+
+  HAL_TIMER
+    *tim;
+
+  HAL_USART
+    *u;
+
+  uint32_t
+    *reg;
+
+  HalTick();
+  reg = HalRaw( Addr);
+  if ( (tim = TimerFor( Addr & ~0x3ffU)))
+    TimerSync( tim);
+  else if ( (u = UsartFor( Addr & ~0xffU)) && (Addr & 0xff) == OFF_USART_DR)
+    REG( u->Base, OFF_USART_SR) &= ~(USART_SR_RXNE | USART_SR_ORE |
+      USART_SR_NE | USART_SR_FE | USART_SR_IDLE);
+  else if ( Addr == DWT_BASE + 0x04)
+    *reg = (uint32_t) HalCycles;
+  return reg;
+} // HalRegister
+
+//	HalRaw - Find a register, no side effects.
+//	------------------------------------------
+
+static uint32_t *HalRaw( uint32_t Addr)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < HAL_BLOCK_COUNT; i++)
+  {
+    if ( Addr >= HalBlocks[ i].Base && Addr < HalBlocks[ i].Base + BLOCK_SPAN)
+      return &HalBlocks[ i].Reg[ (Addr - HalBlocks[ i].Base) / 4];
+  }
+  fprintf( stderr, "hal: no register at %08x\n", Addr);
+  exit( 2);
+} // HalRaw
+
+//	HalTick - Charge for an access; let things happen.
+//	--------------------------------------------------
+
+static void HalTick( void)
+{
+
+  if ( !HalRunning)
+    return;
+  HalCycles += HAL_ACCESS_CYCLES;
+  if ( HalCycles >= HalNextAt)
+    HalEvents();
+  if ( HalCycles > HalStuckAt)
+    longjmp( HalExit, HAL_STUCK);
+  if ( !HalPrimask)
+    HalIrqCheck();
+  return;
+} // HalTick
+
+//	HalEvents - Do whatever has come due.
+//	-------------------------------------
+
+static void HalEvents( void)
+{
+
+  HAL_EVENT
+    event;
+
+  int
+    i;
+
+  if ( HalInEvents)
+    return;			// an action touched a register
+  HalInEvents = 1;
+  do
+  {
+    for ( i = 0; i < HAL_TIMER_COUNT; i++)
+      TimerSync( &HalTimers[ i]);
+    while ( HalHeapLen && HalHeap[ 0].At <= HalCycles)
+    {
+      HeapPop( &event);
+      (*event.Action)( event.Arg, event.Value);
+    }
+    HalReschedule();
+  } while ( HalNextAt <= HalCycles);
+  HalInEvents = 0;
+  return;
+} // HalEvents
+
+//	HalReschedule - Work out when something's next due.
+//	---------------------------------------------------
+
+static void HalReschedule( void)
+{
+
+  uint64_t
+    at;
+
+  int
+    i;
+
+  HalNextAt = HalHeapLen ? HalHeap[ 0].At : HAL_NEVER;
+  for ( i = 0; i < HAL_TIMER_COUNT; i++)
+  {
+    at = TimerNextAt( &HalTimers[ i]);
+    if ( at < HalNextAt)
+      HalNextAt = at;
+  }
+  return;
+} // HalReschedule
+
+//	HalIrqCheck - Take any interrupt that can be taken.
+//	---------------------------------------------------
+//
+//	Highest priority first; only one that beats whatever is running
+//	now, and the BASEPRI mask.  Called again from inside the ISR as it
+//	touches registers, so higher priorities nest.
+//
+
+static void HalIrqCheck( void)
+{
+
+  int
+    i,
+    best,
+    bestPriority,
+    priority,
+    saved;
+
+  while ( !HalPrimask)
+  {
+    best = -1;
+    bestPriority = HalActive;
+    if ( HalBasepri && HalBasepri < bestPriority)
+      bestPriority = HalBasepri;
+    for ( i = 0; i < HAL_VECTOR_COUNT; i++)
+    {
+      if ( !HalIrqEnabled[ HalVectors[ i].Irq])
+        continue;
+      priority = HalIrqPriority[ HalVectors[ i].Irq] & 0xf0;
+      if ( priority < bestPriority && HalIrqPending( HalVectors[ i].Irq))
+      {
+        best = i;
+        bestPriority = priority;
+      }
+    } // for each vector
+    if ( best < 0)
+      return;
+
+    saved = HalActive;
+    HalActive = bestPriority;
+    HalCycles += HAL_IRQ_ENTRY_CYCLES;
+    for ( i = 0; i < HalIrqWatcherCount; i++)
+      (*HalIrqWatchers[ i].Watch)( HalIrqWatchers[ i].Arg,
+        HalVectors[ best].Irq, 1);
+    (*HalVectors[ best].Isr)();
+    for ( i = 0; i < HalIrqWatcherCount; i++)
+      (*HalIrqWatchers[ i].Watch)( HalIrqWatchers[ i].Arg,
+        HalVectors[ best].Irq, 0);
+    HalCycles += HAL_IRQ_EXIT_CYCLES;
+    HalActive = saved;
+    if ( HalCycles >= HalNextAt)
+      HalEvents();
+  } // while interrupts are on
+  return;
+} // HalIrqCheck
+
+//	HalIrqPending - See if a peripheral is asking for an interrupt.
+//	---------------------------------------------------------------
+
+static int HalIrqPending( int Irq)
+{
+
+  uint32_t
+    sr,
+    cr1;
+
+  int
+    i;
+
+  switch( Irq)
+  {
+    case NVIC_EXTI9_5_IRQ:
+      return (REG( EXTI_BASE, OFF_EXTI_PR) &
+        REG( EXTI_BASE, OFF_EXTI_IMR) & 0x03e0) != 0;
+
+    case NVIC_EXTI15_10_IRQ:
+      return (REG( EXTI_BASE, OFF_EXTI_PR) &
+        REG( EXTI_BASE, OFF_EXTI_IMR) & 0xfc00) != 0;
+
+    case NVIC_DMA1_CHANNEL3_IRQ:
+    case NVIC_DMA1_CHANNEL4_IRQ:
+    case NVIC_DMA1_CHANNEL7_IRQ:
+      i = Irq - NVIC_DMA1_CHANNEL3_IRQ + 3;	// channel
+      return ((REG( DMA1, OFF_DMA_ISR) >> ((i - 1) * 4)) &
+        REG( DMA1, OFF_DMA_CCR( i)) &
+        (DMA_CCR_TCIE | DMA_CCR_HTIE | DMA_CCR_TEIE)) != 0;
+
+    case NVIC_TIM1_UP_IRQ:
+      return (REG( TIM1, OFF_TIM_SR) & REG( TIM1, OFF_TIM_DIER) &
+        TIM_SR_UIF) != 0;
+
+    case NVIC_TIM2_IRQ:
+    case NVIC_TIM3_IRQ:
+    case NVIC_TIM4_IRQ:
+      i = Irq - NVIC_TIM2_IRQ + 1;
+      return (REG( HalTimers[ i].Base, OFF_TIM_SR) &
+        REG( HalTimers[ i].Base, OFF_TIM_DIER) & TIM_SR_ALL) != 0;
+
+    case NVIC_USART1_IRQ:
+    case NVIC_USART3_IRQ:
+      i = (Irq == NVIC_USART1_IRQ) ? 0 : 1;
+      sr = REG( HalUsarts[ i].Base, OFF_USART_SR);
+      cr1 = REG( HalUsarts[ i].Base, OFF_USART_CR1);
+      return ((sr & (USART_SR_RXNE | USART_SR_ORE)) &&
+              (cr1 & USART_CR1_RXNEIE)) ||
+        ((sr & USART_SR_IDLE) && (cr1 & USART_CR1_IDLEIE)) ||
+        ((sr & USART_SR_TXE) && (cr1 & USART_CR1_TXEIE)) ||
+        ((sr & USART_SR_TC) && (cr1 & USART_CR1_TCIE)) ||
+        ((sr & (USART_SR_ORE | USART_SR_NE | USART_SR_FE)) &&
+         (REG( HalUsarts[ i].Base, OFF_USART_CR3) & USART_CR3_EIE));
+  } // switch
+  return 0;
+} // HalIrqPending
+
+//	HeapPush - Add an event to the heap.
+//	------------------------------------
+
+static void HeapPush( HAL_EVENT *Event)
+{
+
+  int
+    i,
+    parent;
+
+  HAL_EVENT
+    tmp;
+
+  if ( HalHeapLen == HalHeapSize)
+  {
+    HalHeapSize = HalHeapSize ? HalHeapSize * 2 : 1024;
+    HalHeap = realloc( HalHeap, HalHeapSize * sizeof( HAL_EVENT));
+    if ( !HalHeap)
+    {
+      fprintf( stderr, "hal: out of memory\n");
+      exit( 2);
+    }
+  }
+  i = HalHeapLen++;
+  HalHeap[ i] = *Event;
+  while ( i)
+  {
+    parent = (i - 1) / 2;
+    if ( HalHeap[ parent].At < HalHeap[ i].At ||
+         (HalHeap[ parent].At == HalHeap[ i].At &&
+          HalHeap[ parent].Seq < HalHeap[ i].Seq))
+      break;
+    tmp = HalHeap[ parent];
+    HalHeap[ parent] = HalHeap[ i];
+    HalHeap[ i] = tmp;
+    i = parent;
+  }
+  return;
+} // HeapPush
+
+//	HeapPop - Take the earliest event off the heap.
+//	-----------------------------------------------
+
+static void HeapPop( HAL_EVENT *Event)
+{
+
+  int
+    i,
+    child;
+
+  HAL_EVENT
+    tmp;
+
+  *Event = HalHeap[ 0];
+  HalHeap[ 0] = HalHeap[ --HalHeapLen];
+  for ( i = 0; (child = 2 * i + 1) < HalHeapLen; i = child)
+  {
+    if ( child + 1 < HalHeapLen &&
+         (HalHeap[ child + 1].At < HalHeap[ child].At ||
+          (HalHeap[ child + 1].At == HalHeap[ child].At &&
+           HalHeap[ child + 1].Seq < HalHeap[ child].Seq)))
+      child++;
+    if ( HalHeap[ i].At < HalHeap[ child].At ||
+         (HalHeap[ i].At == HalHeap[ child].At &&
+          HalHeap[ i].Seq < HalHeap[ child].Seq))
+      break;
+    tmp = HalHeap[ child];
+    HalHeap[ child] = HalHeap[ i];
+    HalHeap[ i] = tmp;
+  }
+  return;
+} // HeapPop
+
+//  Timers.
+//  -------
+//
+//  Phase counts ticks through one counting cycle.  Edge-aligned, that's
+//  0..ARR with the update at the wrap to 0.  Centre-aligned, it's
+//  0..2*ARR-1: the count goes up to ARR at Phase ARR and back down,
+//  with an update at each end.  A compare flag is set whenever the
+//  count arrives at CCRx, either way.
+
+//	TimerFor - Find a timer by its base address.
+//	--------------------------------------------
+
+static HAL_TIMER *TimerFor( uint32_t Base)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < HAL_TIMER_COUNT; i++)
+    if ( HalTimers[ i].Base == Base)
+      return &HalTimers[ i];
+  return 0;
+} // TimerFor
+
+//	TimerReset - Back to reset state.
+//	---------------------------------
+
+static void TimerReset( HAL_TIMER *Tim)
+{
+
+  memset( HalRaw( Tim->Base), 0, BLOCK_SPAN);
+  Tim->Phase = 0;
+  Tim->Frac = 0;
+  Tim->Synced = HalCycles;
+  return;
+} // TimerReset
+
+//	TimerCentre - See if a timer counts up and down.
+//	------------------------------------------------
+
+static int TimerCentre( HAL_TIMER *Tim)
+{
+  return (REG( Tim->Base, OFF_TIM_CR1) & TIM_CR1_CMS_MASK) != 0;
+} // TimerCentre
+
+//	TimerPeriod - Return ticks in a counting cycle; 0 if none.
+//	----------------------------------------------------------
+
+static uint64_t TimerPeriod( HAL_TIMER *Tim)
+{
+
+  uint64_t
+    arr;
+
+  arr = REG( Tim->Base, OFF_TIM_ARR) & 0xffff;
+  if ( !arr)
+    return 0;
+  return TimerCentre( Tim) ? 2 * arr : arr + 1;
+} // TimerPeriod
+
+//	TimerCount - Return the count at a phase.
+//	-----------------------------------------
+
+static uint32_t TimerCount( HAL_TIMER *Tim, uint64_t Phase)
+{
+
+  uint64_t
+    arr;
+
+  arr = REG( Tim->Base, OFF_TIM_ARR) & 0xffff;
+  if ( TimerCentre( Tim) && Phase > arr)
+    return (uint32_t) (2 * arr - Phase);
+  return (uint32_t) Phase;
+} // TimerCount
+
+//	TimerFlagsAt - Return the flags set on arriving at a phase.
+//	-----------------------------------------------------------
+
+static uint32_t TimerFlagsAt( HAL_TIMER *Tim, uint64_t Phase)
+{
+
+  uint32_t
+    flags,
+    count,
+    arr;
+
+  int
+    i;
+
+  arr = REG( Tim->Base, OFF_TIM_ARR) & 0xffff;
+  count = TimerCount( Tim, Phase);
+  flags = 0;
+  for ( i = 0; i < 4; i++)
+    if ( (REG( Tim->Base, OFF_TIM_CCR1 + 4 * i) & 0xffff) == count)
+      flags |= TIM_SR_CC1IF << i;
+  if ( Phase == 0 || (TimerCentre( Tim) && count == arr))
+    flags |= TIM_SR_UIF;
+  return flags;
+} // TimerFlagsAt
+
+//	TimerNext - Find the next phase that sets any of Mask.
+//	------------------------------------------------------
+//
+//	Returns how many ticks away it is (0 if none) and the phase.
+//
+
+static uint64_t TimerNext( HAL_TIMER *Tim, uint32_t Mask, uint64_t *Phase)
+{
+
+  uint64_t
+    period,
+    arr,
+    points[ 10],
+    d,
+    best;
+
+  int
+    i,
+    n;
+
+  if ( !(period = TimerPeriod( Tim)))
+    return 0;
+  arr = REG( Tim->Base, OFF_TIM_ARR) & 0xffff;
+  n = 0;
+  points[ n++] = 0;
+  if ( TimerCentre( Tim))
+    points[ n++] = arr;
+  for ( i = 0; i < 4; i++)
+  {
+    d = REG( Tim->Base, OFF_TIM_CCR1 + 4 * i) & 0xffff;
+    if ( d > arr)
+      continue;			// never reached
+    points[ n++] = d;
+    if ( TimerCentre( Tim) && d && d < arr)
+      points[ n++] = 2 * arr - d;	// on the way down
+  }
+
+  best = 0;
+  for ( i = 0; i < n; i++)
+  {
+    if ( !(TimerFlagsAt( Tim, points[ i]) & Mask))
+      continue;
+    d = (points[ i] + period - Tim->Phase) % period;
+    if ( !d)
+      d = period;
+    if ( !best || d < best)
+    {
+      best = d;
+      *Phase = points[ i];
+    }
+  }
+  return best;
+} // TimerNext
+
+//	TimerSync - Bring a timer up to now.
+//	------------------------------------
+//
+//	Sets the flags for everything passed on the way, and publishes
+//	the count and direction.
+//
+
+static void TimerSync( HAL_TIMER *Tim)
+{
+
+  uint64_t
+    elapsed,
+    ticks,
+    div,
+    period,
+    d,
+    step,
+    phase;
+
+  uint32_t
+    cr1;
+
+  elapsed = HalCycles - Tim->Synced;
+  Tim->Synced = HalCycles;
+  cr1 = REG( Tim->Base, OFF_TIM_CR1);
+  if ( (cr1 & TIM_CR1_CEN) && (period = TimerPeriod( Tim)))
+  {
+    div = (REG( Tim->Base, OFF_TIM_PSC) & 0xffff) + 1;
+    ticks = (Tim->Frac + elapsed) / div;
+    Tim->Frac = (Tim->Frac + elapsed) % div;
+    if ( ticks > 2 * period && !(cr1 & TIM_CR1_OPM))
+    { // many cycles: every point was passed; skip to the last one
+      for ( d = 0; (step = TimerNext( Tim, TIM_SR_ALL, &phase)) &&
+                   d + step <= period; d += step)
+      {
+        Tim->Phase = phase;
+        REG( Tim->Base, OFF_TIM_SR) |= TimerFlagsAt( Tim, phase);
+      }
+      ticks = (ticks - d) % period;
+    }
+    while ( ticks)
+    {
+      d = TimerNext( Tim, TIM_SR_ALL, &phase);
+      if ( !d || d > ticks)
+      {
+        Tim->Phase = (Tim->Phase + ticks) % period;
+        break;
+      }
+      ticks -= d;
+      Tim->Phase = phase;
+      REG( Tim->Base, OFF_TIM_SR) |= TimerFlagsAt( Tim, phase);
+      if ( phase == 0 && (cr1 & TIM_CR1_OPM))
+      { // one-shot: stop at the update
+        REG( Tim->Base, OFF_TIM_CR1) &= ~TIM_CR1_CEN;
+        Tim->Frac = 0;
+        break;
+      }
+    } // while ticks
+  }
+
+  REG( Tim->Base, OFF_TIM_CNT) = TimerCount( Tim, Tim->Phase);
+  cr1 = REG( Tim->Base, OFF_TIM_CR1);
+  if ( TimerCentre( Tim) &&
+       Tim->Phase >= (REG( Tim->Base, OFF_TIM_ARR) & 0xffff))
+    cr1 |= TIM_CR1_DIR_DOWN;
+  else if ( TimerCentre( Tim))
+    cr1 &= ~TIM_CR1_DIR_DOWN;
+  REG( Tim->Base, OFF_TIM_CR1) = cr1;
+  return;
+} // TimerSync
+
+//	TimerNextAt - When will the timer next want an interrupt?
+//	---------------------------------------------------------
+
+static uint64_t TimerNextAt( HAL_TIMER *Tim)
+{
+
+  uint64_t
+    d,
+    phase,
+    div;
+
+  uint32_t
+    enabled;
+
+  if ( !(REG( Tim->Base, OFF_TIM_CR1) & TIM_CR1_CEN))
+    return HAL_NEVER;
+  enabled = REG( Tim->Base, OFF_TIM_DIER) & TIM_SR_ALL;
+  if ( !enabled || !(d = TimerNext( Tim, enabled, &phase)))
+    return HAL_NEVER;
+  div = (REG( Tim->Base, OFF_TIM_PSC) & 0xffff) + 1;
+  return Tim->Synced + d * div - Tim->Frac;
+} // TimerNextAt
+
+//  GPIO and EXTI.
+//  --------------
+
+//	PortFor - Find a GPIO port.
+//	---------------------------
+
+static HAL_PORT *PortFor( uint32_t Base)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < HAL_PORT_COUNT; i++)
+    if ( HalPorts[ i].Base == Base)
+      return &HalPorts[ i];
+  fprintf( stderr, "hal: no GPIO port at %08x\n", Base);
+  exit( 2);
+} // PortFor
+
+//	GpioUpdate - Work out the pin levels after a change.
+//	----------------------------------------------------
+//
+//	An input reads what's outside; an open-drain output reads low if
+//	either side pulls it low; a push-pull output reads what it drives.
+//	Edges go to EXTI and the watchers.
+//
+
+static void GpioUpdate( HAL_PORT *Port)
+{
+
+  uint32_t
+    cfg,
+    odr,
+    bit;
+
+  uint16_t
+    levels,
+    changed;
+
+  int
+    pin,
+    i;
+
+  odr = REG( Port->Base, OFF_GPIO_ODR);
+  levels = 0;
+  for ( pin = 0; pin < 16; pin++)
+  {
+    bit = 1 << pin;
+    cfg = (pin < 8) ? REG( Port->Base, OFF_GPIO_CRL) >> (pin * 4) :
+      REG( Port->Base, OFF_GPIO_CRH) >> ((pin - 8) * 4);
+    cfg &= 0xf;
+    if ( !(cfg & 3))
+      levels |= Port->External & bit;			// input
+    else if ( cfg & 4)
+      levels |= odr & Port->External & bit;		// open drain
+    else
+      levels |= odr & bit;				// push-pull
+  } // for each pin
+
+  changed = levels ^ Port->Levels;
+  Port->Levels = levels;
+  REG( Port->Base, OFF_GPIO_IDR) = levels;
+  if ( !changed)
+    return;
+
+  for ( pin = 0; pin < 16; pin++)
+  { // edges for EXTI
+    bit = 1 << pin;
+    if ( !(changed & bit) || HalExtiPort[ pin] != Port->Base ||
+         !(REG( EXTI_BASE, OFF_EXTI_IMR) & bit))
+      continue;
+    if ( (levels & bit) ? (REG( EXTI_BASE, OFF_EXTI_RTSR) & bit) :
+         (REG( EXTI_BASE, OFF_EXTI_FTSR) & bit))
+      REG( EXTI_BASE, OFF_EXTI_PR) |= bit;
+  }
+  for ( i = 0; i < HalPinWatcherCount; i++)
+  {
+    if ( HalPinWatchers[ i].Port == Port->Base &&
+         (HalPinWatchers[ i].Pins & changed))
+      (*HalPinWatchers[ i].Watch)( HalPinWatchers[ i].Arg, Port->Base,
+        HalPinWatchers[ i].Pins & changed, levels);
+  }
+  return;
+} // GpioUpdate
+
+//  USARTs and DMA.
+//  ---------------
+
+//	UsartFor - Find a USART.
+//	------------------------
+
+static HAL_USART *UsartFor( uint32_t Base)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < HAL_USART_COUNT; i++)
+    if ( HalUsarts[ i].Base == Base)
+      return &HalUsarts[ i];
+  return 0;
+} // UsartFor
+
+//	UsartBitCycles - Return CPU cycles per bit.
+//	-------------------------------------------
+
+static uint64_t UsartBitCycles( HAL_USART *Usart)
+{
+
+  uint32_t
+    brr;
+
+  brr = REG( Usart->Base, OFF_USART_BRR);
+  return brr ? brr : HAL_CPU_HZ / 9600;
+} // UsartBitCycles
+
+//	UsartRxLine - A bit time begins on the RX pin.
+//	----------------------------------------------
+
+static void UsartRxLine( void *Arg, uint32_t Level)
+{
+
+  HAL_USART
+    *u;
+
+  u = Arg;
+  HalGpioDrive( u->RxPort, u->RxPin, Level);
+  return;
+} // UsartRxLine
+
+//	UsartRxDone - Middle of the stop bit: the byte is in.
+//	-----------------------------------------------------
+//
+//	If the last one hasn't been read, this one is lost (overrun).
+//	With receive DMA on, it goes straight to memory.
+//
+
+static void UsartRxDone( void *Arg, uint32_t Value)
+{
+
+  HAL_USART
+    *u;
+
+  uint32_t
+    cr1;
+
+  u = Arg;
+  cr1 = REG( u->Base, OFF_USART_CR1);
+  if ( !(cr1 & USART_CR1_UE) || !(cr1 & USART_CR1_RE))
+    return;
+  if ( (Value >> 8) & HAL_RX_FRAMING)
+    REG( u->Base, OFF_USART_SR) |= USART_SR_FE;
+  if ( REG( u->Base, OFF_USART_SR) & USART_SR_RXNE)
+  {
+    REG( u->Base, OFF_USART_SR) |= USART_SR_ORE;
+    return;
+  }
+  REG( u->Base, OFF_USART_DR) = Value & 0xff;
+  if ( (REG( u->Base, OFF_USART_CR3) & USART_CR3_DMAR) && DmaReady( u->RxDma))
+    DmaStore( u->RxDma, Value & 0xff);
+  else
+    REG( u->Base, OFF_USART_SR) |= USART_SR_RXNE;
+  return;
+} // UsartRxDone
+
+//	UsartRxIdle - See if the line has stayed idle for a frame.
+//	----------------------------------------------------------
+//
+//	Idle if no start bit has come since; a byte queued for later
+//	(RxActive, with its start still to come) doesn't count.
+//
+
+static void UsartRxIdle( void *Arg, uint32_t Started)
+{
+
+  HAL_USART
+    *u;
+
+  u = Arg;
+  if ( u->RxStarted == Started)
+    REG( u->Base, OFF_USART_SR) |= USART_SR_IDLE;
+  return;
+} // UsartRxIdle
+
+//	UsartRxEnd - End of the stop bit; start the next byte.
+//	------------------------------------------------------
+
+static void UsartRxEnd( void *Arg, uint32_t Value)
+{
+
+  HAL_USART
+    *u;
+
+  (void) Value;
+  u = Arg;
+  u->RxActive = 0;
+  HalSchedule( HalCycles + 10 * UsartBitCycles( u), UsartRxIdle, u,
+    u->RxStarted);
+  if ( u->RxHead != u->RxTail)
+    UsartRxNext( u);
+  return;
+} // UsartRxEnd
+
+//	UsartRxStart - Put the next queued byte on the line.
+//	----------------------------------------------------
+
+static void UsartRxStart( void *Arg, uint32_t Value)
+{
+
+  HAL_USART
+    *u;
+
+  HAL_RX_BYTE
+    *b;
+
+  uint64_t
+    bit;
+
+  int
+    i;
+
+  (void) Value;
+  u = Arg;
+  b = &u->RxQueue[ u->RxHead++];
+  bit = UsartBitCycles( u);
+  u->RxActive = 1;
+  u->RxStarted++;
+  HalGpioDrive( u->RxPort, u->RxPin, 0);		// start bit
+  for ( i = 0; i < 8; i++)
+    HalSchedule( HalCycles + (i + 1) * bit, UsartRxLine, u,
+      (b->What >> i) & 1);
+  HalSchedule( HalCycles + 9 * bit, UsartRxLine, u,
+    (b->Flags & HAL_RX_FRAMING) ? 0 : 1);
+  HalSchedule( HalCycles + 9 * bit + bit / 2, UsartRxDone, u,
+    b->What | (b->Flags << 8));
+  if ( b->Flags & HAL_RX_FRAMING)
+    HalSchedule( HalCycles + 10 * bit, UsartRxLine, u, 1);
+  HalSchedule( HalCycles + 10 * bit, UsartRxEnd, u, 0);
+  return;
+} // UsartRxStart
+
+//	UsartRxNext - Schedule the next queued byte.
+//	--------------------------------------------
+
+static void UsartRxNext( HAL_USART *Usart)
+{
+
+  HalSchedule( Usart->RxQueue[ Usart->RxHead].At, UsartRxStart, Usart, 0);
+  Usart->RxActive = 1;		// line's spoken for
+  return;
+} // UsartRxNext
+
+//	UsartTxDone - A byte has gone out.
+//	----------------------------------
+
+static void UsartTxDone( void *Arg, uint32_t Value)
+{
+
+  HAL_USART
+    *u;
+
+  u = Arg;
+  if ( u->Sink)
+    (*u->Sink)( u->SinkArg, (uint8_t) Value);
+  u->TxBusy = 0;
+  REG( u->Base, OFF_USART_SR) |= USART_SR_TXE | USART_SR_TC;
+  UsartTxKick( u);
+  return;
+} // UsartTxDone
+
+//	UsartTxStart - Start a byte going out.
+//	--------------------------------------
+
+static void UsartTxStart( HAL_USART *Usart, uint8_t What)
+{
+
+  Usart->TxBusy = 1;
+  REG( Usart->Base, OFF_USART_SR) &= ~(USART_SR_TXE | USART_SR_TC);
+  HalSchedule( HalCycles + 10 * UsartBitCycles( Usart), UsartTxDone,
+    Usart, What);
+  return;
+} // UsartTxStart
+
+//	UsartTxKick - Start the next byte, if there is one.
+//	---------------------------------------------------
+
+static void UsartTxKick( HAL_USART *Usart)
+{
+
+  if ( Usart->TxBusy || !(REG( Usart->Base, OFF_USART_CR1) & USART_CR1_UE))
+    return;
+  if ( Usart->TxHeld >= 0)
+  {
+    Usart->TxHeld = -1;
+    UsartTxStart( Usart, (uint8_t) Usart->TxHeldByte);
+  } else if ( (REG( Usart->Base, OFF_USART_CR3) & USART_CR3_DMAT) &&
+              DmaReady( Usart->TxDma))
+    UsartTxStart( Usart, DmaFetch( Usart->TxDma));
+  HalReschedule();
+  return;
+} // UsartTxKick
+
+//	DmaReady - See if a channel has something to move.
+//	--------------------------------------------------
+
+static int DmaReady( int Channel)
+{
+  return (REG( DMA1, OFF_DMA_CCR( Channel)) & DMA_CCR_EN) &&
+    (REG( DMA1, OFF_DMA_CNDTR( Channel)) & 0xffff);
+} // DmaReady
+
+//	DmaAdvance - Count one transfer.
+//	--------------------------------
+//
+//	Returns the memory address for it.
+//
+
+static uint32_t DmaAdvance( int Channel)
+{
+
+  uint32_t
+    done,
+    addr,
+    ccr;
+
+  ccr = REG( DMA1, OFF_DMA_CCR( Channel));
+  done = HalDmaInitial[ Channel] - REG( DMA1, OFF_DMA_CNDTR( Channel));
+  addr = REG( DMA1, OFF_DMA_CMAR( Channel));
+  if ( ccr & DMA_CCR_MINC)
+    addr += done;
+  if ( REG( DMA1, OFF_DMA_CNDTR( Channel)) - 1 == 
+       HalDmaInitial[ Channel] / 2)
+    REG( DMA1, OFF_DMA_ISR) |= (DMA_GIF | DMA_HTIF) << ((Channel - 1) * 4);
+  if ( !--REG( DMA1, OFF_DMA_CNDTR( Channel)))
+  { // done
+    REG( DMA1, OFF_DMA_ISR) |= (DMA_GIF | DMA_TCIF) << ((Channel - 1) * 4);
+    if ( ccr & DMA_CCR_CIRC)
+      REG( DMA1, OFF_DMA_CNDTR( Channel)) = HalDmaInitial[ Channel];
+  }
+  return addr;
+} // DmaAdvance
+
+//	DmaFetch - Read the next byte a channel sends.
+//	----------------------------------------------
+//
+//	The firmware gives DMA addresses as 32 bits; the host build is
+//	linked -no-pie, so its static buffers sit where that works.
+//
+
+static uint8_t DmaFetch( int Channel)
+{
+  return *(uint8_t *) (uintptr_t) DmaAdvance( Channel);
+} // DmaFetch
+
+//	DmaStore - Write the next byte a channel receives.
+//	--------------------------------------------------
+
+static void DmaStore( int Channel, uint8_t What)
+{
+
+  *(uint8_t *) (uintptr_t) DmaAdvance( Channel) = What;
+  return;
+} // DmaStore
+
+//  The libopencm3 stand-ins.
+//  -------------------------
+//
+//  Each costs a tick, which may take an interrupt first.
+
+void cm_enable_interrupts( void)
+{
+
+  HalPrimask = 0;
+  HalTick();
+  return;
+} // cm_enable_interrupts
+
+void cm_disable_interrupts( void)
+{
+
+  HalTick();
+  HalPrimask = 1;
+  return;
+} // cm_disable_interrupts
+
+uint32_t cm_mask_interrupts( uint32_t mask)
+{
+
+  uint32_t
+    old;
+
+  old = HalPrimask;
+  if ( mask)
+  {
+    HalTick();
+    HalPrimask = 1;
+  } else
+  {
+    HalPrimask = 0;
+    HalTick();
+  }
+  return old;
+} // cm_mask_interrupts
+
+bool cm_is_masked_interrupts( void)
+{
+  return HalPrimask != 0;
+} // cm_is_masked_interrupts
+
+bool dwt_enable_cycle_counter( void)
+{
+
+  HalTick();
+  return true;
+} // dwt_enable_cycle_counter
+
+uint32_t dwt_read_cycle_counter( void)
+{
+
+  HalTick();
+  return (uint32_t) HalCycles;
+} // dwt_read_cycle_counter
+
+void nvic_enable_irq( uint8_t irqn)
+{
+
+  HalIrqEnabled[ irqn] = 1;
+  HalTick();
+  return;
+} // nvic_enable_irq
+
+void nvic_disable_irq( uint8_t irqn)
+{
+
+  HalIrqEnabled[ irqn] = 0;
+  HalTick();
+  return;
+} // nvic_disable_irq
+
+void nvic_set_priority( uint8_t irqn, uint8_t priority)
+{
+
+  HalIrqPriority[ irqn] = priority;
+  HalTick();
+  return;
+} // nvic_set_priority
+
+void scb_set_priority_grouping( uint32_t prigroup)
+{
+
+  (void) prigroup;		// sixteen groups assumed
+  HalTick();
+  return;
+} // scb_set_priority_grouping
+
+void rcc_clock_setup_in_hse_8mhz_out_72mhz( void)
+{
+
+  HalTick();
+  return;
+} // rcc_clock_setup_in_hse_8mhz_out_72mhz
+
+void rcc_periph_clock_enable( enum rcc_periph_clken clken)
+{
+
+  (void) clken;
+  HalTick();
+  return;
+} // rcc_periph_clock_enable
+
+void rcc_periph_reset_pulse( enum rcc_periph_rst rst)
+{
+
+  static const uint32_t
+    timers[] = { TIM1, TIM2, TIM3, TIM4 };
+
+  HalTick();
+  TimerReset( TimerFor( timers[ rst]));
+  HalReschedule();
+  return;
+} // rcc_periph_reset_pulse
+
+void rcc_osc_on( enum rcc_osc osc)
+{
+
+  (void) osc;
+  HalTick();
+  return;
+} // rcc_osc_on
+
+void rcc_wait_for_osc_ready( enum rcc_osc osc)
+{
+
+  (void) osc;			// ready at once
+  HalTick();
+  return;
+} // rcc_wait_for_osc_ready
+
+void rcc_set_sysclk_source( uint32_t clk)
+{
+
+  (void) clk;
+  HalTick();
+  return;
+} // rcc_set_sysclk_source
+
+void rcc_wait_for_sysclk_status( enum rcc_osc osc)
+{
+
+  (void) osc;
+  HalTick();
+  return;
+} // rcc_wait_for_sysclk_status
+
+void pwr_set_stop_mode( void)
+{
+
+  HalTick();
+  REG( PWR_BASE, 0) &= ~PWR_CR_PDDS;
+  return;
+} // pwr_set_stop_mode
+
+void pwr_voltage_regulator_low_power_in_stop( void)
+{
+
+  HalTick();
+  REG( PWR_BASE, 0) |= PWR_CR_LPDS;
+  return;
+} // pwr_voltage_regulator_low_power_in_stop
+
+void pwr_voltage_regulator_on_in_stop( void)
+{
+
+  HalTick();
+  REG( PWR_BASE, 0) &= ~PWR_CR_LPDS;
+  return;
+} // pwr_voltage_regulator_on_in_stop
+
+void pwr_clear_wakeup_flag( void)
+{
+
+  HalTick();
+  return;
+} // pwr_clear_wakeup_flag
+
+void gpio_set_mode( uint32_t gpioport, uint8_t mode, uint8_t cnf,
+  uint16_t gpios)
+{
+
+  uint32_t
+    *cr;
+
+  int
+    pin,
+    shift;
+
+  HalTick();
+  for ( pin = 0; pin < 16; pin++)
+  {
+    if ( !(gpios & (1 << pin)))
+      continue;
+    cr = HalRaw( gpioport + ((pin < 8) ? OFF_GPIO_CRL : OFF_GPIO_CRH));
+    shift = (pin & 7) * 4;
+    *cr = (*cr & ~(0xfU << shift)) | ((uint32_t) ((cnf << 2) | mode) << shift);
+  }
+  GpioUpdate( PortFor( gpioport));
+  return;
+} // gpio_set_mode
+
+void gpio_set( uint32_t gpioport, uint16_t gpios)
+{
+
+  HalTick();
+  REG( gpioport, OFF_GPIO_ODR) |= gpios;
+  GpioUpdate( PortFor( gpioport));
+  return;
+} // gpio_set
+
+void gpio_clear( uint32_t gpioport, uint16_t gpios)
+{
+
+  HalTick();
+  REG( gpioport, OFF_GPIO_ODR) &= ~gpios;
+  GpioUpdate( PortFor( gpioport));
+  return;
+} // gpio_clear
+
+void gpio_toggle( uint32_t gpioport, uint16_t gpios)
+{
+
+  HalTick();
+  REG( gpioport, OFF_GPIO_ODR) ^= gpios;
+  GpioUpdate( PortFor( gpioport));
+  return;
+} // gpio_toggle
+
+uint16_t gpio_get( uint32_t gpioport, uint16_t gpios)
+{
+
+  HalTick();
+  return PortFor( gpioport)->Levels & gpios;
+} // gpio_get
+
+void exti_set_trigger( uint32_t extis, enum exti_trigger_type trig)
+{
+
+  HalTick();
+  if ( trig == EXTI_TRIGGER_RISING || trig == EXTI_TRIGGER_BOTH)
+    REG( EXTI_BASE, OFF_EXTI_RTSR) |= extis;
+  else
+    REG( EXTI_BASE, OFF_EXTI_RTSR) &= ~extis;
+  if ( trig == EXTI_TRIGGER_FALLING || trig == EXTI_TRIGGER_BOTH)
+    REG( EXTI_BASE, OFF_EXTI_FTSR) |= extis;
+  else
+    REG( EXTI_BASE, OFF_EXTI_FTSR) &= ~extis;
+  return;
+} // exti_set_trigger
+
+void exti_enable_request( uint32_t extis)
+{
+
+  HalTick();
+  REG( EXTI_BASE, OFF_EXTI_IMR) |= extis;
+  return;
+} // exti_enable_request
+
+void exti_disable_request( uint32_t extis)
+{
+
+  HalTick();
+  REG( EXTI_BASE, OFF_EXTI_IMR) &= ~extis;
+  return;
+} // exti_disable_request
+
+void exti_reset_request( uint32_t extis)
+{
+
+  HalTick();
+  REG( EXTI_BASE, OFF_EXTI_PR) &= ~extis;
+  return;
+} // exti_reset_request
+
+void exti_select_source( uint32_t exti, uint32_t gpioport)
+{
+
+  int
+    line;
+
+  HalTick();
+  for ( line = 0; line < 16; line++)
+    if ( exti & (1 << line))
+      HalExtiPort[ line] = gpioport;
+  return;
+} // exti_select_source
+
+uint32_t exti_get_flag_status( uint32_t exti)
+{
+
+  HalTick();
+  return REG( EXTI_BASE, OFF_EXTI_PR) & exti;
+} // exti_get_flag_status
+
+//  Timer calls bring the timer up to date first, then reschedule.
+
+#define TIMER_PROLOGUE( t) \
+  HAL_TIMER *tim; \
+  HalTick(); \
+  tim = TimerFor( t); \
+  TimerSync( tim)
+
+void timer_set_mode( uint32_t timer_peripheral, uint32_t clock_div,
+  uint32_t alignment, uint32_t direction)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_CR1) = (REG( tim->Base, OFF_TIM_CR1) &
+    ~((3 << 8) | TIM_CR1_CMS_MASK | TIM_CR1_DIR_DOWN)) |
+    clock_div | alignment | direction;
+  HalReschedule();
+  return;
+} // timer_set_mode
+
+void timer_set_prescaler( uint32_t timer_peripheral, uint32_t value)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_PSC) = value;
+  tim->Frac = 0;
+  HalReschedule();
+  return;
+} // timer_set_prescaler
+
+void timer_set_period( uint32_t timer_peripheral, uint32_t period)
+{
+
+  uint64_t
+    cycle;
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_ARR) = period;
+  if ( (cycle = TimerPeriod( tim)) && tim->Phase >= cycle)
+    tim->Phase %= cycle;
+  HalReschedule();
+  return;
+} // timer_set_period
+
+void timer_enable_preload( uint32_t timer_peripheral)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_CR1) |= TIM_CR1_ARPE;
+  return;
+} // timer_enable_preload
+
+void timer_disable_preload( uint32_t timer_peripheral)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_CR1) &= ~TIM_CR1_ARPE;
+  return;
+} // timer_disable_preload
+
+void timer_continuous_mode( uint32_t timer_peripheral)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_CR1) &= ~TIM_CR1_OPM;
+  return;
+} // timer_continuous_mode
+
+void timer_one_shot_mode( uint32_t timer_peripheral)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_CR1) |= TIM_CR1_OPM;
+  return;
+} // timer_one_shot_mode
+
+void timer_update_on_overflow( uint32_t timer_peripheral)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_CR1) |= TIM_CR1_URS;
+  return;
+} // timer_update_on_overflow
+
+void timer_update_on_any( uint32_t timer_peripheral)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_CR1) &= ~TIM_CR1_URS;
+  return;
+} // timer_update_on_any
+
+void timer_enable_counter( uint32_t timer_peripheral)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_CR1) |= TIM_CR1_CEN;
+  HalReschedule();
+  return;
+} // timer_enable_counter
+
+void timer_disable_counter( uint32_t timer_peripheral)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_CR1) &= ~TIM_CR1_CEN;
+  HalReschedule();
+  return;
+} // timer_disable_counter
+
+void timer_set_counter( uint32_t timer_peripheral, uint32_t count)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  tim->Phase = count & 0xffff;
+  tim->Frac = 0;
+  TimerSync( tim);		// publish it
+  HalReschedule();
+  return;
+} // timer_set_counter
+
+uint32_t timer_get_counter( uint32_t timer_peripheral)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  return REG( tim->Base, OFF_TIM_CNT);
+} // timer_get_counter
+
+void timer_enable_irq( uint32_t timer_peripheral, uint32_t irq)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_DIER) |= irq;
+  HalReschedule();
+  return;
+} // timer_enable_irq
+
+void timer_disable_irq( uint32_t timer_peripheral, uint32_t irq)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_DIER) &= ~irq;
+  HalReschedule();
+  return;
+} // timer_disable_irq
+
+bool timer_get_flag( uint32_t timer_peripheral, uint32_t flag)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  return (REG( tim->Base, OFF_TIM_SR) & flag) != 0;
+} // timer_get_flag
+
+void timer_clear_flag( uint32_t timer_peripheral, uint32_t flag)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_SR) &= ~flag;
+  return;
+} // timer_clear_flag
+
+void timer_generate_event( uint32_t timer_peripheral, uint32_t event)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  if ( event & TIM_EGR_UG)
+  {
+    tim->Phase = 0;
+    tim->Frac = 0;
+    if ( !(REG( tim->Base, OFF_TIM_CR1) & TIM_CR1_URS))
+      REG( tim->Base, OFF_TIM_SR) |= TIM_SR_UIF;
+    TimerSync( tim);
+  }
+  HalReschedule();
+  return;
+} // timer_generate_event
+
+void timer_set_oc_value( uint32_t timer_peripheral, enum tim_oc_id oc_id,
+  uint32_t value)
+{
+
+  TIMER_PROLOGUE( timer_peripheral);
+  REG( tim->Base, OFF_TIM_CCR1 + 4 * (oc_id / 2)) = value;
+  HalReschedule();
+  return;
+} // timer_set_oc_value
+
+//  Output compare pins and input capture aren't modelled.
+
+void timer_set_oc_mode( uint32_t timer_peripheral, enum tim_oc_id oc_id,
+  enum tim_oc_mode oc_mode)
+{
+
+  (void) timer_peripheral;
+  (void) oc_id;
+  (void) oc_mode;
+  HalTick();
+  return;
+} // timer_set_oc_mode
+
+void timer_enable_oc_output( uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+
+  (void) timer_peripheral;
+  (void) oc_id;
+  HalTick();
+  return;
+} // timer_enable_oc_output
+
+void timer_disable_oc_output( uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+
+  (void) timer_peripheral;
+  (void) oc_id;
+  HalTick();
+  return;
+} // timer_disable_oc_output
+
+void timer_set_oc_polarity_high( uint32_t timer_peripheral,
+  enum tim_oc_id oc_id)
+{
+
+  (void) timer_peripheral;
+  (void) oc_id;
+  HalTick();
+  return;
+} // timer_set_oc_polarity_high
+
+void timer_set_oc_polarity_low( uint32_t timer_peripheral,
+  enum tim_oc_id oc_id)
+{
+
+  (void) timer_peripheral;
+  (void) oc_id;
+  HalTick();
+  return;
+} // timer_set_oc_polarity_low
+
+void timer_enable_oc_preload( uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+
+  (void) timer_peripheral;
+  (void) oc_id;
+  HalTick();
+  return;
+} // timer_enable_oc_preload
+
+void timer_disable_oc_preload( uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+
+  (void) timer_peripheral;
+  (void) oc_id;
+  HalTick();
+  return;
+} // timer_disable_oc_preload
+
+void timer_ic_set_input( uint32_t timer_peripheral, enum tim_ic_id ic,
+  enum tim_ic_input in)
+{
+
+  (void) timer_peripheral;
+  (void) ic;
+  (void) in;
+  HalTick();
+  return;
+} // timer_ic_set_input
+
+void timer_ic_set_polarity( uint32_t timer_peripheral, enum tim_ic_id ic,
+  enum tim_ic_pol pol)
+{
+
+  (void) timer_peripheral;
+  (void) ic;
+  (void) pol;
+  HalTick();
+  return;
+} // timer_ic_set_polarity
+
+void timer_ic_enable( uint32_t timer_peripheral, enum tim_ic_id ic)
+{
+
+  (void) timer_peripheral;
+  (void) ic;
+  HalTick();
+  return;
+} // timer_ic_enable
+
+void timer_ic_disable( uint32_t timer_peripheral, enum tim_ic_id ic)
+{
+
+  (void) timer_peripheral;
+  (void) ic;
+  HalTick();
+  return;
+} // timer_ic_disable
+
+void usart_set_baudrate( uint32_t usart, uint32_t baud)
+{
+
+  HalTick();
+  REG( usart, OFF_USART_BRR) = HAL_CPU_HZ / baud;	// cycles per bit
+  return;
+} // usart_set_baudrate
+
+void usart_set_databits( uint32_t usart, uint32_t bits)
+{
+
+  (void) usart;
+  (void) bits;
+  HalTick();
+  return;
+} // usart_set_databits
+
+void usart_set_stopbits( uint32_t usart, uint32_t stopbits)
+{
+
+  (void) usart;
+  (void) stopbits;
+  HalTick();
+  return;
+} // usart_set_stopbits
+
+void usart_set_parity( uint32_t usart, uint32_t parity)
+{
+
+  (void) usart;
+  (void) parity;
+  HalTick();
+  return;
+} // usart_set_parity
+
+void usart_set_flow_control( uint32_t usart, uint32_t flowcontrol)
+{
+
+  (void) usart;
+  (void) flowcontrol;
+  HalTick();
+  return;
+} // usart_set_flow_control
+
+void usart_set_mode( uint32_t usart, uint32_t mode)
+{
+
+  HalTick();
+  REG( usart, OFF_USART_CR1) = (REG( usart, OFF_USART_CR1) &
+    ~USART_MODE_TX_RX) | mode;
+  return;
+} // usart_set_mode
+
+void usart_enable( uint32_t usart)
+{
+
+  HalTick();
+  REG( usart, OFF_USART_CR1) |= USART_CR1_UE;
+  if ( !UsartFor( usart)->TxBusy)
+    REG( usart, OFF_USART_SR) |= USART_SR_TXE | USART_SR_TC;
+  UsartTxKick( UsartFor( usart));
+  return;
+} // usart_enable
+
+void usart_disable( uint32_t usart)
+{
+
+  HalTick();
+  REG( usart, OFF_USART_CR1) &= ~USART_CR1_UE;
+  return;
+} // usart_disable
+
+void usart_send( uint32_t usart, uint16_t data)
+{
+
+  HAL_USART
+    *u;
+
+  HalTick();
+  u = UsartFor( usart);
+  if ( u->TxBusy)
+  { // into the data register behind the one going out
+    u->TxHeld = 1;
+    u->TxHeldByte = data & 0xff;
+    REG( usart, OFF_USART_SR) &= ~USART_SR_TXE;
+  } else
+    UsartTxStart( u, data & 0xff);
+  HalReschedule();
+  return;
+} // usart_send
+
+uint16_t usart_recv( uint32_t usart)
+{
+
+  HalTick();
+  REG( usart, OFF_USART_SR) &= ~(USART_SR_RXNE | USART_SR_ORE |
+    USART_SR_NE | USART_SR_FE | USART_SR_IDLE);
+  return REG( usart, OFF_USART_DR) & 0xff;
+} // usart_recv
+
+void usart_send_blocking( uint32_t usart, uint16_t data)
+{
+
+  while ( UsartFor( usart)->TxHeld >= 0)
+    HalTick();
+  usart_send( usart, data);
+  return;
+} // usart_send_blocking
+
+uint16_t usart_recv_blocking( uint32_t usart)
+{
+
+  while ( !(REG( usart, OFF_USART_SR) & USART_SR_RXNE))
+    HalTick();
+  return usart_recv( usart);
+} // usart_recv_blocking
+
+void usart_enable_rx_dma( uint32_t usart)
+{
+
+  HalTick();
+  REG( usart, OFF_USART_CR3) |= USART_CR3_DMAR;
+  return;
+} // usart_enable_rx_dma
+
+void usart_disable_rx_dma( uint32_t usart)
+{
+
+  HalTick();
+  REG( usart, OFF_USART_CR3) &= ~USART_CR3_DMAR;
+  return;
+} // usart_disable_rx_dma
+
+void usart_enable_tx_dma( uint32_t usart)
+{
+
+  HalTick();
+  REG( usart, OFF_USART_CR3) |= USART_CR3_DMAT;
+  UsartTxKick( UsartFor( usart));
+  return;
+} // usart_enable_tx_dma
+
+void usart_disable_tx_dma( uint32_t usart)
+{
+
+  HalTick();
+  REG( usart, OFF_USART_CR3) &= ~USART_CR3_DMAT;
+  return;
+} // usart_disable_tx_dma
+
+void dma_channel_reset( uint32_t dma, uint8_t channel)
+{
+
+  HalTick();
+  REG( dma, OFF_DMA_CCR( channel)) = 0;
+  REG( dma, OFF_DMA_CNDTR( channel)) = 0;
+  REG( dma, OFF_DMA_CMAR( channel)) = 0;
+  REG( dma, OFF_DMA_ISR) &= ~(0xfU << ((channel - 1) * 4));
+  HalDmaInitial[ channel] = 0;
+  return;
+} // dma_channel_reset
+
+void dma_clear_interrupt_flags( uint32_t dma, uint8_t channel,
+  uint32_t interrupts)
+{
+
+  HalTick();
+  REG( dma, OFF_DMA_ISR) &= ~(interrupts << ((channel - 1) * 4));
+  return;
+} // dma_clear_interrupt_flags
+
+bool dma_get_interrupt_flag( uint32_t dma, uint8_t channel,
+  uint32_t interrupts)
+{
+
+  HalTick();
+  return ((REG( dma, OFF_DMA_ISR) >> ((channel - 1) * 4)) & interrupts) != 0;
+} // dma_get_interrupt_flag
+
+//  Set or clear bits in a channel's CCR.
+
+static void DmaCcr( uint32_t Dma, uint8_t Channel, uint32_t Clear,
+  uint32_t Set)
+{
+
+  HalTick();
+  REG( Dma, OFF_DMA_CCR( Channel)) =
+    (REG( Dma, OFF_DMA_CCR( Channel)) & ~Clear) | Set;
+  return;
+} // DmaCcr
+
+void dma_enable_mem2mem_mode( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, 0, 1 << 14);
+} // dma_enable_mem2mem_mode
+
+void dma_set_priority( uint32_t dma, uint8_t channel, uint32_t prio)
+{
+  DmaCcr( dma, channel, 3 << 12, prio);
+} // dma_set_priority
+
+void dma_set_memory_size( uint32_t dma, uint8_t channel, uint32_t mem_size)
+{
+  DmaCcr( dma, channel, 3 << 10, mem_size);
+} // dma_set_memory_size
+
+void dma_set_peripheral_size( uint32_t dma, uint8_t channel,
+  uint32_t peripheral_size)
+{
+  DmaCcr( dma, channel, 3 << 8, peripheral_size);
+} // dma_set_peripheral_size
+
+void dma_enable_memory_increment_mode( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, 0, DMA_CCR_MINC);
+} // dma_enable_memory_increment_mode
+
+void dma_disable_memory_increment_mode( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, DMA_CCR_MINC, 0);
+} // dma_disable_memory_increment_mode
+
+void dma_enable_circular_mode( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, 0, DMA_CCR_CIRC);
+} // dma_enable_circular_mode
+
+void dma_set_read_from_peripheral( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, DMA_CCR_DIR, 0);
+} // dma_set_read_from_peripheral
+
+void dma_set_read_from_memory( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, 0, DMA_CCR_DIR);
+} // dma_set_read_from_memory
+
+void dma_enable_transfer_error_interrupt( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, 0, DMA_CCR_TEIE);
+} // dma_enable_transfer_error_interrupt
+
+void dma_enable_half_transfer_interrupt( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, 0, DMA_CCR_HTIE);
+} // dma_enable_half_transfer_interrupt
+
+void dma_enable_transfer_complete_interrupt( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, 0, DMA_CCR_TCIE);
+} // dma_enable_transfer_complete_interrupt
+
+void dma_disable_transfer_complete_interrupt( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, DMA_CCR_TCIE, 0);
+} // dma_disable_transfer_complete_interrupt
+
+void dma_enable_channel( uint32_t dma, uint8_t channel)
+{
+
+  int
+    i;
+
+  DmaCcr( dma, channel, 0, DMA_CCR_EN);
+  for ( i = 0; i < HAL_USART_COUNT; i++)
+    if ( HalUsarts[ i].TxDma == channel)
+      UsartTxKick( &HalUsarts[ i]);
+  return;
+} // dma_enable_channel
+
+void dma_disable_channel( uint32_t dma, uint8_t channel)
+{
+  DmaCcr( dma, channel, DMA_CCR_EN, 0);
+} // dma_disable_channel
+
+void dma_set_peripheral_address( uint32_t dma, uint8_t channel,
+  uint32_t address)
+{
+
+  HalTick();
+  REG( dma, OFF_DMA_CMAR( channel) - 4) = address;	// CPAR
+  return;
+} // dma_set_peripheral_address
+
+void dma_set_memory_address( uint32_t dma, uint8_t channel, uint32_t address)
+{
+
+  HalTick();
+  REG( dma, OFF_DMA_CMAR( channel)) = address;
+  return;
+} // dma_set_memory_address
+
+void dma_set_number_of_data( uint32_t dma, uint8_t channel, uint16_t number)
+{
+
+  HalTick();
+  REG( dma, OFF_DMA_CNDTR( channel)) = number;
+  HalDmaInitial[ channel] = number;
+  return;
+} // dma_set_number_of_data
+
+//  Default handlers, as the vector table would have.  The firmware's
+//  own take their place.
+
+#define HAL_WEAK_ISR( name) \
+  void name( void) __attribute__(( weak)); \
+  void name( void) {}
+
+HAL_WEAK_ISR( exti9_5_isr)
+HAL_WEAK_ISR( exti15_10_isr)
+HAL_WEAK_ISR( dma1_channel3_isr)
+HAL_WEAK_ISR( dma1_channel4_isr)
+HAL_WEAK_ISR( dma1_channel7_isr)
+HAL_WEAK_ISR( tim1_up_isr)
+HAL_WEAK_ISR( tim1_cc_isr)
+HAL_WEAK_ISR( tim2_isr)
+HAL_WEAK_ISR( tim3_isr)
+HAL_WEAK_ISR( tim4_isr)
+HAL_WEAK_ISR( usart1_isr)
+HAL_WEAK_ISR( usart3_isr)
+HAL_WEAK_ISR( sys_tick_handler)
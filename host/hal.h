@@ -0,0 +1,72 @@
+#ifndef _HAL_DEFINED
+#define _HAL_DEFINED
+
+#include <stdint.h>
+
+//	Simulated STM32F103 for running the firmware on the host.
+//
+//	The firmware is built unchanged against the libopencm3 stand-ins
+//	in host/include, with main renamed FirmwareMain.  Time is counted
+//	in CPU cycles: every register access or library call costs a few,
+//	an interrupt costs its entry and exit, and WFI skips straight to
+//	the next thing that happens.  Interrupts are taken at those same
+//	points, by priority, so the ISRs nest as they would on the chip.
+//
+//	Modelled: GPIO (with open-drain lines the outside world can pull
+//	low), EXTI, TIM1-TIM4 counting, compares and update (edge and
+//	centre-aligned), USART1/USART3 at their baud rates, DMA for the
+//	USARTs, NVIC priorities and PRIMASK, and the DWT cycle counter.
+//	Not modelled: DMA paced by a timer (PS2_DMA_TX), timer outputs,
+//	and the clocks stopping in Stop mode--it just sleeps.
+//
+//	A test driver sets up what the outside world does by scheduling
+//	actions at given times, then calls HalRun.  Actions, pin and
+//	UART watchers run in simulator context: they may drive pins and
+//	schedule more actions, but must not call into the firmware.
+
+#define HAL_CPU_HZ 72000000
+#define HAL_US( us) ((uint64_t) (us) * (HAL_CPU_HZ / 1000000))
+#define HAL_MS( ms) ((uint64_t) (ms) * (HAL_CPU_HZ / 1000))
+#define HAL_NEVER UINT64_MAX
+
+#define HAL_ACCESS_CYCLES 4	// a register access or library call
+#define HAL_IRQ_ENTRY_CYCLES 12	// exception entry
+#define HAL_IRQ_EXIT_CYCLES 10	// and return
+#define HAL_STUCK_CYCLES HAL_MS( 1000)	// busy this long past the end
+
+#define HAL_RX_FRAMING 1	// HalUartReceive: bad stop bit
+
+typedef enum
+{
+  HAL_DONE = 1,			// ran to the end time
+  HAL_STOPPED,			// HalStop was called
+  HAL_STUCK,			// never got back to WFI
+  HAL_RETURNED			// FirmwareMain returned
+} HAL_RESULT;
+
+typedef void (*HAL_ACTION)( void *Arg, uint32_t Value);
+typedef void (*HAL_PIN_WATCH)( void *Arg, uint32_t Port, uint16_t Changed,
+  uint16_t Levels);
+typedef void (*HAL_IRQ_WATCH)( void *Arg, int Irq, int Enter);
+typedef void (*HAL_UART_SINK)( void *Arg, uint8_t What);
+
+void HalInit( void);
+uint64_t HalNow( void);
+HAL_RESULT HalRun( int (*Entry)( void), uint64_t Until);
+void HalStop( void);
+void HalSchedule( uint64_t At, HAL_ACTION Action, void *Arg, uint32_t Value);
+
+void HalGpioDrive( uint32_t Port, uint16_t Pins, int Level);
+uint16_t HalGpioLevels( uint32_t Port);
+void HalWatchPins( uint32_t Port, uint16_t Pins, HAL_PIN_WATCH Watch,
+  void *Arg);
+void HalWatchIrqs( HAL_IRQ_WATCH Watch, void *Arg);
+const char *HalIrqName( int Irq);
+
+void HalUartReceive( uint32_t Usart, uint64_t At, uint8_t What, int Flags);
+int HalUartPending( uint32_t Usart);
+void HalUartSink( uint32_t Usart, HAL_UART_SINK Sink, void *Arg);
+
+int FirmwareMain( void);
+
+#endif // _HAL_DEFINED
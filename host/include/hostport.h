@@ -0,0 +1,20 @@
+#ifndef _HOSTPORT_DEFINED
+#define _HOSTPORT_DEFINED
+
+//	Forced into every firmware file in the host build (-include).
+//
+//	WFI becomes a call into the simulator, which runs the peripherals
+//	forward until an interrupt is pending; BASEPRI becomes the
+//	simulator's.
+
+#include <stdint.h>
+
+void HalWait( void);
+uint32_t HalMask( uint32_t Priority);
+void HalUnmask( uint32_t Was);
+
+#define EVENT_WAIT() HalWait()
+#define IRQ_MASK( prio) HalMask( prio)
+#define IRQ_UNMASK( was) HalUnmask( was)
+
+#endif // _HOSTPORT_DEFINED
@@ -0,0 +1,16 @@
+#ifndef LIBOPENCM3_CM3_COMMON_H
+#define LIBOPENCM3_CM3_COMMON_H
+//  Host stand-in for libopencm3/cm3/common.h.
+//
+//	These headers declare only what the firmware uses.  Every
+//	register access goes through HalRegister, which brings the
+//	simulated peripherals (host/hal.c) up to date first, so the
+//	same source runs against them unchanged.
+
+#include <stdint.h>
+#include <stdbool.h>
+volatile uint32_t *HalRegister( uint32_t Addr);
+#define MMIO32(addr) (*HalRegister( (uint32_t) (addr)))
+#define BEGIN_DECLS
+#define END_DECLS
+#endif
@@ -0,0 +1,11 @@
+#ifndef LIBOPENCM3_CORTEX_H
+#define LIBOPENCM3_CORTEX_H
+//  Host stand-in for libopencm3/cm3/cortex.h: just what the firmware uses.
+//  Registers are reached through HalRegister (host/hal.c).
+
+#include <libopencm3/cm3/common.h>
+void cm_enable_interrupts( void);
+void cm_disable_interrupts( void);
+uint32_t cm_mask_interrupts( uint32_t mask);
+bool cm_is_masked_interrupts( void);
+#endif
@@ -0,0 +1,13 @@
+#ifndef LIBOPENCM3_CM3_DWT_H
+#define LIBOPENCM3_CM3_DWT_H
+//  Host stand-in for libopencm3/cm3/dwt.h: just what the firmware uses.
+//  Registers are reached through HalRegister (host/hal.c).
+
+#include <libopencm3/cm3/common.h>
+#define DWT_BASE 0xe0001000U
+#define DWT_CTRL MMIO32(DWT_BASE + 0x00)
+#define DWT_CYCCNT MMIO32(DWT_BASE + 0x04)
+#define DWT_CTRL_CYCCNTENA (1 << 0)
+bool dwt_enable_cycle_counter( void);
+uint32_t dwt_read_cycle_counter( void);
+#endif
@@ -0,0 +1,37 @@
+#ifndef LIBOPENCM3_NVIC_H
+#define LIBOPENCM3_NVIC_H
+//  Host stand-in for libopencm3/cm3/nvic.h: just what the firmware uses.
+//  Registers are reached through HalRegister (host/hal.c).
+
+#include <libopencm3/cm3/common.h>
+#define NVIC_EXTI0_IRQ 6
+#define NVIC_DMA1_CHANNEL3_IRQ 13
+#define NVIC_DMA1_CHANNEL4_IRQ 14
+#define NVIC_DMA1_CHANNEL7_IRQ 17
+#define NVIC_EXTI9_5_IRQ 23
+#define NVIC_TIM1_UP_IRQ 25
+#define NVIC_TIM1_CC_IRQ 27
+#define NVIC_TIM2_IRQ 28
+#define NVIC_TIM3_IRQ 29
+#define NVIC_TIM4_IRQ 30
+#define NVIC_USART1_IRQ 37
+#define NVIC_USART3_IRQ 39
+#define NVIC_EXTI15_10_IRQ 40
+#define NVIC_IRQ_COUNT 68
+void nvic_enable_irq( uint8_t irqn);
+void nvic_disable_irq( uint8_t irqn);
+void nvic_set_priority( uint8_t irqn, uint8_t priority);
+void sys_tick_handler( void);
+void dma1_channel3_isr( void);
+void dma1_channel4_isr( void);
+void dma1_channel7_isr( void);
+void exti9_5_isr( void);
+void exti15_10_isr( void);
+void tim1_up_isr( void);
+void tim1_cc_isr( void);
+void tim2_isr( void);
+void tim3_isr( void);
+void tim4_isr( void);
+void usart1_isr( void);
+void usart3_isr( void);
+#endif
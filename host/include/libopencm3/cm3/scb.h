@@ -0,0 +1,14 @@
+#ifndef LIBOPENCM3_SCB_H
+#define LIBOPENCM3_SCB_H
+//  Host stand-in for libopencm3/cm3/scb.h: just what the firmware uses.
+//  Registers are reached through HalRegister (host/hal.c).
+
+#include <libopencm3/cm3/common.h>
+#define SCB_SCR MMIO32(0xe000ed10U)
+#define SCB_SCR_SLEEPDEEP (1 << 2)
+#define SCB_SCR_SLEEPONEXIT (1 << 1)
+#define SCB_AIRCR_PRIGROUP_GROUP16_NOSUB (0x3 << 8)
+#define SCB_AIRCR_PRIGROUP_GROUP8_SUB2 (0x4 << 8)
+#define SCB_AIRCR_PRIGROUP_GROUP4_SUB4 (0x5 << 8)
+void scb_set_priority_grouping( uint32_t prigroup);
+#endif
@@ -0,0 +1,34 @@
+#ifndef LIBOPENCM3_EXTI_H
+#define LIBOPENCM3_EXTI_H
+//  Host stand-in for libopencm3/stm32/exti.h: just what the firmware uses.
+//  Registers are reached through HalRegister (host/hal.c).
+
+#include <libopencm3/cm3/common.h>
+#define EXTI_IMR MMIO32(0x40010400U + 0x00)
+#define EXTI_RTSR MMIO32(0x40010400U + 0x08)
+#define EXTI_FTSR MMIO32(0x40010400U + 0x0c)
+#define EXTI_PR MMIO32(0x40010400U + 0x14)
+#define EXTI0 (1 << 0)
+#define EXTI1 (1 << 1)
+#define EXTI2 (1 << 2)
+#define EXTI3 (1 << 3)
+#define EXTI4 (1 << 4)
+#define EXTI5 (1 << 5)
+#define EXTI6 (1 << 6)
+#define EXTI7 (1 << 7)
+#define EXTI8 (1 << 8)
+#define EXTI9 (1 << 9)
+#define EXTI10 (1 << 10)
+#define EXTI11 (1 << 11)
+#define EXTI12 (1 << 12)
+#define EXTI13 (1 << 13)
+#define EXTI14 (1 << 14)
+#define EXTI15 (1 << 15)
+enum exti_trigger_type { EXTI_TRIGGER_RISING, EXTI_TRIGGER_FALLING, EXTI_TRIGGER_BOTH };
+void exti_set_trigger( uint32_t extis, enum exti_trigger_type trig);
+void exti_enable_request( uint32_t extis);
+void exti_disable_request( uint32_t extis);
+void exti_reset_request( uint32_t extis);
+void exti_select_source( uint32_t exti, uint32_t gpioport);
+uint32_t exti_get_flag_status( uint32_t exti);
+#endif
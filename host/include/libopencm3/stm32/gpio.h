@@ -0,0 +1,58 @@
+#ifndef LIBOPENCM3_GPIO_H
+#define LIBOPENCM3_GPIO_H
+//  Host stand-in for libopencm3/stm32/gpio.h: just what the firmware uses.
+//  Registers are reached through HalRegister (host/hal.c).
+
+#include <libopencm3/cm3/common.h>
+#define GPIOA 0x40010800U
+#define GPIOB 0x40010c00U
+#define GPIOC 0x40011000U
+#define GPIO0 (1 << 0)
+#define GPIO1 (1 << 1)
+#define GPIO2 (1 << 2)
+#define GPIO3 (1 << 3)
+#define GPIO4 (1 << 4)
+#define GPIO5 (1 << 5)
+#define GPIO6 (1 << 6)
+#define GPIO7 (1 << 7)
+#define GPIO8 (1 << 8)
+#define GPIO9 (1 << 9)
+#define GPIO10 (1 << 10)
+#define GPIO11 (1 << 11)
+#define GPIO12 (1 << 12)
+#define GPIO13 (1 << 13)
+#define GPIO14 (1 << 14)
+#define GPIO15 (1 << 15)
+#define GPIO_CRL(port) MMIO32((port) + 0x00)
+#define GPIO_CRH(port) MMIO32((port) + 0x04)
+#define GPIO_IDR(port) MMIO32((port) + 0x08)
+#define GPIO_ODR(port) MMIO32((port) + 0x0c)
+#define GPIO_BSRR(port) MMIO32((port) + 0x10)
+#define GPIO_BRR(port) MMIO32((port) + 0x14)
+#define GPIO_MODE_INPUT 0x00
+#define GPIO_MODE_OUTPUT_10_MHZ 0x01
+#define GPIO_MODE_OUTPUT_2_MHZ 0x02
+#define GPIO_MODE_OUTPUT_50_MHZ 0x03
+#define GPIO_CNF_INPUT_ANALOG 0x00
+#define GPIO_CNF_INPUT_FLOAT 0x01
+#define GPIO_CNF_INPUT_PULL_UPDOWN 0x02
+#define GPIO_CNF_OUTPUT_PUSHPULL 0x00
+#define GPIO_CNF_OUTPUT_OPENDRAIN 0x01
+#define GPIO_CNF_OUTPUT_ALTFN_PUSHPULL 0x02
+#define GPIO_CNF_OUTPUT_ALTFN_OPENDRAIN 0x03
+#define GPIO_BANK_USART1_TX GPIOA
+#define GPIO_USART1_TX GPIO9
+#define GPIO_BANK_USART1_RX GPIOA
+#define GPIO_USART1_RX GPIO10
+#define GPIO_BANK_USART3_RX GPIOB
+#define GPIO_USART3_RX GPIO11
+#define GPIO_BANK_TIM3_CH4 GPIOB
+#define GPIO_TIM3_CH4 GPIO1
+#define GPIO_BANK_TIM4_CH1 GPIOB
+#define GPIO_TIM4_CH1 GPIO6
+void gpio_set_mode( uint32_t gpioport, uint8_t mode, uint8_t cnf, uint16_t gpios);
+void gpio_set( uint32_t gpioport, uint16_t gpios);
+void gpio_clear( uint32_t gpioport, uint16_t gpios);
+uint16_t gpio_get( uint32_t gpioport, uint16_t gpios);
+void gpio_toggle( uint32_t gpioport, uint16_t gpios);
+#endif
@@ -0,0 +1,15 @@
+#ifndef LIBOPENCM3_PWR_H
+#define LIBOPENCM3_PWR_H
+//  Host stand-in for libopencm3/stm32/pwr.h: just what the firmware uses.
+//  Registers are reached through HalRegister (host/hal.c).
+
+#include <libopencm3/cm3/common.h>
+#define PWR_CR MMIO32(0x40007000U)
+#define PWR_CR_LPDS (1 << 0)
+#define PWR_CR_PDDS (1 << 1)
+#define PWR_CR_CWUF (1 << 2)
+void pwr_set_stop_mode( void);
+void pwr_voltage_regulator_low_power_in_stop( void);
+void pwr_voltage_regulator_on_in_stop( void);
+void pwr_clear_wakeup_flag( void);
+#endif
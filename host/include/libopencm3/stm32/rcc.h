@@ -0,0 +1,20 @@
+#ifndef LIBOPENCM3_RCC_H
+#define LIBOPENCM3_RCC_H
+//  Host stand-in for libopencm3/stm32/rcc.h: just what the firmware uses.
+//  Registers are reached through HalRegister (host/hal.c).
+
+#include <libopencm3/cm3/common.h>
+enum rcc_periph_clken { RCC_GPIOA, RCC_GPIOB, RCC_GPIOC, RCC_AFIO, RCC_USART1,
+  RCC_USART3, RCC_TIM1, RCC_TIM2, RCC_TIM3, RCC_TIM4, RCC_DMA1, RCC_PWR };
+enum rcc_periph_rst { RST_TIM1, RST_TIM2, RST_TIM3, RST_TIM4 };
+enum rcc_osc { RCC_PLL, RCC_HSE, RCC_HSI };
+#define RCC_CFGR_SW_SYSCLKSEL_PLLCLK 0x2
+extern uint32_t rcc_ahb_frequency, rcc_apb1_frequency, rcc_apb2_frequency;
+void rcc_clock_setup_in_hse_8mhz_out_72mhz( void);
+void rcc_periph_clock_enable( enum rcc_periph_clken clken);
+void rcc_periph_reset_pulse( enum rcc_periph_rst rst);
+void rcc_osc_on( enum rcc_osc osc);
+void rcc_wait_for_osc_ready( enum rcc_osc osc);
+void rcc_set_sysclk_source( uint32_t clk);
+void rcc_wait_for_sysclk_status( enum rcc_osc osc);
+#endif
@@ -0,0 +1,83 @@
+#ifndef LIBOPENCM3_TIMER_H
+#define LIBOPENCM3_TIMER_H
+//  Host stand-in for libopencm3/stm32/timer.h: just what the firmware uses.
+//  Registers are reached through HalRegister (host/hal.c).
+
+#include <libopencm3/cm3/common.h>
+#define TIM1 0x40012c00U
+#define TIM2 0x40000000U
+#define TIM3 0x40000400U
+#define TIM4 0x40000800U
+#define TIM_CR1(tim) MMIO32((tim) + 0x00)
+#define TIM_CR2(tim) MMIO32((tim) + 0x04)
+#define TIM_SMCR(tim) MMIO32((tim) + 0x08)
+#define TIM_DIER(tim) MMIO32((tim) + 0x0c)
+#define TIM_SR(tim) MMIO32((tim) + 0x10)
+#define TIM_EGR(tim) MMIO32((tim) + 0x14)
+#define TIM_CCER(tim) MMIO32((tim) + 0x20)
+#define TIM_CNT(tim) MMIO32((tim) + 0x24)
+#define TIM_PSC(tim) MMIO32((tim) + 0x28)
+#define TIM_ARR(tim) MMIO32((tim) + 0x2c)
+#define TIM_CCR1(tim) MMIO32((tim) + 0x34)
+#define TIM_CCR2(tim) MMIO32((tim) + 0x38)
+#define TIM_CCR3(tim) MMIO32((tim) + 0x3c)
+#define TIM_CCR4(tim) MMIO32((tim) + 0x40)
+#define TIM_CR1_CKD_CK_INT (0x0 << 8)
+#define TIM_CR1_ARPE (1 << 7)
+#define TIM_CR1_CMS_EDGE (0x0 << 5)
+#define TIM_CR1_CMS_CENTER_1 (0x1 << 5)
+#define TIM_CR1_CMS_CENTER_3 (0x3 << 5)
+#define TIM_CR1_DIR_UP (0 << 4)
+#define TIM_CR1_DIR_DOWN (1 << 4)
+#define TIM_CR1_OPM (1 << 3)
+#define TIM_CR1_URS (1 << 2)
+#define TIM_CR1_CEN (1 << 0)
+#define TIM_DIER_UDE (1 << 8)
+#define TIM_DIER_CC4IE (1 << 4)
+#define TIM_DIER_CC3IE (1 << 3)
+#define TIM_DIER_CC2IE (1 << 2)
+#define TIM_DIER_CC1IE (1 << 1)
+#define TIM_DIER_UIE (1 << 0)
+#define TIM_SR_CC4IF (1 << 4)
+#define TIM_SR_CC3IF (1 << 3)
+#define TIM_SR_CC2IF (1 << 2)
+#define TIM_SR_CC1IF (1 << 1)
+#define TIM_SR_UIF (1 << 0)
+#define TIM_EGR_UG (1 << 0)
+enum tim_oc_id { TIM_OC1 = 0, TIM_OC1N, TIM_OC2, TIM_OC2N, TIM_OC3, TIM_OC3N, TIM_OC4 };
+enum tim_oc_mode { TIM_OCM_FROZEN, TIM_OCM_ACTIVE, TIM_OCM_INACTIVE, TIM_OCM_TOGGLE,
+  TIM_OCM_FORCE_LOW, TIM_OCM_FORCE_HIGH, TIM_OCM_PWM1, TIM_OCM_PWM2 };
+enum tim_ic_id { TIM_IC1, TIM_IC2, TIM_IC3, TIM_IC4 };
+enum tim_ic_input { TIM_IC_OUT = 0, TIM_IC_IN_TI1 = 1, TIM_IC_IN_TI2 = 2, TIM_IC_IN_TRC = 3, TIM_IC_IN_TI3 = 5, TIM_IC_IN_TI4 = 6 };
+enum tim_ic_pol { TIM_IC_RISING, TIM_IC_FALLING };
+void timer_set_mode( uint32_t timer_peripheral, uint32_t clock_div, uint32_t alignment, uint32_t direction);
+void timer_set_prescaler( uint32_t timer_peripheral, uint32_t value);
+void timer_set_period( uint32_t timer_peripheral, uint32_t period);
+void timer_enable_preload( uint32_t timer_peripheral);
+void timer_disable_preload( uint32_t timer_peripheral);
+void timer_continuous_mode( uint32_t timer_peripheral);
+void timer_one_shot_mode( uint32_t timer_peripheral);
+void timer_enable_counter( uint32_t timer_peripheral);
+void timer_disable_counter( uint32_t timer_peripheral);
+void timer_set_counter( uint32_t timer_peripheral, uint32_t count);
+uint32_t timer_get_counter( uint32_t timer_peripheral);
+void timer_enable_irq( uint32_t timer_peripheral, uint32_t irq);
+void timer_disable_irq( uint32_t timer_peripheral, uint32_t irq);
+bool timer_get_flag( uint32_t timer_peripheral, uint32_t flag);
+void timer_clear_flag( uint32_t timer_peripheral, uint32_t flag);
+void timer_generate_event( uint32_t timer_peripheral, uint32_t event);
+void timer_update_on_overflow( uint32_t timer_peripheral);
+void timer_update_on_any( uint32_t timer_peripheral);
+void timer_set_oc_mode( uint32_t timer_peripheral, enum tim_oc_id oc_id, enum tim_oc_mode oc_mode);
+void timer_enable_oc_output( uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_disable_oc_output( uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_set_oc_polarity_high( uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_set_oc_polarity_low( uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_set_oc_value( uint32_t timer_peripheral, enum tim_oc_id oc_id, uint32_t value);
+void timer_enable_oc_preload( uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_disable_oc_preload( uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_ic_set_input( uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_input in);
+void timer_ic_set_polarity( uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_pol pol);
+void timer_ic_enable( uint32_t timer_peripheral, enum tim_ic_id ic);
+void timer_ic_disable( uint32_t timer_peripheral, enum tim_ic_id ic);
+#endif
@@ -0,0 +1,313 @@
+//  ircap - Read and write IR captures.
+//  -----------------------------------
+//
+//	See ircap.h for the two file forms.  Errors are reported on
+//	stderr, with the file name and, for text, the line.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ircap.h"
+
+static int LoadBinary( IRCAP *Cap, FILE *In, const char *Name);
+static int LoadText( IRCAP *Cap, FILE *In, const char *Name);
+static int ParseLine( char *Line, uint64_t *At, int *What, int *Flags);
+
+//*	IRCapInit - Start an empty capture.
+//	-----------------------------------
+
+void IRCapInit( IRCAP *Cap)
+{
+
+  Cap->Bytes = 0;
+  Cap->Count = 0;
+  Cap->Size = 0;
+  return;
+} // IRCapInit
+
+//*	IRCapFree - Let go of a capture's memory.
+//	-----------------------------------------
+
+void IRCapFree( IRCAP *Cap)
+{
+
+  free( Cap->Bytes);
+  IRCapInit( Cap);
+  return;
+} // IRCapFree
+
+//*	IRCapAdd - Add a byte to a capture.
+//	-----------------------------------
+//
+//	Bytes are expected in time order.
+//
+
+void IRCapAdd( IRCAP *Cap, uint64_t At, uint8_t What, int Flags)
+{
+
+  if ( Cap->Count == Cap->Size)
+  {
+    Cap->Size = Cap->Size ? Cap->Size * 2 : 1024;
+    Cap->Bytes = realloc( Cap->Bytes, Cap->Size * sizeof( IRCAP_BYTE));
+    if ( !Cap->Bytes)
+    {
+      fprintf( stderr, "ircap: out of memory\n");
+      exit( 2);
+    }
+  }
+  Cap->Bytes[ Cap->Count].At = At;
+  Cap->Bytes[ Cap->Count].What = What;
+  Cap->Bytes[ Cap->Count].Flags = (uint8_t) Flags;
+  Cap->Count++;
+  return;
+} // IRCapAdd
+
+//*	IRCapLoad - Read a capture file, binary or text.
+//	------------------------------------------------
+//
+//	Name "-" is standard input.  The bytes are added to Cap.  Returns
+//	0 if all went well, -1 (with a message) if not.
+//
+
+int IRCapLoad( IRCAP *Cap, const char *Name)
+{
+
+  FILE
+    *in;
+
+  char
+    magic[ 4];
+
+  int
+    c,
+    i,
+    result;
+
+  if ( !strcmp( Name, "-"))
+    in = stdin;
+  else if ( !(in = fopen( Name, "rb")))
+  {
+    perror( Name);
+    return -1;
+  }
+
+//  Binary if it starts with the magic; otherwise start again from the
+//  top and read it as text.
+
+  for ( i = 0; i < 4 && (c = getc( in)) != EOF; i++)
+    magic[ i] = (char) c;
+  if ( i == 4 && !memcmp( magic, IRCAP_MAGIC, 4))
+    result = LoadBinary( Cap, in, Name);
+  else
+  {
+    if ( in == stdin)
+    { // can't rewind a pipe
+      fprintf( stderr, "%s: text captures must be named\n", Name);
+      return -1;
+    }
+    rewind( in);
+    result = LoadText( Cap, in, Name);
+  }
+  if ( in != stdin)
+    fclose( in);
+  return result;
+} // IRCapLoad
+
+//	LoadBinary - Read the records after the magic.
+//	----------------------------------------------
+
+static int LoadBinary( IRCAP *Cap, FILE *In, const char *Name)
+{
+
+  uint64_t
+    at,
+    gap;
+
+  int
+    c,
+    shift;
+
+  at = 0;
+  for (;;)
+  {
+    gap = 0;
+    shift = 0;
+    do
+    {
+      if ( (c = getc( In)) == EOF)
+      {
+        if ( shift)
+          break;
+        return 0;		// clean end
+      }
+      gap |= (uint64_t) (c & 0x7f) << shift;
+      shift += 7;
+    } while ( (c & 0x80) && shift < 64);
+    if ( c == EOF || (c & 0x80) || (c = getc( In)) == EOF)
+    {
+      fprintf( stderr, "%s: cut off after %d bytes\n", Name, Cap->Count);
+      return -1;
+    }
+    at += gap >> 1;
+    IRCapAdd( Cap, at, (uint8_t) c, (gap & 1) ? IRCAP_FRAMING : 0);
+  } // for each byte
+} // LoadBinary
+
+//	LoadText - Read "microseconds byte [F]" lines.
+//	----------------------------------------------
+
+static int LoadText( IRCAP *Cap, FILE *In, const char *Name)
+{
+
+  char
+    line[ 256];
+
+  uint64_t
+    at,
+    last;
+
+  int
+    lineNo,
+    what,
+    flags,
+    got;
+
+  lineNo = 0;
+  last = 0;
+  while ( fgets( line, sizeof( line), In))
+  {
+    lineNo++;
+    got = ParseLine( line, &at, &what, &flags);
+    if ( got < 0 || (got && at < last))
+    {
+      fprintf( stderr, "%s:%d: expected \"microseconds hex-byte [F]\", "
+        "in time order\n", Name, lineNo);
+      return -1;
+    }
+    if ( got)
+    {
+      IRCapAdd( Cap, at, (uint8_t) what, flags);
+      last = at;
+    }
+  } // while lines
+  return 0;
+} // LoadText
+
+//	ParseLine - Pick apart one line of a text capture.
+//	--------------------------------------------------
+//
+//	Returns 1 with the byte filled in, 0 for a blank or comment line,
+//	-1 if the line makes no sense.
+//
+
+static int ParseLine( char *Line, uint64_t *At, int *What, int *Flags)
+{
+
+  char
+    *p,
+    *end;
+
+  unsigned long
+    what;
+
+  if ( (p = strchr( Line, '#')))
+    *p = 0;
+  p = Line + strspn( Line, " \t\r\n");
+  if ( !*p)
+    return 0;			// blank
+
+  *At = strtoull( p, &end, 10);
+  if ( end == p)
+    return -1;
+  p = end;
+  what = strtoul( p, &end, 16);
+  if ( end == p || what > 255)
+    return -1;
+  *What = (int) what;
+  p = end + strspn( end, " \t");
+  *Flags = 0;
+  if ( *p == 'F' || *p == 'f')
+  {
+    *Flags = IRCAP_FRAMING;
+    p++;
+  }
+  p += strspn( p, " \t\r\n");
+  return *p ? -1 : 1;
+} // ParseLine
+
+//*	IRCapWrite - Write a capture in binary form.
+//	--------------------------------------------
+//
+//	Returns 0, or -1 if the write failed.
+//
+
+int IRCapWrite( IRCAP *Cap, FILE *Out)
+{
+
+  uint64_t
+    last;
+
+  int
+    i;
+
+  fwrite( IRCAP_MAGIC, 1, 4, Out);
+  last = 0;
+  for ( i = 0; i < Cap->Count; i++)
+  {
+    IRCapWriteByte( Out, Cap->Bytes[ i].At - last, Cap->Bytes[ i].What,
+      Cap->Bytes[ i].Flags);
+    last = Cap->Bytes[ i].At;
+  }
+  return ferror( Out) ? -1 : 0;
+} // IRCapWrite
+
+//*	IRCapWriteByte - Write one binary record.
+//	-----------------------------------------
+//
+//	Gap is in microseconds since the last byte.  For writing as the
+//	bytes come in; the magic must have gone out first.
+//
+
+void IRCapWriteByte( FILE *Out, uint64_t Gap, uint8_t What, int Flags)
+{
+
+  Gap = (Gap << 1) | ((Flags & IRCAP_FRAMING) ? 1 : 0);
+  while ( Gap > 0x7f)
+  {
+    putc( (int) (Gap & 0x7f) | 0x80, Out);
+    Gap >>= 7;
+  }
+  putc( (int) Gap, Out);
+  putc( What, Out);
+  return;
+} // IRCapWriteByte
+
+//*	IRCapWriteText - Write a capture in text form.
+//	----------------------------------------------
+//
+//	A blank line goes in wherever the line was quiet for more than
+//	a byte time, so frames stand out.
+//
+
+int IRCapWriteText( IRCAP *Cap, FILE *Out)
+{
+
+  IRCAP_BYTE
+    *b;
+
+  int
+    i;
+
+  for ( i = 0; i < Cap->Count; i++)
+  {
+    b = &Cap->Bytes[ i];
+    if ( i && b->At - b[ -1].At > 2 * IRCAP_BYTE_US)
+      putc( '\n', Out);
+    fprintf( Out, "%llu %02X%s\n", (unsigned long long) b->At, b->What,
+      (b->Flags & IRCAP_FRAMING) ? " F" : "");
+  }
+  return ferror( Out) ? -1 : 0;
+} // IRCapWriteText
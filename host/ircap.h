@@ -0,0 +1,58 @@
+#ifndef _IRCAP_DEFINED
+#define _IRCAP_DEFINED
+
+#include <stdio.h>
+#include <stdint.h>
+
+//	IR captures: what came in on the IR sensor line, byte by byte,
+//	with the time each one's start bit began.  Gaps, bursts, repeats
+//	and garbage are all kept as they were, so a capture played back
+//	(replay.c) gives the firmware exactly what it had at the time.
+//
+//	On disk, a capture is either
+//
+//	  binary: IRCAP_MAGIC, then for each byte a gap and the byte.
+//	    The gap is microseconds since the previous byte's start bit
+//	    (since the start of the recording, for the first), shifted
+//	    up one with IRCAP_FRAMING in bit 0, written 7 bits at a time,
+//	    low-order first, with the top bit set on all but the last.
+//	    Back-to-back bytes at 1200 baud come to 3 bytes each.
+//
+//	  text: one byte per line, "microseconds hex-byte", with an F
+//	    after it for a framing error.  # starts a comment.  Easier
+//	    to write by hand; ircap converts between the two.
+//
+//	IRCapLoad tells which from the first four bytes.
+
+#define IRCAP_MAGIC "IRC1"
+#define IRCAP_BYTE_US 8333	// one byte at 1200 N81
+
+#define IRCAP_FRAMING 1		// bad stop bit
+
+typedef struct
+{
+  uint64_t
+    At;				// us from the start of the recording
+  uint8_t
+    What,
+    Flags;
+} IRCAP_BYTE;
+
+typedef struct
+{
+  IRCAP_BYTE
+    *Bytes;
+  int
+    Count,
+    Size;
+} IRCAP;
+
+void IRCapInit( IRCAP *Cap);
+void IRCapFree( IRCAP *Cap);
+void IRCapAdd( IRCAP *Cap, uint64_t At, uint8_t What, int Flags);
+int IRCapLoad( IRCAP *Cap, const char *Name);
+int IRCapWrite( IRCAP *Cap, FILE *Out);
+void IRCapWriteByte( FILE *Out, uint64_t Gap, uint8_t What, int Flags);
+int IRCapWriteText( IRCAP *Cap, FILE *Out);
+
+#endif // _IRCAP_DEFINED
@@ -0,0 +1,374 @@
+//  ircap - Record, convert and make up IR captures.
+//  ------------------------------------------------
+//
+//	  ircap record [device]	 bytes from a serial port (or standard
+//				 input), as they come, to a binary
+//				 capture on standard output
+//	  ircap dump [file]	 capture to text
+//	  ircap pack [file]	 text (or binary) capture to binary
+//	  ircap gen [-k keys] [-s seed] [-g garbage%]
+//				 a made-up typing session, to binary
+//
+//	To record from the floor, tap the IR receiver's output into a
+//	USB serial adapter, set it up with stty (1200 baud, raw, no
+//	echo) and let ircap record run while someone types.  Each byte
+//	is stamped when read() hands it over, less a byte time; that's
+//	only as close as the operating system's latency, but fine for
+//	gaps between keys.  Interrupt it to stop; the file is written as
+//	it goes.
+//
+//	gen types keys from the keymap at 4-15 keys a second, with
+//	pauses, some keys rolled over into the next, and some held long
+//	enough to repeat; now and then a pointing stick frame.  -g makes
+//	that share of frames bad: a check byte dropped or corrupted, a
+//	stray byte, or a byte with a framing error.
+//
+//	The file forms are in ircap.h.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "keymap.h"
+#include "ircap.h"
+
+#define IR_CHECK( b) ((uint8_t) ((~(b) & 0xf8) | ((b) & 0x07)))
+#define MAX_EVENTS 65536
+
+typedef struct
+{
+  uint64_t
+    At;				// us
+  uint8_t
+    Code;			// first byte of the frame
+  int
+    Seq;			// tie-break, so the sort keeps order
+} GEN_EVENT;
+
+static GEN_EVENT
+  Events[ MAX_EVENTS];
+
+static int
+  EventCount;
+
+static uint32_t
+  Seed;
+
+static int Record( const char *Device);
+static int Convert( const char *Name, int Text);
+static int Generate( int Keys, int Garbage);
+static void AddEvent( uint64_t At, uint8_t Code);
+static int EventOrder( const void *A, const void *B);
+static uint32_t Random( uint32_t Range);
+static void Usage( void);
+
+int main( int argc, char *argv[])
+{
+
+  int
+    i,
+    keys,
+    garbage;
+
+  if ( argc < 2)
+  {
+    Usage();
+    return 2;
+  }
+
+  if ( !strcmp( argv[ 1], "record"))
+    return Record( argc > 2 ? argv[ 2] : 0);
+  if ( !strcmp( argv[ 1], "dump"))
+    return Convert( argc > 2 ? argv[ 2] : "-", 1);
+  if ( !strcmp( argv[ 1], "pack"))
+    return Convert( argc > 2 ? argv[ 2] : "-", 0);
+  if ( strcmp( argv[ 1], "gen"))
+  {
+    Usage();
+    return 2;
+  }
+
+  keys = 200;
+  garbage = 0;
+  Seed = 1;
+  for ( i = 2; i + 1 < argc; i += 2)
+  {
+    if ( !strcmp( argv[ i], "-k"))
+      keys = atoi( argv[ i + 1]);
+    else if ( !strcmp( argv[ i], "-s"))
+      Seed = (uint32_t) strtoul( argv[ i + 1], 0, 0);
+    else if ( !strcmp( argv[ i], "-g"))
+      garbage = atoi( argv[ i + 1]);
+    else
+      break;
+  }
+  if ( i != argc || keys < 1 || garbage < 0 || garbage > 100)
+  {
+    Usage();
+    return 2;
+  }
+  return Generate( keys, garbage);
+} // main
+
+//	Usage - Say how to run us.
+//	--------------------------
+
+static void Usage( void)
+{
+
+  fprintf( stderr,
+    "Usage: ircap record [device]\n"
+    "       ircap dump [file]\n"
+    "       ircap pack [file]\n"
+    "       ircap gen [-k keys] [-s seed] [-g garbage%%]\n");
+  return;
+} // Usage
+
+//	Record - Capture bytes as they arrive.
+//	--------------------------------------
+//
+//	Device 0 means standard input.
+//
+
+static int Record( const char *Device)
+{
+
+  struct timespec
+    now;
+
+  uint64_t
+    start,
+    at,
+    last;
+
+  uint8_t
+    c;
+
+  int
+    fd;
+
+  fd = 0;
+  if ( Device && (fd = open( Device, O_RDONLY | O_NOCTTY)) < 0)
+  {
+    perror( Device);
+    return 1;
+  }
+
+  fwrite( IRCAP_MAGIC, 1, 4, stdout);
+  fflush( stdout);
+  start = 0;
+  last = 0;
+  while ( read( fd, &c, 1) == 1)
+  {
+    clock_gettime( CLOCK_MONOTONIC, &now);
+    at = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    if ( !start)
+      start = at - IRCAP_BYTE_US;
+    at -= start + IRCAP_BYTE_US;	// back to the start bit
+    if ( at < last)
+      at = last;			// read() bunched them up
+    IRCapWriteByte( stdout, at - last, c, 0);
+    fflush( stdout);
+    last = at;
+  } // while bytes
+  return 0;
+} // Record
+
+//	Convert - Write a capture out as text or binary.
+//	------------------------------------------------
+
+static int Convert( const char *Name, int Text)
+{
+
+  IRCAP
+    cap;
+
+  int
+    result;
+
+  IRCapInit( &cap);
+  if ( IRCapLoad( &cap, Name))
+    return 1;
+  result = Text ? IRCapWriteText( &cap, stdout) : IRCapWrite( &cap, stdout);
+  IRCapFree( &cap);
+  if ( result)
+    perror( "ircap");
+  return result ? 1 : 0;
+} // Convert
+
+//	Generate - Make up a typing session.
+//	------------------------------------
+//
+//	The frames are laid out on a timeline first, as the keyboard
+//	would send them if the line were free; then sorted and sent, each
+//	as soon as the line is clear, which is how bursts bunch up.
+//
+
+static int Generate( int Keys, int Garbage)
+{
+
+  static const uint8_t
+    specials[] = { IR_KEY_MOUSE, IR_KEY_REPEAT, IR_KEY_CLEAR };
+
+  uint8_t
+    usable[ 128];
+
+  IRCAP
+    cap;
+
+  GEN_EVENT
+    *e;
+
+  uint64_t
+    at,
+    hold,
+    t,
+    lineFree;
+
+  int
+    usableCount,
+    key,
+    i,
+    j,
+    result;
+
+  usableCount = 0;
+  for ( key = 1; key < 128; key++)
+  {
+    for ( j = 0; j < (int) sizeof( specials); j++)
+      if ( key == specials[ j])
+        break;
+    if ( KeyMap[ key] && j == (int) sizeof( specials))
+      usable[ usableCount++] = (uint8_t) key;
+  }
+
+//  The timeline: a make, then (maybe after other keys) the break.
+
+  EventCount = 0;
+  at = 500000;
+  for ( i = 0; i < Keys && EventCount < MAX_EVENTS - 64; i++)
+  {
+    key = usable[ Random( usableCount)];
+    AddEvent( at, (uint8_t) (key | 128));
+    if ( Random( 100) < 4)
+    { // held down: repeats from half a second, ten a second
+      hold = 600000 + Random( 1000000);
+      for ( t = 500000; t < hold; t += 100000)
+        AddEvent( at + t, IR_KEY_REPEAT);
+      AddEvent( at + hold, (uint8_t) key);
+      at += hold + 100000;
+      continue;
+    }
+    hold = 40000 + Random( 110000);
+    AddEvent( at + hold, (uint8_t) key);
+    if ( Random( 100) < 3)
+      AddEvent( at + 20000 + Random( 200000), IR_KEY_MOUSE);
+    if ( Random( 100) < 5)
+      at += 500000 + Random( 2500000);	// stopped to think
+    else
+      at += 65000 + Random( 185000);	// rolls over if less than hold
+  } // for each key
+  AddEvent( at + 500000, IR_KEY_CLEAR);
+  qsort( Events, EventCount, sizeof( Events[ 0]), EventOrder);
+
+//  Now send them, with whatever damage was asked for.
+
+  IRCapInit( &cap);
+  lineFree = 0;
+  for ( e = Events; e < Events + EventCount; e++)
+  {
+    at = e->At > lineFree ? e->At : lineFree;
+    if ( e->Code == IR_KEY_MOUSE)
+    { // lead-in and two bytes of stick
+      IRCapAdd( &cap, at, IR_KEY_MOUSE, 0);
+      IRCapAdd( &cap, at + IRCAP_BYTE_US, (uint8_t) Random( 256), 0);
+      IRCapAdd( &cap, at + 2 * IRCAP_BYTE_US, (uint8_t) Random( 256), 0);
+      lineFree = at + 3 * IRCAP_BYTE_US;
+      continue;
+    }
+    if ( Garbage && Random( 100) < (uint32_t) Garbage)
+    {
+      switch( Random( 4))
+      {
+        case 0:			// check byte lost
+          IRCapAdd( &cap, at, e->Code, 0);
+          lineFree = at + IRCAP_BYTE_US;
+          continue;
+
+        case 1:			// check byte hit
+          IRCapAdd( &cap, at, e->Code, 0);
+          IRCapAdd( &cap, at + IRCAP_BYTE_US,
+            IR_CHECK( e->Code) ^ (uint8_t) (1 << Random( 8)), 0);
+          lineFree = at + 2 * IRCAP_BYTE_US;
+          continue;
+
+        case 2:			// stray byte first
+          IRCapAdd( &cap, at, (uint8_t) Random( 256), 0);
+          at += IRCAP_BYTE_US;
+          break;
+
+        default:		// a byte with a bad stop bit first
+          IRCapAdd( &cap, at, (uint8_t) Random( 256), IRCAP_FRAMING);
+          at += IRCAP_BYTE_US;
+          break;
+      } // switch
+    }
+    IRCapAdd( &cap, at, e->Code, 0);
+    IRCapAdd( &cap, at + IRCAP_BYTE_US, IR_CHECK( e->Code), 0);
+    lineFree = at + 2 * IRCAP_BYTE_US;
+  } // for each frame
+
+  result = IRCapWrite( &cap, stdout);
+  IRCapFree( &cap);
+  if ( result)
+    perror( "ircap");
+  return result ? 1 : 0;
+} // Generate
+
+//	AddEvent - Put a frame on the timeline.
+//	---------------------------------------
+
+static void AddEvent( uint64_t At, uint8_t Code)
+{
+
+  Events[ EventCount].At = At;
+  Events[ EventCount].Code = Code;
+  Events[ EventCount].Seq = EventCount;
+  EventCount++;
+  return;
+} // AddEvent
+
+//	EventOrder - qsort comparison: by time, then as added.
+//	------------------------------------------------------
+
+static int EventOrder( const void *A, const void *B)
+{
+
+  const GEN_EVENT
+    *a = A,
+    *b = B;
+
+  if ( a->At != b->At)
+    return a->At < b->At ? -1 : 1;
+  return a->Seq - b->Seq;
+} // EventOrder
+
+//	Random - A number from 0 to Range-1.
+//	------------------------------------
+//
+//	Our own generator, so the same seed makes the same file anywhere.
+//
+
+static uint32_t Random( uint32_t Range)
+{
+
+  Seed = Seed * 1103515245 + 12345;
+  return (Seed >> 8) % Range;		// the low bits aren't much good
+} // Random
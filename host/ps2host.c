@@ -0,0 +1,565 @@
+//  PS/2 host model for the simulator.
+//  ----------------------------------
+//
+//	See ps2host.h.  Everything here is driven by the pin watcher on
+//	CLK and DATA, and by actions scheduled with HalSchedule; none of
+//	it runs in the firmware's context.
+//
+//	A falling edge on CLK that we didn't cause is a device clock.
+//	Outside a send of our own, each one is sampled as a bit of a
+//	device-to-host frame: start (0), eight data bits LSB first, odd
+//	parity and stop (1).  During a send, the same edges pace our
+//	data bits out, as the device reads them while CLK is high.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libopencm3/stm32/gpio.h>
+
+#include "gpiodef.h"
+#include "ps2host.h"
+
+#define US( cycles) ((double) (cycles) / HAL_US( 1))
+
+static const PS2H_SPAN
+  SpanLimits[ PS2H_SPANS] =
+  {
+    { "clock period", HAL_US( 60), HAL_US( 100), 0, 0, 0, 0, 0 },
+    { "clock low", HAL_US( 30), HAL_US( 50), 0, 0, 0, 0, 0 },
+    { "clock high", HAL_US( 30), HAL_US( 50), 0, 0, 0, 0, 0 },
+    { "data to clock fall", HAL_US( 5), HAL_US( 25), 0, 0, 0, 0, 0 },
+    { "clock rise to data", HAL_US( 5), 0, 0, 0, 0, 0, 0 },
+    { "idle before frame", HAL_US( 50), 0, 0, 0, 0, 0, 0 },
+    { "inhibit recovery", HAL_US( 50), 0, 0, 0, 0, 0, 0 },
+    { "request to clock", 0, HAL_MS( 15), 0, 0, 0, 0, 0 },
+    { "host frame time", 0, HAL_MS( 2), 0, 0, 0, 0, 0 },
+    { "frame spacing", 0, 0, 0, 0, 0, 0, 0 }
+  };
+
+static void HostPins( void *Arg, uint32_t Port, uint16_t Changed,
+  uint16_t Levels);
+static void DeviceFall( PS2_HOST *Host, uint64_t Now);
+static void ReceiveBit( PS2_HOST *Host, uint64_t Now);
+static void SendEdge( PS2_HOST *Host, uint64_t Now);
+static void FrameAdd( PS2_HOST *Host, uint64_t End, uint8_t What, int Status);
+static void SpanAdd( PS2_HOST *Host, int Id, uint64_t Cycles);
+static void HoldClk( PS2_HOST *Host, int Hold);
+static void DriveData( void *Arg, uint32_t Level);
+static void InhibitStart( void *Arg, uint32_t Value);
+static void InhibitEnd( void *Arg, uint32_t Value);
+static void SendStart( void *Arg, uint32_t Value);
+static void SendRequest( void *Arg, uint32_t Value);
+static void SendTimeout( void *Arg, uint32_t Value);
+
+//*	PS2HostInit - Put a host on the PS/2 lines.
+//	-------------------------------------------
+//
+//	After HalInit; the lines start out released.
+//
+
+void PS2HostInit( PS2_HOST *Host)
+{
+
+  memset( Host, 0, sizeof( *Host));
+  memcpy( Host->Span, SpanLimits, sizeof( SpanLimits));
+  Host->Levels = PS2_BIT_CLK | PS2_BIT_DATA;
+  HalWatchPins( PS2_GPIO, PS2_BIT_CLK | PS2_BIT_DATA, HostPins, Host);
+  return;
+} // PS2HostInit
+
+//*	PS2HostInhibit - Hold the clock low for a while.
+//	------------------------------------------------
+//
+//	Starting at At, for Length cycles.  A frame in progress is cut
+//	off; the device is to send it again once we let go.
+//
+
+void PS2HostInhibit( PS2_HOST *Host, uint64_t At, uint64_t Length)
+{
+
+  HalSchedule( At, InhibitStart, Host, 0);
+  HalSchedule( At + Length, InhibitEnd, Host, 0);
+  return;
+} // PS2HostInhibit
+
+//*	PS2HostSend - Send a byte to the device.
+//	----------------------------------------
+//
+//	Starts at At, or when the last send is over if that's later.
+//	Flags are PS2H_SEND_ flags.
+//
+
+void PS2HostSend( PS2_HOST *Host, uint64_t At, uint8_t What, int Flags)
+{
+
+  HalSchedule( At, SendStart, Host, What | (Flags << 8));
+  return;
+} // PS2HostSend
+
+//*	PS2HostSendDuring - Send a byte over the device's next frame.
+//	-------------------------------------------------------------
+//
+//	The request to send starts Delay cycles after the start bit of
+//	the next frame the device sends--a collision, on purpose.  Called
+//	again before that frame, it takes the frame after, and so on.
+//
+
+void PS2HostSendDuring( PS2_HOST *Host, uint8_t What, uint64_t Delay)
+{
+
+  Host->Armed++;
+  Host->ArmedByte = What;
+  Host->ArmedDelay = Delay;
+  return;
+} // PS2HostSendDuring
+
+//*	PS2HostBytes - Copy out the bytes received whole.
+//	-------------------------------------------------
+//
+//	Returns how many; cut and corrupt frames are left out.
+//
+
+int PS2HostBytes( PS2_HOST *Host, uint8_t *Out, int Max)
+{
+
+  int
+    i,
+    n;
+
+  for ( i = n = 0; i < Host->FrameCount && n < Max; i++)
+    if ( Host->Frames[ i].Status == PS2H_OK)
+      Out[ n++] = Host->Frames[ i].What;
+  return n;
+} // PS2HostBytes
+
+//*	PS2HostReport - Print what was seen.
+//	------------------------------------
+
+void PS2HostReport( PS2_HOST *Host, FILE *Out)
+{
+
+  PS2H_SPAN
+    *s;
+
+  int
+    i;
+
+  fprintf( Out, "  frames: %u good, %u cut by host, %u corrupt; "
+    "%u runt clocks\n", Host->Good, Host->Cut, Host->Corrupt, Host->Runts);
+  if ( Host->Sent || Host->NotAcked)
+    fprintf( Out, "  to device: %u acknowledged, %u not\n",
+      Host->Sent, Host->NotAcked);
+  s = &Host->Span[ PS2H_PERIOD];
+  if ( s->Count)
+    fprintf( Out, "  clock %.2f kHz average\n",
+      1000.0 / US( s->Sum / s->Count));
+  s = &Host->Span[ PS2H_SPACING];
+  if ( s->Count)
+    fprintf( Out, "  back to back: %.0f frames/s, %.1f kbit/s\n",
+      1e6 / US( s->Min), 11e3 / US( s->Min));
+
+  fprintf( Out, "  %-20s %8s %8s %8s %8s %8s %s\n", "timing (us)", "min",
+    "avg", "max", "spec lo", "spec hi", "out of spec");
+  for ( i = 0; i < PS2H_SPANS; i++)
+  {
+    s = &Host->Span[ i];
+    if ( !s->Count)
+      continue;
+    fprintf( Out, "  %-20s %8.1f %8.1f %8.1f ", s->Name, US( s->Min),
+      US( s->Sum / s->Count), US( s->Max));
+    if ( s->Lo)
+      fprintf( Out, "%8.1f ", US( s->Lo));
+    else
+      fprintf( Out, "%8s ", "-");
+    if ( s->Hi)
+      fprintf( Out, "%8.1f ", US( s->Hi));
+    else
+      fprintf( Out, "%8s ", "-");
+    fprintf( Out, "%u of %u\n", s->Violations, s->Count);
+  } // for each timing
+  return;
+} // PS2HostReport
+
+//	HostPins - CLK or DATA has changed.
+//	-----------------------------------
+
+static void HostPins( void *Arg, uint32_t Port, uint16_t Changed,
+  uint16_t Levels)
+{
+
+  PS2_HOST
+    *host;
+
+  uint64_t
+    now,
+    low;
+
+  (void) Port;
+  host = Arg;
+  now = HalNow();
+  host->Levels = Levels;
+
+  if ( Changed & PS2_BIT_DATA)
+  { // a device data change while CLK is high, inside a frame
+    if ( host->SendState == PS2H_IDLE && !host->HoldData &&
+         (Levels & PS2_BIT_CLK) && host->Bits)
+      SpanAdd( host, PS2H_HOLD, now - host->LastRise);
+    host->LastData = now;
+  }
+
+  if ( !(Changed & PS2_BIT_CLK))
+    return;
+  if ( Levels & PS2_BIT_CLK)
+  { // rising edge
+    if ( host->Clocking)
+    {
+      low = now - host->LastFall;
+      if ( low < PS2H_GLITCH)
+      { // not a clock; undo it
+        host->Runts++;
+        host->Violations++;
+        if ( host->LastFallCounted && host->Bits)
+          host->Shift &= ~(1 << --host->Bits);
+      } else
+        SpanAdd( host, PS2H_LOW, low);
+    }
+    host->LastRise = now;
+  } else if ( !host->HoldClk)
+    DeviceFall( host, now);
+  return;
+} // HostPins
+
+//	DeviceFall - The device has clocked.
+//	------------------------------------
+
+static void DeviceFall( PS2_HOST *Host, uint64_t Now)
+{
+
+  if ( Host->Clocking && Now - Host->LastFall <= PS2H_FRAME_GAP)
+  {
+    SpanAdd( Host, PS2H_PERIOD, Now - Host->LastFall);
+    if ( Host->LastRise > Host->LastFall)
+      SpanAdd( Host, PS2H_HIGH, Now - Host->LastRise);
+  } else
+    Host->Clocking = 0;	// a new run of clocks
+  Host->Clocking++;
+  if ( Host->Released)
+  { // first clock since we stopped inhibiting
+    if ( Now - Host->Released < HAL_MS( 10))
+      SpanAdd( Host, PS2H_RECOVERY, Now - Host->Released);
+    Host->Released = 0;
+  }
+
+  Host->LastFallCounted = 0;
+  if ( Host->SendState != PS2H_IDLE)
+    SendEdge( Host, Now);
+  else
+    ReceiveBit( Host, Now);
+  Host->LastFall = Now;
+  return;
+} // DeviceFall
+
+//	ReceiveBit - Take a bit of a frame from the device.
+//	---------------------------------------------------
+
+static void ReceiveBit( PS2_HOST *Host, uint64_t Now)
+{
+
+  int
+    parity,
+    status,
+    i;
+
+  if ( Host->Bits && Now - Host->LastFall > PS2H_FRAME_GAP)
+  { // the clock stopped partway
+    FrameAdd( Host, Host->LastFall, 0, PS2H_RUNOUT);
+    Host->Bits = 0;
+  }
+  if ( !Host->Bits)
+  {
+    SpanAdd( Host, PS2H_FRAME_IDLE, Now - Host->LastRise);
+    Host->FrameStart = Now;
+    Host->Shift = 0;
+    if ( Host->Armed)
+    {
+      Host->Armed--;
+      PS2HostSend( Host, Now + Host->ArmedDelay, Host->ArmedByte, 0);
+    }
+  }
+  if ( (Host->Bits && Host->LastData > Host->LastRise) ||
+       (!Host->Bits && Host->LastData > Host->LastFall))
+    SpanAdd( Host, PS2H_SETUP, Now - Host->LastData);
+
+  Host->Shift |= ((Host->Levels & PS2_BIT_DATA) ? 1 : 0) << Host->Bits;
+  Host->LastFallCounted = 1;
+  if ( ++Host->Bits < 11)
+    return;
+
+  parity = 0;
+  for ( i = 1; i < 10; i++)
+    parity ^= (Host->Shift >> i) & 1;
+  if ( Host->Shift & 1)
+    status = PS2H_BAD_START;
+  else if ( !parity)
+    status = PS2H_BAD_PARITY;
+  else if ( !(Host->Shift & 0x400))
+    status = PS2H_BAD_STOP;
+  else
+    status = PS2H_OK;
+  FrameAdd( Host, Now, (Host->Shift >> 1) & 0xff, status);
+  Host->Bits = 0;
+  Host->Clocking = 0;		// the next frame's timing is its own
+  return;
+} // ReceiveBit
+
+//	SendEdge - Clock our byte out.
+//	------------------------------
+//
+//	Data bits go out on falls 1-8, parity on 9; on 10 we let go of
+//	DATA for the stop bit.  Then the device pulls DATA low and clocks
+//	once more to acknowledge.
+//
+
+static void SendEdge( PS2_HOST *Host, uint64_t Now)
+{
+
+  Host->SendEdges++;
+  switch( Host->SendState)
+  {
+    case PS2H_WAIT_CLOCK:
+      SpanAdd( Host, PS2H_CLOCK_START, Now - Host->SendAsked);
+      Host->SendFirst = Now;
+      Host->SendState = PS2H_BITS;
+      // fall through
+
+    case PS2H_BITS:
+      if ( Host->SendEdges <= 9)
+        HalSchedule( Now + PS2H_DATA_DELAY, DriveData, Host,
+          (Host->SendBits >> (Host->SendEdges - 1)) & 1);
+      else
+      { // stop bit
+        HalSchedule( Now + PS2H_DATA_DELAY, DriveData, Host, 1);
+        Host->SendState = PS2H_WAIT_ACK;
+      }
+      break;
+
+    case PS2H_WAIT_ACK:
+      if ( !(Host->Levels & PS2_BIT_DATA))
+      {
+        SpanAdd( Host, PS2H_RX_TIME, Now - Host->SendFirst);
+        Host->Sent++;
+        Host->SendState = PS2H_IDLE;
+        Host->Clocking = 0;
+      } else if ( Host->SendEdges > 13)
+      { // no ACK
+        Host->NotAcked++;
+        Host->SendState = PS2H_IDLE;
+      }
+      break;
+
+    default:
+      break;
+  } // switch
+  return;
+} // SendEdge
+
+//	FrameAdd - Note a frame from the device.
+//	----------------------------------------
+
+static void FrameAdd( PS2_HOST *Host, uint64_t End, uint8_t What, int Status)
+{
+
+  PS2H_FRAME
+    *f;
+
+  if ( Status == PS2H_OK)
+  {
+    if ( Host->Good && Host->FrameStart - Host->LastStart < HAL_MS( 2))
+      SpanAdd( Host, PS2H_SPACING, Host->FrameStart - Host->LastStart);
+    Host->LastStart = Host->FrameStart;
+    Host->Good++;
+  } else if ( Status == PS2H_CUT)
+    Host->Cut++;
+  else
+    Host->Corrupt++;
+
+  if ( Host->FrameCount >= PS2H_MAX_FRAMES)
+    return;
+  f = &Host->Frames[ Host->FrameCount++];
+  f->Start = Host->FrameStart;
+  f->End = End;
+  f->What = What;
+  f->Status = Status;
+  return;
+} // FrameAdd
+
+//	SpanAdd - Add a timing, checking it against the spec.
+//	-----------------------------------------------------
+
+static void SpanAdd( PS2_HOST *Host, int Id, uint64_t Cycles)
+{
+
+  PS2H_SPAN
+    *s;
+
+  s = &Host->Span[ Id];
+  if ( !s->Count || Cycles < s->Min)
+    s->Min = Cycles;
+  if ( Cycles > s->Max)
+    s->Max = Cycles;
+  s->Sum += Cycles;
+  s->Count++;
+  if ( (s->Lo && Cycles < s->Lo) || (s->Hi && Cycles > s->Hi))
+  {
+    s->Violations++;
+    Host->Violations++;
+  }
+  return;
+} // SpanAdd
+
+//	HoldClk - Pull CLK low, or stop pulling.
+//	----------------------------------------
+//
+//	Holds nest, so an inhibit and a request to send can overlap.
+//	Cutting into a frame ends it.
+//
+
+static void HoldClk( PS2_HOST *Host, int Hold)
+{
+
+  if ( Hold)
+  {
+    if ( !Host->HoldClk++)
+    {
+      if ( Host->Bits)
+      {
+        FrameAdd( Host, HalNow(), 0, PS2H_CUT);
+        Host->Bits = 0;
+      }
+      Host->Clocking = 0;
+      HalGpioDrive( PS2_GPIO, PS2_BIT_CLK, 0);
+    }
+  } else if ( !--Host->HoldClk)
+    HalGpioDrive( PS2_GPIO, PS2_BIT_CLK, 1);
+  return;
+} // HoldClk
+
+//	DriveData - Set our side of DATA.
+//	---------------------------------
+
+static void DriveData( void *Arg, uint32_t Level)
+{
+
+  PS2_HOST
+    *host;
+
+  host = Arg;
+  host->HoldData = !Level;
+  HalGpioDrive( PS2_GPIO, PS2_BIT_DATA, Level);
+  return;
+} // DriveData
+
+//	InhibitStart, InhibitEnd - Hold CLK low, then let it go.
+//	--------------------------------------------------------
+
+static void InhibitStart( void *Arg, uint32_t Value)
+{
+
+  (void) Value;
+  HoldClk( Arg, 1);
+  return;
+} // InhibitStart
+
+static void InhibitEnd( void *Arg, uint32_t Value)
+{
+
+  PS2_HOST
+    *host;
+
+  (void) Value;
+  host = Arg;
+  HoldClk( host, 0);
+  if ( !host->HoldClk)
+    host->Released = HalNow();
+  return;
+} // InhibitEnd
+
+//	SendStart - Begin a request to send.
+//	------------------------------------
+//
+//	Hold CLK low long enough for the device to notice, then pull DATA
+//	low (the start bit) and let CLK go.
+//
+
+static void SendStart( void *Arg, uint32_t Value)
+{
+
+  PS2_HOST
+    *host;
+
+  int
+    parity,
+    i;
+
+  host = Arg;
+  if ( host->SendState != PS2H_IDLE)
+  { // still busy with the last one
+    HalSchedule( HalNow() + HAL_MS( 1), SendStart, host, Value);
+    return;
+  }
+
+  host->SendByte = Value & 0xff;
+  host->SendFlags = Value >> 8;
+  parity = 1;
+  for ( i = 0; i < 8; i++)
+    parity ^= (host->SendByte >> i) & 1;
+  if ( host->SendFlags & PS2H_SEND_BAD_PARITY)
+    parity ^= 1;
+  host->SendBits = host->SendByte | (parity << 8);
+  host->SendEdges = 0;
+  host->SendAsked = HalNow();
+  host->SendState = PS2H_RTS;
+  HoldClk( host, 1);
+  HalSchedule( HalNow() + PS2H_RTS_HOLD, SendRequest, host, 0);
+  return;
+} // SendStart
+
+//	SendRequest - Start bit down, clock released.
+//	---------------------------------------------
+
+static void SendRequest( void *Arg, uint32_t Value)
+{
+
+  PS2_HOST
+    *host;
+
+  (void) Value;
+  host = Arg;
+  DriveData( host, 0);
+  host->SendState = PS2H_WAIT_CLOCK;
+  HoldClk( host, 0);
+  HalSchedule( HalNow() + HAL_MS( 20), SendTimeout, host,
+    (uint32_t) host->SendAsked);
+  return;
+} // SendRequest
+
+//	SendTimeout - Give up on a device that doesn't clock.
+//	-----------------------------------------------------
+
+static void SendTimeout( void *Arg, uint32_t Value)
+{
+
+  PS2_HOST
+    *host;
+
+  host = Arg;
+  if ( host->SendState == PS2H_IDLE || (uint32_t) host->SendAsked != Value)
+    return;			// that one finished
+  if ( host->SendState == PS2H_WAIT_CLOCK)
+    SpanAdd( host, PS2H_CLOCK_START, HalNow() - host->SendAsked);
+  host->NotAcked++;
+  host->SendState = PS2H_IDLE;
+  DriveData( host, 1);
+  return;
+} // SendTimeout
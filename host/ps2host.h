@@ -0,0 +1,155 @@
+#ifndef _PS2HOST_DEFINED
+#define _PS2HOST_DEFINED
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+//	A PS/2 host (the PC end of the cable) for the simulator.
+//
+//	It sits on the simulated CLK and DATA lines, which are open-drain
+//	from both ends: either side can pull a line low, and it's high
+//	only when neither does.  Left alone it just listens, reading each
+//	frame the firmware sends on the falling edges of CLK and timing
+//	every edge against the spec.  It can also be told to inhibit (hold
+//	CLK low for a while) and to send bytes to the device, with a
+//	request-to-send and the rest of the host side of the handshake.
+//
+//	Timing limits are those of the usual PS/2 references, in cycles.
+
+#define PS2H_GLITCH HAL_US( 5)		// CLK low for less: a runt, not a clock
+#define PS2H_FRAME_GAP HAL_US( 200)	// clocks further apart: frame's over
+#define PS2H_RTS_HOLD HAL_US( 110)	// CLK held low for a request to send
+#define PS2H_DATA_DELAY HAL_US( 5)	// after CLK falls, before we change DATA
+
+#define PS2H_MAX_FRAMES 65536	// kept; later ones are only counted
+
+//  What became of a frame from the device.
+
+typedef enum
+{
+  PS2H_OK,
+  PS2H_CUT,			// host inhibited before the stop bit
+  PS2H_RUNOUT,			// clock stopped partway
+  PS2H_BAD_START,
+  PS2H_BAD_PARITY,
+  PS2H_BAD_STOP
+} PS2H_STATUS;
+
+typedef struct
+{
+  uint64_t
+    Start,			// first falling edge
+    End;			// last
+  uint8_t
+    What,
+    Status;			// PS2H_STATUS
+} PS2H_FRAME;
+
+//  Timings collected, and the limits they're checked against.
+
+typedef enum
+{
+  PS2H_PERIOD,			// falling edge to falling edge
+  PS2H_LOW,			// CLK low
+  PS2H_HIGH,			// CLK high, within a frame
+  PS2H_SETUP,			// DATA change to CLK falling
+  PS2H_HOLD,			// CLK rising to DATA change
+  PS2H_FRAME_IDLE,		// CLK high before a frame from the device
+  PS2H_RECOVERY,		// end of inhibit to the device's next clock
+  PS2H_CLOCK_START,		// request to send to the device's first clock
+  PS2H_RX_TIME,			// first clock to acknowledge, host to device
+  PS2H_SPACING,			// frame start to frame start, device to host
+  PS2H_SPANS
+} PS2H_SPAN_ID;
+
+typedef struct
+{
+  const char
+    *Name;
+  uint64_t
+    Lo,				// limits; 0 for none
+    Hi,
+    Min,
+    Max,
+    Sum;
+  uint32_t
+    Count,
+    Violations;
+} PS2H_SPAN;
+
+//  Where a byte to the device has got to.
+
+typedef enum
+{
+  PS2H_IDLE,
+  PS2H_RTS,			// holding CLK low
+  PS2H_WAIT_CLOCK,		// CLK released; waiting for the device
+  PS2H_BITS,			// clocking out data, parity, stop
+  PS2H_WAIT_ACK			// DATA released; waiting for the device's ACK
+} PS2H_SEND_STATE;
+
+#define PS2H_SEND_BAD_PARITY 1	// PS2HostSend: flip the parity bit
+
+typedef struct
+{
+  PS2H_FRAME
+    Frames[ PS2H_MAX_FRAMES];	// from the device, as they came
+  int
+    FrameCount;
+  uint32_t
+    Good,
+    Cut,
+    Corrupt,
+    Runts,			// CLK pulses too short to be clocks
+    Sent,			// bytes we sent that were acknowledged
+    NotAcked,
+    Violations;			// timings out of spec, all told
+  PS2H_SPAN
+    Span[ PS2H_SPANS];
+
+//  The rest is working state.
+
+  int
+    HoldClk,			// nonzero while we pull CLK low
+    HoldData,
+    Bits,			// bits of the frame being received
+    Clocking,			// device falling edges in this run
+    LastFallCounted;		// the last fall took a bit
+  uint16_t
+    Levels,
+    Shift;
+  uint64_t
+    FrameStart,
+    LastStart,			// of the previous good frame
+    LastFall,
+    LastRise,
+    LastData,
+    Released;			// end of our last inhibit; 0 once measured
+
+  PS2H_SEND_STATE
+    SendState;
+  int
+    SendFlags,
+    SendEdges,
+    Armed;			// PS2HostSendDurings waiting for frames
+  uint8_t
+    SendByte,
+    ArmedByte;
+  uint16_t
+    SendBits;			// data and parity, bit 0 first
+  uint64_t
+    SendAsked,
+    SendFirst,
+    ArmedDelay;
+} PS2_HOST;
+
+void PS2HostInit( PS2_HOST *Host);
+void PS2HostInhibit( PS2_HOST *Host, uint64_t At, uint64_t Length);
+void PS2HostSend( PS2_HOST *Host, uint64_t At, uint8_t What, int Flags);
+void PS2HostSendDuring( PS2_HOST *Host, uint8_t What, uint64_t Delay);
+int PS2HostBytes( PS2_HOST *Host, uint8_t *Out, int Max);
+void PS2HostReport( PS2_HOST *Host, FILE *Out);
+
+#endif // _PS2HOST_DEFINED
@@ -0,0 +1,633 @@
+//  ps2sim - PS/2 line conformance and timing runs.
+//  -----------------------------------------------
+//
+//	Runs the firmware in the simulator against the PS/2 host model
+//	(ps2host.c) through a set of scripts, each from power-up:
+//
+//	  boot       nothing but the BAT code
+//	  stream     a run of IR keys, makes and breaks
+//	  inhibit    the same, with the host holding the clock low at
+//	             odd moments, cutting frames off
+//	  commands   host commands and the replies to them, including a
+//	             frame with bad parity and a resend request
+//	  collision  host commands sent over the device's frames while
+//	             keys are going out
+//	  fallback   keys with every frame cut at first, so the clock
+//	             slows right down, then enough clean ones to bring it
+//	             back up to the default
+//	  reset      the same slowdown, then a host reset, which should
+//	             put the default rate back at once
+//
+//	For each, the bytes that got through whole are checked against
+//	what should have, and every clock and data edge against the spec.
+//	Lost means an expected byte never came; extra, one that shouldn't
+//	have; cut frames are fine as long as they come again.
+//
+//	Usage: irkey-ps2sim [-v] [-w] [script ...]
+//
+//	-v lists every frame; -w writes the waveforms of each script to
+//	SCRIPT.vcd (vcd.h) in the current directory.  Exits 0 if all
+//	scripts pass.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <libopencm3/stm32/usart.h>
+
+#include "keydef.h"
+#include "ps2.h"
+#include "hal.h"
+#include "ps2host.h"
+#include "vcd.h"
+
+#define MAX_BYTES 4096
+#define BOOT_TIME HAL_MS( 400)	// BAT is out by then
+#define IR_BYTE_TIME HAL_US( 8334)	// 10 bits at 1200 baud
+#define SETTLE_TIME HAL_MS( 100)	// for IR bytes to be in, even with IR_USE_DMA
+
+#define IR_CHECK( b) ((uint8_t) ((~(b) & 0xf8) | ((b) & 0x07)))
+
+typedef struct
+{
+  const char
+    *Name;
+  int
+    (*Run)( void);
+} SCRIPT;
+
+extern uint16_t
+  KeyMap[ 128];			// the firmware's (main.c)
+
+static PS2_HOST
+  Host;
+
+static VCD_FILE
+  Wave;
+
+static uint8_t
+  Expect[ MAX_BYTES],		// what the device should send
+  Replies[ MAX_BYTES];		// host replies, where they may come in among keys
+
+static int
+  ExpectLen,
+  ReplyLen,
+  Verbose,
+  Waves;
+
+static int ScriptBoot( void);
+static int ScriptStream( void);
+static int ScriptInhibit( void);
+static int ScriptCommands( void);
+static int ScriptCollision( void);
+static int ScriptFallback( void);
+static int ScriptReset( void);
+static uint64_t CutEverything( uint64_t After);
+static int FrameHz( const PS2H_FRAME *Frame);
+static uint64_t QueueKeys( uint64_t At, int Keys);
+static void ExpectBytes( uint8_t *List, int *Len, const uint8_t *What, int N);
+static int Finish( uint64_t Until);
+static int Interleaved( const uint8_t *Got, int GotLen);
+
+static const SCRIPT
+  Scripts[] =
+  {
+    { "boot", ScriptBoot },
+    { "stream", ScriptStream },
+    { "inhibit", ScriptInhibit },
+    { "commands", ScriptCommands },
+    { "collision", ScriptCollision },
+    { "fallback", ScriptFallback },
+    { "reset", ScriptReset },
+    { 0, 0 }
+  };
+
+int main( int argc, char *argv[])
+{
+
+  const SCRIPT
+    *s;
+
+  char
+    name[ 64];
+
+  int
+    i,
+    passed,
+    ran,
+    failed,
+    wanted;
+
+  failed = 0;
+  ran = 0;
+  for ( i = 1; i < argc; i++)
+    if ( !strcmp( argv[ i], "-v"))
+      Verbose = 1;
+    else if ( !strcmp( argv[ i], "-w"))
+      Waves = 1;
+
+  for ( s = Scripts; s->Name; s++)
+  {
+    wanted = 1;
+    for ( i = 1; i < argc; i++)
+    {
+      if ( argv[ i][ 0] == '-')
+        continue;
+      wanted = 0;
+      if ( !strcmp( argv[ i], s->Name))
+      {
+        wanted = 1;
+        break;
+      }
+    }
+    if ( !wanted)
+      continue;
+
+    printf( "== %s\n", s->Name);
+    HalInit();
+    PS2HostInit( &Host);
+    snprintf( name, sizeof( name), "%s.vcd", s->Name);
+    if ( Waves && VcdOpen( &Wave, name))
+      return 2;
+    ExpectLen = 0;
+    ReplyLen = 0;
+    passed = (*s->Run)();
+    VcdClose( &Wave);
+    if ( passed)
+    {
+      printf( "  PASS\n");
+    } else
+    {
+      printf( "  FAIL\n");
+      failed++;
+    }
+    ran++;
+  } // for each script
+
+  if ( !ran)
+  {
+    fprintf( stderr, "Scripts:");
+    for ( s = Scripts; s->Name; s++)
+      fprintf( stderr, " %s", s->Name);
+    fprintf( stderr, "\n");
+    return 2;
+  }
+  printf( "%d of %d scripts passed\n", ran - failed, ran);
+  return failed ? 1 : 0;
+} // main
+
+//	ScriptBoot - Power up and send the BAT code.
+//	--------------------------------------------
+
+static int ScriptBoot( void)
+{
+
+  static const uint8_t
+    bat[] = { KEY_BAT };
+
+  ExpectBytes( Expect, &ExpectLen, bat, sizeof( bat));
+  return Finish( BOOT_TIME + HAL_MS( 100));
+} // ScriptBoot
+
+//	ScriptStream - A run of keys.
+//	-----------------------------
+
+static int ScriptStream( void)
+{
+
+  static const uint8_t
+    bat[] = { KEY_BAT };
+
+  uint64_t
+    end;
+
+  ExpectBytes( Expect, &ExpectLen, bat, sizeof( bat));
+  end = QueueKeys( BOOT_TIME, 40);
+  return Finish( end + HAL_MS( 50));
+} // ScriptStream
+
+//	ScriptInhibit - Keys, with the host cutting in.
+//	-----------------------------------------------
+//
+//	The host holds the clock low for 100-400 us every 0.5-2.5 ms,
+//	from a fixed pseudo-random sequence so runs repeat exactly.
+//
+
+static int ScriptInhibit( void)
+{
+
+  static const uint8_t
+    bat[] = { KEY_BAT };
+
+  uint64_t
+    end,
+    at;
+
+  uint32_t
+    seed;
+
+  ExpectBytes( Expect, &ExpectLen, bat, sizeof( bat));
+  end = QueueKeys( BOOT_TIME, 40);
+  seed = 12345;
+  for ( at = BOOT_TIME; at < end; )
+  {
+    seed = seed * 1103515245 + 12345;
+    at += HAL_US( 500 + (seed >> 16) % 2000);
+    seed = seed * 1103515245 + 12345;
+    PS2HostInhibit( &Host, at, HAL_US( 100 + (seed >> 16) % 300));
+  }
+  return Finish( end + HAL_MS( 50));
+} // ScriptInhibit
+
+//	ScriptCommands - Host commands and their replies.
+//	-------------------------------------------------
+
+static int ScriptCommands( void)
+{
+
+  static const struct
+  {
+    uint8_t
+      What,
+      Flags,
+      Reply[ 4],
+      ReplyLen;
+  } cmds[] =
+  {
+    { HOST_SET_LED, 0, { KEY_ACK }, 1 },
+    { 0x07, 0, { KEY_ACK }, 1 },
+    { HOST_ECHO, 0, { KEY_ECHO }, 1 },
+    { HOST_ID, 0, { KEY_ACK, 0xab, 0x83 }, 3 },
+    { HOST_RESEND, 0, { 0x83 }, 1 },			// the last byte again
+    { HOST_TYPEMATIC, 0, { KEY_ACK }, 1 },
+    { 0x20, 0, { KEY_ACK }, 1 },
+    { HOST_SET_SCAN, 0, { KEY_ACK }, 1 },
+    { 0x03, 0, { KEY_RESEND }, 1 },			// only set 2
+    { HOST_SET_SCAN, 0, { KEY_ACK }, 1 },
+    { 0x02, 0, { KEY_ACK }, 1 },
+    { HOST_SET_SCAN, 0, { KEY_ACK }, 1 },
+    { 0x00, 0, { KEY_ACK, 0x02 }, 2 },			// which set?
+    { 0xfc, 0, { KEY_ACK }, 1 },			// make/break for...
+    { 0x1c, 0, { KEY_ACK }, 1 },			// ...these keys
+    { 0x1b, 0, { KEY_ACK }, 1 },
+    { HOST_ECHO, PS2H_SEND_BAD_PARITY, { KEY_RESEND }, 1 },
+    { HOST_ECHO, 0, { KEY_ECHO }, 1 },
+    { HOST_RESET, 0, { KEY_ACK, KEY_BAT }, 2 }
+  };
+
+  static const uint8_t
+    bat[] = { KEY_BAT };
+
+  uint64_t
+    at;
+
+  int
+    i;
+
+  ExpectBytes( Expect, &ExpectLen, bat, sizeof( bat));
+  at = BOOT_TIME;
+  for ( i = 0; i < (int) (sizeof( cmds) / sizeof( cmds[ 0])); i++)
+  {
+    PS2HostSend( &Host, at, cmds[ i].What, cmds[ i].Flags);
+    ExpectBytes( Expect, &ExpectLen, cmds[ i].Reply, cmds[ i].ReplyLen);
+    at += HAL_MS( 10);
+  }
+  if ( !Finish( at + HAL_MS( 20)))
+    return 0;
+  return Host.Sent == sizeof( cmds) / sizeof( cmds[ 0]);
+} // ScriptCommands
+
+//	ScriptCollision - Commands over the top of keys.
+//	------------------------------------------------
+//
+//	Each command goes out partway through one of the device's frames,
+//	at a different point each time.  The replies may come in among
+//	the keys, but each stream must be whole and in order.
+//
+
+static void CollisionArm( void *Arg, uint32_t Value);
+
+static int ScriptCollision( void)
+{
+
+  static const uint8_t
+    bat[] = { KEY_BAT },
+    echo[] = { KEY_ECHO };
+
+  uint64_t
+    end,
+    at;
+
+  int
+    i;
+
+  ExpectBytes( Expect, &ExpectLen, bat, sizeof( bat));
+  end = QueueKeys( BOOT_TIME, 20);
+  for ( i = 0, at = BOOT_TIME + HAL_MS( 20); at < end - HAL_MS( 20);
+        i++, at += HAL_MS( 37))
+  {
+    HalSchedule( at, CollisionArm, 0, i);
+    ExpectBytes( Replies, &ReplyLen, echo, sizeof( echo));
+  }
+  if ( !Finish( end + HAL_MS( 50)))
+    return 0;
+  return Host.Sent == (uint32_t) i;
+} // ScriptCollision
+
+//	CollisionArm - Send an echo over the next frame.
+//	------------------------------------------------
+//
+//	Value picks how far in: 0 to 700 us, across all eleven bits.
+//
+
+static void CollisionArm( void *Arg, uint32_t Value)
+{
+
+  (void) Arg;
+  PS2HostSendDuring( &Host, HOST_ECHO, HAL_US( (Value * 53) % 700));
+  return;
+} // CollisionArm
+
+//	ScriptFallback - Slow down for a bad host, then speed up again.
+//	---------------------------------------------------------------
+//
+//	Enough keys follow the cut frames for PS2_RECOVER_FRAMES good
+//	ones at each step back up.
+//
+
+static int ScriptFallback( void)
+{
+
+  static const uint8_t
+    bat[] = { KEY_BAT };
+
+  uint64_t
+    end;
+
+  int
+    slowest,
+    last,
+    hz,
+    i;
+
+  ExpectBytes( Expect, &ExpectLen, bat, sizeof( bat));
+  end = CutEverything( QueueKeys( BOOT_TIME, 3));
+  end = QueueKeys( end, 100);
+  end = QueueKeys( end, 100);
+  end = QueueKeys( end, 100);
+  if ( !Finish( end + HAL_MS( 50)))
+    return 0;
+
+  slowest = PS2_RATE_MAX;
+  last = 0;
+  for ( i = 0; i < Host.FrameCount; i++)
+  {
+    if ( Host.Frames[ i].Status != PS2H_OK)
+      continue;
+    hz = FrameHz( &Host.Frames[ i]);
+    if ( hz < slowest)
+      slowest = hz;
+    last = hz;
+  }
+  printf( "  slowest frame %d Hz, last %d Hz\n", slowest, last);
+  return slowest < PS2_RATE_MIN * 21 / 20 &&
+    last > PS2_RATE_DEFAULT * 19 / 20 && last < PS2_RATE_DEFAULT * 21 / 20;
+} // ScriptFallback
+
+//	ScriptReset - Slow down for a bad host, then get reset.
+//	-------------------------------------------------------
+//
+//	Too few keys to speed up again by themselves, so the reply to the
+//	reset should be the first thing at the default rate.  The reset
+//	waits until the keys are all out, so none are flushed.
+//
+
+static int ScriptReset( void)
+{
+
+  static const uint8_t
+    bat[] = { KEY_BAT },
+    resetReply[] = { KEY_ACK, KEY_BAT };
+
+  uint64_t
+    at;
+
+  int
+    before,
+    after;
+
+  ExpectBytes( Expect, &ExpectLen, bat, sizeof( bat));
+  at = CutEverything( QueueKeys( BOOT_TIME, 3));
+  at = QueueKeys( at, 5) + SETTLE_TIME;
+  PS2HostSend( &Host, at, HOST_RESET, 0);
+  ExpectBytes( Expect, &ExpectLen, resetReply, sizeof( resetReply));
+  if ( !Finish( at + HAL_MS( 30)) || Host.FrameCount < 3)
+    return 0;
+
+  before = FrameHz( &Host.Frames[ Host.FrameCount - 3]);
+  after = FrameHz( &Host.Frames[ Host.FrameCount - 1]);
+  printf( "  last key %d Hz, BAT %d Hz\n", before, after);
+  return before < PS2_RATE_MIN * 21 / 20 &&
+    after > PS2_RATE_DEFAULT * 19 / 20 && after < PS2_RATE_DEFAULT * 21 / 20;
+} // ScriptReset
+
+//	CutEverything - Have the host cut off every frame for a while.
+//	--------------------------------------------------------------
+//
+//	From BOOT_TIME until the IR bytes due by After are all in.
+//	Inhibits 150 us long every 500 us: too close together for even a
+//	frame at the slowest rate to get out between them.  Returns when
+//	they end.
+//
+
+static uint64_t CutEverything( uint64_t After)
+{
+
+  uint64_t
+    at;
+
+  for ( at = BOOT_TIME; at < After + SETTLE_TIME; at += HAL_US( 500))
+    PS2HostInhibit( &Host, at, HAL_US( 150));
+  return at;
+} // CutEverything
+
+//	FrameHz - Return the clock rate a frame went at.
+//	------------------------------------------------
+//
+//	From its first falling edge to its last, ten clock periods.
+//
+
+static int FrameHz( const PS2H_FRAME *Frame)
+{
+
+  if ( Frame->End <= Frame->Start)
+    return 0;
+  return (int) ((uint64_t) 10 * HAL_CPU_HZ / (Frame->End - Frame->Start));
+} // FrameHz
+
+//	QueueKeys - Have the IR sensor send keys.
+//	-----------------------------------------
+//
+//	Makes and breaks of Keys different keys, back to back from At,
+//	each as a key code and its check byte.  The PS/2 codes due are
+//	added to Expect.  Returns when the last byte will be in.
+//
+
+static uint64_t QueueKeys( uint64_t At, int Keys)
+{
+
+  uint8_t
+    code[ 3];
+
+  uint16_t
+    rkey;
+
+  int
+    key,
+    make,
+    n;
+
+  for ( key = 1; Keys && key < 128; key++)
+  {
+    rkey = KeyMap[ key];
+    if ( !rkey || key == IR_KEY_MOUSE || key == IR_KEY_REPEAT ||
+         key == IR_KEY_CLEAR || key == IR_KEY_PRTSCRN ||
+         key == IR_KEY_PAUSE)
+      continue;
+    for ( make = 1; make >= 0; make--)
+    {
+      HalUartReceive( USART3, At, make ? key | 128 : key, 0);
+      HalUartReceive( USART3, At, IR_CHECK( make ? key | 128 : key), 0);
+      At += 2 * IR_BYTE_TIME;
+      n = 0;
+      if ( rkey & 0xff00)
+        code[ n++] = rkey >> 8;
+      if ( !make)
+        code[ n++] = 0xf0;
+      code[ n++] = rkey & 0xff;
+      ExpectBytes( Expect, &ExpectLen, code, n);
+    }
+    Keys--;
+  } // for each key
+  return At;
+} // QueueKeys
+
+//	ExpectBytes - Add to a list of bytes due.
+//	-----------------------------------------
+
+static void ExpectBytes( uint8_t *List, int *Len, const uint8_t *What, int N)
+{
+
+  while ( N-- && *Len < MAX_BYTES)
+    List[ (*Len)++] = *What++;
+  return;
+} // ExpectBytes
+
+//	Finish - Run the script; check and report.
+//	------------------------------------------
+//
+//	Returns nonzero if it passed.
+//
+
+static int Finish( uint64_t Until)
+{
+
+  static const char
+    *status[] = { "ok", "cut", "runout", "bad start", "bad parity",
+      "bad stop" };
+
+  uint8_t
+    got[ MAX_BYTES];
+
+  HAL_RESULT
+    result;
+
+  PS2H_FRAME
+    *f;
+
+  int
+    gotLen,
+    good,
+    lost,
+    extra,
+    i;
+
+  result = HalRun( FirmwareMain, Until);
+  if ( Verbose)
+  {
+    for ( i = 0; i < Host.FrameCount; i++)
+    {
+      f = &Host.Frames[ i];
+      printf( "  %10.1f us  %02X %s\n", f->Start / (double) HAL_US( 1),
+        f->What, status[ f->Status]);
+    }
+  }
+
+  gotLen = PS2HostBytes( &Host, got, MAX_BYTES);
+  lost = 0;
+  extra = 0;
+  if ( ReplyLen)
+  { // replies mixed in
+    good = Interleaved( got, gotLen);
+    if ( !good)
+      lost = ExpectLen + ReplyLen - gotLen;
+  } else
+  {
+    for ( i = 0; i < gotLen && i < ExpectLen && got[ i] == Expect[ i]; i++)
+      ;
+    good = i == gotLen && i == ExpectLen;
+    if ( !good)
+    {
+      lost = ExpectLen - i;
+      extra = gotLen - i;
+      printf( "  bytes differ from #%d:", i);
+      for ( ; i < gotLen && i < ExpectLen + 4; i++)
+        printf( " %02X", got[ i]);
+      printf( "\n");
+    }
+  }
+
+  PS2HostReport( &Host, stdout);
+  printf( "  %d bytes expected, %d received; %d lost, %d extra\n",
+    ExpectLen + ReplyLen, gotLen, lost > 0 ? lost : 0, extra > 0 ? extra : 0);
+  if ( result != HAL_DONE)
+    printf( "  firmware %s\n", result == HAL_STUCK ? "stuck" : "stopped");
+  return result == HAL_DONE && good && !Host.Corrupt && !Host.Violations &&
+    !Host.NotAcked;
+} // Finish
+
+//	Interleaved - See if Got is Expect and Replies, merged.
+//	-------------------------------------------------------
+//
+//	Each in its own order.  A table of which prefixes of the two can
+//	make each prefix of Got; small enough here.
+//
+
+static int Interleaved( const uint8_t *Got, int GotLen)
+{
+
+  static uint8_t
+    can[ MAX_BYTES + 1][ 64];
+
+  int
+    i,
+    j;
+
+  if ( GotLen != ExpectLen + ReplyLen || ReplyLen >= 64)
+    return 0;
+  for ( i = 0; i <= ExpectLen; i++)
+  {
+    for ( j = 0; j <= ReplyLen; j++)
+    {
+      if ( !i && !j)
+        can[ i][ j] = 1;
+      else
+        can[ i][ j] =
+          (i && can[ i - 1][ j] && Got[ i + j - 1] == Expect[ i - 1]) ||
+          (j && can[ i][ j - 1] && Got[ i + j - 1] == Replies[ j - 1]);
+    }
+  }
+  return can[ ExpectLen][ ReplyLen];
+} // Interleaved
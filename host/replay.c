@@ -0,0 +1,721 @@
+//  replay - Play IR captures through the firmware and time the keys.
+//  -----------------------------------------------------------------
+//
+//	Each capture (ircap.h) is fed to the simulated USART3 from power-
+//	up, byte for byte at the times recorded, and everything goes
+//	through the firmware as on the bench: usart3_isr, ProcessKeys and
+//	the PS/2 bit engine, out to the host model (ps2host.c).
+//
+//	Alongside, the same bytes are run through a decoder of our own
+//	(irdecode.c, which has no hardware in it) and the keymap, to say
+//	which keys should come out and when each was complete on the IR
+//	line.  The PS/2 frames received are matched up against those in
+//	order; a key whose codes never come is dropped.  For each key
+//	that does come, the latency is from the USART having its check
+//	byte (halfway through the stop bit) to the host seeing the start
+//	bit of its first code, and to the stop bit of its last.
+//
+//	Usage: irkey-replay [-s] [-i ms] [-e | -o] [-v] [-w] capture ...
+//
+//	-s  saturate: all the bytes back to back, as fast as the IR line
+//	    goes, for the most keys a second the pipeline can carry
+//	-i  a busy host: hold the PS/2 clock low for this long in every
+//	    100 ms
+//	-e  check the PS/2 bytes against the expected-output file beside
+//	    each capture (the capture's name, with .ps2 for its type)
+//	-o  write that file, from what came out
+//	-v  list the keys and their latencies
+//	-w  write the waveforms (vcd.h) to the capture's name, with .vcd
+//	    for its type, in the current directory
+//
+//	A capture passes if no key is dropped, nothing comes out that
+//	shouldn't, no frame is corrupt, the firmware keeps going, and
+//	with -e, the output is as expected.  Exits 0 if all pass.
+//
+//	The expected files are from the default build.  Built with
+//	IR_USE_DMA, bytes with framing errors are kept rather than thrown
+//	away, so a capture with some in it decodes differently and won't
+//	match; the other checks still hold.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <libopencm3/stm32/usart.h>
+
+#include "keydef.h"
+#include "irdecode.h"
+#include "ir.h"
+#include "ps2.h"
+#include "hal.h"
+#include "ps2host.h"
+#include "vcd.h"
+#include "ircap.h"
+
+#define BOOT_TIME HAL_MS( 400)		// BAT is out by then
+#define IR_BYTE_TIME (HAL_CPU_HZ / 120)	// 10 bits at 1200 baud
+#define IR_RXNE_TIME (IR_BYTE_TIME * 19 / 20)	// start bit to RXNE
+#define HOST_BUSY_PERIOD HAL_MS( 100)
+#define MAX_SEQ 8
+
+//  A key event that should make it out, and what became of it.
+
+typedef struct
+{
+  uint64_t
+    Done,			// check byte in the USART
+    First,			// first code's start bit, if out
+    Last;			// last code's stop bit
+  uint8_t
+    Seq[ MAX_SEQ],
+    SeqLen,
+    Type,			// IR_EVENT_TYPE
+    Key,
+    Out;
+} REPLAY_KEY;
+
+extern uint16_t
+  KeyMap[ 128];			// the firmware's (main.c)
+
+static PS2_HOST
+  Host;
+
+static VCD_FILE
+  Wave;
+
+static REPLAY_KEY
+  *Keys;
+
+static uint8_t
+  Down[ 128];			// keys made and not yet broken, as main.c
+
+static int
+  KeyCount,
+  KeySize,
+  Saturate,
+  Verbose,
+  Waves;
+
+static uint64_t
+  BusyTime;
+
+static int Replay( const char *Name, int Check, int Write);
+static uint64_t Schedule( IRCAP *Cap, IR_DECODER *Dec);
+static void AddKey( IR_EVENT *Event, uint64_t Done);
+static int AddCodes( int Type, uint8_t Key, uint64_t Done);
+static int MatchKeys( int *Extra);
+static void Report( void);
+static uint64_t Percentile( uint64_t *Sorted, int Count, int Pct);
+static int CycleOrder( const void *A, const void *B);
+static int CompareExpected( const char *Name, const uint8_t *Got, int GotLen);
+static int WriteExpected( const char *Name, const uint8_t *Got, int GotLen);
+static void ExpectedName( char *Out, int Max, const char *Name);
+static void WaveName( char *Out, int Max, const char *Name);
+
+int main( int argc, char *argv[])
+{
+
+  int
+    i,
+    check,
+    write,
+    ran,
+    failed;
+
+  check = 0;
+  write = 0;
+  ran = 0;
+  failed = 0;
+  for ( i = 1; i < argc; i++)
+  {
+    if ( !strcmp( argv[ i], "-s"))
+      Saturate = 1;
+    else if ( !strcmp( argv[ i], "-i") && i + 1 < argc)
+      BusyTime = HAL_MS( atoi( argv[ ++i]));
+    else if ( !strcmp( argv[ i], "-e"))
+      check = 1;
+    else if ( !strcmp( argv[ i], "-o"))
+      write = 1;
+    else if ( !strcmp( argv[ i], "-v"))
+      Verbose = 1;
+    else if ( !strcmp( argv[ i], "-w"))
+      Waves = 1;
+    else if ( argv[ i][ 0] == '-')
+      break;
+    else
+    {
+      if ( !Replay( argv[ i], check, write))
+        failed++;
+      ran++;
+    }
+  } // for each argument
+
+  if ( i < argc || !ran || BusyTime >= HOST_BUSY_PERIOD ||
+       (check && write))
+  {
+    fprintf( stderr, "Usage: irkey-replay [-s] [-i ms] [-e | -o] [-v] [-w] "
+      "capture ...\n");
+    return 2;
+  }
+  if ( ran > 1)
+    printf( "%d of %d captures passed\n", ran - failed, ran);
+  return failed ? 1 : 0;
+} // main
+
+//	Replay - Run one capture through; check and report.
+//	---------------------------------------------------
+//
+//	Returns nonzero if it passed.
+//
+
+static int Replay( const char *Name, int Check, int Write)
+{
+
+  static uint8_t
+    got[ PS2H_MAX_FRAMES];
+
+  IRCAP
+    cap;
+
+  IR_DECODER
+    dec;
+
+  HAL_RESULT
+    result;
+
+  char
+    waveName[ 512];
+
+  uint64_t
+    end,
+    t;
+
+  int
+    framing,
+    dropped,
+    extra,
+    gotLen,
+    good,
+    i;
+
+  printf( "== %s\n", Name);
+  IRCapInit( &cap);
+  if ( IRCapLoad( &cap, Name))
+    return 0;
+
+  HalInit();
+  PS2HostInit( &Host);
+  KeyCount = 0;
+  memset( Down, 0, sizeof( Down));
+  IRDecodeInit( &dec, HAL_CPU_HZ / 1000);
+  end = Schedule( &cap, &dec);
+  for ( t = BOOT_TIME; BusyTime && t < end; t += HOST_BUSY_PERIOD)
+    PS2HostInhibit( &Host, t, BusyTime);
+  if ( Waves)
+  {
+    WaveName( waveName, sizeof( waveName), Name);
+    if ( VcdOpen( &Wave, waveName))
+      return 0;
+  }
+  result = HalRun( FirmwareMain, end + HAL_MS( 200) + 2 * BusyTime);
+  VcdClose( &Wave);
+
+  framing = 0;
+  for ( i = 0; i < cap.Count; i++)
+    if ( cap.Bytes[ i].Flags & IRCAP_FRAMING)
+      framing++;
+  printf( "  %d IR bytes over %.2f s%s; %u frames decoded, %u resyncs, "
+    "%u timed out, %u stale repeats, %d framing errors\n", cap.Count,
+    cap.Count ? (cap.Bytes[ cap.Count - 1].At - cap.Bytes[ 0].At) / 1e6 : 0,
+    Saturate ? " as recorded (sent back to back)" : "", dec.Frames,
+    dec.Resyncs, dec.Timeouts, dec.StaleRepeats, framing);
+
+  dropped = MatchKeys( &extra);
+  printf( "  keys: %d due, %d out, %d dropped; %d bytes extra\n",
+    KeyCount, KeyCount - dropped, dropped, extra);
+  if ( Host.FrameCount == PS2H_MAX_FRAMES)
+    printf( "  (only the first %d frames were kept)\n", PS2H_MAX_FRAMES);
+  Report();
+
+  gotLen = PS2HostBytes( &Host, got, PS2H_MAX_FRAMES);
+  good = result == HAL_DONE && !dropped && !extra && !Host.Corrupt;
+  if ( result != HAL_DONE)
+    printf( "  firmware %s\n", result == HAL_STUCK ? "stuck" : "stopped");
+  if ( Check && !CompareExpected( Name, got, gotLen))
+    good = 0;
+  if ( Write && !WriteExpected( Name, got, gotLen))
+    good = 0;
+  printf( "  %s\n", good ? "PASS" : "FAIL");
+  IRCapFree( &cap);
+  return good;
+} // Replay
+
+//	Schedule - Queue the capture's bytes and work out the keys due.
+//	---------------------------------------------------------------
+//
+//	Each byte starts when recorded or as soon as the line is free.
+//	Our decoder is fed the way ProcessIR feeds the firmware's: good
+//	bytes only (unless the DMA takes them all), stamped when RXNE
+//	comes up, and a half-taken frame dropped whenever the line
+//	goes idle for a byte time.  Returns when the last byte is in.
+//
+
+static uint64_t Schedule( IRCAP *Cap, IR_DECODER *Dec)
+{
+
+  IRCAP_BYTE
+    *b;
+
+  IR_EVENT
+    event;
+
+  uint64_t
+    at,
+    lineFree,
+    done;
+
+  int
+    i;
+
+  lineFree = BOOT_TIME;
+  for ( i = 0; i < Cap->Count; i++)
+  {
+    b = &Cap->Bytes[ i];
+    at = Saturate ? BOOT_TIME :
+      BOOT_TIME + HAL_US( b->At - Cap->Bytes[ 0].At);
+    HalUartReceive( USART3, at, b->What,
+      (b->Flags & IRCAP_FRAMING) ? HAL_RX_FRAMING : 0);
+
+    if ( at < lineFree)
+      at = lineFree;
+    else if ( i && at - lineFree >= IR_BYTE_TIME && IRDecodePending( Dec))
+      IRDecodeReset( Dec);		// idle line ended the frame
+    lineFree = at + IR_BYTE_TIME;
+    done = at + IR_RXNE_TIME;
+#ifndef IR_USE_DMA
+    if ( b->Flags & IRCAP_FRAMING)
+      continue;				// usart3_isr throws these away
+#endif
+    if ( IRDecodeByte( Dec, b->What, (uint32_t) done, &event))
+      AddKey( &event, done);
+  } // for each byte
+  return lineFree;
+} // Schedule
+
+//	AddKey - Add the codes for a key event, as SendKeyEvent would.
+//	--------------------------------------------------------------
+//
+//	A break goes out only for a key that's down; a clear breaks all
+//	of them, lowest code first.
+//
+
+static void AddKey( IR_EVENT *Event, uint64_t Done)
+{
+
+  int
+    key;
+
+  if ( Event->Type == IR_EVENT_CLEAR)
+  {
+    for ( key = 0; key < 128; key++)
+      if ( Down[ key])
+      {
+        AddCodes( IR_EVENT_BREAK, (uint8_t) key, Done);
+        Down[ key] = 0;
+      }
+    return;
+  }
+  if ( Event->Type != IR_EVENT_MAKE && Event->Type != IR_EVENT_REPEAT &&
+       Event->Type != IR_EVENT_BREAK)
+    return;
+
+  key = Event->Key & 127;
+  if ( Event->Type == IR_EVENT_BREAK && !Down[ key])
+    return;
+  if ( AddCodes( Event->Type, (uint8_t) key, Done) && key != IR_KEY_PAUSE)
+    Down[ key] = Event->Type != IR_EVENT_BREAK;
+  return;
+} // AddKey
+
+//	AddCodes - Add the codes for one key going down or up.
+//	------------------------------------------------------
+//
+//	Returns nonzero if the key has any.
+//
+
+static int AddCodes( int Type, uint8_t Key, uint64_t Done)
+{
+
+  static const uint8_t
+    pauseSeq[] = { 0xe1, 0x14, 0x77, 0xe1, 0xf0, 0x14, 0xf0, 0x77 },
+    pscrnMakeSeq[] = { 0xe0, 0x12, 0xe0, 0x7c },
+    pscrnBreakSeq[] = { 0xe0, 0xf0, 0x7c, 0xe0, 0xf0, 0x12 };
+
+  REPLAY_KEY
+    *k;
+
+  const uint8_t
+    *seq;
+
+  uint16_t
+    rkey;
+
+  uint8_t
+    code[ 3];
+
+  int
+    len;
+
+  if ( Key == IR_KEY_PAUSE)
+  {
+    if ( Type != IR_EVENT_MAKE)
+      return 0;
+    seq = pauseSeq;
+    len = sizeof( pauseSeq);
+  } else if ( Key == IR_KEY_PRTSCRN)
+  {
+    seq = Type == IR_EVENT_BREAK ? pscrnBreakSeq : pscrnMakeSeq;
+    len = Type == IR_EVENT_BREAK ? sizeof( pscrnBreakSeq) :
+      sizeof( pscrnMakeSeq);
+  } else
+  {
+    if ( !(rkey = KeyMap[ Key]))
+      return 0;
+    len = 0;
+    if ( rkey & 0xff00)
+      code[ len++] = rkey >> 8;
+    if ( Type == IR_EVENT_BREAK)
+      code[ len++] = 0xf0;
+    code[ len++] = rkey & 0xff;
+    seq = code;
+  }
+
+  if ( KeyCount == KeySize)
+  {
+    KeySize = KeySize ? KeySize * 2 : 1024;
+    Keys = realloc( Keys, KeySize * sizeof( REPLAY_KEY));
+    if ( !Keys)
+    {
+      fprintf( stderr, "replay: out of memory\n");
+      exit( 2);
+    }
+  }
+  k = &Keys[ KeyCount++];
+  memset( k, 0, sizeof( *k));
+  k->Done = Done;
+  memcpy( k->Seq, seq, len);
+  k->SeqLen = (uint8_t) len;
+  k->Type = (uint8_t) Type;
+  k->Key = Key;
+  return 1;
+} // AddCodes
+
+//	MatchKeys - Find each key's codes among the frames received.
+//	------------------------------------------------------------
+//
+//	In order, past the BAT code.  A sequence is queued whole or not
+//	at all, so a key either comes out complete where it should or
+//	not at all.  Returns the number dropped; *Extra is set to the
+//	bytes that weren't any key's.
+//
+
+static int MatchKeys( int *Extra)
+{
+
+  static int
+    good[ PS2H_MAX_FRAMES];	// Host.Frames index of each good byte
+
+  REPLAY_KEY
+    *k;
+
+  int
+    goodCount,
+    pos,
+    dropped,
+    i,
+    j;
+
+  goodCount = 0;
+  for ( i = 0; i < Host.FrameCount; i++)
+    if ( Host.Frames[ i].Status == PS2H_OK)
+      good[ goodCount++] = i;
+
+  pos = 0;
+  if ( goodCount && Host.Frames[ good[ 0]].What == KEY_BAT)
+    pos = 1;
+  dropped = 0;
+  for ( k = Keys; k < Keys + KeyCount; k++)
+  {
+    for ( j = 0; j < k->SeqLen && pos + j < goodCount &&
+          Host.Frames[ good[ pos + j]].What == k->Seq[ j]; j++)
+      ;
+    if ( j < k->SeqLen)
+    {
+      dropped++;
+      continue;
+    }
+    k->Out = 1;
+    k->First = Host.Frames[ good[ pos]].Start;
+    k->Last = Host.Frames[ good[ pos + j - 1]].End;
+    pos += j;
+  } // for each key
+  *Extra = goodCount - pos;
+  return dropped;
+} // MatchKeys
+
+//	Report - Throughput and latency.
+//	--------------------------------
+//
+//	The peak is the most keys whose first code went out within any
+//	one second.
+//
+
+static void Report( void)
+{
+
+  static const char
+    *types[] = { "", "make", "break", "repeat" };
+
+  REPLAY_KEY
+    *k;
+
+  uint64_t
+    *first,
+    *last,
+    *out;
+
+  int
+    n,
+    i,
+    j,
+    peak;
+
+  first = malloc( (KeyCount + 1) * sizeof( uint64_t));
+  last = malloc( (KeyCount + 1) * sizeof( uint64_t));
+  out = malloc( (KeyCount + 1) * sizeof( uint64_t));
+  if ( !first || !last || !out)
+  {
+    fprintf( stderr, "replay: out of memory\n");
+    exit( 2);
+  }
+
+  n = 0;
+  for ( k = Keys; k < Keys + KeyCount; k++)
+  {
+    if ( Verbose)
+    {
+      printf( "  %10.3f ms  %02X %-6s", k->Done / (double) HAL_MS( 1),
+        k->Key, types[ k->Type < 4 ? k->Type : 0]);
+      if ( k->Out)
+        printf( "  %7.3f %7.3f\n", (k->First - k->Done) / (double) HAL_MS( 1),
+          (k->Last - k->Done) / (double) HAL_MS( 1));
+      else
+        printf( "  dropped\n");
+    }
+    if ( !k->Out)
+      continue;
+    first[ n] = k->First - k->Done;
+    last[ n] = k->Last - k->Done;
+    out[ n] = k->First;
+    n++;
+  } // for each key
+
+  if ( n)
+  {
+    peak = 0;
+    for ( i = j = 0; i < n; i++)
+    { // out[] is in order already
+      while ( out[ i] - out[ j] >= HAL_MS( 1000))
+        j++;
+      if ( i - j + 1 > peak)
+        peak = i - j + 1;
+    }
+    printf( "  throughput: %.1f keys/s over the run, %d in the busiest "
+      "second\n", n / ((out[ n - 1] - Keys[ 0].Done) / (double) HAL_MS( 1000)
+        + 1e-9), peak);
+
+    qsort( first, n, sizeof( uint64_t), CycleOrder);
+    qsort( last, n, sizeof( uint64_t), CycleOrder);
+    printf( "  latency (ms)          p50      p90      p99      max\n");
+    printf( "  to first clock   %8.3f %8.3f %8.3f %8.3f\n",
+      Percentile( first, n, 50) / (double) HAL_MS( 1),
+      Percentile( first, n, 90) / (double) HAL_MS( 1),
+      Percentile( first, n, 99) / (double) HAL_MS( 1),
+      first[ n - 1] / (double) HAL_MS( 1));
+    printf( "  to last byte     %8.3f %8.3f %8.3f %8.3f\n",
+      Percentile( last, n, 50) / (double) HAL_MS( 1),
+      Percentile( last, n, 90) / (double) HAL_MS( 1),
+      Percentile( last, n, 99) / (double) HAL_MS( 1),
+      last[ n - 1] / (double) HAL_MS( 1));
+  }
+  printf( "  PS/2: %u frames good, %u cut by host, %u corrupt\n",
+    Host.Good, Host.Cut, Host.Corrupt);
+  free( first);
+  free( last);
+  free( out);
+  return;
+} // Report
+
+//	Percentile - Pick one out of a sorted list.
+//	-------------------------------------------
+
+static uint64_t Percentile( uint64_t *Sorted, int Count, int Pct)
+{
+  return Sorted[ (int) ((Count - 1) * (int64_t) Pct / 100)];
+} // Percentile
+
+//	CycleOrder - qsort comparison for cycle counts.
+//	-----------------------------------------------
+
+static int CycleOrder( const void *A, const void *B)
+{
+
+  uint64_t
+    a = *(const uint64_t *) A,
+    b = *(const uint64_t *) B;
+
+  return a < b ? -1 : a > b;
+} // CycleOrder
+
+//	ExpectedName - Name of the expected-output file for a capture.
+//	--------------------------------------------------------------
+
+static void ExpectedName( char *Out, int Max, const char *Name)
+{
+
+  const char
+    *dot,
+    *slash;
+
+  dot = strrchr( Name, '.');
+  slash = strrchr( Name, '/');
+  if ( !dot || (slash && dot < slash))
+    dot = Name + strlen( Name);
+  snprintf( Out, Max, "%.*s.ps2", (int) (dot - Name), Name);
+  return;
+} // ExpectedName
+
+//	WaveName - Make the name of the waveform file for a capture.
+//	------------------------------------------------------------
+//
+//	As ExpectedName, but with .vcd, and in the current directory.
+//
+
+static void WaveName( char *Out, int Max, const char *Name)
+{
+
+  const char
+    *dot,
+    *slash;
+
+  slash = strrchr( Name, '/');
+  if ( slash)
+    Name = slash + 1;
+  dot = strrchr( Name, '.');
+  if ( !dot)
+    dot = Name + strlen( Name);
+  snprintf( Out, Max, "%.*s.vcd", (int) (dot - Name), Name);
+  return;
+} // WaveName
+
+//	CompareExpected - Check the output against the file.
+//	----------------------------------------------------
+//
+//	The file is hex bytes, any number to a line; # starts a comment.
+//	Returns nonzero if they're the same.
+//
+
+static int CompareExpected( const char *Name, const uint8_t *Got, int GotLen)
+{
+
+  char
+    fileName[ 512],
+    line[ 256],
+    *p,
+    *end;
+
+  unsigned long
+    what;
+
+  FILE
+    *in;
+
+  int
+    n,
+    same;
+
+  ExpectedName( fileName, sizeof( fileName), Name);
+  if ( !(in = fopen( fileName, "r")))
+  {
+    perror( fileName);
+    return 0;
+  }
+  n = 0;
+  same = 1;
+  while ( same && fgets( line, sizeof( line), in))
+  {
+    if ( (p = strchr( line, '#')))
+      *p = 0;
+    for ( p = line; ; p = end)
+    {
+      what = strtoul( p, &end, 16);
+      if ( end == p)
+        break;
+      if ( n >= GotLen || Got[ n] != what)
+      {
+        if ( n < GotLen)
+          printf( "  output differs from %s at byte %d: %02X, expected "
+            "%02lX\n", fileName, n, Got[ n], what);
+        else
+          printf( "  output ends at byte %d; %s goes on\n", n, fileName);
+        same = 0;
+        break;
+      }
+      n++;
+    }
+  } // while lines
+  fclose( in);
+  if ( same && n < GotLen)
+  {
+    printf( "  output goes on past the end of %s: %d more bytes\n",
+      fileName, GotLen - n);
+    same = 0;
+  }
+  return same;
+} // CompareExpected
+
+//	WriteExpected - Write the output as an expected-output file.
+//	------------------------------------------------------------
+
+static int WriteExpected( const char *Name, const uint8_t *Got, int GotLen)
+{
+
+  char
+    fileName[ 512];
+
+  FILE
+    *out;
+
+  int
+    i;
+
+  ExpectedName( fileName, sizeof( fileName), Name);
+  if ( !(out = fopen( fileName, "w")))
+  {
+    perror( fileName);
+    return 0;
+  }
+  fprintf( out, "# PS/2 output for %s, from irkey-replay -o\n", Name);
+  for ( i = 0; i < GotLen; i++)
+    fprintf( out, "%02X%c", Got[ i], (i % 16 == 15 || i == GotLen - 1) ?
+      '\n' : ' ');
+  i = ferror( out);
+  fclose( out);
+  if ( i)
+    perror( fileName);
+  else
+    printf( "  wrote %s\n", fileName);
+  return !i;
+} // WriteExpected
@@ -0,0 +1,508 @@
+//  ringtest - Unit and stress tests of the SPSC ring (ring.h).
+//  -----------------------------------------------------------
+//
+//	The unit tests run each call with the counters started just
+//	short of where they wrap, so every one of them is seen across the
+//	wrap: single bytes, slots, peeking, the bulk calls refusing a run
+//	the ring can't take whole, and the overflow and high-water counts.
+//
+//	The stress test runs a producer and a consumer thread on one small
+//	ring, as the ISR and the main line would, with the calls mixed at
+//	random on each side.  The bytes are a known sequence, so the
+//	consumer checks that every one arrives, once and in order.
+//
+//	Usage: irkey-ringtest [bytes]	bytes for the stress test; default
+//					8000000
+//
+//	Exits 0 if all pass.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ring.h"
+
+#define RING_LEN 64
+#define WRAP_START ((uint32_t) -(RING_LEN / 2 + 3))	// counters wrap mid-test
+#define MAX_RUN 24				// longest bulk run in the stress test
+
+#define CHECK( cond) Check( (cond), #cond, __LINE__)
+
+static RING
+  StressRing;
+
+static uint8_t
+  StressData[ RING_LEN];
+
+static uint32_t
+  StressBytes,
+  StressRefused;			// producer's count of bytes turned away
+
+static volatile int
+  StressStop;				// the consumer has given up
+
+static int
+  Failures;
+
+static void Check( int Ok, const char *What, int Line);
+static void StartAt( RING *Ring, uint8_t *Data, uint32_t Count);
+static void TestSingle( void);
+static void TestSlots( void);
+static void TestBulk( void);
+static void TestCounts( void);
+static int TestStress( void);
+static void *Producer( void *Arg);
+static void *Consumer( void *Arg);
+static void Refused( uint32_t Len);
+static uint8_t SeqByte( uint32_t N);
+static uint32_t Random( uint32_t *Seed, uint32_t Range);
+
+int main( int argc, char *argv[])
+{
+
+  StressBytes = argc > 1 ? (uint32_t) strtoul( argv[ 1], 0, 0) : 8000000;
+  TestSingle();
+  TestSlots();
+  TestBulk();
+  TestCounts();
+  if ( !Failures)
+    Failures += !TestStress();
+  printf( "%s\n", Failures ? "FAIL" : "PASS");
+  return Failures ? 1 : 0;
+} // main
+
+//	Check - Count and report a failed check.
+//	----------------------------------------
+
+static void Check( int Ok, const char *What, int Line)
+{
+
+  if ( Ok)
+    return;
+  printf( "  line %d: %s\n", Line, What);
+  Failures++;
+  return;
+} // Check
+
+//	StartAt - Set up an empty ring with both counters at Count.
+//	-----------------------------------------------------------
+
+static void StartAt( RING *Ring, uint8_t *Data, uint32_t Count)
+{
+
+  RingInit( Ring, Data, RING_LEN);
+  Ring->In = Count;
+  Ring->Out = Count;
+  return;
+} // StartAt
+
+//	TestSingle - RingPut, RingGet and RingPeek, filling and emptying.
+//	-----------------------------------------------------------------
+
+static void TestSingle( void)
+{
+
+  RING
+    ring;
+
+  uint8_t
+    data[ RING_LEN];
+
+  int
+    pass,
+    i;
+
+  printf( "== single bytes\n");
+  StartAt( &ring, data, WRAP_START);
+  CHECK( RingEmpty( &ring) && RingLevel( &ring) == 0);
+  CHECK( RingFree( &ring) == RING_LEN);
+  CHECK( RingGet( &ring) == -1 && RingPeek( &ring) == -1);
+
+  for ( pass = 0; pass < 3; pass++)
+  { // each pass goes further past the wrap
+    for ( i = 0; i < RING_LEN; i++)
+      CHECK( RingPut( &ring, (uint8_t) (i + pass)));
+    CHECK( RingLevel( &ring) == RING_LEN && RingFree( &ring) == 0);
+    CHECK( !RingPut( &ring, 0xee));	// all of it usable, and no more
+    CHECK( RingPeek( &ring) == pass);
+    CHECK( RingPeek( &ring) == pass);	// peeking takes nothing
+    for ( i = 0; i < RING_LEN; i++)
+      CHECK( RingGet( &ring) == (uint8_t) (i + pass));
+    CHECK( RingEmpty( &ring) && RingGet( &ring) == -1);
+  }
+  CHECK( ring.In - WRAP_START == 3 * RING_LEN && ring.In < WRAP_START);
+
+  StartAt( &ring, data, WRAP_START);	// 0xff mustn't look like empty
+  CHECK( RingPut( &ring, 0xff) && RingGet( &ring) == 0xff);
+  return;
+} // TestSingle
+
+//	TestSlots - RingPutSlot/RingPublish and RingGetSlot/RingRelease.
+//	----------------------------------------------------------------
+
+static void TestSlots( void)
+{
+
+  RING
+    ring;
+
+  uint8_t
+    data[ RING_LEN];
+
+  uint32_t
+    tag[ RING_LEN];			// a parallel array, as ir.c keeps
+
+  int
+    slot,
+    i;
+
+  printf( "== slots\n");
+  StartAt( &ring, data, WRAP_START);
+  CHECK( RingGetSlot( &ring) == -1);
+  for ( i = 0; i < RING_LEN; i++)
+  {
+    slot = RingPutSlot( &ring);
+    CHECK( slot == (int) ((WRAP_START + i) & (RING_LEN - 1)));
+    if ( slot < 0)
+      return;
+    data[ slot] = (uint8_t) i;
+    tag[ slot] = 1000 + i;
+    CHECK( RingLevel( &ring) == (uint32_t) i);	// not visible yet
+    RingPublish( &ring, 1);
+  }
+  CHECK( RingPutSlot( &ring) == -1);
+
+  for ( i = 0; i < RING_LEN; i++)
+  {
+    slot = RingGetSlot( &ring);
+    CHECK( slot >= 0 && data[ slot] == i && tag[ slot] == 1000u + i);
+    if ( slot < 0)
+      return;
+    CHECK( RingGetSlot( &ring) == slot);	// stays until released
+    RingRelease( &ring, 1);
+  }
+  CHECK( RingGetSlot( &ring) == -1);
+
+//  Publish and release several at once, as the DMA receive path does.
+
+  for ( i = 0; i < 10; i++)
+    data[ (ring.In + i) & ring.Mask] = (uint8_t) (0x40 + i);
+  RingPublish( &ring, 10);
+  CHECK( RingLevel( &ring) == 10 && RingPeek( &ring) == 0x40);
+  RingRelease( &ring, 7);
+  CHECK( RingLevel( &ring) == 3 && RingGet( &ring) == 0x47);
+  return;
+} // TestSlots
+
+//	TestBulk - RingPutBulk and RingGetBulk, all or none.
+//	----------------------------------------------------
+
+static void TestBulk( void)
+{
+
+  RING
+    ring;
+
+  uint8_t
+    data[ RING_LEN],
+    in[ RING_LEN + 1],
+    out[ RING_LEN + 1];
+
+  int
+    i;
+
+  printf( "== bulk\n");
+  for ( i = 0; i < RING_LEN + 1; i++)
+    in[ i] = (uint8_t) (i * 7 + 1);
+  StartAt( &ring, data, WRAP_START);
+
+  CHECK( !RingPutBulk( &ring, in, RING_LEN + 1));	// more than the ring
+  CHECK( RingEmpty( &ring));
+  CHECK( RingPutBulk( &ring, in, RING_LEN - 5));
+  CHECK( !RingPutBulk( &ring, in, 6));		// one short: none go in
+  CHECK( RingLevel( &ring) == RING_LEN - 5);
+  CHECK( RingPutBulk( &ring, in + RING_LEN - 5, 5));	// exactly fills it
+  CHECK( RingFree( &ring) == 0);
+
+  memset( out, 0, sizeof( out));
+  CHECK( !RingGetBulk( &ring, out, RING_LEN + 1));	// one short: none out
+  CHECK( RingLevel( &ring) == RING_LEN && out[ 0] == 0);
+  CHECK( RingGetBulk( &ring, out, 10));
+  CHECK( !memcmp( out, in, 10));
+  CHECK( RingGetBulk( &ring, out + 10, RING_LEN - 10));	// across the wrap
+  CHECK( !memcmp( out, in, RING_LEN));
+  CHECK( RingEmpty( &ring));
+  CHECK( RingGetBulk( &ring, out, 0) && RingPutBulk( &ring, in, 0));
+  CHECK( RingEmpty( &ring));
+  return;
+} // TestBulk
+
+//	TestCounts - Overflows and HighWater.
+//	-------------------------------------
+
+static void TestCounts( void)
+{
+
+  RING
+    ring;
+
+  uint8_t
+    data[ RING_LEN],
+    in[ RING_LEN];
+
+  int
+    i;
+
+  printf( "== overflow and high-water counts\n");
+  memset( in, 0x55, sizeof( in));
+  StartAt( &ring, data, WRAP_START);
+  CHECK( ring.Overflows == 0 && ring.HighWater == 0);
+
+  for ( i = 0; i < 20; i++)
+    RingPut( &ring, (uint8_t) i);
+  CHECK( ring.HighWater == 20);
+  for ( i = 0; i < 15; i++)
+    RingGet( &ring);
+  RingPut( &ring, 0);
+  CHECK( ring.HighWater == 20);		// the most, not the latest
+
+  RingPutBulk( &ring, in, RING_LEN - 6);	// full
+  CHECK( ring.HighWater == RING_LEN && ring.Overflows == 0);
+  CHECK( !RingPut( &ring, 1));
+  CHECK( ring.Overflows == 1);
+  CHECK( RingPutSlot( &ring) == -1);
+  CHECK( ring.Overflows == 2);
+  CHECK( !RingPutBulk( &ring, in, 9));
+  CHECK( ring.Overflows == 11);		// each byte turned away counts
+
+  RingGetBulk( &ring, in, RING_LEN);	// the consumer never counts
+  CHECK( !RingGetBulk( &ring, in, 1) && RingGet( &ring) == -1);
+  CHECK( ring.Overflows == 11 && ring.HighWater == RING_LEN);
+  return;
+} // TestCounts
+
+//	TestStress - A producer and a consumer thread on one ring.
+//	----------------------------------------------------------
+//
+//	Returns nonzero if every byte came through in order.
+//
+
+static int TestStress( void)
+{
+
+  pthread_t
+    producer,
+    consumer;
+
+  void
+    *result;
+
+  printf( "== stress, %lu bytes\n", (unsigned long) StressBytes);
+  StartAt( &StressRing, StressData, (uint32_t) -1000);
+  StressRefused = 0;
+  StressStop = 0;
+  if ( pthread_create( &consumer, 0, Consumer, 0) ||
+       pthread_create( &producer, 0, Producer, 0))
+  {
+    printf( "  can't start the threads\n");
+    return 0;
+  }
+  pthread_join( producer, 0);
+  pthread_join( consumer, &result);
+  if ( !result)
+    return 0;
+
+  printf( "  %lu bytes refused while full, high water %lu of %d\n",
+    (unsigned long) StressRefused, (unsigned long) StressRing.HighWater,
+    RING_LEN);
+  CHECK( StressRing.Overflows == StressRefused);
+  CHECK( StressRing.HighWater <= RING_LEN);
+  CHECK( RingEmpty( &StressRing));
+  return !Failures;
+} // TestStress
+
+//	Producer - Put the sequence in, a byte or a run at a time.
+//	----------------------------------------------------------
+//
+//	Refusals are retried, so every byte goes in once; each one yields
+//	first, so the consumer gets to run on a single CPU too.  Stops
+//	early if the consumer has found a bad byte.
+//
+
+static void *Producer( void *Arg)
+{
+
+  uint8_t
+    run[ MAX_RUN];
+
+  uint32_t
+    seed,
+    sent,
+    len,
+    i;
+
+  int
+    slot;
+
+  (void) Arg;
+  seed = 1;
+  for ( sent = 0; sent < StressBytes && !StressStop; )
+  {
+    switch( Random( &seed, 3))
+    {
+      case 0:
+        if ( RingPut( &StressRing, SeqByte( sent)))
+          sent++;
+        else
+          Refused( 1);
+        break;
+
+      case 1:
+        if ( (slot = RingPutSlot( &StressRing)) < 0)
+        {
+          Refused( 1);
+          break;
+        }
+        StressData[ slot] = SeqByte( sent++);
+        RingPublish( &StressRing, 1);
+        break;
+
+      default:
+        len = 1 + Random( &seed, MAX_RUN);
+        if ( len > StressBytes - sent)
+          len = StressBytes - sent;
+        for ( i = 0; i < len; i++)
+          run[ i] = SeqByte( sent + i);
+        if ( RingPutBulk( &StressRing, run, len))
+          sent += len;
+        else
+          Refused( len);
+        break;
+    } // switch
+  } // while there's more to send
+  return 0;
+} // Producer
+
+//	Consumer - Take the sequence out and check it.
+//	----------------------------------------------
+//
+//	Returns nonzero (as a pointer) if it all came through in order;
+//	otherwise stops the producer too.
+//
+
+static void *Consumer( void *Arg)
+{
+
+  uint8_t
+    run[ MAX_RUN];
+
+  uint32_t
+    seed,
+    got,
+    len,
+    i;
+
+  int
+    what,
+    slot;
+
+  (void) Arg;
+  seed = 2;
+  for ( got = 0; got < StressBytes; )
+  {
+    switch( Random( &seed, 3))
+    {
+      case 0:
+        if ( (what = RingGet( &StressRing)) < 0)
+        {
+          sched_yield();
+          break;
+        }
+        if ( what != SeqByte( got))
+        {
+          printf( "  byte %lu is %02X, not %02X\n", (unsigned long) got,
+            what, SeqByte( got));
+          StressStop = 1;
+          return 0;
+        }
+        got++;
+        break;
+
+      case 1:
+        if ( (slot = RingGetSlot( &StressRing)) < 0)
+        {
+          sched_yield();
+          break;
+        }
+        if ( StressData[ slot] != SeqByte( got))
+        {
+          printf( "  slot byte %lu is %02X, not %02X\n",
+            (unsigned long) got, StressData[ slot], SeqByte( got));
+          StressStop = 1;
+          return 0;
+        }
+        RingRelease( &StressRing, 1);
+        got++;
+        break;
+
+      default:
+        len = 1 + Random( &seed, MAX_RUN);
+        if ( len > StressBytes - got)
+          len = StressBytes - got;
+        if ( !RingGetBulk( &StressRing, run, len))
+        {
+          sched_yield();
+          break;
+        }
+        for ( i = 0; i < len; i++)
+          if ( run[ i] != SeqByte( got + i))
+          {
+            printf( "  run byte %lu is %02X, not %02X\n",
+              (unsigned long) (got + i), run[ i], SeqByte( got + i));
+            StressStop = 1;
+            return 0;
+          }
+        got += len;
+        break;
+    } // switch
+  } // while there's more to come
+  return (void *) 1;
+} // Consumer
+
+//	Refused - Count bytes the ring turned away, and let the consumer in.
+//	--------------------------------------------------------------------
+
+static void Refused( uint32_t Len)
+{
+
+  StressRefused += Len;
+  sched_yield();
+  return;
+} // Refused
+
+//	SeqByte - The Nth byte of the stress sequence.
+//	----------------------------------------------
+//
+//	Not a plain count, so a slip by a multiple of 256 shows too.
+//
+
+static uint8_t SeqByte( uint32_t N)
+{
+  return (uint8_t) (N ^ (N >> 8) ^ (N >> 16));
+} // SeqByte
+
+//	Random - A number from 0 to Range-1.
+//	------------------------------------
+
+static uint32_t Random( uint32_t *Seed, uint32_t Range)
+{
+
+  *Seed = *Seed * 1103515245 + 12345;
+  return (*Seed >> 8) % Range;
+} // Random
@@ -0,0 +1,97 @@
+//  smoke - Run the firmware in the simulator and see that a key gets out.
+//  ----------------------------------------------------------------------
+//
+//	Starts the firmware as on power-up, with nothing on the PS/2
+//	lines but the pull-ups.  After the BAT code has gone out, the IR
+//	sensor sends a make and a break of the A key.  The host model
+//	(ps2host.c) just listens, and should get
+//
+//	  AA (BAT complete), 1C (A make), F0 1C (A break)
+//
+//	with good parity and stop bits, and the firmware back asleep
+//	when time's up.  Exits 0 if so.
+//
+//	Usage: irkey-smoke [-v]		-v copies the debug port to stdout
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <libopencm3/stm32/usart.h>
+
+#include "hal.h"
+#include "ps2host.h"
+
+#define IR_CHECK( b) ((uint8_t) ((~(b) & 0xf8) | ((b) & 0x07)))
+
+static PS2_HOST
+  Host;
+
+static void Echo( void *Arg, uint8_t What);
+static void SendIR( uint64_t At, uint8_t Key);
+
+int main( int argc, char *argv[])
+{
+
+  static const uint8_t
+    expect[] = { 0xaa, 0x1c, 0xf0, 0x1c };
+
+  uint8_t
+    got[ 16];
+
+  HAL_RESULT
+    result;
+
+  int
+    gotLen,
+    i,
+    ok;
+
+  HalInit();
+  PS2HostInit( &Host);
+  if ( argc > 1 && !strcmp( argv[ 1], "-v"))
+    HalUartSink( USART1, Echo, 0);
+
+  SendIR( HAL_MS( 600), 0xcc);		// A down
+  SendIR( HAL_MS( 700), 0x4c);		// and up
+  result = HalRun( FirmwareMain, HAL_MS( 1000));
+
+  printf( "Run ended %s at %.3f ms\n",
+    result == HAL_DONE ? "normally" :
+    result == HAL_STUCK ? "STUCK" : "early",
+    HalNow() / (double) HAL_MS( 1));
+  gotLen = PS2HostBytes( &Host, got, sizeof( got));
+  printf( "PS/2 frames:");
+  for ( i = 0; i < gotLen; i++)
+    printf( " %02X", got[ i]);
+  printf( "\n%u bad frames\n", Host.Corrupt);
+
+  ok = result == HAL_DONE && !Host.Corrupt &&
+    gotLen == (int) sizeof( expect) && !memcmp( got, expect, sizeof( expect));
+  printf( "%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+} // main
+
+//	SendIR - Have the sensor send a key code and its check byte.
+//	------------------------------------------------------------
+
+static void SendIR( uint64_t At, uint8_t Key)
+{
+
+  HalUartReceive( USART3, At, Key, 0);
+  HalUartReceive( USART3, At, IR_CHECK( Key), 0);
+  return;
+} // SendIR
+
+//	Echo - Copy the debug port to stdout.
+//	-------------------------------------
+
+static void Echo( void *Arg, uint8_t What)
+{
+
+  (void) Arg;
+  putchar( What);
+  return;
+} // Echo
@@ -0,0 +1,219 @@
+//  tracedump - Turn the firmware's binary trace back into text.
+//  ------------------------------------------------------------
+//
+//	Reads the USART1 byte stream (from a file or a serial port set up
+//	with stty, or standard input) and prints one line per record:
+//	the time in microseconds since the first record, the record name
+//	and its arguments.  TR_TEXT records are put back together into
+//	lines of text.
+//
+//	Records start with TRACE_SYNC; if a record doesn't make sense
+//	(the stream was picked up in the middle, or a byte went missing),
+//	we slide along a byte at a time until one does.
+//
+//	Usage: tracedump [-c cpu-MHz] [file]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+#define RECORD_LEN 12		// TRACE_RECORD as sent
+
+static const char
+  *TraceNames[ TR_COUNT] =
+  {
+    "TEXT",
+    "LOST",
+    "HOST_BYTE",
+    "KEY_EVENT",
+    "PS2_SENT",
+    "PS2_ABORT",
+    "PS2_RX_ERROR",
+    "PS2_RATE",
+    "PS2_DROP",
+    "WAKE"
+  };
+
+static char
+  TextLine[ 256];
+
+static int
+  TextLen;
+
+static void PrintRecord( double Us, int Id, uint16_t Arg1, uint32_t Arg2);
+
+int main( int argc, char *argv[])
+{
+
+  FILE
+    *in;
+
+  uint8_t
+    rec[ RECORD_LEN];
+
+  int
+    have,
+    c,
+    id,
+    i,
+    started,
+    skipped;
+
+  uint16_t
+    arg1;
+
+  uint32_t
+    arg2,
+    stamp,
+    lastStamp;
+
+  uint64_t
+    cycles;			// since the first record, wraps taken out
+
+  double
+    mhz;
+
+  mhz = 72.0;
+  in = stdin;
+  for ( i = 1; i < argc; i++)
+  {
+    if ( !strcmp( argv[ i], "-c") && i + 1 < argc)
+      mhz = atof( argv[ ++i]);
+    else if ( !(in = fopen( argv[ i], "rb")))
+    {
+      perror( argv[ i]);
+      return 1;
+    }
+  } // for each argument
+
+  have = 0;
+  started = 0;
+  skipped = 0;
+  cycles = 0;
+  lastStamp = 0;
+  while ( (c = getc( in)) != EOF)
+  {
+    rec[ have++] = (uint8_t) c;
+    if ( have < RECORD_LEN)
+      continue;
+
+    if ( rec[ 0] != TRACE_SYNC || rec[ 1] >= TR_COUNT)
+    { // out of step--slide along one
+      memmove( rec, rec + 1, --have);
+      skipped++;
+      continue;
+    }
+    if ( skipped)
+    {
+      printf( "(%d bytes skipped)\n", skipped);
+      skipped = 0;
+    }
+
+    id = rec[ 1];
+    arg1 = rec[ 2] | (rec[ 3] << 8);
+    arg2 = rec[ 4] | (rec[ 5] << 8) | (rec[ 6] << 16) | 
+      ((uint32_t) rec[ 7] << 24);
+    stamp = rec[ 8] | (rec[ 9] << 8) | (rec[ 10] << 16) | 
+      ((uint32_t) rec[ 11] << 24);
+    if ( started)
+      cycles += (uint32_t) (stamp - lastStamp);
+    started = 1;
+    lastStamp = stamp;
+    have = 0;
+    PrintRecord( cycles / mhz, id, arg1, arg2);
+  } // while bytes
+
+  if ( TextLen)
+    printf( "%s\n", TextLine);
+  return 0;
+} // main
+
+//	PrintRecord - Print one record.
+//	-------------------------------
+
+static void PrintRecord( double Us, int Id, uint16_t Arg1, uint32_t Arg2)
+{
+
+  int
+    i;
+
+  char
+    c;
+
+  static const char
+    *wakeNames[] = { "?", "IR", "host" },
+    *sourceNames[] = { "queue", "resend", "replay" };
+
+  if ( Id == TR_TEXT)
+  { // gather a line
+    for ( i = 0; i < Arg1 && i < 4; i++)
+    {
+      c = (char) (Arg2 >> (i * 8));
+      if ( c == '\r')
+        continue;
+      if ( c == '\n' || TextLen == sizeof( TextLine) - 1)
+      {
+        TextLine[ TextLen] = 0;
+        printf( "%12.1f  %s\n", Us, TextLine);
+        TextLen = 0;
+        if ( c == '\n')
+          continue;
+      }
+      TextLine[ TextLen++] = c;
+    }
+    return;
+  }
+
+  printf( "%12.1f  %-12s ", Us, TraceNames[ Id]);
+  switch( Id)
+  {
+    case TR_LOST:
+      printf( "%u records\n", (unsigned) Arg2);
+      break;
+
+    case TR_HOST_BYTE:
+      printf( "%02x action %x\n", Arg1, (unsigned) Arg2);
+      break;
+
+    case TR_KEY_EVENT:
+      printf( "type %d key %02x%s\n", Arg1 >> 8, Arg1 & 0xff, 
+        Arg2 ? "" : " (not sent)");
+      break;
+
+    case TR_PS2_SENT:
+      printf( "%02x from %s\n", Arg1, 
+        Arg2 < 3 ? sourceNames[ Arg2] : "?");
+      break;
+
+    case TR_PS2_ABORT:
+      printf( "%02x\n", Arg1);
+      break;
+
+    case TR_PS2_RX_ERROR:
+      printf( "%02x%s%s\n", Arg1, (Arg2 & 1) ? " parity" : "",
+        (Arg2 & 2) ? " stop" : "");
+      break;
+
+    case TR_PS2_RATE:
+      printf( "%u Hz%s\n", (unsigned) Arg2, Arg1 ? " (up)" : "");
+      break;
+
+    case TR_PS2_DROP:
+      printf( "%d bytes\n", Arg1);
+      break;
+
+    case TR_WAKE:
+      printf( "on %s after %u us\n", wakeNames[ Arg1 < 3 ? Arg1 : 0], 
+        (unsigned) Arg2);
+      break;
+
+    default:
+      printf( "%04x %08x\n", Arg1, (unsigned) Arg2);
+      break;
+  } // switch
+  return;
+} // PrintRecord
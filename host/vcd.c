@@ -0,0 +1,192 @@
+//  vcd - Write a simulator run's waveforms out as a VCD file.
+//  ----------------------------------------------------------
+//
+//	See vcd.h.  Driven by a pin watcher and an interrupt watcher;
+//	nothing here runs in the firmware's context.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libopencm3/stm32/gpio.h>
+
+#include "gpiodef.h"
+#include "vcd.h"
+
+#define VCD_NS( cycles) ((cycles) * 1000 / (HAL_CPU_HZ / 1000000))
+#define VCD_FIRST_IRQ_ID '$'		// after the pins' identifiers
+
+//  The pins recorded.
+
+typedef struct
+{
+  const char
+    *Scope,
+    *Name;
+  uint32_t
+    Port;
+  uint16_t
+    Pin;
+  char
+    Id;
+} VCD_PIN;
+
+static const VCD_PIN
+  VcdPins[] =
+  {
+    { "ps2", "clk", PS2_GPIO, PS2_BIT_CLK, '!' },
+    { "ps2", "data", PS2_GPIO, PS2_BIT_DATA, '"' },
+    { "ir", "rx", IR_RX_GPIO, GPIO_USART3_RX, '#' }
+  };
+
+#define VCD_PIN_COUNT ((int) (sizeof( VcdPins) / sizeof( VcdPins[ 0])))
+
+static void VcdPinChange( void *Arg, uint32_t Port, uint16_t Changed,
+  uint16_t Levels);
+static void VcdIrq( void *Arg, int Irq, int Enter);
+static void VcdChange( VCD_FILE *Vcd, char Id, int Level);
+
+//*	VcdOpen - Start recording a run to a file.
+//	------------------------------------------
+//
+//	After HalInit and before HalRun.  Returns 0 if all went well, -1
+//	(with a message) if the file can't be written.
+//
+
+int VcdOpen( VCD_FILE *Vcd, const char *Name)
+{
+
+  const VCD_PIN
+    *pin;
+
+  const char
+    *scope;
+
+  char
+    id;
+
+  int
+    irq;
+
+  memset( Vcd, 0, sizeof( *Vcd));
+  if ( !(Vcd->Out = fopen( Name, "w")))
+  {
+    perror( Name);
+    return -1;
+  }
+
+  fprintf( Vcd->Out, "$version irkey simulator $end\n"
+    "$timescale 1ns $end\n"
+    "$scope module irkey $end\n");
+  scope = 0;
+  for ( pin = VcdPins; pin < VcdPins + VCD_PIN_COUNT; pin++)
+  {
+    if ( !scope || strcmp( scope, pin->Scope))
+    {
+      if ( scope)
+        fprintf( Vcd->Out, "$upscope $end\n");
+      scope = pin->Scope;
+      fprintf( Vcd->Out, "$scope module %s $end\n", scope);
+    }
+    fprintf( Vcd->Out, "$var wire 1 %c %s $end\n", pin->Id, pin->Name);
+  }
+  fprintf( Vcd->Out, "$upscope $end\n"
+    "$scope module isr $end\n");
+  id = VCD_FIRST_IRQ_ID;
+  for ( irq = 0; irq < NVIC_IRQ_COUNT; irq++)
+  {
+    if ( !strcmp( HalIrqName( irq), "?"))
+      continue;			// nothing simulated there
+    Vcd->IrqId[ irq] = id;
+    fprintf( Vcd->Out, "$var wire 1 %c %s $end\n", id++, HalIrqName( irq));
+  }
+  fprintf( Vcd->Out, "$upscope $end\n"
+    "$upscope $end\n"
+    "$enddefinitions $end\n");
+
+//  Where everything starts out.
+
+  fprintf( Vcd->Out, "#%llu\n$dumpvars\n",
+    (unsigned long long) VCD_NS( HalNow()));
+  for ( pin = VcdPins; pin < VcdPins + VCD_PIN_COUNT; pin++)
+  {
+    fprintf( Vcd->Out, "%d%c\n",
+      (HalGpioLevels( pin->Port) & pin->Pin) != 0, pin->Id);
+    HalWatchPins( pin->Port, pin->Pin, VcdPinChange, Vcd);
+  }
+  for ( irq = 0; irq < NVIC_IRQ_COUNT; irq++)
+    if ( Vcd->IrqId[ irq])
+      fprintf( Vcd->Out, "0%c\n", Vcd->IrqId[ irq]);
+  fprintf( Vcd->Out, "$end\n");
+  HalWatchIrqs( VcdIrq, Vcd);
+  Vcd->Stamp = VCD_NS( HalNow());
+  return 0;
+} // VcdOpen
+
+//*	VcdClose - Finish the file, after HalRun.
+//	-----------------------------------------
+//
+//	The last stamp is the end of the run, so a viewer shows it all.
+//
+
+void VcdClose( VCD_FILE *Vcd)
+{
+
+  if ( !Vcd->Out)
+    return;
+  if ( VCD_NS( HalNow()) != Vcd->Stamp)
+    fprintf( Vcd->Out, "#%llu\n", (unsigned long long) VCD_NS( HalNow()));
+  fclose( Vcd->Out);
+  Vcd->Out = 0;
+  return;
+} // VcdClose
+
+//	VcdPinChange - Pin watcher: record the pins that changed.
+//	---------------------------------------------------------
+
+static void VcdPinChange( void *Arg, uint32_t Port, uint16_t Changed,
+  uint16_t Levels)
+{
+
+  const VCD_PIN
+    *pin;
+
+  for ( pin = VcdPins; pin < VcdPins + VCD_PIN_COUNT; pin++)
+    if ( pin->Port == Port && (pin->Pin & Changed))
+      VcdChange( (VCD_FILE *) Arg, pin->Id, (Levels & pin->Pin) != 0);
+  return;
+} // VcdPinChange
+
+//	VcdIrq - Interrupt watcher: a handler starts or ends.
+//	-----------------------------------------------------
+
+static void VcdIrq( void *Arg, int Irq, int Enter)
+{
+
+  VCD_FILE
+    *vcd;
+
+  vcd = (VCD_FILE *) Arg;
+  if ( Irq >= 0 && Irq < NVIC_IRQ_COUNT && vcd->IrqId[ Irq])
+    VcdChange( vcd, vcd->IrqId[ Irq], Enter);
+  return;
+} // VcdIrq
+
+//	VcdChange - Write a change, stamped now.
+//	----------------------------------------
+
+static void VcdChange( VCD_FILE *Vcd, char Id, int Level)
+{
+
+  uint64_t
+    now;
+
+  if ( !Vcd->Out)
+    return;
+  now = VCD_NS( HalNow());
+  if ( now != Vcd->Stamp)
+    fprintf( Vcd->Out, "#%llu\n", (unsigned long long) now);
+  fprintf( Vcd->Out, "%d%c\n", Level != 0, Id);
+  Vcd->Stamp = now;
+  return;
+} // VcdChange
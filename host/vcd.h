@@ -0,0 +1,37 @@
+#ifndef _VCD_DEFINED
+#define _VCD_DEFINED
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libopencm3/cm3/nvic.h>
+
+#include "hal.h"
+
+//	Waveforms of a simulator run, as a Value Change Dump (IEEE 1364)
+//	file for GTKWave and the like.
+//
+//	Recorded: the PS/2 CLK and DATA lines as they read (either end
+//	pulling low), the USART3 RX pin bit by bit, and a line for each
+//	interrupt that's high while its handler runs.  A handler's line
+//	goes high once the entry cycles are spent and low before the exit
+//	ones, so the gap between a compare match or pin edge and the rise
+//	is the latency the firmware sees; nested handlers overlap.
+//
+//	Time is in nanoseconds, rounded down from CPU cycles (13.9 ns at
+//	72 MHz).
+
+typedef struct
+{
+  FILE
+    *Out;
+  uint64_t
+    Stamp;			// of the last change written, in ns
+  char
+    IrqId[ NVIC_IRQ_COUNT];	// identifier of each interrupt's line; 0 if none
+} VCD_FILE;
+
+int VcdOpen( VCD_FILE *Vcd, const char *Name);
+void VcdClose( VCD_FILE *Vcd);
+
+#endif // _VCD_DEFINED
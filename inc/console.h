@@ -0,0 +1,31 @@
+#ifndef _CONSOLE_DEFINED
+#define _CONSOLE_DEFINED
+
+#include <stdint.h>
+
+#include "irdecode.h"
+#include "hostcmd.h"
+
+//	Diagnostics console on USART1.
+//
+//	If you want a command shell on the debug port, uncomment the
+//	following line.  Characters are received by interrupt and the
+//	line is edited and run from the main loop (EV_CONSOLE), so keys
+//	keep flowing while you type.  The periodic reports are then left
+//	to the "latency" and "profile" commands.  Needs USE_USART_DEBUG.
+//
+//	The receive interrupt can't wake us from Stop mode; type something
+//	twice if it's been idle a while.
+
+// #define USE_CONSOLE 1
+
+#define CONSOLE_LINE_LEN 64	// longest command line
+
+#ifdef USE_CONSOLE
+void ConsoleInit( IR_DECODER *Decoder, HOST_CMD *Host, uint16_t *Keys);
+void ConsoleProcess( void);
+#else
+#define ConsoleInit( decoder, host, keys)	// all no-ops
+#endif
+
+#endif // _CONSOLE_DEFINED
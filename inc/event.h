@@ -0,0 +1,49 @@
+#ifndef _EVENT_DEFINED
+#define _EVENT_DEFINED
+
+#include <stdint.h>
+
+//	Main loop event dispatcher.
+//
+//	Interrupt handlers post events; the main loop sleeps (WFI) until
+//	there's one pending, then runs the handlers in order of priority,
+//	highest (lowest number) first.
+
+typedef enum
+{
+  EV_HOST,			// byte(s) from the PS/2 host
+  EV_IR,			// byte(s) or end of frame from the IR sensor
+  EV_TIMER,			// deadline reached; housekeeping
+  EV_CONSOLE,			// character(s) typed on the debug port
+  EV_COUNT
+} EVENT_ID;
+
+typedef void (*EVENT_HANDLER)( void);
+
+//  Sleep until an interrupt is pending.  The host build (host/) puts
+//  its own in here.
+
+#ifndef EVENT_WAIT
+#define EVENT_WAIT() __asm__ volatile( "wfi")
+#endif
+
+extern volatile uint8_t
+  EventPending[ EV_COUNT];	// set by EventPost, cleared on dispatch
+
+//*	EventPost - Say an event has happened.
+//	--------------------------------------
+//
+//	Safe from any interrupt handler.  Posting an event that's already
+//	pending does nothing more.
+//
+
+static inline void EventPost( EVENT_ID Id)
+{
+  EventPending[ Id] = 1;
+} // EventPost
+
+void EventInit( void);
+void EventSetHandler( EVENT_ID Id, EVENT_HANDLER Handler);
+void EventRun( void);
+
+#endif // _EVENT_DEFINED
@@ -2,6 +2,8 @@
 #define _globals_defined
 #include <stdint.h>
 
+#include "ring.h"
+
 #ifdef MAIN
 #define _scope 
 #else
@@ -11,32 +13,34 @@
 #define TRUE 1
 #define FALSE 0
 
-_scope uint16_t
-  LastKey;		// Last key pressed
+//  Clock tree, as set up by rcc_clock_setup_in_hse_8mhz_out_72mhz().
 
-_scope volatile uint32_t 
-  TickCount;            // incremented by systick - 1.0  ms.
+#define CPU_CLOCK_HZ 72000000		// SYSCLK and AHB
+#define APB1_TIMER_HZ 72000000		// APB1 is SYSCLK/2; its timers get x2
+#define CYCLES_PER_MS (CPU_CLOCK_HZ / 1000)
 
 _scope uint8_t 
   LastMake;		// last "make"
 
-#define IR_RX_BUFFER_SIZE 64	// how many bytes in the IR receive buffer
+#define IR_RX_BUFFER_SIZE 64	// IR receive buffer; a power of two
 
-_scope volatile int
-  IrRxBufferIn,
-  IrRxBufferOut;
+_scope RING
+  IrRxRing;		// over IrRxBuffer; overflows are bytes lost
   
 _scope uint8_t
   IrRxBuffer[ IR_RX_BUFFER_SIZE];
 
-#define PS2_RX_BUFFER_SIZE 64	// how many bytes in the ps2 receive buffer
+_scope uint32_t
+  IrRxStamp[ IR_RX_BUFFER_SIZE];	// DWT cycle count when each byte arrived
 
 _scope volatile int
-  PS2RxBufferIn,
-  PS2RxBufferOut;
-  
-_scope uint8_t
-  PS2RxBuffer[ PS2_RX_BUFFER_SIZE];	// the buffer
+  IrRxIdle;		// line has gone idle since the last byte
+
+_scope volatile uint32_t
+  IrFrameCount,		// idle-line frame ends seen
+  IrOverrunErrors,	// USART3 overruns
+  IrFramingErrors,	// bytes with bad stop bit (discarded)
+  IrNoiseErrors;	// bytes flagged as noisy
 
 #endif
 
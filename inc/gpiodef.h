@@ -8,7 +8,22 @@
 #define PS2_BIT_CLK     GPIO6           // GPIO bit 7
 #define PS2_BIT_DATA    GPIO7           // GPIO bit 6
 
-//  "Pulse" LED, blinks once per second.
+//   EXTI line (and its interrupt) that watches the PS/2 clock pin for
+//   a host request-to-send while the PS/2 timer is stopped.  These
+//   must agree with PS2_BIT_CLK.
+
+#define PS2_CLK_EXTI    EXTI6
+#define PS2_CLK_IRQ     NVIC_EXTI9_5_IRQ
+
+//   EXTI line (and interrupt) on the USART3 RX pin, used to wake up
+//   from Stop mode on an IR start bit.  Must agree with GPIO_USART3_RX.
+
+#define IR_RX_GPIO      GPIOB
+#define IR_RX_EXTI      EXTI11
+#define IR_RX_IRQ       NVIC_EXTI15_10_IRQ
+
+//  "Pulse" LED, blinks once per second.  It's driven by TIM3 channel 4
+//  (timebase.c), so it must be on that pin.
 
 #define LED_GPIO GPIOB          // GPIO for LED
 #define LED_BIT  GPIO1          // Bit in GPIO for led
@@ -0,0 +1,52 @@
+#ifndef _HOSTCMD_DEFINED
+#define _HOSTCMD_DEFINED
+
+#include <stdint.h>
+
+//	PS/2 host command processor.
+//
+//	Bytes from the host are fed in one at a time as they arrive;
+//	nothing here ever waits for the parameter of a two-byte command.
+//	The caller is told what to do about each byte through the flags
+//	HostCmdByte returns, so there are no hardware dependencies here.
+
+//  What HostCmdByte wants done.
+
+#define HC_REPLY 1		// send Reply[0..ReplyLen-1]
+#define HC_RESET 2		// throw away anything not yet sent first
+#define HC_LEDS 4		// update the LEDs from Leds
+
+#define HC_REPLY_MAX 3		// longest reply
+
+//  Where we are in a command.
+
+typedef enum
+{
+  HCS_COMMAND,			// waiting for a command
+  HCS_PARAM,			// waiting for Command's parameter
+  HCS_KEYS			// taking Command's list of keys
+} HOST_CMD_STATE;
+
+typedef struct
+{
+  HOST_CMD_STATE
+    State;
+  uint8_t
+    Command,			// command waiting for its parameter or keys
+    Leds,			// LED bits: xxxxxCNS
+    Typematic,			// last typematic rate/delay set
+    ScanSet,			// scan set we report; only ever 2
+    Enabled,			// nonzero if keys are to be sent
+    Reply[ HC_REPLY_MAX],	// what to send back
+    ReplyLen;
+  uint32_t
+    Commands,			// commands taken
+    Unknown,			// commands we didn't know
+    BadParams,			// parameters we couldn't take
+    Abandoned;			// commands cut off by a new one
+} HOST_CMD;
+
+void HostCmdInit( HOST_CMD *Cmd);
+int HostCmdByte( HOST_CMD *Cmd, uint8_t What);
+
+#endif // _HOSTCMD_DEFINED
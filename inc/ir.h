@@ -1,9 +1,21 @@
 #ifndef _IR_DEFINED
 #define _IR_DEFINED 
 
-//	Routines dealing with servicing the IR sensor and System tick.
+//	Routines dealing with servicing the IR sensor.
+
+//	If you want USART3 to receive into IrRxBuffer by circular DMA,
+//	rather than taking an interrupt per byte, uncomment the following
+//	line.  Either way, the idle-line interrupt marks the end of each
+//	IR frame.
+
+// #define IR_USE_DMA 1
+
+//	Each received byte is stamped with the DWT cycle counter, which
+//	runs at the CPU clock.
+
+#define IR_CHAR_CYCLES (CPU_CLOCK_HZ / 120)	// one byte time at 1200 N81
 
 void SetupIRSensor( void);
-void SetupSysTick( void);
+int IRInject( const uint8_t *What, int Len);
 
 #endif // _IR_DEFINED
\ No newline at end of file
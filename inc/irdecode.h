@@ -0,0 +1,75 @@
+#ifndef _IRDECODE_DEFINED
+#define _IRDECODE_DEFINED
+
+#include <stdint.h>
+
+//	IR keyboard frame decoder.
+//
+//	Bytes from the IR receiver are fed in one at a time; whenever a
+//	byte completes a frame, a key event is returned.  All state is
+//	kept in the IR_DECODER structure, so the decoder has no hardware
+//	dependencies and more than one may be run at once.
+//
+//	Each byte comes with the time it arrived, in whatever ticks the
+//	caller likes; the tick rate is given to IRDecodeInit.
+
+#define KEY_TIMEOUT 50		// ms; a longer gap can't be inside a frame
+#define REPEAT_TIMEOUT 1000	// ms; a repeat later than this is stale
+
+//  Key event types.
+
+typedef enum
+{
+  IR_EVENT_NONE,		// nothing (yet)
+  IR_EVENT_MAKE,		// key pressed
+  IR_EVENT_BREAK,		// key released
+  IR_EVENT_REPEAT,		// typematic repeat of the last make
+  IR_EVENT_CLEAR,		// all keys up
+  IR_EVENT_MOUSE		// pointing stick frame (discarded)
+} IR_EVENT_TYPE;
+
+typedef struct
+{
+  IR_EVENT_TYPE
+    Type;
+  uint8_t
+    Key;			// IR key code, high bit stripped
+  uint32_t
+    Stamp;			// when the byte that completed it arrived
+} IR_EVENT;
+
+//  Where we are in a frame.
+
+typedef enum
+{
+  IRD_FIRST,			// waiting for the first byte
+  IRD_CHECK,			// waiting for the check byte
+  IRD_MOUSE1,			// skipping mouse bytes
+  IRD_MOUSE2
+} IR_DECODE_STATE;
+
+typedef struct
+{
+  IR_DECODE_STATE
+    State;
+  uint8_t
+    First,			// first byte of the frame in progress
+    LastKey;			// last make, for repeats; 0 if none
+  uint32_t
+    PairGap,			// ticks allowed between bytes of a frame
+    RepeatGap,			// ticks allowed between key and repeat
+    LastStamp,			// when the last byte arrived
+    KeyStamp,			// when LastKey was last seen
+    Frames,			// good frames decoded
+    Resyncs,			// check bytes that didn't match
+    Timeouts,			// partial frames dropped for a gap
+    StaleRepeats;		// repeats ignored as too late
+} IR_DECODER;
+
+void IRDecodeInit( IR_DECODER *Dec, uint32_t TicksPerMs);
+void IRDecodeReset( IR_DECODER *Dec);
+int IRDecodePending( IR_DECODER *Dec);
+int IRDecodeByte( IR_DECODER *Dec, uint8_t What, uint32_t Stamp, 
+  IR_EVENT *Event);
+
+#endif // _IRDECODE_DEFINED
@@ -0,0 +1,57 @@
+#ifndef _IRQPRIO_DEFINED
+#define _IRQPRIO_DEFINED
+
+#include <stdint.h>
+
+//	Interrupt priorities.
+//
+//	The STM32F103 has 4 priority bits (the top of each byte); all of
+//	them are used for preemption, no subpriority.  Lower is more
+//	urgent.  The PS/2 bit timer preempts everything else, so nothing
+//	below it can move a clock edge; the rest are ordered by how long
+//	they can afford to wait.
+//
+//	Everything below IRQ_PRIO_PS2_TIMER must keep its body short and
+//	bounded--no loops over more than a buffer's worth and no waiting.
+
+#define IRQ_GROUPING SCB_AIRCR_PRIGROUP_GROUP16_NOSUB
+
+#define IRQ_PRIO_PS2_TIMER	(0 << 4)	// TIM2: PS/2 clock and data
+#define IRQ_PRIO_PS2_AUX	(1 << 4)	// TIM4, DMA1 ch 7, clock EXTI
+#define IRQ_PRIO_IR		(2 << 4)	// USART3; 8 ms per byte
+#define IRQ_PRIO_WAKE		(3 << 4)	// IR RX pin EXTI
+#define IRQ_PRIO_TIME		(4 << 4)	// TIM1 deadlines
+#define IRQ_PRIO_DEBUG		(6 << 4)	// USART1 debug output
+
+//  Hold off the interrupts at Priority and below (BASEPRI), and leave
+//  the more urgent ones running: for data shared only with handlers
+//  at or below Priority.  IRQ_MASK never lowers the mask already set,
+//  and returns what to hand IRQ_UNMASK.  It can't hold off
+//  IRQ_PRIO_PS2_TIMER (zero turns BASEPRI off); data tim2_isr shares
+//  still needs cm_mask_interrupts.  The host build (host/) puts its
+//  own in here.
+
+#ifndef IRQ_MASK
+#define IRQ_MASK( prio) IrqMask( prio)
+#define IRQ_UNMASK( was) IrqUnmask( was)
+
+static inline uint32_t IrqMask( uint32_t Priority)
+{
+
+  uint32_t
+    was;
+
+  __asm__ volatile( "mrs %0, basepri" : "=r" (was));
+  __asm__ volatile( "msr basepri_max, %0" :: "r" (Priority) : "memory");
+  return was;
+} // IrqMask
+
+static inline void IrqUnmask( uint32_t Was)
+{
+
+  __asm__ volatile( "msr basepri, %0" :: "r" (Was) : "memory");
+  return;
+} // IrqUnmask
+#endif
+
+#endif // _IRQPRIO_DEFINED
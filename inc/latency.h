@@ -0,0 +1,51 @@
+#ifndef _LATENCY_DEFINED
+#define _LATENCY_DEFINED
+
+#include <stdint.h>
+
+//	Keystroke latency measurement.
+//
+//	If you want end-to-end latency histograms kept and reported over
+//	the debug UART, uncomment the following line.  Times are DWT
+//	cycle counts: when the IR byte that completed a key arrived, when
+//	the key was decoded, and when the last PS/2 frame for it was out.
+
+// #define USE_LATENCY_STATS 1
+
+#define LATENCY_BUCKETS 32	// log2 buckets; covers all of 32 bits
+#define LATENCY_PENDING 16	// keys in flight at once; a power of two
+
+typedef enum
+{
+  LAT_IR_TO_DECODE,		// IR byte arrival to decoded event
+  LAT_DECODE_TO_PS2,		// decoded event to last PS/2 frame sent
+  LAT_IR_TO_PS2,		// the whole thing
+  LAT_COUNT
+} LATENCY_ID;
+
+typedef struct
+{
+  uint32_t
+    Count,
+    Max,			// cycles
+    Bucket[ LATENCY_BUCKETS];	// Bucket[ i]: 2^i <= cycles < 2^(i+1)
+} LATENCY_HIST;
+
+#ifdef USE_LATENCY_STATS
+void LatencyInit( void);
+void LatencyQueued( uint32_t Arrived, uint32_t Decoded, uint32_t TxMark);
+void LatencyFrameDone( uint32_t TxOut);
+void LatencyFlush( uint32_t TxOut);
+uint32_t LatencyPercentile( const LATENCY_HIST *Hist, int Percent);
+const LATENCY_HIST *LatencyHist( LATENCY_ID Id);
+void LatencyReport( int Force);
+#else
+#define LatencyInit()			// all no-ops
+#define LatencyQueued( arrived, decoded, mark) \
+  ((void) (arrived), (void) (decoded), (void) (mark))
+#define LatencyFrameDone( out)
+#define LatencyFlush( out)
+#define LatencyReport( force)
+#endif
+
+#endif // _LATENCY_DEFINED
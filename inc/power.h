@@ -0,0 +1,57 @@
+#ifndef _POWER_DEFINED
+#define _POWER_DEFINED
+
+#include <stdint.h>
+
+//	Low-power (Stop mode) operation.
+//
+//	If you want the MCU put into Stop mode after a spell with nothing
+//	to do, uncomment the following line.  It wakes on the start bit
+//	of an IR byte or a PS/2 host request.  PS2_IDLE_GATING is needed,
+//	so that the PS/2 clock pin is being watched.  The key pressed to
+//	wake it is lost (see power.c).
+
+// #define USE_STOP_MODE 1
+
+//	How long (ms) with no keys or host traffic before we stop.  Long,
+//	so that only a keyboard left alone pays for the lost key.
+
+#define STOP_IDLE_MS 600000
+
+//	Uncomment to let the regulator drop to low-power in Stop mode.
+//	Less current, but a slower wakeup.
+
+// #define STOP_LOW_POWER_REGULATOR 1
+
+#ifdef USE_STOP_MODE
+typedef struct
+{
+  uint32_t
+    Stops,			// times we've stopped
+    IrWakes,			// woken by the IR line
+    HostWakes,			// woken by the PS/2 clock
+    FirstKeysDropped,		// IR wakes where the waking key was lost
+    WakeUs,			// last wakeup to 72 MHz, microseconds
+    WakeUsMax;			// worst of those
+} POWER_STATS;
+
+extern POWER_STATS
+  PowerStats;
+
+void PowerInit( void);
+void PowerSetIdle( uint32_t Ms);
+void PowerActivity( void);
+int PowerStopDue( void);
+int PowerQuiet( void);
+void PowerStop( void);
+int PowerWokeOnIR( void);
+void PowerFirstKey( int Dropped);
+#else
+#define PowerInit()		// all no-ops
+#define PowerSetIdle( ms)
+#define PowerActivity()
+#define PowerWokeOnIR() 0
+#define PowerFirstKey( dropped) ((void) (dropped))
+#endif
+
+#endif // _POWER_DEFINED
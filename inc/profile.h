@@ -0,0 +1,88 @@
+#ifndef _PROFILE_DEFINED
+#define _PROFILE_DEFINED
+
+#include <stdint.h>
+
+//	Interrupt handler profiling.
+//
+//	If you want each interrupt handler's time measured, uncomment the
+//	following line.  Each handler is stamped with the DWT cycle
+//	counter on the way in and out; ProfileReport prints the count,
+//	min, max and total cycles of each, and its share of the CPU.
+//	The figures include any higher-priority handler that preempted
+//	it.
+
+// #define USE_ISR_PROFILE 1
+
+typedef enum
+{
+  PROF_TIM2,			// PS/2 bit timer
+  PROF_TIM4,			// PS/2 DMA inhibit watch
+  PROF_DMA7,			// PS/2 DMA frame done
+  PROF_EXTI_PS2,		// PS/2 clock wakeup
+  PROF_USART3,			// IR receive
+  PROF_DMA3,			// IR receive DMA half or all full
+  PROF_EXTI_IR,			// IR wakeup from Stop
+  PROF_TIM1,			// deadlines
+  PROF_USART1,			// debug port receive
+  PROF_DMA4,			// debug port DMA done
+  PROF_COUNT
+} PROFILE_ID;
+
+#ifdef USE_ISR_PROFILE
+#include <libopencm3/cm3/dwt.h>
+
+typedef struct
+{
+  uint32_t
+    Start,			// cycle count on entry
+    Count,
+    Min,
+    Max;
+  uint64_t
+    Total;
+} PROFILE;
+
+extern PROFILE
+  Profiles[ PROF_COUNT];
+
+//*	ProfileEnter - Stamp entry to a handler.
+//	----------------------------------------
+
+static inline void ProfileEnter( PROFILE_ID Id)
+{
+  Profiles[ Id].Start = dwt_read_cycle_counter();
+} // ProfileEnter
+
+//*	ProfileExit - Stamp exit from a handler.
+//	----------------------------------------
+
+static inline void ProfileExit( PROFILE_ID Id)
+{
+
+  PROFILE
+    *prof;
+
+  uint32_t
+    cycles;
+
+  prof = &Profiles[ Id];
+  cycles = dwt_read_cycle_counter() - prof->Start;
+  prof->Count++;
+  prof->Total += cycles;
+  if ( cycles < prof->Min)
+    prof->Min = cycles;
+  if ( cycles > prof->Max)
+    prof->Max = cycles;
+} // ProfileExit
+
+void ProfileReset( void);
+void ProfileReport( void);
+#else
+#define ProfileEnter( id)		// all no-ops
+#define ProfileExit( id)
+#define ProfileReset()
+#define ProfileReport()
+#endif
+
+#endif // _PROFILE_DEFINED
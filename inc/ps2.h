@@ -26,13 +26,71 @@
 #define KEY_BAT 0xaa			// BAT completed
 #define KEY_ECHO 0xee			// response to echo
 
+#define PS2_TX_BUFFER_SIZE 64	// bytes in the transmit ring
+#define PS2_RX_BUFFER_SIZE 64	// bytes in the receive ring
+
+//	PS/2 clock rates.  The spec allows 10 to 16.7 KHz.  We start at
+//	PS2_RATE_DEFAULT and, if the host keeps cutting frames short or
+//	asking for them again, drop down through the rate table in ps2.c.
+//	After a long enough run of good frames we try the next faster one
+//	again, up to the rate we started at; a host reset starts us at
+//	PS2_RATE_DEFAULT again.
+//	The limits stay a little inside the spec's: the clock edges come
+//	from interrupt handlers, and at exactly 10 KHz a high half can
+//	come out a shade over the 50 us allowed.
+
+#define PS2_RATE_MIN 10500		// Hz
+#define PS2_RATE_MAX 16500
+#define PS2_RATE_DEFAULT 16000
+#define PS2_FALLBACK_ERRORS 4		// failures in a row before slowing
+#define PS2_RECOVER_FRAMES 256		// good frames in a row before speeding up
+
+//	Stop TIM2 whenever the interface is idle with nothing to send,
+//	restarting it for the next byte queued or when the host pulls the
+//	clock line low.  Comment out to leave TIM2 running all the time.
+
+#define PS2_IDLE_GATING 1
+
+//	Send frames to the host by DMA instead of bit-by-bit from tim2_isr.
+//	TIM4 update events clock a precomputed table of GPIO BSRR words out
+//	through DMA1 channel 7.  TIM4 channel 1 input capture on the clock
+//	pin (PB6) catches the host inhibiting, and each update checks the
+//	host isn't holding the clock down.  This needs the PS/2
+//	clock on TIM4_CH1, as it is in gpiodef.h.  Uncomment to use it.
+
+// #define PS2_DMA_TX 1
+
+//	Measure how late tim2_isr drives each clock edge, in CPU cycles
+//	from the TIM2 compare to the GPIO write.  Costs a few cycles per
+//	edge.  Uncomment to use it; read with PS2JitterStats.
+
+// #define PS2_JITTER_PROBE 1
+
 //	Prototypes.
 
 void UpdateStatusLEDs( uint8_t What);
 void PS2Init( void);
 int PS2Ready( void);
-void PS2Put( uint8_t What);
-void PS2PutStr( uint8_t *What);
+int PS2Quiet( void);
+int PS2PutSeq( const uint8_t *What, int Len);
+int PS2Put( uint8_t What);
+int PS2PutStr( const uint8_t *What);
+int PS2TxLevel( void);
+uint32_t PS2TxMark( void);
+int PS2TxMaxLevel( void);
+int PS2TxDropCount( void);
+int PS2TxAbortCount( void);
+int PS2TxRetryCount( void);
+int PS2RxErrorCount( void);
+int PS2ReplayCount( void);
+#ifdef PS2_JITTER_PROBE
+void PS2JitterStats( uint32_t *Worst, uint32_t *Average, uint32_t *Edges);
+void PS2JitterReset( void);
+#endif
+void PS2TxFlush( void);
 int PS2Get( void);
+int PS2SetRate( int Hz);
+int PS2GetRate( void);
+void PS2RateError( void);
 
 #endif
@@ -0,0 +1,73 @@
+#ifndef _PS2FRAME_DEFINED
+#define _PS2FRAME_DEFINED
+
+#include <stdint.h>
+
+//	A keyboard-to-host PS/2 frame laid out as GPIO BSRR words, for
+//	sending by DMA (PS2_DMA_TX in ps2.c).
+//
+//	Each of the 11 bits takes four words, written a quarter of a clock
+//	period apart: release the clock, set the data, pull the clock
+//	down, hold it down.  So the clock is high and low for half a period
+//	each, and the data changes a quarter period after the rising edge
+//	and a quarter before the falling one--where tim2_isr changes it.
+//	A last word releases both lines.
+//
+//	No other dependencies, so it builds on the host for the unit test
+//	(host/frametest.c).
+
+#define PS2_FRAME_BITS 11
+#define PS2_FRAME_WORDS ((PS2_FRAME_BITS * 4) + 1)
+
+#define BSRR_SET( bits) ((uint32_t) (bits))
+#define BSRR_RESET( bits) ((uint32_t) (bits) << 16)
+
+//  Given how many words have been written: nonzero if the last one
+//  pulled the clock down, so a falling edge now is our own.
+
+#define PS2_FRAME_OWN_FALL( written) (((written) & 3) == 3)
+
+//  Nonzero if the last one set the data, so we let go of the clock a
+//  quarter period ago and it should read high by now.
+
+#define PS2_FRAME_CLK_UP( written) (((written) & 3) == 2)
+
+//*	PS2FrameBuild - Lay out a frame.
+//	--------------------------------
+//
+//	Table gets PS2_FRAME_WORDS words sending What, with Clk and Data
+//	the pins' bits in the port.
+//
+
+static inline void PS2FrameBuild( uint32_t *Table, uint8_t What,
+  uint32_t Clk, uint32_t Data)
+{
+
+  int
+    i,
+    bit,
+    parity;
+
+  parity = 1;				// odd parity
+  for ( i = 0; i < PS2_FRAME_BITS; i++)
+  {
+    if ( i == 0)
+      bit = 0;				// start
+    else if ( i < 9)
+    { // data, LSB first
+      bit = (What >> (i - 1)) & 1;
+      parity ^= bit;
+    } else if ( i == 9)
+      bit = parity;
+    else
+      bit = 1;				// stop
+    *Table++ = BSRR_SET( Clk);
+    *Table++ = bit ? BSRR_SET( Data) : BSRR_RESET( Data);
+    *Table++ = BSRR_RESET( Clk);
+    *Table++ = 0;			// hold
+  } // for each bit
+  *Table = BSRR_SET( Clk | Data);	// release the lines
+  return;
+} // PS2FrameBuild
+
+#endif // _PS2FRAME_DEFINED
@@ -0,0 +1,252 @@
+#ifndef _RING_DEFINED
+#define _RING_DEFINED
+
+#include <stdint.h>
+
+//	Single-producer, single-consumer byte ring.
+//
+//	One side (usually an ISR) only ever moves In; the other only ever
+//	moves Out, so neither needs interrupts masked.  In and Out run
+//	free and are masked on use; the size must be a power of two, and
+//	all of it can be used.
+//
+//	The data is written before In is moved (and read before Out is
+//	moved), with a barrier in between, so the other side never sees
+//	a slot before it's ready.  Where a parallel array goes with the
+//	data (or DMA fills it), use RingPutSlot/RingPublish and
+//	RingGetSlot/RingRelease to get at the slot index directly.
+//
+//	Everything is inline; the header has no other dependencies, so
+//	it builds on the host as well.
+
+#if defined( __arm__)
+#define RING_BARRIER() __asm__ volatile( "dmb" ::: "memory")
+#else
+#define RING_BARRIER() __sync_synchronize()
+#endif
+
+//  Nonzero if n will do as a ring size.
+
+#define RING_SIZE_OK( n) ( (n) && !((n) & ((n) - 1)))
+
+typedef struct
+{
+  volatile uint32_t
+    In,				// producer's count
+    Out;			// consumer's count
+  uint32_t
+    Mask;			// size - 1
+  uint8_t
+    *Data;
+  volatile uint32_t
+    Overflows,			// bytes refused for want of room
+    HighWater;			// most bytes ever waiting
+} RING;
+
+//*	RingInit - Set up a ring over a buffer.
+//	---------------------------------------
+//
+//	Size must satisfy RING_SIZE_OK.
+//
+
+static inline void RingInit( RING *Ring, uint8_t *Data, uint32_t Size)
+{
+
+  Ring->In = 0;
+  Ring->Out = 0;
+  Ring->Mask = Size - 1;
+  Ring->Data = Data;
+  Ring->Overflows = 0;
+  Ring->HighWater = 0;
+  return;
+} // RingInit
+
+//*	RingLevel - Return bytes waiting.
+//	---------------------------------
+
+static inline uint32_t RingLevel( const RING *Ring)
+{
+  return Ring->In - Ring->Out;
+} // RingLevel
+
+//*	RingFree - Return room left.
+//	----------------------------
+
+static inline uint32_t RingFree( const RING *Ring)
+{
+  return Ring->Mask + 1 - (Ring->In - Ring->Out);
+} // RingFree
+
+//*	RingEmpty - See if there's nothing waiting.
+//	-------------------------------------------
+
+static inline int RingEmpty( const RING *Ring)
+{
+  return Ring->In == Ring->Out;
+} // RingEmpty
+
+//*	RingPublish - Producer: make Count more bytes visible.
+//	------------------------------------------------------
+//
+//	The bytes must already be in place.
+//
+
+static inline void RingPublish( RING *Ring, uint32_t Count)
+{
+
+  uint32_t
+    level;
+
+  RING_BARRIER();			// data before index
+  Ring->In += Count;
+  level = Ring->In - Ring->Out;
+  if ( level > Ring->HighWater)
+    Ring->HighWater = level;
+  return;
+} // RingPublish
+
+//*	RingPutSlot - Producer: find where the next byte goes.
+//	------------------------------------------------------
+//
+//	Returns the slot index, or -1 (and counts an overflow) if the
+//	ring is full.  RingPublish makes it visible.
+//
+
+static inline int RingPutSlot( RING *Ring)
+{
+
+  if ( (Ring->In - Ring->Out) > Ring->Mask)
+  { // full
+    Ring->Overflows++;
+    return -1;
+  }
+  return Ring->In & Ring->Mask;
+} // RingPutSlot
+
+//*	RingPut - Producer: add a byte.
+//	-------------------------------
+//
+//	Returns 1 if added, 0 if the ring was full.
+//
+
+static inline int RingPut( RING *Ring, uint8_t What)
+{
+
+  int
+    slot;
+
+  if ( (slot = RingPutSlot( Ring)) < 0)
+    return 0;
+  Ring->Data[ slot] = What;
+  RingPublish( Ring, 1);
+  return 1;
+} // RingPut
+
+//*	RingPutBulk - Producer: add a run of bytes, all or none.
+//	--------------------------------------------------------
+//
+//	Returns 1 if added; 0 (with Len overflows counted) if there
+//	wasn't room for all of them.  They all appear at once.
+//
+
+static inline int RingPutBulk( RING *Ring, const uint8_t *What, uint32_t Len)
+{
+
+  uint32_t
+    in;
+
+  if ( Len > RingFree( Ring))
+  {
+    Ring->Overflows += Len;
+    return 0;
+  }
+  for ( in = Ring->In; Len--; in++)
+    Ring->Data[ in & Ring->Mask] = *What++;
+  RingPublish( Ring, in - Ring->In);
+  return 1;
+} // RingPutBulk
+
+//*	RingRelease - Consumer: give back Count bytes.
+//	----------------------------------------------
+
+static inline void RingRelease( RING *Ring, uint32_t Count)
+{
+
+  RING_BARRIER();			// finish reading before freeing
+  Ring->Out += Count;
+  return;
+} // RingRelease
+
+//*	RingGetSlot - Consumer: find the oldest byte.
+//	---------------------------------------------
+//
+//	Returns the slot index, or -1 if empty.  The byte stays in the
+//	ring until RingRelease.
+//
+
+static inline int RingGetSlot( RING *Ring)
+{
+
+  if ( Ring->In == Ring->Out)
+    return -1;
+  RING_BARRIER();			// index before data
+  return Ring->Out & Ring->Mask;
+} // RingGetSlot
+
+//*	RingPeek - Consumer: look at the oldest byte.
+//	---------------------------------------------
+//
+//	Returns -1 if empty.
+//
+
+static inline int RingPeek( RING *Ring)
+{
+
+  int
+    slot;
+
+  if ( (slot = RingGetSlot( Ring)) < 0)
+    return -1;
+  return Ring->Data[ slot];
+} // RingPeek
+
+//*	RingGet - Consumer: take the oldest byte.
+//	-----------------------------------------
+//
+//	Returns -1 if empty.
+//
+
+static inline int RingGet( RING *Ring)
+{
+
+  int
+    what;
+
+  if ( (what = RingPeek( Ring)) >= 0)
+    RingRelease( Ring, 1);
+  return what;
+} // RingGet
+
+//*	RingGetBulk - Consumer: take a run of bytes, all or none.
+//	---------------------------------------------------------
+//
+//	Returns 1 if Len bytes were taken; 0 (and nothing taken) if fewer
+//	were waiting.
+//
+
+static inline int RingGetBulk( RING *Ring, uint8_t *What, uint32_t Len)
+{
+
+  uint32_t
+    out;
+
+  if ( Len > RingLevel( Ring))
+    return 0;
+  RING_BARRIER();			// index before data
+  for ( out = Ring->Out; out != Ring->Out + Len; out++)
+    *What++ = Ring->Data[ out & Ring->Mask];
+  RingRelease( Ring, Len);
+  return 1;
+} // RingGetBulk
+
+#endif // _RING_DEFINED
@@ -0,0 +1,19 @@
+#ifndef _TIMEBASE_DEFINED
+#define _TIMEBASE_DEFINED
+
+#include <stdint.h>
+
+//	Timekeeping without a periodic interrupt.
+//
+//	TimeNow reads the time on demand from the DWT cycle counter.  The
+//	heartbeat LED is blinked by TIM3 in hardware, and TIM1 is set as a
+//	one-shot only for the next deadline.  Time doesn't advance in
+//	Stop mode.
+
+#define TIME_GUARD_MS 30000	// TIM1 fires at least this often
+
+void TimeInit( void);
+uint32_t TimeNow( void);
+void TimeSetDeadline( uint32_t At);
+
+#endif // _TIMEBASE_DEFINED
@@ -0,0 +1,62 @@
+#ifndef _TRACE_DEFINED
+#define _TRACE_DEFINED
+
+#include <stdint.h>
+
+//	Binary trace log.
+//
+//	If you want a trace of what's going on, uncomment the following
+//	line.  Each call to Trace writes a 12-byte record into a RAM ring
+//	in a few dozen cycles; DMA sends the records out USART1, and the
+//	host tool tracedump turns them back into text.  Uprintf output
+//	goes the same way, as TR_TEXT records.  Needs USE_USART_DEBUG.
+
+// #define USE_TRACE 1
+
+#define TRACE_RECORDS 64	// records in the ring; a power of two
+#define TRACE_SYNC 0xa5		// first byte of every record
+
+//  What a record is about, and what its arguments are.  This header is
+//  shared with tracedump, so add new ones at the end.
+
+typedef enum
+{
+  TR_TEXT,			// Arg1 count, Arg2 up to 4 characters
+  TR_LOST,			// Arg2 records lost to a full ring
+  TR_HOST_BYTE,			// Arg1 byte from host, Arg2 HC_ action
+  TR_KEY_EVENT,			// Arg1 IR event type << 8 | key, Arg2 queued
+  TR_PS2_SENT,			// Arg1 byte, Arg2 source (0 queue, 1 FE, 2 replay)
+  TR_PS2_ABORT,			// Arg1 byte cut off by the host
+  TR_PS2_RX_ERROR,		// Arg1 byte, Arg2 1 parity, 2 stop bit
+  TR_PS2_RATE,			// Arg1 1 if faster, Arg2 new clock rate, Hz
+  TR_PS2_DROP,			// Arg1 sequence length dropped
+  TR_WAKE,			// Arg1 1 IR, 2 host, Arg2 wakeup us
+  TR_COUNT
+} TRACE_ID;
+
+//  One record, as sent (little-endian).
+
+typedef struct
+{
+  uint8_t
+    Sync,			// TRACE_SYNC
+    Id;				// TRACE_ID
+  uint16_t
+    Arg1;
+  uint32_t
+    Arg2,
+    Stamp;			// DWT cycle count
+} TRACE_RECORD;
+
+#ifdef USE_TRACE
+void TraceInit( void);
+void Trace( TRACE_ID Id, uint16_t Arg1, uint32_t Arg2);
+void TraceText( char What);
+void TraceFlush( void);
+uint32_t TraceLostCount( void);
+#else
+#define TraceInit()			// all no-ops
+#define Trace( id, arg1, arg2) ((void) (arg1), (void) (arg2))
+#endif
+
+#endif // _TRACE_DEFINED
@@ -2,14 +2,27 @@
 
 #ifndef UART_H_DEFINED
 
+#include <stdint.h>
+
+//  Each of the two output buffers holds this many characters.
+
+#ifndef UART_TX_BUF_LEN
+#define UART_TX_BUF_LEN 256
+#endif
+
+#define UART_RX_BUF_LEN 64	// typed characters held; a power of two
+
 void InitUART( int Baudrate);
 int Ucharavail( void);
 unsigned char Ugetchar( void);
+int Ureadchar( void);
 void Uputchar( unsigned char What);
 void Uputs( char *What);
 void Uprintf( char *Form,...);
 char *Ugets( char *buf, int len);
 char *Hexin( unsigned int *RetVal, unsigned int *Digits, char *Buf);
+uint32_t UDropCount( void);
+void UFlush( void);
 
 #define UART_H_DEFINED 1
 #endif
@@ -0,0 +1,421 @@
+//  Diagnostics console.
+//  --------------------
+//
+//	A small command shell on the debug port.  usart1_isr puts each
+//	character typed into a ring and posts EV_CONSOLE; ConsoleProcess
+//	then takes whatever's there, echoes it, and runs the line when
+//	CR or LF comes.  Nothing here waits for input, so the keyboard
+//	carries on as usual between (and during) commands.
+//
+//	Numbers are hex, as in the keymap, except for times in ms and
+//	rates in Hz, which are decimal.  Type "help" for the list.
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+#include "debug.h"
+#include "console.h"
+#include "ps2.h"
+#include "ir.h"
+#include "power.h"
+#include "latency.h"
+#include "profile.h"
+#include "trace.h"
+
+#ifdef USE_CONSOLE
+
+#ifndef USE_USART_DEBUG
+#error "USE_CONSOLE needs USE_USART_DEBUG"
+#endif
+
+#define TIMEOUT_GAP_MAX (UINT32_MAX / CYCLES_PER_MS)	// ms; see CmdTimeout
+
+typedef struct
+{
+  const char
+    *Name;
+  void
+    (*Run)( char *Args);
+  const char
+    *Help;
+} CONSOLE_COMMAND;
+
+static IR_DECODER
+  *ConsoleDecoder;
+
+static HOST_CMD
+  *ConsoleHost;
+
+static uint16_t
+  *ConsoleKeys;
+
+static char
+  ConsoleLine[ CONSOLE_LINE_LEN + 1];
+
+static int
+  ConsoleLen;
+
+static void ConsoleRun( char *Line);
+static char *ConsoleWord( char **Line);
+static void CmdHelp( char *Args);
+static void CmdStats( char *Args);
+static void CmdLatency( char *Args);
+static void CmdProfile( char *Args);
+static void CmdKey( char *Args);
+static void CmdTimeout( char *Args);
+static void CmdRate( char *Args);
+static void CmdIR( char *Args);
+
+static const CONSOLE_COMMAND
+  ConsoleCommands[] =
+  {
+    { "help", CmdHelp, "list commands" },
+    { "stats", CmdStats, "show counters" },
+    { "latency", CmdLatency, "show key latency" },
+    { "profile", CmdProfile, "show ISR times; profile reset" },
+    { "key", CmdKey, "key kk [vvvv] - show or set keymap entry" },
+    { "timeout", CmdTimeout,
+      "timeout [pair|repeat|stop ms] - show or set timeouts" },
+    { "rate", CmdRate, "rate [hz] - show or set PS/2 clock" },
+    { "ir", CmdIR, "ir bb bb ... - feed bytes to the IR decoder" },
+    { 0, 0, 0 }
+  };
+
+//*	ConsoleInit - Start the console.
+//	--------------------------------
+//
+//	Decoder, Host and Keys are what the commands look at and change.
+//
+
+void ConsoleInit( IR_DECODER *Decoder, HOST_CMD *Host, uint16_t *Keys)
+{
+
+  ConsoleDecoder = Decoder;
+  ConsoleHost = Host;
+  ConsoleKeys = Keys;
+  ConsoleLen = 0;
+  Uprintf( "> ");
+  return;
+} // ConsoleInit
+
+//*	ConsoleProcess - Take what's been typed.
+//	----------------------------------------
+//
+//	The EV_CONSOLE handler.  Backspace and DEL rub out; anything past
+//	the end of the line is ignored.
+//
+
+void ConsoleProcess( void)
+{
+
+  int
+    c;
+
+  while ( (c = Ureadchar()) != -1)
+  {
+    if ( c == '\r' || c == '\n')
+    {
+      Uputs( "\n");
+      ConsoleLine[ ConsoleLen] = 0;
+      ConsoleLen = 0;
+      ConsoleRun( ConsoleLine);
+      Uprintf( "> ");
+    } else if ( c == '\b' || c == 127)
+    {
+      if ( ConsoleLen)
+      {
+        Uputs( "\b \b");	// backspace-space-backspace
+        ConsoleLen--;
+      }
+    } else if ( c >= ' ' && ConsoleLen < CONSOLE_LINE_LEN)
+    {
+      Uputchar( c);
+      ConsoleLine[ ConsoleLen++] = c;
+    }
+  } // while characters
+  return;
+} // ConsoleProcess
+
+//	ConsoleRun - Run a command line.
+//	--------------------------------
+
+static void ConsoleRun( char *Line)
+{
+
+  char
+    *name;
+
+  const CONSOLE_COMMAND
+    *cmd;
+
+  if ( !*(name = ConsoleWord( &Line)))
+    return;			// empty line
+  for ( cmd = ConsoleCommands; cmd->Name; cmd++)
+  {
+    if ( !strcmp( name, cmd->Name))
+    {
+      (*cmd->Run)( Line);
+      return;
+    }
+  } // for each command
+  Uprintf( "%s? Try help\n", name);
+  return;
+} // ConsoleRun
+
+//	ConsoleWord - Split off the next word.
+//	--------------------------------------
+//
+//	Returns the word (empty if none) and moves Line past it.
+//
+
+static char *ConsoleWord( char **Line)
+{
+
+  char
+    *p,
+    *word;
+
+  for ( p = *Line; *p == ' '; p++)
+    ;
+  word = p;
+  while ( *p && *p != ' ')
+    p++;
+  if ( *p)
+    *p++ = 0;
+  *Line = p;
+  return word;
+} // ConsoleWord
+
+//	CmdHelp - List the commands.
+//	----------------------------
+
+static void CmdHelp( char *Args)
+{
+
+  const CONSOLE_COMMAND
+    *cmd;
+
+  (void) Args;
+  for ( cmd = ConsoleCommands; cmd->Name; cmd++)
+    Uprintf( "%8s  %s\n", cmd->Name, cmd->Help);
+  return;
+} // CmdHelp
+
+//	CmdStats - Show the counters.
+//	-----------------------------
+
+static void CmdStats( char *Args)
+{
+
+  (void) Args;
+  Uprintf( "IR: %d frames, %d overrun %d framing %d noise, %d lost\n",
+    IrFrameCount, IrOverrunErrors, IrFramingErrors, IrNoiseErrors,
+    IrRxRing.Overflows);
+  Uprintf( "Decoder: %d frames, %d resyncs %d timeouts %d stale\n",
+    ConsoleDecoder->Frames, ConsoleDecoder->Resyncs,
+    ConsoleDecoder->Timeouts, ConsoleDecoder->StaleRepeats);
+  Uprintf( "PS/2 out: %d queued, %d max, %d dropped %d aborted %d retried\n",
+    PS2TxLevel(), PS2TxMaxLevel(), PS2TxDropCount(), PS2TxAbortCount(),
+    PS2TxRetryCount());
+  Uprintf( "PS/2 in: %d errors, %d replays, %d Hz\n",
+    PS2RxErrorCount(), PS2ReplayCount(), PS2GetRate());
+  Uprintf( "Host: %d commands, %d unknown %d bad %d abandoned, %s\n",
+    ConsoleHost->Commands, ConsoleHost->Unknown, ConsoleHost->BadParams,
+    ConsoleHost->Abandoned, ConsoleHost->Enabled ? "enabled" : "disabled");
+#ifdef USE_TRACE
+  Uprintf( "Debug: %d trace records lost\n", UDropCount());
+#else
+  Uprintf( "Debug: %d characters dropped\n", UDropCount());
+#endif
+#ifdef USE_STOP_MODE
+  Uprintf( "Stop: %d times, %d IR %d host wakes, %d keys lost, "
+    "wake %d us (max %d)\n",
+    PowerStats.Stops, PowerStats.IrWakes, PowerStats.HostWakes,
+    PowerStats.FirstKeysDropped, PowerStats.WakeUs, PowerStats.WakeUsMax);
+#endif
+#ifdef PS2_JITTER_PROBE
+  {
+    uint32_t
+      worst,
+      average,
+      edges;
+
+    PS2JitterStats( &worst, &average, &edges);
+    Uprintf( "PS/2 edge latency: worst %d avg %d cycles, %d edges\n",
+      worst, average, edges);
+  }
+#endif
+  return;
+} // CmdStats
+
+//	CmdLatency - Show the latency figures.
+//	--------------------------------------
+
+static void CmdLatency( char *Args)
+{
+
+  (void) Args;
+#ifdef USE_LATENCY_STATS
+  LatencyReport( 1);
+#else
+  Uprintf( "Not built in (USE_LATENCY_STATS)\n");
+#endif
+  return;
+} // CmdLatency
+
+//	CmdProfile - Show or clear the ISR figures.
+//	-------------------------------------------
+
+static void CmdProfile( char *Args)
+{
+
+#ifdef USE_ISR_PROFILE
+  if ( !strcmp( ConsoleWord( &Args), "reset"))
+    ProfileReset();
+  else
+    ProfileReport();
+#else
+  (void) Args;
+  Uprintf( "Not built in (USE_ISR_PROFILE)\n");
+#endif
+  return;
+} // CmdProfile
+
+//	CmdKey - Show or change a keymap entry.
+//	---------------------------------------
+//
+//	key kk shows what IR key kk sends; key kk vvvv changes it.  The
+//	high byte of vvvv is the prefix (e0), if any; 0 sends nothing.
+//
+
+static void CmdKey( char *Args)
+{
+
+  unsigned int
+    key,
+    value,
+    digits;
+
+  Args = Hexin( &key, &digits, Args);
+  if ( !digits || key > 0xff)
+  {
+    Uprintf( "key kk [vvvv]\n");
+    return;
+  }
+  key &= 127;			// as SendKeyEvent does
+  Hexin( &value, &digits, Args);
+  if ( digits)
+    ConsoleKeys[ key] = (uint16_t) value;
+  Uprintf( "%02x: %04x\n", key, ConsoleKeys[ key]);
+  return;
+} // CmdKey
+
+//	CmdTimeout - Show or change a timeout.
+//	--------------------------------------
+//
+//	pair is the longest gap inside an IR frame, repeat the longest
+//	wait for a typematic repeat, stop the idle time before Stop mode.
+//	pair and repeat are kept in DWT cycles, so can't be more than one
+//	turn of the counter (59.6 s at 72 MHz).
+//
+
+static void CmdTimeout( char *Args)
+{
+
+  char
+    *name;
+
+  unsigned long
+    ms;
+
+  name = ConsoleWord( &Args);
+  ms = strtoul( Args, 0, 10);
+  if ( *name && !ms)
+  {
+    Uprintf( "timeout pair|repeat|stop ms\n");
+    return;
+  }
+
+  if ( (!strcmp( name, "pair") || !strcmp( name, "repeat")) &&
+       ms > TIMEOUT_GAP_MAX)
+  {
+    Uprintf( "%s is %d ms at most\n", name, TIMEOUT_GAP_MAX);
+    return;
+  }
+
+  if ( !strcmp( name, "pair"))
+    ConsoleDecoder->PairGap = (uint32_t) ms * CYCLES_PER_MS;
+  else if ( !strcmp( name, "repeat"))
+    ConsoleDecoder->RepeatGap = (uint32_t) ms * CYCLES_PER_MS;
+#ifdef USE_STOP_MODE
+  else if ( !strcmp( name, "stop"))
+    PowerSetIdle( (uint32_t) ms);
+#endif
+  else if ( *name)
+  {
+    Uprintf( "%s? pair or repeat%s\n", name,
+#ifdef USE_STOP_MODE
+      " or stop");
+#else
+      "");
+#endif
+    return;
+  }
+  Uprintf( "pair %d ms, repeat %d ms\n",
+    ConsoleDecoder->PairGap / CYCLES_PER_MS,
+    ConsoleDecoder->RepeatGap / CYCLES_PER_MS);
+  return;
+} // CmdTimeout
+
+//	CmdRate - Show or change the PS/2 clock rate.
+//	---------------------------------------------
+
+static void CmdRate( char *Args)
+{
+
+  uint32_t
+    hz;
+
+  if ( (hz = strtoul( Args, 0, 10)) && !PS2SetRate( hz))
+    Uprintf( "%d to %d Hz\n", PS2_RATE_MIN, PS2_RATE_MAX);
+  Uprintf( "PS/2 clock %d Hz\n", PS2GetRate());
+  return;
+} // CmdRate
+
+//	CmdIR - Feed bytes to the IR decoder.
+//	-------------------------------------
+//
+//	As one frame, as though the sensor had received them just now.
+//
+
+static void CmdIR( char *Args)
+{
+
+  uint8_t
+    bytes[ 8];
+
+  unsigned int
+    value,
+    digits;
+
+  int
+    len;
+
+  for ( len = 0; len < (int) sizeof( bytes); len++)
+  {
+    Args = Hexin( &value, &digits, Args);
+    if ( !digits)
+      break;
+    bytes[ len] = (uint8_t) value;
+  } // for each byte
+  if ( !len)
+    Uprintf( "ir bb bb ...\n");
+  else if ( !IRInject( bytes, len))
+    Uprintf( "Can't inject now\n");
+  return;
+} // CmdIR
+
+#endif // USE_CONSOLE
@@ -0,0 +1,124 @@
+//  Main loop event dispatcher.
+//  ---------------------------
+//
+//	Rather than poll everything all the time, the main loop sleeps
+//	until an interrupt handler posts an event.  The check for pending
+//	events is made with interrupts off, so one posted just before the
+//	WFI still wakes it: a pending interrupt ends WFI even when it
+//	can't be taken yet, and it's taken as soon as they're back on.
+//
+//	With USE_STOP_MODE, after long enough with nothing doing, we
+//	stop (power.c) rather than just sleep.
+//
+//	After each handler, we start again from the top, so a host
+//	command that comes in while IR bytes are being handled is dealt
+//	with next.
+//
+
+#include <stdint.h>
+
+#include <libopencm3/cm3/cortex.h>
+
+#include "event.h"
+#include "power.h"
+
+volatile uint8_t
+  EventPending[ EV_COUNT];
+
+static EVENT_HANDLER
+  EventHandlers[ EV_COUNT];
+
+static int EventAny( void);
+
+//*	EventInit - Clear all events and handlers.
+//	------------------------------------------
+
+void EventInit( void)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < EV_COUNT; i++)
+  {
+    EventPending[ i] = 0;
+    EventHandlers[ i] = 0;
+  }
+  return;
+} // EventInit
+
+//*	EventSetHandler - Say what to call for an event.
+//	------------------------------------------------
+
+void EventSetHandler( EVENT_ID Id, EVENT_HANDLER Handler)
+{
+
+  EventHandlers[ Id] = Handler;
+  return;
+} // EventSetHandler
+
+//*	EventRun - Run the main loop.
+//	-----------------------------
+//
+//	Never returns.  Every event is run once at the start, so anything
+//	that arrived before we got here is picked up.
+//
+
+void EventRun( void)
+{
+
+  int
+    i;
+
+#ifdef USE_STOP_MODE
+  int
+    stopDue;
+#endif
+
+  for ( i = 0; i < EV_COUNT; i++)
+    EventPost( (EVENT_ID) i);
+
+  while (1)
+  {
+#ifdef USE_STOP_MODE
+    stopDue = PowerStopDue();	// reads the time: not with interrupts off
+#endif
+    cm_disable_interrupts();
+    if ( !EventAny())
+    { // sleep until an interrupt is pending
+#ifdef USE_STOP_MODE
+      if ( stopDue && PowerQuiet())
+        PowerStop();		// deeply
+      else
+#endif
+        EVENT_WAIT();
+    }
+    cm_enable_interrupts();	// and take it
+
+    for ( i = 0; i < EV_COUNT; i++)
+    {
+      if ( EventPending[ i])
+      { // highest priority first
+        EventPending[ i] = 0;	// cleared before, so a new post isn't lost
+        if ( EventHandlers[ i])
+          (*EventHandlers[ i])();
+        break;			// and look again from the top
+      }
+    } // for each event
+  } // while
+} // EventRun
+
+//	EventAny - See if any event is pending.
+//	---------------------------------------
+
+static int EventAny( void)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < EV_COUNT; i++)
+    if ( EventPending[ i])
+      return 1;
+  return 0;
+} // EventAny
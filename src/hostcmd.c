@@ -0,0 +1,234 @@
+//  PS/2 host command processor.
+//  ----------------------------
+//
+//	Usually, the response to a host command is an ACK, but there are
+//	some exceptions.  Since we don't have an adjustable typematic
+//	rate, most of these just say "I got it", but the settings are
+//	remembered so they can be reported back.  We only send scan set
+//	2, so asking for 1 or 3 gets a RESEND; the host then knows it's
+//	getting 2, and a query never says otherwise.
+//
+//	ED (LEDs), F0 (scan set) and F3 (typematic) take a parameter.
+//	Rather than wait for it, we ACK the command and remember that a
+//	parameter is due; the next byte from the host is taken as that
+//	parameter.  No parameter is ever 0xed or above, so a byte in that
+//	range is a new command and the old one is forgotten--which is
+//	what a BIOS that gives up on us and sends a reset expects.
+//
+//	The scan set 3 commands FB, FC and FD (set keys typematic only,
+//	make/break, make only) are followed by a list of keys, each
+//	ACKed, up to the next command.  We ACK and forget them the same
+//	way, so none of the list is taken as a command.
+//
+//	HOST_RESEND normally never gets here; ps2.c answers it itself.
+//
+
+#include <stdint.h>
+
+#include "ps2.h"
+#include "hostcmd.h"
+
+static void HostCmdDefaults( HOST_CMD *Cmd);
+static int HostCmdCommand( HOST_CMD *Cmd, uint8_t What);
+static int HostCmdParam( HOST_CMD *Cmd, uint8_t What);
+static int HostCmdReply( HOST_CMD *Cmd, const uint8_t *What, int Len);
+
+#define HOST_LAST_PARAM 0xec	// parameters are never above this
+#define SCAN_SET_DEFAULT 2	// the only one we send
+#define TYPEMATIC_DEFAULT 0x2b	// 10.9 cps, 500 ms
+
+//*	HostCmdInit - Initialize the command processor.
+//	-----------------------------------------------
+
+void HostCmdInit( HOST_CMD *Cmd)
+{
+
+  Cmd->State = HCS_COMMAND;
+  Cmd->Command = 0;
+  Cmd->Leds = 0;
+  Cmd->Enabled = 1;
+  Cmd->ReplyLen = 0;
+  Cmd->Commands = 0;
+  Cmd->Unknown = 0;
+  Cmd->BadParams = 0;
+  Cmd->Abandoned = 0;
+  HostCmdDefaults( Cmd);
+  return;
+} // HostCmdInit
+
+//*	HostCmdByte - Take one byte from the host.
+//	------------------------------------------
+//
+//	Returns a combination of the HC_ flags; zero if nothing needs
+//	doing.  If HC_RESET is set, anything still waiting to go to the
+//	host should be dropped before the reply is sent.
+//
+
+int HostCmdByte( HOST_CMD *Cmd, uint8_t What)
+{
+
+  static const uint8_t
+    ack[] = { KEY_ACK };
+
+  Cmd->ReplyLen = 0;
+  if ( Cmd->State == HCS_PARAM)
+  {
+    Cmd->State = HCS_COMMAND;
+    if ( What <= HOST_LAST_PARAM)
+      return HostCmdParam( Cmd, What);
+    Cmd->Abandoned++;		// a new command instead
+  } else if ( Cmd->State == HCS_KEYS)
+  {
+    if ( What <= HOST_LAST_PARAM)
+      return HostCmdReply( Cmd, ack, sizeof( ack));	// one more key
+    Cmd->State = HCS_COMMAND;	// end of the list
+  }
+  return HostCmdCommand( Cmd, What);
+} // HostCmdByte
+
+//	HostCmdDefaults - Put the settings back to power-up.
+//	----------------------------------------------------
+//
+//	The LEDs and whether we're enabled are left alone.
+//
+
+static void HostCmdDefaults( HOST_CMD *Cmd)
+{
+
+  Cmd->Typematic = TYPEMATIC_DEFAULT;
+  Cmd->ScanSet = SCAN_SET_DEFAULT;
+  return;
+} // HostCmdDefaults
+
+//	HostCmdCommand - Handle a command byte.
+//	---------------------------------------
+
+static int HostCmdCommand( HOST_CMD *Cmd, uint8_t What)
+{
+
+  static const uint8_t
+    ack[] = { KEY_ACK },
+    resend[] = { KEY_RESEND },
+    echo[] = { KEY_ECHO },
+    resetReply[] = { KEY_ACK, KEY_BAT },
+    idReply[] = { KEY_ACK, 0xab, 0x83 };	// default 101-key
+
+  Cmd->Commands++;
+  switch( What)
+  {
+    case HOST_RESET:
+      HostCmdDefaults( Cmd);
+      Cmd->Enabled = 1;
+      Cmd->Leds = 0;		// turn the LEDs off
+      HostCmdReply( Cmd, resetReply, sizeof( resetReply));
+      return HC_RESET | HC_REPLY | HC_LEDS;
+
+    case HOST_RESEND:		// ps2.c should have had this
+      return 0;
+
+    case HOST_DEFAULT:
+      HostCmdDefaults( Cmd);
+      Cmd->Enabled = 1;
+      return HostCmdReply( Cmd, ack, sizeof( ack));
+
+    case HOST_DISABLE:		// defaults, and stop sending keys
+      HostCmdDefaults( Cmd);
+      Cmd->Enabled = 0;
+      return HostCmdReply( Cmd, ack, sizeof( ack));
+
+    case HOST_ENABLE:
+      Cmd->Enabled = 1;
+      return HostCmdReply( Cmd, ack, sizeof( ack));
+
+    case HOST_ECHO:		// respond with echo
+      return HostCmdReply( Cmd, echo, sizeof( echo));
+
+    case HOST_ID:		// get keyboard ID
+      return HostCmdReply( Cmd, idReply, sizeof( idReply));
+
+    case HOST_TYPEMATIC:	// we need another byte
+    case HOST_SET_SCAN:
+    case HOST_SET_LED:
+      Cmd->Command = What;
+      Cmd->State = HCS_PARAM;
+      return HostCmdReply( Cmd, ack, sizeof( ack));
+
+    default:
+      if ( What >= 0xfb && What <= 0xfd)
+      { // scan set 3 key type for a list of keys--take the list
+        Cmd->Command = What;
+        Cmd->State = HCS_KEYS;
+        return HostCmdReply( Cmd, ack, sizeof( ack));
+      } else if ( What >= 0xf7 && What <= 0xfa)
+      { // and for all keys--just say OK
+        return HostCmdReply( Cmd, ack, sizeof( ack));
+      }
+      Cmd->Unknown++;
+      return HostCmdReply( Cmd, resend, sizeof( resend));
+  } // switch
+} // HostCmdCommand
+
+//	HostCmdParam - Handle the parameter of a two-byte command.
+//	----------------------------------------------------------
+
+static int HostCmdParam( HOST_CMD *Cmd, uint8_t What)
+{
+
+  uint8_t
+    scanReply[ 2];
+
+  static const uint8_t
+    ack[] = { KEY_ACK },
+    resend[] = { KEY_RESEND };
+
+  switch( Cmd->Command)
+  {
+    case HOST_SET_LED:
+      Cmd->Leds = What & 7;
+      HostCmdReply( Cmd, ack, sizeof( ack));
+      return HC_REPLY | HC_LEDS;
+
+    case HOST_SET_SCAN:
+      if ( What == 0)
+      { // query--say which one
+        scanReply[ 0] = KEY_ACK;
+        scanReply[ 1] = Cmd->ScanSet;
+        return HostCmdReply( Cmd, scanReply, sizeof( scanReply));
+      } else if ( What == SCAN_SET_DEFAULT)
+      {
+        Cmd->ScanSet = What;
+        return HostCmdReply( Cmd, ack, sizeof( ack));
+      }
+      break;			// 1 and 3 too: we can't send them
+
+    case HOST_TYPEMATIC:
+      if ( !(What & 0x80))
+      {
+        Cmd->Typematic = What;
+        return HostCmdReply( Cmd, ack, sizeof( ack));
+      }
+      break;
+  } // switch
+
+  Cmd->BadParams++;		// ask for it again
+  Cmd->State = HCS_PARAM;
+  return HostCmdReply( Cmd, resend, sizeof( resend));
+} // HostCmdParam
+
+//	HostCmdReply - Set up the reply.
+//	--------------------------------
+//
+//	Returns HC_REPLY.
+//
+
+static int HostCmdReply( HOST_CMD *Cmd, const uint8_t *What, int Len)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < Len; i++)
+    Cmd->Reply[ i] = What[ i];
+  Cmd->ReplyLen = Len;
+  return HC_REPLY;
+} // HostCmdReply
@@ -8,28 +8,54 @@
 
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
-#include <libopencm3/cm3/systick.h>
 #include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
 #include <libopencm3/stm32/timer.h>
 #include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
 
 #include "debug.h"
 #include "gpiodef.h"
 #include "globals.h"
 #include "ir.h"
+#include "irqprio.h"
+#include "profile.h"
+#include "event.h"
+
+#if !RING_SIZE_OK( IR_RX_BUFFER_SIZE)
+#error IR_RX_BUFFER_SIZE must be a power of two
+#endif
+
+#ifdef IR_USE_DMA
+static void IrDmaPublish( int AtIdle);
+#endif
 
 //*     SetupIRSensor - Set up UART3 for the IR sensor.
 //      -----------------------------------------------
 //
 //      Basically, 1200 N81
+//
+//	With IR_USE_DMA, DMA1 channel 3 (USART3 RX) fills IrRxBuffer
+//	as a circular buffer and only the idle-line, error and DMA
+//	half/full interrupts are taken.
+//
+//	The DWT cycle counter is started here for the byte timestamps.
 
 void SetupIRSensor( void)
 {
 
-  IrRxBufferIn = 0;
-  IrRxBufferOut = 0;		// make sure buffer is empty
+  dwt_enable_cycle_counter();
+
+  RingInit( &IrRxRing, IrRxBuffer, IR_RX_BUFFER_SIZE);
+  IrRxIdle = 1;
+  IrFrameCount = 0;
+  IrOverrunErrors = 0;
+  IrFramingErrors = 0;
+  IrNoiseErrors = 0;
 
   rcc_periph_clock_enable(RCC_USART3);
+  nvic_set_priority( NVIC_USART3_IRQ, IRQ_PRIO_IR);
   nvic_enable_irq( NVIC_USART3_IRQ);
   usart_set_baudrate(USART3, 1200);	// keyboard is 1200 bps, N81
   usart_set_databits(USART3, 8);
@@ -37,73 +63,209 @@ void SetupIRSensor( void)
   usart_set_mode(USART3, USART_MODE_RX);
   usart_set_parity(USART3, USART_PARITY_NONE);
   usart_set_flow_control(USART3, USART_FLOWCONTROL_NONE);
+
+#ifdef IR_USE_DMA
+  rcc_periph_clock_enable(RCC_DMA1);
+  dma_channel_reset( DMA1, DMA_CHANNEL3);
+  dma_set_peripheral_address( DMA1, DMA_CHANNEL3, 
+    (uint32_t) &USART_DR(USART3));
+  dma_set_memory_address( DMA1, DMA_CHANNEL3, (uint32_t) IrRxBuffer);
+  dma_set_number_of_data( DMA1, DMA_CHANNEL3, IR_RX_BUFFER_SIZE);
+  dma_set_read_from_peripheral( DMA1, DMA_CHANNEL3);
+  dma_enable_memory_increment_mode( DMA1, DMA_CHANNEL3);
+  dma_set_peripheral_size( DMA1, DMA_CHANNEL3, DMA_CCR_PSIZE_8BIT);
+  dma_set_memory_size( DMA1, DMA_CHANNEL3, DMA_CCR_MSIZE_8BIT);
+  dma_enable_circular_mode( DMA1, DMA_CHANNEL3);
+  dma_set_priority( DMA1, DMA_CHANNEL3, DMA_CCR_PL_HIGH);
+  dma_enable_half_transfer_interrupt( DMA1, DMA_CHANNEL3);
+  dma_enable_transfer_complete_interrupt( DMA1, DMA_CHANNEL3);
+  nvic_set_priority( NVIC_DMA1_CHANNEL3_IRQ, IRQ_PRIO_IR);
+  nvic_enable_irq( NVIC_DMA1_CHANNEL3_IRQ);
+  dma_enable_channel( DMA1, DMA_CHANNEL3);
+  usart_enable_rx_dma( USART3);
+  USART_CR3(USART3) |= USART_CR3_EIE;	// interrupt on overrun/noise/framing
+#else
   USART_CR1(USART3) |= USART_CR1_RXNEIE;	// enable receive interrupt
+#endif
+  USART_CR1(USART3) |= USART_CR1_IDLEIE;	// and on end of frame
   usart_enable( USART3);
 } // SetupIRSensor
 
-//*	USART3 (IR Sensor) Receive ISR
-//	------------------------------
+#ifdef IR_USE_DMA
+//	IrDmaPublish - Make bytes written by DMA visible.
+//	-------------------------------------------------
+//
+//	Moves the ring's input up to the DMA write position.  Called at
+//	the end of a frame, and when the DMA has filled half or all of
+//	the buffer--frames sent back to back never let the line go idle,
+//	and would otherwise lap the buffer.
 //
-//	Just adds a character to the buffer, if possible.
+//	The input always follows the DMA, even if the consumer has fallen
+//	so far behind that its oldest unread bytes were written over.  The
+//	bytes lost are counted, and the ring is left holding more than it
+//	can; GetIRByte takes that as the sign to skip them, which leaves
+//	the newest IR_RX_BUFFER_SIZE bytes, in order.
+//
+//	The bytes arrive back to back, so each one is stamped by counting
+//	back from now: from one character time after the last byte if the
+//	line has just gone idle (AtIdle), from the last byte if not.
 //
 
-void usart3_isr(void)
+static void IrDmaPublish( int AtIdle)
 {
 
-  if ( ((USART_CR1(USART3) & USART_CR1_RXNEIE) != 0) &&
-       ((USART_SR(USART3) & USART_SR_RXNE) != 0)) 
+  uint32_t
+    dmaPos,
+    newBytes,
+    level,
+    i,
+    stamp;
+
+  dmaPos = IR_RX_BUFFER_SIZE - DMA_CNDTR( DMA1, DMA_CHANNEL3);
+  newBytes = (dmaPos - IrRxRing.In) & IrRxRing.Mask;
+  level = RingLevel( &IrRxRing);
+  if ( level > IR_RX_BUFFER_SIZE)
+    level = IR_RX_BUFFER_SIZE;		// last loss not skipped yet
+  if ( newBytes > IR_RX_BUFFER_SIZE - level)
+    IrRxRing.Overflows += newBytes - (IR_RX_BUFFER_SIZE - level);
+
+  stamp = dwt_read_cycle_counter() - 
+    ((newBytes - (AtIdle ? 0 : 1)) * IR_CHAR_CYCLES);
+  for ( i = 0; i < newBytes; i++)
   {
+    IrRxStamp[ (IrRxRing.In + i) & IrRxRing.Mask] = stamp;
+    stamp += IR_CHAR_CYCLES;
+  } // for each new byte
 
-    int rxNext;
+  RingPublish( &IrRxRing, newBytes);
+  if ( IrRxRing.HighWater > IR_RX_BUFFER_SIZE)
+    IrRxRing.HighWater = IR_RX_BUFFER_SIZE;	// not counting the lost
+} // IrDmaPublish
 
-    IrRxBuffer[ IrRxBufferIn] = usart_recv( USART3);
-    rxNext = IrRxBufferIn+1;
-    if ( rxNext >= IR_RX_BUFFER_SIZE)
-      rxNext = 0;			// wrap around
-    if ( rxNext != IrRxBufferOut)
-    {
-      IrRxBufferIn = rxNext;	// stuff the new byte
-    } 
-  } // if we have a character.
+//	DMA1 channel 3 interrupt - the IR buffer is half or all full.
+//	-------------------------------------------------------------
 
+void dma1_channel3_isr(void)
+{
 
-} // usart3_isr
+  ProfileEnter( PROF_DMA3);
+  dma_clear_interrupt_flags( DMA1, DMA_CHANNEL3, DMA_HTIF | DMA_TCIF);
+  IrRxIdle = 0;			// a byte just came; more may follow
+  IrDmaPublish( 0);
+  EventPost( EV_IR);
+  ProfileExit( PROF_DMA3);
+} // dma1_channel3_isr
+#endif
 
-//  Sys_tick_handler - called every millisecond.
-//  --------------------------------------------
+//*	IRInject - Feed bytes in as though the sensor received them.
+//	------------------------------------------------------------
 //
-//	also toggle the LED once per second.
+//	For testing from the console.  The bytes go into the ring as one
+//	frame, stamped now, and the line is marked idle after them.  The
+//	ring has one producer, so usart3_isr is kept out while we do it.
+//
+//	Returns 1 if queued; 0 if there wasn't room, or with IR_USE_DMA,
+//	where the ring's input belongs to the DMA.
 //
 
-
-void sys_tick_handler( void)
+int IRInject( const uint8_t *What, int Len)
 {
-  TickCount++;
 
-  if ( !(TickCount & 0x3ff))
-  {  // Every 1024 milliseconds, blink LED
-    gpio_toggle(LED_GPIO, LED_BIT); // LED on/off 
+#ifdef IR_USE_DMA
+  (void) What;
+  (void) Len;
+  return 0;
+#else
+  uint32_t
+    wasMasked,
+    stamp;
+
+  int
+    i;
+
+  wasMasked = cm_mask_interrupts( 1);
+  if ( (uint32_t) Len > RingFree( &IrRxRing))
+  {
+    cm_mask_interrupts( wasMasked);
+    return 0;
   }
-} // sys_tick_handler
+  stamp = dwt_read_cycle_counter();
+  for ( i = 0; i < Len; i++)
+  {
+    IrRxBuffer[ (IrRxRing.In + i) & IrRxRing.Mask] = What[ i];
+    IrRxStamp[ (IrRxRing.In + i) & IrRxRing.Mask] = stamp;
+  }
+  RingPublish( &IrRxRing, Len);
+  IrRxIdle = 1;
+  EventPost( EV_IR);
+  cm_mask_interrupts( wasMasked);
+  return 1;
+#endif
+} // IRInject
 
-//*	SetupSysTick - Configure System Timer.
-//	---------------------------------------
+//*	USART3 (IR Sensor) Receive ISR
+//	------------------------------
+//
+//	Adds a character to the buffer, if possible; or, in DMA mode,
+//	publishes what the DMA has stored.  Line errors are counted and
+//	bytes with a framing error are thrown away.  The idle-line
+//	interrupt sets IrRxIdle to mark the end of a frame.
 //
-//	We interrupt every 1 msec.
+//	Reading SR followed by DR clears the error and IDLE flags.
 //
-  
-void SetupSysTick( void)
+
+void usart3_isr(void)
 {
 
-// 72MHz / 8 => 9,000,000 counts per second 
+  uint32_t
+    status;
+
+  ProfileEnter( PROF_USART3);
+  status = USART_SR(USART3);
+
+  if ( status & USART_SR_ORE)
+    IrOverrunErrors++;
+  if ( status & USART_SR_NE)
+    IrNoiseErrors++;
+  if ( status & USART_SR_FE)
+    IrFramingErrors++;
 
-  systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+#ifndef IR_USE_DMA
+  if ( ((USART_CR1(USART3) & USART_CR1_RXNEIE) != 0) &&
+       ((status & USART_SR_RXNE) != 0)) 
+  {
 
-//  9000000/9000 = 1000 overflows per second - every 1ms one interrupt 
+    int slot;
+    uint8_t rxData;
 
-  systick_set_reload(8999);  //  SysTick interrupt every N clock pulses 
-  systick_interrupt_enable();
-  TickCount = 0;	     // clear tick counter
-  systick_counter_enable();
-} // SetupSysTick
+    rxData = usart_recv( USART3);
+    if ( !(status & USART_SR_FE))
+    { // good byte
+      if ( (slot = RingPutSlot( &IrRxRing)) >= 0)
+      { // stuff the new byte; full ring counts the loss
+        IrRxBuffer[ slot] = rxData;
+        IrRxStamp[ slot] = dwt_read_cycle_counter();
+        RingPublish( &IrRxRing, 1);
+      }
+      IrRxIdle = 0;
+      EventPost( EV_IR);
+    } // if no framing error
+  } // if we have a character.
+#endif
 
+  if ( status & USART_SR_IDLE)
+  { // end of a frame
+    (void) USART_DR(USART3);		// clear the flag
+#ifdef IR_USE_DMA
+    IrDmaPublish( 1);
+#endif
+    IrFrameCount++;
+    IrRxIdle = 1;
+    EventPost( EV_IR);
+  } // if line went idle
+#ifdef IR_USE_DMA
+  else if ( status & (USART_SR_ORE | USART_SR_NE | USART_SR_FE))
+    (void) USART_DR(USART3);		// clear the error; DMA has the byte
+#endif
+  ProfileExit( PROF_USART3);
+} // usart3_isr
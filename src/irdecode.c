@@ -0,0 +1,190 @@
+//  IR keyboard frame decoder.
+//  --------------------------
+//
+//	The SK-8807 sends each key as a pair of bytes.  The first has the
+//	key number in the low 7 bits, with the high bit set for a make and
+//	clear for a break; the second is a check byte, the first with the
+//	top 5 bits inverted.  Two codes are special: IR_KEY_REPEAT (sent
+//	while a key is held) and IR_KEY_MOUSE, which is followed by two
+//	bytes of pointing stick data.
+//
+//	The decoder takes one byte at a time and never waits.  If a check
+//	byte doesn't match, it's taken as the first byte of the next
+//	frame, so a stream that has slipped by a byte realigns on the very
+//	next good pair rather than losing keys until it happens to fall
+//	back into step.
+//
+//	Timing comes from the arrival stamp on each byte, not from when
+//	we get around to looking at it, so a busy main loop can't pair
+//	bytes that were really far apart.  A gap of more than KEY_TIMEOUT
+//	ends a frame, and a repeat more than REPEAT_TIMEOUT after the key
+//	(or its last repeat) is ignored.
+//
+
+#include <stdint.h>
+
+#include "keydef.h"
+#include "irdecode.h"
+
+//  The check byte that must follow a given first byte.
+
+#define IR_CHECK_BYTE( b) ((uint8_t) ((~(b) & 0xf8) | ((b) & 0x07)))
+
+static int DecodeFirst( IR_DECODER *Dec, uint8_t What, IR_EVENT *Event);
+static int DecodePair( IR_DECODER *Dec, uint8_t What, uint32_t Stamp,
+  IR_EVENT *Event);
+
+//*	IRDecodeInit - Initialize a decoder.
+//	------------------------------------
+//
+//	TicksPerMs is the rate of the stamps passed to IRDecodeByte.
+//
+
+void IRDecodeInit( IR_DECODER *Dec, uint32_t TicksPerMs)
+{
+
+  Dec->State = IRD_FIRST;
+  Dec->First = 0;
+  Dec->LastKey = 0;
+  Dec->PairGap = KEY_TIMEOUT * TicksPerMs;
+  Dec->RepeatGap = REPEAT_TIMEOUT * TicksPerMs;
+  Dec->LastStamp = 0;
+  Dec->KeyStamp = 0;
+  Dec->Frames = 0;
+  Dec->Resyncs = 0;
+  Dec->Timeouts = 0;
+  Dec->StaleRepeats = 0;
+  return;
+} // IRDecodeInit
+
+//*	IRDecodeReset - Abandon any partial frame.
+//	------------------------------------------
+//
+//	Called when the line has gone quiet in the middle of a frame.
+//	The repeat key is kept.
+//
+
+void IRDecodeReset( IR_DECODER *Dec)
+{
+
+  Dec->State = IRD_FIRST;
+  return;
+} // IRDecodeReset
+
+//*	IRDecodePending - See if a frame is in progress.
+//	------------------------------------------------
+//
+//	Returns nonzero if some bytes of a frame have been taken.
+//
+
+int IRDecodePending( IR_DECODER *Dec)
+{
+  return Dec->State != IRD_FIRST;
+} // IRDecodePending
+
+//*	IRDecodeByte - Feed one byte to the decoder.
+//	--------------------------------------------
+//
+//	Stamp is when the byte arrived.  Returns 1 and fills in *Event if
+//	this byte completed a frame; otherwise returns 0 and *Event is set
+//	to IR_EVENT_NONE.
+//
+
+int IRDecodeByte( IR_DECODER *Dec, uint8_t What, uint32_t Stamp, 
+  IR_EVENT *Event)
+{
+
+  Event->Type = IR_EVENT_NONE;
+  Event->Key = 0;
+  Event->Stamp = Stamp;
+
+  if ( (Dec->State != IRD_FIRST) && 
+       ((Stamp - Dec->LastStamp) > Dec->PairGap))
+  { // too long since the last byte; that frame is dead
+    Dec->Timeouts++;
+    Dec->State = IRD_FIRST;
+  }
+  Dec->LastStamp = Stamp;
+
+  switch( Dec->State)
+  {
+    case IRD_FIRST:
+      return DecodeFirst( Dec, What, Event);
+
+    case IRD_CHECK:
+      if ( What != IR_CHECK_BYTE( Dec->First))
+      { // out of step--this may be the start of the next frame
+        Dec->Resyncs++;
+        return DecodeFirst( Dec, What, Event);
+      }
+      Dec->State = IRD_FIRST;
+      return DecodePair( Dec, Dec->First, Stamp, Event);
+
+    case IRD_MOUSE1:			// skip pointing stick data
+      Dec->State = IRD_MOUSE2;
+      break;
+
+    case IRD_MOUSE2:
+      Dec->State = IRD_FIRST;
+      Event->Type = IR_EVENT_MOUSE;
+      return 1;
+  } // switch
+  return 0;
+} // IRDecodeByte
+
+//	DecodeFirst - Take the first byte of a frame.
+//	---------------------------------------------
+
+static int DecodeFirst( IR_DECODER *Dec, uint8_t What, IR_EVENT *Event)
+{
+
+  (void) Event;
+  if ( What == IR_KEY_MOUSE)
+    Dec->State = IRD_MOUSE1;		// mouse lead-in
+  else
+  {
+    Dec->First = What;
+    Dec->State = IRD_CHECK;
+  }
+  return 0;
+} // DecodeFirst
+
+//	DecodePair - Turn a checked frame into an event.
+//	------------------------------------------------
+//
+//	A make is remembered so that a following repeat code can be
+//	turned into it; any other release forgets it.  So does a long
+//	enough silence--we've likely missed the break.
+//
+
+static int DecodePair( IR_DECODER *Dec, uint8_t What, uint32_t Stamp,
+  IR_EVENT *Event)
+{
+
+  Dec->Frames++;
+  if ( (What == IR_KEY_REPEAT) && Dec->LastKey &&
+       ((Stamp - Dec->KeyStamp) > Dec->RepeatGap))
+  { // stale
+    Dec->StaleRepeats++;
+    Dec->LastKey = 0;
+  }
+
+  if ( What & 128)
+  { // make
+    Dec->LastKey = What;
+    Dec->KeyStamp = Stamp;
+    Event->Type = IR_EVENT_MAKE;
+    Event->Key = What & 127;
+  } else if ( (What == IR_KEY_REPEAT) && Dec->LastKey)
+  { // repeat of a held key
+    Dec->KeyStamp = Stamp;
+    Event->Type = IR_EVENT_REPEAT;
+    Event->Key = Dec->LastKey & 127;
+  } else
+  { // release
+    Dec->LastKey = 0;
+    Event->Type = (What == IR_KEY_CLEAR) ? IR_EVENT_CLEAR : IR_EVENT_BREAK;
+    Event->Key = What;
+  } // if not a make
+  return 1;
+} // DecodePair
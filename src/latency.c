@@ -0,0 +1,250 @@
+//  Keystroke latency measurement.
+//  ------------------------------
+//
+//	Each key sent to the host carries three DWT cycle stamps:
+//
+//	  1. When the IR byte that completed its frame arrived (the
+//	     stamp usart3_isr, or the DMA publish, put on it).
+//	  2. When the decoder handed back the event (ProcessIR).
+//	  3. When the last PS/2 frame of its scan code sequence was
+//	     through (PS2TxCommit, from SendClear or the DMA interrupt).
+//
+//	When a sequence is queued, the first two stamps go into a small
+//	ring along with the transmit ring's input count after it--its
+//	"mark".  When the transmit ring's output count reaches the mark,
+//	the key is done, and the three differences go into histograms.
+//	The main line fills the ring, tim2_isr empties it.
+//
+//	The histograms have a bucket per power of two, which is plenty
+//	to see where the time goes and costs a CLZ to fill.  Percentiles
+//	are given as the top of the bucket they fall in, so they're high
+//	by up to a factor of two.
+//
+
+#include <stdint.h>
+
+#include <libopencm3/cm3/dwt.h>
+
+#include "globals.h"
+#include "debug.h"
+#include "latency.h"
+
+#ifdef USE_LATENCY_STATS
+
+#ifndef USE_USART_DEBUG
+#error "USE_LATENCY_STATS needs USE_USART_DEBUG for its report"
+#endif
+
+#if !RING_SIZE_OK( LATENCY_PENDING)
+#error "LATENCY_PENDING must be a power of two"
+#endif
+
+static LATENCY_HIST
+  LatencyHists[ LAT_COUNT];
+
+//  Keys queued but not yet sent.  The ring's data isn't used; the
+//  slots index the stamp arrays.
+
+static RING
+  LatencyRing;
+
+static uint8_t
+  LatencyUnused[ LATENCY_PENDING];
+
+static uint32_t
+  LatencyArrived[ LATENCY_PENDING],
+  LatencyDecoded[ LATENCY_PENDING],
+  LatencyMark[ LATENCY_PENDING];
+
+static uint32_t
+  LatencyReported;		// key count at the last report
+
+static void LatencyAdd( LATENCY_ID Id, uint32_t Cycles);
+
+//*	LatencyInit - Clear everything.
+//	-------------------------------
+
+void LatencyInit( void)
+{
+
+  int
+    i,
+    j;
+
+  RingInit( &LatencyRing, LatencyUnused, LATENCY_PENDING);
+  for ( i = 0; i < LAT_COUNT; i++)
+  {
+    LatencyHists[ i].Count = 0;
+    LatencyHists[ i].Max = 0;
+    for ( j = 0; j < LATENCY_BUCKETS; j++)
+      LatencyHists[ i].Bucket[ j] = 0;
+  }
+  LatencyReported = 0;
+  return;
+} // LatencyInit
+
+//*	LatencyQueued - Note a key's sequence has been queued.
+//	------------------------------------------------------
+//
+//	TxMark is the transmit ring's input count just after it.  If too
+//	many keys are in flight, this one just isn't measured.
+//
+
+void LatencyQueued( uint32_t Arrived, uint32_t Decoded, uint32_t TxMark)
+{
+
+  int
+    slot;
+
+  if ( (slot = RingPutSlot( &LatencyRing)) < 0)
+    return;
+  LatencyArrived[ slot] = Arrived;
+  LatencyDecoded[ slot] = Decoded;
+  LatencyMark[ slot] = TxMark;
+  RingPublish( &LatencyRing, 1);
+  return;
+} // LatencyQueued
+
+//*	LatencyFrameDone - Note a frame from the ring has gone out.
+//	-----------------------------------------------------------
+//
+//	Called from tim2_isr (or the DMA interrupt) with the transmit
+//	ring's output count after the frame.  If the main line was held
+//	up long enough for a whole sequence to go before it was noted,
+//	its mark is already behind us; it's dropped, not measured.
+//
+
+void LatencyFrameDone( uint32_t TxOut)
+{
+
+  int
+    slot;
+
+  uint32_t
+    now;
+
+  LatencyFlush( TxOut - 1);		// any we missed the end of
+  if ( (slot = RingGetSlot( &LatencyRing)) < 0)
+    return;
+  if ( TxOut != LatencyMark[ slot])
+    return;				// not the last of its sequence
+
+  now = dwt_read_cycle_counter();
+  LatencyAdd( LAT_IR_TO_DECODE, LatencyDecoded[ slot] - LatencyArrived[ slot]);
+  LatencyAdd( LAT_DECODE_TO_PS2, now - LatencyDecoded[ slot]);
+  LatencyAdd( LAT_IR_TO_PS2, now - LatencyArrived[ slot]);
+  RingRelease( &LatencyRing, 1);
+  return;
+} // LatencyFrameDone
+
+//*	LatencyFlush - Forget keys the transmit ring has thrown away.
+//	-------------------------------------------------------------
+//
+//	Called from tim2_isr when a flush moves the output count on.
+//	Drops every key whose mark is at or before TxOut.
+//
+
+void LatencyFlush( uint32_t TxOut)
+{
+
+  int
+    slot;
+
+  while ( (slot = RingGetSlot( &LatencyRing)) >= 0 &&
+          (int32_t) (TxOut - LatencyMark[ slot]) >= 0)
+    RingRelease( &LatencyRing, 1);
+  return;
+} // LatencyFlush
+
+//*	LatencyPercentile - Estimate a percentile.
+//	------------------------------------------
+//
+//	Returns the top of the bucket holding the given percentile, in
+//	cycles, but never more than the largest seen.
+//
+
+uint32_t LatencyPercentile( const LATENCY_HIST *Hist, int Percent)
+{
+
+  uint32_t
+    want,
+    sum,
+    top;
+
+  int
+    i;
+
+  if ( !Hist->Count)
+    return 0;
+  want = (uint32_t) (((uint64_t) Hist->Count * Percent + 99) / 100);
+  sum = 0;
+  for ( i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    sum += Hist->Bucket[ i];
+    if ( sum >= want)
+      break;
+  }
+  top = (i >= 31) ? 0xffffffff : (((uint32_t) 2 << i) - 1);
+  return (top < Hist->Max) ? top : Hist->Max;
+} // LatencyPercentile
+
+//*	LatencyHist - Return a histogram.
+//	---------------------------------
+
+const LATENCY_HIST *LatencyHist( LATENCY_ID Id)
+{
+  return &LatencyHists[ Id];
+} // LatencyHist
+
+//*	LatencyReport - Print the figures over the debug UART.
+//	------------------------------------------------------
+//
+//	Only if there's been a key since last time, unless Force is
+//	nonzero.  Microseconds.
+//
+
+void LatencyReport( int Force)
+{
+
+  static const char
+    *names[ LAT_COUNT] = { "IR->decode", "decode->PS/2", "IR->PS/2" };
+
+  const LATENCY_HIST
+    *hist;
+
+  int
+    i;
+
+  if ( !Force && LatencyHists[ LAT_IR_TO_PS2].Count == LatencyReported)
+    return;
+  LatencyReported = LatencyHists[ LAT_IR_TO_PS2].Count;
+  for ( i = 0; i < LAT_COUNT; i++)
+  {
+    hist = &LatencyHists[ i];
+    Uprintf( "%s: %d keys, p50 %d p99 %d max %d us\n", names[ i],
+      hist->Count,
+      LatencyPercentile( hist, 50) / (CPU_CLOCK_HZ / 1000000),
+      LatencyPercentile( hist, 99) / (CPU_CLOCK_HZ / 1000000),
+      hist->Max / (CPU_CLOCK_HZ / 1000000));
+  }
+  return;
+} // LatencyReport
+
+//	LatencyAdd - Put one figure in a histogram.
+//	-------------------------------------------
+
+static void LatencyAdd( LATENCY_ID Id, uint32_t Cycles)
+{
+
+  LATENCY_HIST
+    *hist;
+
+  hist = &LatencyHists[ Id];
+  hist->Count++;
+  if ( Cycles > hist->Max)
+    hist->Max = Cycles;
+  hist->Bucket[ Cycles ? (31 - __builtin_clz( Cycles)) : 0]++;
+  return;
+} // LatencyAdd
+
+#endif // USE_LATENCY_STATS
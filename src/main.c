@@ -1,8 +1,10 @@
+#include <string.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/flash.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/cm3/nvic.h>
-#include <libopencm3/cm3/systick.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/dwt.h>
 #include <libopencm3/stm32/usart.h>
 
 #define MAIN
@@ -14,15 +16,62 @@
 #include "debug.h"
 
 #include "ir.h"
+#include "irdecode.h"
+#include "hostcmd.h"
+#include "event.h"
+#include "power.h"
+#include "timebase.h"
+#include "irqprio.h"
+#include "latency.h"
+#include "profile.h"
+#include "trace.h"
+#include "console.h"
 
 //  Here's the lookup table for mapping IR keys to PS/2 keys.
 
 #include "keymap.h"
 
-static uint16_t GetIRByte( void);
+static int GetIRByte( uint32_t *Stamp);
 static void ProcessKeys( void);
+static void ProcessIR( void);
+static void ProcessTimer( void);
+static int SendKeyEvent( IR_EVENT *Event);
+static int QueueKey( uint8_t Key, int Break);
+static int ReleaseKeys( void);
 static void ProcessHostData( void);
 
+static IR_DECODER
+  IrDecoder;			// IR frame decoder state
+
+static HOST_CMD
+  HostCmd;			// host command processor state
+
+//  Which IR keys the host has been sent a make for and no break, and
+//  which of those are owed a break we haven't been able to send yet;
+//  a bit for each of the 128 codes.
+
+#define KEY_BIT( set, key) ((set)[ (key) >> 3] & (1 << ((key) & 7)))
+#define KEY_SET( set, key) ((set)[ (key) >> 3] |= (uint8_t) (1 << ((key) & 7)))
+#define KEY_RESET( set, key) ((set)[ (key) >> 3] &= (uint8_t) ~(1 << ((key) & 7)))
+
+#define RELEASE_RETRY_MS 10	// queue full; try the rest after this
+
+//  Without a console to ask for them, whatever measurements are built
+//  in are printed this often.
+
+#if defined( USE_USART_DEBUG) && !defined( USE_CONSOLE) && \
+  (defined( USE_LATENCY_STATS) || defined( USE_ISR_PROFILE) || \
+  defined( PS2_JITTER_PROBE))
+#define REPORT_MS 5000
+
+static uint32_t
+  ReportAt;			// TimeNow of the next report
+#endif
+
+static uint8_t
+  KeysDown[ 128 / 8],
+  KeysOwed[ 128 / 8];
+
 
 //*  IBM IR keyboard to PS/2 Converter.
 //   ----------------------------------
@@ -65,6 +114,7 @@ int main(void)
 {
 
   rcc_clock_setup_in_hse_8mhz_out_72mhz();
+  scb_set_priority_grouping( IRQ_GROUPING);	// see irqprio.h
 
 // Enable GPIOC clock. 
 
@@ -72,13 +122,6 @@ int main(void)
   rcc_periph_clock_enable(RCC_GPIOB);
   rcc_periph_clock_enable(RCC_GPIOC);
 
-// Set LED GPIO up.
-
-  gpio_set_mode(LED_GPIO, GPIO_MODE_OUTPUT_2_MHZ,
-      GPIO_CNF_OUTPUT_PUSHPULL, LED_BIT);
-
-  gpio_clear(LED_GPIO, LED_BIT);	// LED on - blinks once per second
-
 // Set status LEDs up.
 
   gpio_set_mode( STATUS_GPIO, GPIO_MODE_OUTPUT_2_MHZ,
@@ -86,15 +129,24 @@ int main(void)
       STATUS_BIT_NUM | STATUS_BIT_SCROLL | STATUS_BIT_CAPS);
   gpio_clear( STATUS_GPIO, 
       STATUS_BIT_NUM | STATUS_BIT_SCROLL |  STATUS_BIT_CAPS);
-  SetupSysTick();
+
+//  Start the clock; this also blinks the LED once per second.
+
+  TimeInit();
 
 //   The following is executed only if USART 1 debug output is desired.
 
   InitUART( 115200);
+  TraceInit();
   Uprintf( "\nReady...\n");
-  LastKey = 0;
+  IRDecodeInit( &IrDecoder, CYCLES_PER_MS);
+  HostCmdInit( &HostCmd);
   SetupIRSensor();
   PS2Init();			// start up the PS2 interface
+  PowerInit();
+  LatencyInit();
+  ProfileReset();
+  ConsoleInit( &IrDecoder, &HostCmd, KeyMap);
 
 //  ProcessKeys should never exit.
 
@@ -107,214 +159,388 @@ int main(void)
 //*     GetIRByte - Get a byte from the IR receiver.
 //      --------------------------------------------
 //
-//      Waits until a byte is ready.  If timeout, returns 0xffff;
-//      otherwise returns the received byte.
+//      Never waits.  Returns -1 if the buffer is empty; otherwise
+//      returns the received byte and sets *Stamp to when it arrived.
+//
+//	With IR_USE_DMA, the ring holding more than it can means the DMA
+//	wrote over our oldest bytes (see IrDmaPublish); they're skipped.
 //
-//	The idea here is that the second byte in a 2-byte IR sequence
-//	always follows immedately after the first, so if there's a 50
-//	msec. or longer pause between characters, this can't be the first
-//	byte of a 2-byte sequence.
-
-#define KEY_TIMEOUT 50               // idle time in milliseconds
 
-static uint16_t GetIRByte( void)
+static int GetIRByte( uint32_t *Stamp)
 {
-  
-  uint32_t
-    startTime;
 
-  uint8_t
+  int
+    slot,
     cData;
+
+#ifdef IR_USE_DMA
+  uint32_t
+    level;
+
+  if ( (level = RingLevel( &IrRxRing)) > IR_RX_BUFFER_SIZE)
+    RingRelease( &IrRxRing, level - IR_RX_BUFFER_SIZE);
+#endif
     
-  startTime = TickCount;        // start the timer
-  while( (TickCount - startTime) < KEY_TIMEOUT)
-  { // keep waiting for data
-    if ( IrRxBufferIn != IrRxBufferOut)	// if there's data
-    {
-      cData = IrRxBuffer[ IrRxBufferOut++];	// get a byte from buffer
-      if ( IrRxBufferOut >= IR_RX_BUFFER_SIZE)
-        IrRxBufferOut = 0;	// wrap arond
-      return cData;
-    }	// if there's data in the buffer
-  } // while we have time
-  return 0xffff;                // timeout
+  if ( (slot = RingGetSlot( &IrRxRing)) < 0)
+    return -1;			// nothing there
+
+  cData = IrRxBuffer[ slot];	// get a byte from buffer
+  *Stamp = IrRxStamp[ slot];
+  RingRelease( &IrRxRing, 1);
+  return cData;
 } // GetIRByte
 
 //*     ProcessKeys - Process IR keystrokes.
 //      ------------------------------------
 //
-//      What all of this is about.  Basically, works like this:
-//
-//      1. Wait and read a byte from the IR sensor
-//      2. If it's the mouse bye (0x3f), read two more, discard and go to 1.
-//      3. Otherwise, read another byte and check validity against the first
-//         byte.
-//      4. Isolate the low-order 7 bits of the byte and look it up in the
-//         keymap table.
-//      5. If the keymap lookup returns a zero word, discard and go to 1
-//      6. Otherwise, if the first byte received has the high order bit set
-//         send a "key down" code.  If not, send a "key up" code. Go to 1.
+//      What all of this is about.  The interrupt handlers post events
+//      (event.c) and we sleep until there's one; then, most urgent
+//      first:
+//
+//      1. EV_HOST: deal with anything the host has sent.
+//      2. EV_IR: feed whatever bytes the IR sensor has received to the
+//         frame decoder (irdecode.c), which pairs and checks them using
+//         the time each byte arrived.  Each key event the decoder hands
+//         back is turned into PS/2 scan codes by SendKeyEvent.
+//      3. EV_TIMER: housekeeping.
+//      4. EV_CONSOLE: commands typed on the debug port (console.c).
+//
+//      Nothing here waits, so host commands are never held up behind
+//      the IR keyboard and vice-versa.
+//
+
+static void ProcessKeys( void)
+{
+
+  EventInit();
+  EventSetHandler( EV_HOST, ProcessHostData);
+  EventSetHandler( EV_IR, ProcessIR);
+  EventSetHandler( EV_TIMER, ProcessTimer);
+#ifdef USE_CONSOLE
+  EventSetHandler( EV_CONSOLE, ConsoleProcess);
+#endif
+#ifdef REPORT_MS
+  ReportAt = TimeNow() + REPORT_MS;
+  TimeSetDeadline( ReportAt);
+#endif
+  EventRun();			// never returns
+  return;
+} // ProcessKeys
+
+//	ProcessIR - Decode what the IR sensor has received.
+//	---------------------------------------------------
+//
+//	If the buffer is empty, the line has gone idle and the decoder
+//	is still holding the first byte of a pair, the check byte is
+//	never coming--drop the partial frame.
+//
+//	If an IR byte woke us from Stop mode, we see whether anything
+//	came of the burst that woke us, so lost keys can be counted.
+//
+
+static void ProcessIR( void)
+{
+
+  int
+    irByte;
+
+  uint32_t
+    irStamp;
+
+  IR_EVENT
+    event;
+
+  uint32_t
+    decoded;
+
+  int
+    queued;
+
+  static int
+    afterWake;			// first burst since an IR wakeup
+
+  static uint32_t
+    wakeFrames;			// decoder's frame count at the wakeup
+
+  if ( PowerWokeOnIR())
+  {
+    afterWake = 1;
+    wakeFrames = IrDecoder.Frames;
+  }
+
+  while( (irByte = GetIRByte( &irStamp)) != -1)
+  { // run everything received through the decoder
+    PowerActivity();
+    if ( IRDecodeByte( &IrDecoder, (uint8_t) irByte, irStamp, &event))
+    {
+      decoded = dwt_read_cycle_counter();
+      queued = SendKeyEvent( &event);
+      Trace( TR_KEY_EVENT, (event.Type << 8) | event.Key, queued);
+      if ( queued)
+        LatencyQueued( event.Stamp, decoded, PS2TxMark());
+    }
+  } // while bytes
+
+  if ( IrRxIdle && RingEmpty( &IrRxRing))
+  { // between frames
+    if ( IRDecodePending( &IrDecoder))
+      IRDecodeReset( &IrDecoder);	// frame ended short
+    if ( afterWake)
+    {
+      PowerFirstKey( IrDecoder.Frames == wakeFrames);
+      afterWake = 0;
+    }
+  }
+  return;
+} // ProcessIR
+
+//	ProcessTimer - Periodic housekeeping.
+//	-------------------------------------
+//
+//	In case an IR event went astray (say, the idle interrupt was lost
+//	to an overrun), look at the IR side once in a while too, and send
+//	any breaks that didn't fit in the queue.  Then, every REPORT_MS,
+//	report whatever measurements are built in--unless there's a
+//	console to ask for them.  EV_TIMER comes for other deadlines too,
+//	so the report keeps its own.
+//
+
+static void ProcessTimer( void)
+{
+
+#ifdef REPORT_MS
+  uint32_t
+    now;
+#endif
+
+  ProcessIR();
+  ReleaseKeys();
+#ifdef REPORT_MS
+  now = TimeNow();
+  if ( (int32_t) (now - ReportAt) >= 0)
+  {
+    LatencyReport( 0);
+    ProfileReport();
+#ifdef PS2_JITTER_PROBE
+    {
+      uint32_t
+        worst,
+        average,
+        edges;
+
+      PS2JitterStats( &worst, &average, &edges);
+      Uprintf( "PS/2 edge latency: worst %d avg %d cycles, %d edges\n",
+        worst, average, edges);
+    }
+#endif
+    ReportAt = now + REPORT_MS;
+  }
+  TimeSetDeadline( ReportAt);
+#endif // REPORT_MS
+  return;
+} // ProcessTimer
+
+//*	SendKeyEvent - Send PS/2 scan codes for a key event.
+//	----------------------------------------------------
+//
+//	The low-order 7 bits of the key are looked up in the keymap
+//	table.  A repeat is sent as another make.  If the keymap lookup 
+//	returns a zero word, nothing is sent.
 //      
 //      Note that on the PS/2, a "key up" prefixes an 0xf0 before the
 //      last byte of a sequence.   For example, if the key down is E0 23,
 //      the "key up" will bae E0 F0 23.
 //
+//	Pause and Print Screen have sequences of their own and nothing
+//	else is sent for them.  Pause has no break and doesn't repeat.
+//
+//	The host only ever sees a break for a key it has had the make
+//	for: a break for a key that isn't down (its make was lost, or it's
+//	line noise that happened to check) is dropped.  IR_EVENT_CLEAR
+//	sends a break for every key still down.
+//
+//	Nothing is sent while the host has us disabled (HOST_DISABLE),
+//	but the breaks the host would have had are kept, and go out when
+//	it enables us again.
+//
+//	Returns 1 if a sequence was queued.
+//
 
-static void ProcessKeys( void)
+static int SendKeyEvent( IR_EVENT *Event)
 {
 
-  uint16_t
-    rkey,
-    b1,
-    b2;
-    
-  const uint8_t
+  uint8_t
+    key;
+
+  static const uint8_t
     pauseSeq[] = 
-      {0xe1, 0x14, 0x77, 0xe1, 0xf0, 0x14, 0xf0, 0x77, 0 },
+      {0xe1, 0x14, 0x77, 0xe1, 0xf0, 0x14, 0xf0, 0x77, 0 };
+
+  switch( Event->Type)
+  {
+    case IR_EVENT_MAKE:
+    case IR_EVENT_REPEAT:
+    case IR_EVENT_BREAK:
+    case IR_EVENT_CLEAR:
+      break;
+
+    default:
+      return 0;			// nothing to send
+  } // switch
+
+  if ( Event->Type == IR_EVENT_CLEAR)
+  { // let go of everything
+    memcpy( KeysOwed, KeysDown, sizeof( KeysDown));
+    return ReleaseKeys();
+  }
+
+  key = Event->Key & 127;
+  if ( !HostCmd.Enabled)
+  { // host has told us to be quiet; keep track of what it's missing
+    if ( Event->Type != IR_EVENT_BREAK)
+      KEY_RESET( KeysOwed, key);
+    else if ( KEY_BIT( KeysDown, key))
+      KEY_SET( KeysOwed, key);
+    return 0;
+  }
+
+  if ( key == IR_KEY_PAUSE)
+  {
+    if ( Event->Type != IR_EVENT_MAKE)
+      return 0;
+    return PS2PutStr( pauseSeq);
+  }
+
+  if ( Event->Type == IR_EVENT_BREAK)
+  { // now, or as soon as there's room
+    if ( !KEY_BIT( KeysDown, key))
+      return 0;
+    KEY_SET( KeysOwed, key);
+    return ReleaseKeys();
+  }
+
+  KEY_RESET( KeysOwed, key);	// down again, so nothing's owed
+  if ( !QueueKey( key, 0))
+    return 0;
+  KEY_SET( KeysDown, key);
+  return 1;
+} // SendKeyEvent
+
+//	QueueKey - Queue the make or break codes for a key.
+//	---------------------------------------------------
+//
+//	Returns 1 if queued; 0 if the key has no codes or there's no room.
+//
+
+static int QueueKey( uint8_t Key, int Break)
+{
+
+  uint16_t
+    rkey;
+
+  uint8_t
+    seq[ 3];			// scan code sequence for one key
+
+  int
+    seqLen;
+
+  static const uint8_t
     pscrnMakeSeq[] = 
       {	0xe0, 0x12, 0xe0, 0x7c, 0 },
     pscrnBreakSeq[] =
       {	0xe0, 0xf0, 0x7c, 0xe0, 0xf0, 0x12, 0};
-          
-
-  while (1)
-  { // servicing loop
-  
-//  See if there's data from the host.
-
-    ProcessHostData();  
-  
-//  Okay, now look at the keyboard buffer.  
-
-    b1 = GetIRByte();   // get first byte
-    if (b1 == 0xffff)
-      continue;                         // timeout
-    b2 = GetIRByte();   // get second byte
-    if ( b2 == 0xffff)
-      continue;                         // timeout
-    if ( b1 == IR_KEY_MOUSE)
-    {  // someone touched the mouse
-      GetIRByte();
-      continue;                         // discard 2 bytes and loop
-    } // if a mouse lead-in
-
-//      Check to see that the two bytes agree.  If not, ignore.
-
-    if ( b2 != ((~b1 & 0xf8) | (b1 & 0x7)) )
-    { // if there
-      continue;				// not valid--discard
-    }   // if no match
-
-// 	If this is a "make" code, save it for repeat.
-
-    if ( b1 & 128)
-      LastKey = b1;			// save it
-    else
-    { // check for repeat       
-      if ( (b1 == IR_KEY_REPEAT) && LastKey)
-        b1 = LastKey;			// save last key
-      else
-        LastKey = 0;			// any other release clears
-    } // if not a make	
-
-//	Check for Pause/Break and Print Screen.
-        
-    if ( b1 == (IR_KEY_PAUSE | 128))
-      PS2PutStr( (uint8_t *) pauseSeq);		// Pause has no break
-    else if ( b1 == (IR_KEY_PRTSCRN | 128))
-      PS2PutStr( (uint8_t *) pscrnMakeSeq);
-    else if ( b1 == IR_KEY_PRTSCRN) 
-      PS2PutStr( (uint8_t *) pscrnBreakSeq); 
-
-    rkey = KeyMap[ b1 & 127];         // get the result key
-    if (!rkey)
-      continue;                         // if a null key mapping
-
-    if ( rkey & 0xff00)
-    {   // first part of 2-byte code
-      PS2Put( rkey >> 8);
-    }
-    if ( !(b1 & 128))
-    {   // key up
-      PS2Put( 0xf0);
-      LastKey = 0;
-    }
-    PS2Put( rkey & 0xff);
-  } // while
-  return;
-} // ProcessKeys
 
-// 	ProcessHostData - Check for messages coming from the host.
-//      ----------------------------------------------------------
+  if ( Key == IR_KEY_PRTSCRN) 
+    return PS2PutStr( Break ? pscrnBreakSeq : pscrnMakeSeq);
+
+  rkey = KeyMap[ Key];		// get the result key
+  if (!rkey)
+    return 0;			// if a null key mapping
+
+//	Build the whole sequence and queue it in one go.
+
+  seqLen = 0;
+  if ( rkey & 0xff00)
+  {   // first part of 2-byte code
+    seq[ seqLen++] = rkey >> 8;
+  }
+  if ( Break)
+  {   // key up
+    seq[ seqLen++] = 0xf0;
+  }
+  seq[ seqLen++] = rkey & 0xff;
+  return PS2PutSeq( seq, seqLen);
+} // QueueKey
+
+//	ReleaseKeys - Send the breaks owed to the host.
+//	-----------------------------------------------
 //
-//	Usually, the response to these messages is an ACK, but there
-//	some exceptions.  In all cases, since we don't have LEDs, nor
-//	an adjustable typematic rate, we don't really do anything other
-//	than to say "I got it".
+//	As many as fit in the queue; if that's not all of them, we're
+//	called again from ProcessTimer a little later for the rest.
+//	Returns 1 if anything was queued.
 //
 
-static void ProcessHostData( void)
+static int ReleaseKeys( void)
 {
 
-  int 
-    ps2val,
-    param;
-  uint32_t
-    startTime;
+  uint8_t
+    key;
 
-#define HOST_TIMEOUT 5		// 5 msec should be more than enough
-    
-  if ( (ps2val = PS2Get()) == -1)
-    return;		// nothing to do
+  int
+    queued;
 
-Uprintf( "Host sends %02x ", ps2val);
-    
-  switch( ps2val)
+  queued = 0;
+  if ( !HostCmd.Enabled)
+    return 0;			// when we're let talk again
+  for ( key = 0; key < 128; key++)
   {
-   
-    case HOST_RESET:
-      PS2Put( KEY_ACK);
-      PS2Put( KEY_BAT);		// say reset's done
-      UpdateStatusLEDs( 0);	// turn the LEDs off
-      break;
-        
-    case HOST_DEFAULT:
-    case HOST_DISABLE:
-    case HOST_ENABLE:
-      PS2Put( KEY_ACK);		// just acknowledge
-      break;
-    
-    case HOST_ECHO:
-      PS2Put( KEY_ECHO);	// respond with echo
+    if ( !KEY_BIT( KeysOwed, key))
+      continue;
+    if ( !QueueKey( key, 1))
+    { // full up
+      TimeSetDeadline( TimeNow() + RELEASE_RETRY_MS);
       break;
+    }
+    KEY_RESET( KeysOwed, key);
+    KEY_RESET( KeysDown, key);
+    queued = 1;
+  } // for each key
+  return queued;
+} // ReleaseKeys
 
-    case HOST_ID:		// get keyboard ID
-      PS2Put( KEY_ACK);
-      PS2Put( 0x83);		// default 101-key
-      PS2Put( 0xab);
-      break; 
-      
-    case HOST_TYPEMATIC:	// we need another byte
-    case HOST_SET_SCAN:
-    case HOST_SET_LED:
-      startTime = TickCount;        // start the timer
-      do
-      {
-        if ( (TickCount - startTime) > HOST_TIMEOUT)
-          break;		// we must have missed it        
-      } while ( (param = PS2Get()) == -1);
-      
-      if ( ps2val == HOST_SET_LED)
-        UpdateStatusLEDs( (uint8_t) param);// update the LEDs      
-      PS2Put( KEY_ACK);		// just acknowledge it
-      break;      
+// 	ProcessHostData - Check for messages coming from the host.
+//      ----------------------------------------------------------
+//
+//	Everything the host has sent is run through the command
+//	processor (hostcmd.c), which never waits for the parameter of a
+//	two-byte command; it just remembers it's due.  So a burst of
+//	setup commands from a BIOS or KVM switch doesn't hold up keys.
+//
 
-    default:
-      Uprintf( "Unknown code %02x\n", ps2val);
-      PS2Put( KEY_RESEND);	// don't know what it is
-      break;
-  
-  } // get request type
-  Uprintf( "\n"); 
+static void ProcessHostData( void)
+{
+
+  int 
+    ps2val,
+    action;
+
+  while ( (ps2val = PS2Get()) != -1)
+  { // for each byte from the host
+    PowerActivity();
+    action = HostCmdByte( &HostCmd, (uint8_t) ps2val);
+    Trace( TR_HOST_BYTE, ps2val, action);
+    if ( action & HC_RESET)
+    { // forget anything not yet sent; the host takes all keys as up
+      PS2TxFlush();
+      PS2SetRate( PS2_RATE_DEFAULT);	// and start the clock afresh
+      memset( KeysDown, 0, sizeof( KeysDown));
+      memset( KeysOwed, 0, sizeof( KeysOwed));
+    }
+    if ( action & HC_REPLY)
+      PS2PutSeq( HostCmd.Reply, HostCmd.ReplyLen);
+    if ( action & HC_LEDS)
+      UpdateStatusLEDs( HostCmd.Leds);
+  } // while
+  ReleaseKeys();		// in case we've just been enabled again
   return;
 } //  ProcessHostData
@@ -0,0 +1,258 @@
+//  Low-power (Stop mode) operation.
+//  --------------------------------
+//
+//	When nothing has happened for a while--no IR bytes, nothing from
+//	the host, nothing waiting to go out--the main loop calls
+//	PowerStop instead of just sleeping.  All the clocks stop; only an
+//	EXTI line can get us going again.  We watch two:
+//
+//	  - The USART3 RX pin (PB11), falling edge: an IR start bit.
+//	  - The PS/2 clock pin (ps2.c arms this itself whenever TIM2 is
+//	    asleep), falling edge: the host wants to talk.
+//
+//	On wakeup we're running from the 8 MHz HSI with the HSE and PLL
+//	off; the rest of main's clock setup (prescalers, PLL multiplier,
+//	flash wait states) is kept, so we just start them again and
+//	switch over.  The time that takes, mostly HSE startup and PLL
+//	lock, is measured in HSI cycles with the DWT cycle counter and
+//	kept in PowerStats.  The counter doesn't run while we're stopped,
+//	so the few microseconds from the edge to the first instruction
+//	aren't in it.
+//
+//	USART3 isn't clocked while we're stopped, and it needs to see the
+//	line high before a start bit, so it never sees the one that woke
+//	us; it finds its feet somewhere in the first byte, and the key
+//	that byte began is lost--the IR keyboard doesn't send it again.
+//	We count those: main tells us whether anything good was decoded
+//	from the burst of bytes that woke us.
+//
+
+#include <stdint.h>
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include "globals.h"
+#include "gpiodef.h"
+#include "ps2.h"
+#include "power.h"
+#include "irqprio.h"
+#include "profile.h"
+#include "timebase.h"
+#include "trace.h"
+#include "event.h"
+
+#ifdef USE_STOP_MODE
+
+#ifndef PS2_IDLE_GATING
+#error "USE_STOP_MODE needs PS2_IDLE_GATING"
+#endif
+
+#define HSI_MHZ 8		// what we run on right after a wakeup
+
+POWER_STATS
+  PowerStats;
+
+static uint32_t
+  PowerIdleMs,			// idle time before a stop
+  PowerLastActivity;		// TimeNow when something last happened
+
+static volatile int
+  PowerIrWoke;			// woken by IR; main hasn't asked yet
+
+//*	PowerInit - Set up for Stop mode.
+//	---------------------------------
+//
+//	The IR EXTI line is only unmasked while we're stopped.
+//
+
+void PowerInit( void)
+{
+
+  rcc_periph_clock_enable( RCC_PWR);
+  rcc_periph_clock_enable( RCC_AFIO);
+  pwr_set_stop_mode();		// Stop, not Standby
+#ifdef STOP_LOW_POWER_REGULATOR
+  pwr_voltage_regulator_low_power_in_stop();
+#else
+  pwr_voltage_regulator_on_in_stop();
+#endif
+
+  exti_select_source( IR_RX_EXTI, IR_RX_GPIO);
+  exti_set_trigger( IR_RX_EXTI, EXTI_TRIGGER_FALLING);
+  exti_disable_request( IR_RX_EXTI);
+  nvic_set_priority( IR_RX_IRQ, IRQ_PRIO_WAKE);
+  nvic_enable_irq( IR_RX_IRQ);
+
+  PowerIdleMs = STOP_IDLE_MS;
+  PowerLastActivity = TimeNow();
+  PowerIrWoke = 0;
+  return;
+} // PowerInit
+
+//*	PowerSetIdle - Set how long to wait before stopping.
+//	----------------------------------------------------
+
+void PowerSetIdle( uint32_t Ms)
+{
+
+  PowerIdleMs = Ms;
+  return;
+} // PowerSetIdle
+
+//*	PowerActivity - Note that something happened.
+//	---------------------------------------------
+//
+//	Restarts the idle time.
+//
+
+void PowerActivity( void)
+{
+
+  PowerLastActivity = TimeNow();
+  return;
+} // PowerActivity
+
+//*	PowerStopDue - See if we've been idle long enough to stop.
+//	----------------------------------------------------------
+//
+//	Called from the main loop with interrupts on, before it checks
+//	for events: reading the time and arming the deadline both take a
+//	while.  If it's not time yet, EV_TIMER is asked for when it will
+//	be, so we look again.
+//
+
+int PowerStopDue( void)
+{
+
+  if ( (TimeNow() - PowerLastActivity) < PowerIdleMs)
+  {
+    TimeSetDeadline( PowerLastActivity + PowerIdleMs);
+    return 0;
+  }
+  return 1;
+} // PowerStopDue
+
+//*	PowerQuiet - See if anything is in flight.
+//	------------------------------------------
+//
+//	Called with interrupts off, just before stopping: the PS/2 side
+//	must be asleep with nothing queued, and the IR line idle with
+//	nothing left in the buffer.
+//
+
+int PowerQuiet( void)
+{
+
+  if ( !PS2Quiet())
+    return 0;
+  return IrRxIdle && RingEmpty( &IrRxRing);
+} // PowerQuiet
+
+//*	PowerStop - Stop until an IR byte or the host wakes us.
+//	-------------------------------------------------------
+//
+//	Called from the main loop with interrupts off, in place of WFI;
+//	returns (still with them off) running at 72 MHz again.  The EXTI
+//	interrupt that woke us is taken once the caller turns interrupts
+//	back on.
+//
+
+void PowerStop( void)
+{
+
+  uint32_t
+    woke,
+    us;
+
+  uint16_t
+    source;
+
+  PowerStats.Stops++;
+  exti_reset_request( IR_RX_EXTI);
+  exti_enable_request( IR_RX_EXTI);
+
+  SCB_SCR |= SCB_SCR_SLEEPDEEP;
+  EVENT_WAIT();
+  SCB_SCR &= ~SCB_SCR_SLEEPDEEP;
+
+  woke = dwt_read_cycle_counter();
+  rcc_osc_on( RCC_HSE);
+  rcc_wait_for_osc_ready( RCC_HSE);
+  rcc_osc_on( RCC_PLL);
+  rcc_wait_for_osc_ready( RCC_PLL);
+  us = (dwt_read_cycle_counter() - woke) / HSI_MHZ;	// all on the HSI
+  rcc_set_sysclk_source( RCC_CFGR_SW_SYSCLKSEL_PLLCLK);
+  rcc_wait_for_sysclk_status( RCC_PLL);
+
+  exti_disable_request( IR_RX_EXTI);
+  source = 0;
+  if ( exti_get_flag_status( IR_RX_EXTI))
+  {
+    PowerStats.IrWakes++;
+    PowerIrWoke = 1;
+    source = 1;
+  } else if ( exti_get_flag_status( PS2_CLK_EXTI))
+  {
+    PowerStats.HostWakes++;
+    source = 2;
+  }
+
+  PowerStats.WakeUs = us;
+  if ( us > PowerStats.WakeUsMax)
+    PowerStats.WakeUsMax = us;
+  PowerLastActivity = TimeNow();
+  Trace( TR_WAKE, source, us);
+  return;
+} // PowerStop
+
+//*	PowerWokeOnIR - See if the IR line woke us.
+//	-------------------------------------------
+//
+//	Returns 1 just once for each IR wakeup.
+//
+
+int PowerWokeOnIR( void)
+{
+
+  if ( !PowerIrWoke)
+    return 0;
+  PowerIrWoke = 0;
+  return 1;
+} // PowerWokeOnIR
+
+//*	PowerFirstKey - Say how the first IR burst after a wakeup went.
+//	---------------------------------------------------------------
+//
+//	Dropped is nonzero if nothing could be decoded from it.
+//
+
+void PowerFirstKey( int Dropped)
+{
+
+  if ( Dropped)
+    PowerStats.FirstKeysDropped++;
+  return;
+} // PowerFirstKey
+
+//	IR RX pin EXTI handler.
+//	-----------------------
+//
+//	Just clears the flag; PowerStop has already seen it.
+//
+
+void exti15_10_isr(void)
+{
+
+  ProfileEnter( PROF_EXTI_IR);
+  exti_reset_request( IR_RX_EXTI);
+  ProfileExit( PROF_EXTI_IR);
+  return;
+} // exti15_10_isr
+
+#endif // USE_STOP_MODE
@@ -0,0 +1,118 @@
+//  Interrupt handler profiling.
+//  ----------------------------
+//
+//	The stamping is done inline (profile.h); here we just clear and
+//	report.  CPU share is the handler's total cycles over the cycles
+//	since the last reset, in tenths of a percent.
+//
+
+#include <stdint.h>
+
+#include <libopencm3/cm3/cortex.h>
+
+#include "globals.h"
+#include "debug.h"
+#include "timebase.h"
+#include "profile.h"
+
+#ifdef USE_ISR_PROFILE
+
+#ifndef USE_USART_DEBUG
+#error "USE_ISR_PROFILE needs USE_USART_DEBUG for its report"
+#endif
+
+PROFILE
+  Profiles[ PROF_COUNT];
+
+static uint32_t
+  ProfileSince;			// TimeNow at the last reset
+
+//*	ProfileReset - Clear all the figures.
+//	-------------------------------------
+
+void ProfileReset( void)
+{
+
+  int
+    i;
+
+  uint32_t
+    wasMasked;
+
+  wasMasked = cm_mask_interrupts( 1);
+  for ( i = 0; i < PROF_COUNT; i++)
+  {
+    Profiles[ i].Count = 0;
+    Profiles[ i].Total = 0;
+    Profiles[ i].Min = 0xffffffff;
+    Profiles[ i].Max = 0;
+  }
+  ProfileSince = TimeNow();
+  cm_mask_interrupts( wasMasked);
+  return;
+} // ProfileReset
+
+//*	ProfileReport - Print the figures over the debug UART.
+//	------------------------------------------------------
+//
+//	First, how busy interrupts kept us since the reset, all told--so
+//	it gets out even if the debug buffer can't take the whole table.
+//	A preempted handler's figure includes the one that preempted it,
+//	so that's a shade high when they nest.
+//
+
+void ProfileReport( void)
+{
+
+  static const char
+    *names[ PROF_COUNT] = 
+      { "tim2", "tim4", "dma7", "exti ps2", "usart3", "dma3", "exti ir", 
+        "tim1", "usart1", "dma4" };
+
+  PROFILE
+    prof[ PROF_COUNT];
+
+  uint64_t
+    elapsed,
+    busy;
+
+  uint32_t
+    ms,
+    count,
+    permille,
+    wasMasked;
+
+  int
+    i;
+
+  ms = TimeNow() - ProfileSince;
+  elapsed = (uint64_t) ms * CYCLES_PER_MS;
+  if ( !elapsed)
+    elapsed = 1;
+  busy = 0;
+  count = 0;
+  for ( i = 0; i < PROF_COUNT; i++)
+  {
+    wasMasked = cm_mask_interrupts( 1);
+    prof[ i] = Profiles[ i];		// a consistent copy
+    cm_mask_interrupts( wasMasked);
+    busy += prof[ i].Total;
+    count += prof[ i].Count;
+  }
+  permille = (uint32_t) ((busy * 1000) / elapsed);
+  Uprintf( "ISR busy %d.%d pct over %d ms, %d interrupts\n",
+    permille / 10, permille % 10, ms, count);
+
+  Uprintf( "ISR       count      min      max  cpu\n");
+  for ( i = 0; i < PROF_COUNT; i++)
+  {
+    if ( !prof[ i].Count)
+      continue;
+    permille = (uint32_t) ((prof[ i].Total * 1000) / elapsed);
+    Uprintf( "%8s %8d %8d %8d %d.%d pct\n", names[ i], prof[ i].Count, 
+      prof[ i].Min, prof[ i].Max, permille / 10, permille % 10);
+  }
+  return;
+} // ProfileReport
+
+#endif // USE_ISR_PROFILE
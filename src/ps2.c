@@ -4,26 +4,66 @@
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/dma.h>
 #include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
 
 #include "globals.h"
 #include "gpiodef.h"
 #include "debug.h"
 #include "ps2.h"
+#include "event.h"
+#include "timebase.h"
+#include "irqprio.h"
+#include "latency.h"
+#include "profile.h"
+#include "trace.h"
+#include "ps2frame.h"
 
 //*	PS2 Key-Host communication.
 //	---------------------------
 //
-//	Most of this code is driven by a 12MHz counter in up-down counting
+//	Most of this code is driven by a 24MHz counter in up-down counting
 //	mode, with compare interrupts at different points in the counting
 //	sequence.   Overall, a PS/2 clock train is generated at a frequency
-//	of about 11KHz.   The compare points generte interrupts so that
+//	of 10-16.7KHz.   The compare points generte interrupts so that
 //	data pulses may be either output or sampled at appropriate places
-//	within the 11KHz pulse train.
+//	within the pulse train.
 //
-//	Data received from the host is placed in a 64-byte buffer.  Since
-//	IR keyboard data is also buffered, keyboard-to-host communication
-//	is not buffered.
+//	The counter period and the compare points all come from the clock
+//	tree in globals.h and the rate wanted, and are checked at build
+//	time.  The rate can be changed while running; it's applied when 
+//	the interface is next idle.
+//
+//	Data received from the host is placed in a 64-byte buffer.  Data
+//	going to the host is queued in a transmit ring that the timer
+//	interrupt drains by itself, so callers never wait on the interface.
+//	A multi-byte scan code sequence is queued all-or-nothing, so the
+//	host never sees half of one because the ring was full.
+//
+//	A byte stays at the head of the ring until it has gone out whole.
+//	If the host pulls the clock low partway through, the same byte is
+//	sent again once the host lets go, so E0/F0/E1 sequences always
+//	arrive complete and in order.  Nothing is ever sent between the
+//	bytes of a sequence except replies to the host itself.
+//
+//	Frames from the host are checked for parity and stop bit.  A bad
+//	one is dropped and we ask for it again (KEY_RESEND) ahead of
+//	anything queued.  A HOST_RESEND from the host is answered right
+//	here, by replaying the last byte sent, without going through
+//	the main line.
+//
+//	With PS2_IDLE_GATING, the timer is stopped whenever the line is
+//	idle and there's nothing to send, so an idle keyboard takes no
+//	interrupts at all.  Queueing a byte restarts it, as does the host
+//	pulling the clock line low (an EXTI falling-edge interrupt).
+//
+//	With PS2_DMA_TX, sending is handed off entirely: the whole 11-bit
+//	frame is laid out as GPIO BSRR words and TIM4 paces DMA writes of
+//	them to the port, so ISR latency elsewhere can't stretch a clock
+//	pulse.  TIM2 is stopped for the length of the frame.  Receiving
+//	is still done by TIM2.
 //
 //	Be careful where you put debug output calls--there's a good chance
 //	that you could mess up the timing, so be careful.  Debug output
@@ -31,6 +71,39 @@
 //	be fine if you keep your debug messages terse.
 //
 
+//  Timer arithmetic.  One up-down cycle of TIM2 is one PS/2 clock, so
+//  the period is in counts per PS/2 clock.  OC1 (clock edges) falls a 
+//  quarter of the way through, OC2 (data) at the top.
+
+#define PS2_PRESCALER 3
+#define PS2_COUNT_HZ (APB1_TIMER_HZ / PS2_PRESCALER)
+#define PS2_PERIOD( hz) (PS2_COUNT_HZ / (hz))
+#define PS2_OC1( period) (((period) / 4) - 1)
+#define PS2_OC2( period) (((period) / 2) - 1)
+
+#if (APB1_TIMER_HZ % PS2_PRESCALER) != 0
+#error "PS/2 prescaler must divide the timer clock evenly"
+#endif
+#if (PS2_PERIOD( PS2_RATE_MIN) / 2) > 65536
+#error "PS/2 period too long for a 16-bit timer; raise PS2_PRESCALER"
+#endif
+#if PS2_OC1( PS2_PERIOD( PS2_RATE_MAX)) < 200
+#error "PS/2 quarter period too short for tim2_isr; lower PS2_PRESCALER"
+#endif
+#if (PS2_RATE_DEFAULT < PS2_RATE_MIN) || (PS2_RATE_DEFAULT > PS2_RATE_MAX)
+#error "PS2_RATE_DEFAULT is outside the PS/2 spec"
+#endif
+#if !RING_SIZE_OK( PS2_TX_BUFFER_SIZE) || !RING_SIZE_OK( PS2_RX_BUFFER_SIZE)
+#error "PS/2 buffer sizes must be powers of two"
+#endif
+
+//  Rates we fall back through, fastest first.
+
+static const int
+  PS2RateTable[] = { 16000, 14000, 12000, 10500 };
+
+#define PS2_RATE_COUNT ((int) (sizeof( PS2RateTable) / sizeof( PS2RateTable[0])))
+
 //  Sates for receive and transmit.
 
 typedef enum 
@@ -38,7 +111,8 @@ typedef enum
   IDLE, 
   SEND, 
   REQUEST, 
-  RECEIVE 
+  RECEIVE,
+  DMA_SEND			// frame going out by DMA
 } PS2_STATE;
 
 // Data transfer states.
@@ -63,7 +137,69 @@ static volatile PS2_TRANSFER_STATE
 static int 
   PS2Prescaler,			// TIM2 prescaler
   PS2Period,			// TIM2 period
-  PS2SendRequest;
+  PS2Rate,			// PS/2 clock in Hz
+  PS2RateTop,			// rate we were set to; we don't go above it
+  PS2RateErrors,		// failures in a row at this rate
+  PS2RateGood,			// good frames in a row at this rate
+  PS2Fallbacks;			// times we've slowed down
+
+static volatile int
+  PS2NewPeriod;			// period to switch to when idle; 0 if none
+
+//  Transmit ring, filled by the main line and drained by tim2_isr;
+//  and receive ring, the other way round.
+
+static uint8_t
+  PS2TxBuffer[ PS2_TX_BUFFER_SIZE],
+  PS2RxBuffer[ PS2_RX_BUFFER_SIZE];
+
+static RING
+  PS2TxRing,
+  PS2RxRing;
+
+static int
+  PS2TxDropped;			// sequences dropped for lack of room
+
+static volatile uint32_t
+  PS2TxFlushTo;			// where a pending flush moves the output
+
+static volatile int
+  PS2TxFlushPending,		// a flush waits for tim2_isr to take it
+  PS2TxRetrying,		// the head byte was cut off last time
+  PS2TxAborts,			// frames cut off by the host
+  PS2TxRetries,			// frames sent again
+  PS2RxParityErrors,		// host frames with bad parity
+  PS2RxFramingErrors,		// host frames with no stop bit
+  PS2Replays;			// HOST_RESENDs answered
+
+//  Bytes that go ahead of the ring.  PS2TxSource says what the frame
+//  being sent came from, so we know what to do when it's done.
+
+typedef enum
+{
+  TX_QUEUE,			// head of the ring
+  TX_RESEND,			// KEY_RESEND for a bad host frame
+  TX_REPLAY			// PS2LastSent again
+} PS2_TX_SOURCE;
+
+static volatile int
+  PS2ResendRequest,		// ask the host to send again
+  PS2ReplayRequest;		// host asked us to send again
+
+static volatile PS2_TX_SOURCE
+  PS2TxSource;
+
+static uint8_t
+  PS2LastSent,			// last byte from the ring but FE, for replays
+  PS2RxError;			// frame being received is bad: 1 parity, 2 stop
+
+static volatile int
+  PS2TimerRunning;		// TIM2 is counting
+
+#ifdef PS2_DMA_TX
+static uint32_t
+  PS2BsrrTable[ PS2_FRAME_WORDS];	// the frame going out; see ps2frame.h
+#endif
 
 static  uint8_t 
   PS2OutputData,
@@ -82,6 +218,27 @@ static void CheckSendRequest(void);
 static void SendClear(void);
 static void ReceiveClear(void);
 static void ClockIRQHandler(void);
+static void PS2ApplyRate(void);
+static void PS2ChangeRate( int Hz);
+static void PS2RateGoodFrame(void);
+static void PS2TxCommit(void);
+static void PS2TxAbort(void);
+static int PS2TxPending(void);
+#ifdef PS2_JITTER_PROBE
+static void PS2Probe( int Up);
+#define PS2_PROBE( up) PS2Probe( up)
+#else
+#define PS2_PROBE( up)
+#endif
+#ifdef PS2_IDLE_GATING
+static void PS2Wake(void);
+static void PS2Sleep(void);
+#endif
+#ifdef PS2_DMA_TX
+static void PS2DmaInit(void);
+static void PS2DmaSend( uint8_t What);
+static void PS2DmaDone(void);
+#endif
 
 //*	UpdateStatusLEDs - Update Status LEDs.
 //	--------------------------------------
@@ -122,36 +279,243 @@ int PS2Ready( void)
   return ( PS2State == IDLE) ? 1 : 0;
 } // PS2Ready
 
+//*	PS2Quiet - See if the interface can be left alone.
+//	--------------------------------------------------
+//
+//	Returns 1 if idle with nothing to send and (with idle gating)
+//	TIM2 stopped, so only the clock pin EXTI is watching the host.
+//
+
+int PS2Quiet( void)
+{
+
+  if ( PS2State != IDLE || PS2TxPending())
+    return 0;
+#ifdef PS2_IDLE_GATING
+  if ( PS2TimerRunning)
+    return 0;
+#endif
+  return 1;
+} // PS2Quiet
+
+
+//*	PS2TxLevel - Return transmit ring fill level.
+//	---------------------------------------------
+//
+//	Returns the number of bytes waiting to go to the host.
+//
+
+int PS2TxLevel( void)
+{
+
+  return RingLevel( &PS2TxRing);
+} // PS2TxLevel
+
+//*	PS2TxMark - Return the transmit ring's input count.
+//	---------------------------------------------------
+//
+//	Counts every byte ever queued; used to tell when a given
+//	sequence has gone out.
+//
+
+uint32_t PS2TxMark( void)
+{
+  return PS2TxRing.In;
+} // PS2TxMark
+
+//*	PS2TxMaxLevel - Return transmit ring high-water mark.
+//	-----------------------------------------------------
+//
+
+int PS2TxMaxLevel( void)
+{
+  return PS2TxRing.HighWater;
+} // PS2TxMaxLevel
+
+//*	PS2TxDropCount - Return count of dropped sequences.
+//	---------------------------------------------------
+//
+
+int PS2TxDropCount( void)
+{
+  return PS2TxDropped;
+} // PS2TxDropCount
+
+//*	PS2TxAbortCount - Return count of frames cut off by the host.
+//	-------------------------------------------------------------
+//
+
+int PS2TxAbortCount( void)
+{
+  return PS2TxAborts;
+} // PS2TxAbortCount
+
+//*	PS2TxRetryCount - Return count of frames sent again.
+//	----------------------------------------------------
+//
+
+int PS2TxRetryCount( void)
+{
+  return PS2TxRetries;
+} // PS2TxRetryCount
+
+//*	PS2RxErrorCount - Return count of bad frames from the host.
+//	-----------------------------------------------------------
+//
+
+int PS2RxErrorCount( void)
+{
+  return PS2RxParityErrors + PS2RxFramingErrors;
+} // PS2RxErrorCount
+
+//*	PS2ReplayCount - Return count of host resend requests answered.
+//	---------------------------------------------------------------
+//
+
+int PS2ReplayCount( void)
+{
+  return PS2Replays;
+} // PS2ReplayCount
+
+#ifdef PS2_JITTER_PROBE
+//  Clock edge latency, in CPU cycles.
+
+static uint32_t
+  PS2JitterWorst,
+  PS2JitterTotal,
+  PS2JitterEdges;
+
+//*	PS2JitterStats - Return clock edge latency figures.
+//	---------------------------------------------------
+//
+//	Worst and average cycles from a TIM2 compare to the GPIO write
+//	for that clock edge, and how many edges were measured.
+//
+
+void PS2JitterStats( uint32_t *Worst, uint32_t *Average, uint32_t *Edges)
+{
+
+  *Worst = PS2JitterWorst;
+  *Edges = PS2JitterEdges;
+  *Average = PS2JitterEdges ? PS2JitterTotal / PS2JitterEdges : 0;
+  return;
+} // PS2JitterStats
+
+//*	PS2JitterReset - Start measuring afresh.
+//	----------------------------------------
+
+void PS2JitterReset( void)
+{
+
+  PS2JitterWorst = 0;
+  PS2JitterTotal = 0;
+  PS2JitterEdges = 0;
+  return;
+} // PS2JitterReset
+
+//  PS2Probe - Note how late this clock edge is.
+//  --------------------------------------------
+//
+//  Called from ClockIRQHandler just before the clock pin is written.
+//  The compare happened when the count passed CCR1 going up (Up) or
+//  down; each count is PS2Prescaler CPU cycles.  The interrupt entry
+//  time is included--that's the point.
+//
+
+static void PS2Probe( int Up)
+{
+
+  uint32_t
+    late;
+
+  if ( Up)
+    late = TIM_CNT(TIM2) - TIM_CCR1(TIM2);
+  else
+    late = TIM_CCR1(TIM2) - TIM_CNT(TIM2);
+  late = (late & 0xffff) * PS2Prescaler;
+  if ( late > PS2JitterWorst)
+    PS2JitterWorst = late;
+  PS2JitterTotal += late;
+  PS2JitterEdges++;
+  return;
+} // PS2Probe
+#endif
+
+//*	PS2TxFlush - Discard anything waiting to go to the host.
+//	--------------------------------------------------------
+//
+//	Used on a host reset.  Only the timer moves the output index, so
+//	we just say how far; it skips there once any byte being clocked
+//	out is finished.  Anything queued after this call is kept.
+//
+
+void PS2TxFlush( void)
+{
+  PS2TxFlushTo = PS2TxRing.In;
+  PS2TxFlushPending = 1;
+  return;
+} // PS2TxFlush
+
+//*	PS2PutSeq - Queue a scan code sequence to interface.
+//	----------------------------------------------------
+//
+//	Either the whole sequence is queued or none of it is; we never
+//	wait for room.  Returns 1 if queued, 0 if dropped.
+//
+//	The ring publishes the whole sequence at once, so tim2_isr never
+//	sees part of one.
+//
+
+int PS2PutSeq( const uint8_t *What, int Len)
+{
+
+  if ( !RingPutBulk( &PS2TxRing, What, Len))
+  { // no room for all of it
+    PS2TxDropped++;
+    Trace( TR_PS2_DROP, Len, 0);
+    return 0;
+  }
+
+#ifdef PS2_IDLE_GATING
+  if ( !PS2TimerRunning)
+  { // timer is asleep--get it going
+    uint32_t
+      wasMasked;
+
+    wasMasked = cm_mask_interrupts( 1);	// keep EXTI out while we do
+    PS2Wake();
+    cm_mask_interrupts( wasMasked);
+  }
+#endif
+  return 1;
+} // PS2PutSeq
 
 //*	PS2Put - Put a character to interface.
 //	--------------------------------------
 //
-//	If interface is busy, this will stall until ready.
+//	Queues one byte; never stalls.  Returns 1 if queued.
 //
 
-void PS2Put( uint8_t What)
+int PS2Put( uint8_t What)
 {
-  while( !PS2Ready()) {};	// stall until ready
-  PS2OutputData = What;		// what we're sending
-  PS2SendRequest = 1;		// say we need to send something
-  while( PS2Ready()) {};	// wait for the timer to pick it up
-  return;
+  return PS2PutSeq( &What, 1);
 } // PS2Put
 
 //	PS2PutStr - Put a null-terminated string to interface.
 //	------------------------------------------------------
 //
-//	Just calls PS2Put().
+//	The whole string is queued as one sequence.
 //
 
-void PS2PutStr( uint8_t *What)
+int PS2PutStr( const uint8_t *What)
 {
-  
-  do
-  {
-    PS2Put( *What++);
-  } while ( *What);
-  return;
+
+  int
+    len;
+
+  for ( len = 0; What[ len]; len++)
+    ;				// find the terminator
+  return PS2PutSeq( What, len);
 } // PS2PutStr
 
 //*	PS2Get - Get a character from interface.
@@ -160,6 +524,9 @@ void PS2PutStr( uint8_t *What)
 //	Returns -1 if no data available; otherwise
 //	returns data last read.
 //
+//	The line may be busy; the ring is safe to read anyway, and a
+//	byte left behind here would wait until the host sent another.
+//
 
 int PS2Get( void)
 {
@@ -167,13 +534,7 @@ int PS2Get( void)
   int 
    idata;
    
-  if ( !PS2Ready()) 
-    return -1;			// if busy
-  if (PS2RxBufferIn == PS2RxBufferOut)
-    return -1;			// empty
-  idata = PS2RxBuffer[ PS2RxBufferOut++];	// get data
-  if ( PS2RxBufferOut >= PS2_RX_BUFFER_SIZE)
-    PS2RxBufferOut = 0;        // wrap arond
+  idata = RingGet( &PS2RxRing);	// -1 if empty
   return idata;
 } // PS2Get
 
@@ -182,32 +543,44 @@ int PS2Get( void)
 //  	---------------------------------------
 //
 //  	We use PB0 and PB1 for clock and data and TIM2 for timer.
-//  	This whole affair is driven by TIM2 running at about 12KHz.
-//  	We use the up+down so that we can sample in the middle of a
-//  	bit cell.
+//  	This whole affair is driven by TIM2 running at the PS/2 clock
+//  	rate.  We use the up+down so that we can sample in the middle
+//  	of a bit cell.
 //
 
 void PS2Init( void)
 {
 
+  uint32_t
+    startTime;
+
 //  Setup the clock and data GPIO pins.  GPIO open-drain and high.
+//  The output latch is set first; the other way round, both lines
+//  would be pulled low for a moment, which a host can take for a
+//  clock.
 
   rcc_periph_clock_enable(RCC_GPIOB);
+  gpio_set( PS2_GPIO, PS2_BIT_CLK | PS2_BIT_DATA);
   gpio_set_mode( PS2_GPIO, GPIO_MODE_OUTPUT_50_MHZ, 
     GPIO_CNF_OUTPUT_OPENDRAIN, PS2_BIT_CLK | PS2_BIT_DATA);
-
-  gpio_set( PS2_GPIO, PS2_BIT_CLK | PS2_BIT_DATA);
     
 //  Handle the setup for TIM2.
 
-  PS2Prescaler = 3;
-  PS2Period = 2000;		// should be 12KHz
+  PS2Prescaler = PS2_PRESCALER;
+  PS2Rate = PS2_RATE_DEFAULT;
+  PS2RateTop = PS2Rate;
+  PS2Period = PS2_PERIOD( PS2Rate);
+  PS2NewPeriod = 0;
+  PS2RateErrors = 0;
+  PS2RateGood = 0;
+  PS2Fallbacks = 0;
 
+  nvic_set_priority( NVIC_TIM2_IRQ, IRQ_PRIO_PS2_TIMER);
   nvic_enable_irq(NVIC_TIM2_IRQ);	// enable interrupt
   rcc_periph_clock_enable(RCC_TIM2);
   rcc_periph_reset_pulse(RST_TIM2);
   timer_set_prescaler( TIM2,  PS2Prescaler - 1);
-  timer_set_period( TIM2, (PS2Period / 2) - 1);
+  timer_set_period( TIM2, PS2_OC2( PS2Period));
   timer_set_mode(TIM2, TIM_CR1_CKD_CK_INT,
 		       TIM_CR1_CMS_CENTER_3, TIM_CR1_DIR_UP);
   timer_disable_preload(TIM2);
@@ -218,7 +591,7 @@ void PS2Init( void)
   timer_set_oc_mode( TIM2, TIM_OC1, TIM_OCM_FROZEN);
   timer_enable_oc_output( TIM2, TIM_OC1);
   timer_set_oc_polarity_high( TIM2, TIM_OC1);
-  timer_set_oc_value( TIM2, TIM_OC1, (PS2Period / 4) - 1); 
+  timer_set_oc_value( TIM2, TIM_OC1, PS2_OC1( PS2Period)); 
   timer_disable_oc_preload( TIM2, TIM_OC1);
     
 //  And then the TIM2 compare 2 mode.
@@ -226,18 +599,48 @@ void PS2Init( void)
   timer_set_oc_mode( TIM2, TIM_OC2, TIM_OCM_FROZEN);
   timer_enable_oc_output( TIM2, TIM_OC2);
   timer_set_oc_polarity_high( TIM2, TIM_OC2);
-  timer_set_oc_value( TIM2, TIM_OC2, (PS2Period / 2) - 1); 
+  timer_set_oc_value( TIM2, TIM_OC2, PS2_OC2( PS2Period)); 
   timer_disable_oc_preload( TIM2, TIM_OC2);
 
 //  enable interrupts for OC1 and OC2.
 
   timer_enable_irq( TIM2, TIM_DIER_CC1IE | TIM_DIER_CC2IE);
+
+#ifdef PS2_DMA_TX
+  PS2DmaInit();
+#endif
+
+#ifdef PS2_IDLE_GATING
+
+//  Set up the EXTI line on the clock pin to wake us when the timer's
+//  stopped.  It's left masked until then.
+
+  rcc_periph_clock_enable(RCC_AFIO);
+  exti_select_source( PS2_CLK_EXTI, PS2_GPIO);
+  exti_set_trigger( PS2_CLK_EXTI, EXTI_TRIGGER_FALLING);
+  exti_disable_request( PS2_CLK_EXTI);
+  nvic_set_priority( PS2_CLK_IRQ, IRQ_PRIO_PS2_AUX);
+  nvic_enable_irq( PS2_CLK_IRQ);
+#endif
   
 //  Set up the various state variables.
 
   PS2State = IDLE;
   PS2TransferState = START;
-  PS2SendRequest = 0;
+  RingInit( &PS2TxRing, PS2TxBuffer, PS2_TX_BUFFER_SIZE);
+  PS2TxDropped = 0;
+  PS2TxFlushPending = 0;
+  PS2TxRetrying = 0;
+  PS2TxAborts = 0;
+  PS2TxRetries = 0;
+  PS2RxParityErrors = 0;
+  PS2RxFramingErrors = 0;
+  PS2Replays = 0;
+  PS2ResendRequest = 0;
+  PS2ReplayRequest = 0;
+  PS2TxSource = TX_QUEUE;
+  PS2LastSent = KEY_BAT;
+  PS2RxError = 0;
   PS2OutputData = 0x00,
   PS2OutputBitPos = 0,
   PS2InputData = 0,
@@ -246,21 +649,372 @@ void PS2Init( void)
 
 //  The next two are debug
 
-  PS2RxBufferIn = 0;
-  PS2RxBufferOut = 0;		// clear the buffer
+  RingInit( &PS2RxRing, PS2RxBuffer, PS2_RX_BUFFER_SIZE);
 
 //  Delay 300 msec, then send the BAT code.
 
-  TickCount = 0;
-  while (TickCount < 300) {}
+  startTime = TimeNow();
+  while ( (TimeNow() - startTime) < 300) {}
   
 // Enable the timer and send the BAT complete code.  
 
+  PS2TimerRunning = 1;
   timer_enable_counter( TIM2);
   PS2Put( 0xaa);
   return;
 } // PS2Init
 
+//*	PS2SetRate - Change the PS/2 clock rate.
+//	----------------------------------------
+//
+//	Returns 1 if Hz is within the spec, 0 (and nothing changes) if
+//	not.  The new rate takes effect when the interface is next idle,
+//	and is the fastest we come back up to after falling back.
+//
+
+int PS2SetRate( int Hz)
+{
+
+  if ( Hz < PS2_RATE_MIN || Hz > PS2_RATE_MAX)
+    return 0;
+  PS2RateTop = Hz;
+  PS2ChangeRate( Hz);
+  return 1;
+} // PS2SetRate
+
+//*	PS2GetRate - Return the PS/2 clock rate.
+//	----------------------------------------
+
+int PS2GetRate( void)
+{
+  return PS2Rate;
+} // PS2GetRate
+
+//*	PS2RateError - Count a failed frame.
+//	------------------------------------
+//
+//	Called when the host cuts a frame short or asks for a resend.
+//	After PS2_FALLBACK_ERRORS of these in a row, we move down to the
+//	next slower rate in the table.  A good frame clears the count.
+//
+
+void PS2RateError( void)
+{
+
+  int
+    i;
+
+  PS2RateGood = 0;
+  if ( ++PS2RateErrors < PS2_FALLBACK_ERRORS)
+    return;
+  PS2RateErrors = 0;
+  for ( i = 0; i < PS2_RATE_COUNT; i++)
+  {
+    if ( PS2RateTable[ i] < PS2Rate)
+    { // first slower one
+      PS2ChangeRate( PS2RateTable[ i]);
+      PS2Fallbacks++;
+      Trace( TR_PS2_RATE, 0, PS2RateTable[ i]);
+      break;
+    }
+  } // for each rate
+  return;
+} // PS2RateError
+
+//  PS2RateGoodFrame - Count a frame that went out whole.
+//  -----------------------------------------------------
+//
+//  After PS2_RECOVER_FRAMES of these in a row below PS2RateTop, we
+//  move up to the next faster rate in the table (or to PS2RateTop,
+//  if that comes first).  Falling back takes only
+//  PS2_FALLBACK_ERRORS, so a host that's marginal at the faster rate
+//  spends most of its time at the slower one.
+//
+
+static void PS2RateGoodFrame(void)
+{
+
+  int
+    i,
+    hz;
+
+  PS2RateErrors = 0;
+  if ( PS2Rate >= PS2RateTop || ++PS2RateGood < PS2_RECOVER_FRAMES)
+    return;
+  hz = PS2RateTop;
+  for ( i = PS2_RATE_COUNT - 1; i >= 0; i--)
+  {
+    if ( PS2RateTable[ i] > PS2Rate)
+    { // first faster one
+      if ( PS2RateTable[ i] < hz)
+        hz = PS2RateTable[ i];
+      break;
+    }
+  } // for each rate
+  PS2ChangeRate( hz);
+  Trace( TR_PS2_RATE, 1, hz);
+  return;
+} // PS2RateGoodFrame
+
+//  PS2ChangeRate - Switch rates when next idle.
+//  --------------------------------------------
+
+static void PS2ChangeRate( int Hz)
+{
+
+  PS2Rate = Hz;
+  PS2RateErrors = 0;
+  PS2RateGood = 0;
+  PS2NewPeriod = PS2_PERIOD( Hz);
+  return;
+} // PS2ChangeRate
+
+//  PS2ApplyRate - Reprogram the timers for a new rate.
+//  ---------------------------------------------------
+//
+//  Invoked from tim2_isr on a rising clock edge while idle, with the
+//  counter a quarter of the way up; that's below any new top, so the
+//  count carries on normally.
+//
+
+static void PS2ApplyRate(void)
+{
+
+  PS2Period = PS2NewPeriod;
+  PS2NewPeriod = 0;
+  timer_set_period( TIM2, PS2_OC2( PS2Period));
+  timer_set_oc_value( TIM2, TIM_OC1, PS2_OC1( PS2Period));
+  timer_set_oc_value( TIM2, TIM_OC2, PS2_OC2( PS2Period));
+#ifdef PS2_DMA_TX
+  timer_set_period( TIM4, PS2_OC1( PS2Period));
+#endif
+  return;
+} // PS2ApplyRate
+
+#ifdef PS2_IDLE_GATING
+//  PS2Wake - Restart TIM2.
+//  -----------------------
+//
+//  Called with the EXTI interrupt kept out, either from the EXTI
+//  handler itself or from PS2PutSeq.  The counter starts from zero, 
+//  counting up, so the first interrupt is a clock rising edge and
+//  CheckSendRequest/CheckReceiveRequest get a look right away.
+//
+
+static void PS2Wake(void)
+{
+
+  if ( PS2TimerRunning)
+    return;			// already awake
+  exti_disable_request( PS2_CLK_EXTI);
+  PS2TimerRunning = 1;
+  timer_set_counter( TIM2, 0);
+  timer_enable_counter( TIM2);
+  return;
+} // PS2Wake
+
+//  PS2Sleep - Stop TIM2 until needed.
+//  ----------------------------------
+//
+//  Invoked from tim2_isr when idle with nothing to send.  The EXTI
+//  line is armed before the clock is checked, so a host request that
+//  begins in between is still caught.
+//
+
+static void PS2Sleep(void)
+{
+
+  exti_reset_request( PS2_CLK_EXTI);
+  exti_enable_request( PS2_CLK_EXTI);
+  if ( !gpio_get( PS2_GPIO, PS2_BIT_CLK))
+  { // host already has the clock; stay awake
+    exti_disable_request( PS2_CLK_EXTI);
+    return;
+  }
+  timer_disable_counter( TIM2);
+  PS2TimerRunning = 0;
+  return;
+} // PS2Sleep
+
+//	PS/2 clock pin EXTI handler.
+//	----------------------------
+//
+//	The host has pulled the clock low while we were asleep.
+//
+
+void exti9_5_isr(void)
+{
+
+  ProfileEnter( PROF_EXTI_PS2);
+  if ( exti_get_flag_status( PS2_CLK_EXTI))
+  {
+    exti_reset_request( PS2_CLK_EXTI);
+    PS2Wake();
+  }
+  ProfileExit( PROF_EXTI_PS2);
+  return;
+} // exti9_5_isr
+#endif
+
+
+#ifdef PS2_DMA_TX
+//  PS2DmaInit - Set up TIM4 and DMA1 channel 7 for sending.
+//  --------------------------------------------------------
+//
+//  TIM4 counts up at the TIM2 count rate and updates four times per
+//  PS/2 clock period; each update has DMA1 channel 7 copy the next
+//  table word to the port's BSRR, and interrupts so tim4_isr can
+//  check the clock came up.  Channel 1 captures falling edges on the
+//  clock pin.
+//
+
+static void PS2DmaInit(void)
+{
+
+  rcc_periph_clock_enable(RCC_TIM4);
+  rcc_periph_clock_enable(RCC_DMA1);
+  rcc_periph_reset_pulse(RST_TIM4);
+  timer_set_prescaler( TIM4, PS2Prescaler - 1);
+  timer_set_period( TIM4, PS2_OC1( PS2Period));
+  timer_set_mode( TIM4, TIM_CR1_CKD_CK_INT,
+		       TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+  timer_continuous_mode( TIM4);
+  timer_ic_set_input( TIM4, TIM_IC1, TIM_IC_IN_TI1);
+  timer_ic_set_polarity( TIM4, TIM_IC1, TIM_IC_FALLING);
+  timer_ic_enable( TIM4, TIM_IC1);
+  timer_enable_irq( TIM4, TIM_DIER_UDE);	// DMA on update
+
+  dma_channel_reset( DMA1, DMA_CHANNEL7);
+  dma_set_peripheral_address( DMA1, DMA_CHANNEL7, 
+    (uint32_t) &GPIO_BSRR( PS2_GPIO));
+  dma_set_memory_address( DMA1, DMA_CHANNEL7, (uint32_t) PS2BsrrTable);
+  dma_set_read_from_memory( DMA1, DMA_CHANNEL7);
+  dma_enable_memory_increment_mode( DMA1, DMA_CHANNEL7);
+  dma_set_peripheral_size( DMA1, DMA_CHANNEL7, DMA_CCR_PSIZE_32BIT);
+  dma_set_memory_size( DMA1, DMA_CHANNEL7, DMA_CCR_MSIZE_32BIT);
+  dma_set_priority( DMA1, DMA_CHANNEL7, DMA_CCR_PL_VERY_HIGH);
+  dma_enable_transfer_complete_interrupt( DMA1, DMA_CHANNEL7);
+
+  nvic_set_priority( NVIC_DMA1_CHANNEL7_IRQ, IRQ_PRIO_PS2_AUX);
+  nvic_set_priority( NVIC_TIM4_IRQ, IRQ_PRIO_PS2_AUX);
+  nvic_enable_irq( NVIC_DMA1_CHANNEL7_IRQ);
+  nvic_enable_irq( NVIC_TIM4_IRQ);
+  return;
+} // PS2DmaInit
+
+//  PS2DmaSend - Start a frame going out by DMA.
+//  --------------------------------------------
+//
+//  Invoked from tim2_isr when a byte is ready to go; stops TIM2 until
+//  the frame is over.  PS2TimerRunning is left set, so queueing more
+//  bytes doesn't restart it early.
+//
+
+static void PS2DmaSend( uint8_t What)
+{
+
+  PS2FrameBuild( PS2BsrrTable, What, PS2_BIT_CLK, PS2_BIT_DATA);
+  timer_disable_counter( TIM2);	// paused; PS2DmaDone restarts it
+  PS2State = DMA_SEND;
+
+  dma_set_number_of_data( DMA1, DMA_CHANNEL7, PS2_FRAME_WORDS);
+  dma_enable_channel( DMA1, DMA_CHANNEL7);
+  timer_clear_flag( TIM4, TIM_SR_CC1IF | TIM_SR_UIF);
+  timer_enable_irq( TIM4, TIM_DIER_CC1IE | TIM_DIER_UIE);
+  timer_set_counter( TIM4, 0);
+  timer_enable_counter( TIM4);
+  return;
+} // PS2DmaSend
+
+//  PS2DmaDone - Finish a DMA frame, sent or not.
+//  ---------------------------------------------
+//
+//  Both lines are released and TIM2 takes over again.
+//
+
+static void PS2DmaDone(void)
+{
+
+  timer_disable_counter( TIM4);
+  timer_disable_irq( TIM4, TIM_DIER_CC1IE | TIM_DIER_UIE);
+  dma_disable_channel( DMA1, DMA_CHANNEL7);
+  gpio_set( PS2_GPIO, PS2_BIT_CLK | PS2_BIT_DATA);
+  PS2State = IDLE;
+
+  timer_set_counter( TIM2, 0);
+  timer_enable_counter( TIM2);
+  return;
+} // PS2DmaDone
+
+//	DMA1 channel 7 interrupt - frame sent.
+//	--------------------------------------
+
+void dma1_channel7_isr(void)
+{
+
+  ProfileEnter( PROF_DMA7);
+  if ( dma_get_interrupt_flag( DMA1, DMA_CHANNEL7, DMA_TCIF))
+  {
+    dma_clear_interrupt_flags( DMA1, DMA_CHANNEL7, DMA_TCIF);
+    if ( PS2State == DMA_SEND)
+    {
+      PS2TxCommit();
+      PS2DmaDone();
+    }
+  }
+  ProfileExit( PROF_DMA7);
+  return;
+} // dma1_channel7_isr
+
+//	TIM4 interrupt - update, or falling edge on the clock line.
+//	-----------------------------------------------------------
+//
+//	A host that pulls the clock down while we hold it down makes no
+//	edge, so each update checks the clock is high a quarter period
+//	after we let it go.  The pin is read before the count, so a word
+//	written in between can't make the check look at the wrong one.
+//
+//	Most falling edges are our own.  Unless the last word written was
+//	one that pulls the clock down (or the frame is all out), the host
+//	has pulled it down on us.
+//
+//	Either way, give up the frame.
+//
+
+void tim4_isr(void)
+{
+
+  int
+    written,
+    clk;
+
+  ProfileEnter( PROF_TIM4);
+  if ( timer_get_flag( TIM4, TIM_SR_UIF))
+  {
+    timer_clear_flag( TIM4, TIM_SR_UIF);
+    clk = gpio_get( PS2_GPIO, PS2_BIT_CLK);
+    written = PS2_FRAME_WORDS - DMA_CNDTR( DMA1, DMA_CHANNEL7);
+    if ( (PS2State == DMA_SEND) && PS2_FRAME_CLK_UP( written) && !clk)
+    { // host holding the clock down--abandon frame
+      PS2TxAbort();
+      PS2DmaDone();
+    }
+  }
+  if ( timer_get_flag( TIM4, TIM_SR_CC1IF))
+  {
+    timer_clear_flag( TIM4, TIM_SR_CC1IF);
+    written = PS2_FRAME_WORDS - DMA_CNDTR( DMA1, DMA_CHANNEL7);
+    if ( (PS2State == DMA_SEND) && (written < PS2_FRAME_WORDS) &&
+         !PS2_FRAME_OWN_FALL( written))
+    { // host inhibit--abandon frame
+      PS2TxAbort();
+      PS2DmaDone();
+    }
+  }
+  ProfileExit( PROF_TIM4);
+  return;
+} // tim4_isr
+#endif
 
 //  SendDataIRQHandler - Handler for sending data.
 //  ----------------------------------------------
@@ -336,8 +1090,7 @@ static PS2_TRANSFER_STATE ReceiveDataIRQHandler(void)
     PS2NextState = PS2TransferState;
 
   int 
-    ps2DataBit,
-    rxNext;
+    ps2DataBit;
 
 //	Get bit from port.
   
@@ -347,6 +1100,7 @@ static PS2_TRANSFER_STATE ReceiveDataIRQHandler(void)
     case START:		// Got the first bit
       PS2InputBitPos = 0;
       PS2Parity = 0;
+      PS2RxError = 0;
       if(ps2DataBit != 0) 
           break;	// this shouldn't happen, so ignore the bit
 
@@ -367,14 +1121,18 @@ static PS2_TRANSFER_STATE ReceiveDataIRQHandler(void)
         
     case PARITY:
       if( ps2DataBit != PS2Parity) 
-      { // Parity error, here, just ignore for now
+      { // Parity error; drop it and ask again
+        PS2RxParityErrors++;
+        PS2RxError |= 1;
       }
       PS2NextState = STOP;
       break;
         
     case STOP:
       if (!ps2DataBit) 
-      { // didn't get the stop bit--ignore
+      { // didn't get the stop bit; drop it and ask again
+        PS2RxFramingErrors++;
+        PS2RxError |= 2;
       }
       PS2NextState = ACK;
       break;
@@ -386,13 +1144,19 @@ static PS2_TRANSFER_STATE ReceiveDataIRQHandler(void)
       
     case UNACK:
       gpio_set( PS2_GPIO, PS2_BIT_DATA);
-      PS2RxBuffer[ PS2RxBufferIn] = PS2InputData;
-      rxNext = PS2RxBufferIn+1;
-      if ( rxNext >= PS2_RX_BUFFER_SIZE)
-        rxNext = 0;                   // wrap around
-      if ( rxNext != PS2RxBufferOut)
-        PS2RxBufferIn = rxNext;    // stuff the new byte
       PS2NextState = FINISHED;
+      if ( PS2RxError)
+      { // garbled
+        Trace( TR_PS2_RX_ERROR, PS2InputData, PS2RxError);
+        PS2ResendRequest = 1;
+        break;
+      } else if ( PS2InputData == HOST_RESEND)
+      { // host wants our last byte again
+        PS2ReplayRequest = 1;
+        PS2RateError();
+        break;
+      }
+      RingPut( &PS2RxRing, PS2InputData);	// stuff the new byte
       break;
 
     case FINISHED:	// finally, release the ACK and stash buffer
@@ -412,7 +1176,7 @@ static PS2_TRANSFER_STATE ReceiveDataIRQHandler(void)
 static void DataIRQHandler(void)
 {
 
-  if (PS2State == IDLE || PS2State == REQUEST) 
+  if (PS2State == IDLE || PS2State == REQUEST || PS2State == DMA_SEND) 
     return;		// nothing to do
 
 // See if the communication was canceled 
@@ -420,6 +1184,8 @@ static void DataIRQHandler(void)
   if ( !gpio_get(PS2_GPIO, PS2_BIT_CLK) ) 
   { // Release DATA Pin 
     gpio_set(PS2_GPIO, PS2_BIT_DATA);
+    if ( PS2State == SEND)
+      PS2TxAbort();		// host cut us off; send it again
     PS2State = IDLE;
     return;
   }
@@ -446,6 +1212,11 @@ static void CheckReceiveRequest(void)
   { // Idle, Clock should be set, otherwise we have a receive request 
     if( !gpio_get(PS2_GPIO, PS2_BIT_CLK ) )
       PS2State = REQUEST;
+    else if ( !gpio_get( PS2_GPIO, PS2_BIT_DATA) )
+    { // host held the clock while we were busy and has let it go
+      PS2State = RECEIVE;		// already; don't send over its start bit
+      PS2TransferState = START;
+    }
   } else if( PS2State == REQUEST) 
   { // Check if CLK is set again, then the transfer can start 
     if( gpio_get(PS2_GPIO, PS2_BIT_CLK) ) 
@@ -463,19 +1234,111 @@ static void CheckReceiveRequest(void)
 } // CheckReceiveRequest
 
 
+//  PS2TxCommit - Take a sent byte off the ring.
+//  --------------------------------------------
+//
+//   Invoked from tim2_isr (or the DMA interrupt) when a frame has gone
+//   out whole.  If it was a resend request or a replay, there's nothing
+//   to take off; just clear the request.
+//
+
+static void PS2TxCommit(void)
+{
+
+  PS2RateGoodFrame();
+  Trace( TR_PS2_SENT, PS2OutputData, PS2TxSource);
+  if ( PS2TxSource == TX_RESEND)
+  {
+    PS2ResendRequest = 0;
+    return;
+  } else if ( PS2TxSource == TX_REPLAY)
+  {
+    PS2ReplayRequest = 0;
+    PS2Replays++;
+    return;
+  }
+
+  if ( PS2OutputData != KEY_RESEND)
+    PS2LastSent = PS2OutputData;	// a replay is never of a resend
+  RingRelease( &PS2TxRing, 1);
+  LatencyFrameDone( PS2TxRing.Out);
+  return;
+} // PS2TxCommit
+
+//  PS2TxAbort - Note a frame cut off by the host.
+//  ----------------------------------------------
+//
+//   The byte is still at the head of the ring (or its request is
+//   still set) and goes out again next time.
+//
+
+static void PS2TxAbort(void)
+{
+
+  Trace( TR_PS2_ABORT, PS2OutputData, 0);
+  PS2TxAborts++;
+  PS2TxRetrying = 1;
+  PS2RateError();
+  return;
+} // PS2TxAbort
+
+//  PS2TxPending - See if there's anything to send.
+//  -----------------------------------------------
+
+static int PS2TxPending(void)
+{
+  return !RingEmpty( &PS2TxRing) || PS2TxFlushPending ||
+    PS2ResendRequest || PS2ReplayRequest;
+} // PS2TxPending
+
 //  CheckSendRequest - Start a sending sequence.
 //  --------------------------------------------
 //
-//   Invoked from tim2_isr.
+//   Invoked from tim2_isr.  A resend request or a replay goes first;
+//   otherwise the byte at the head of the ring is sent but not taken
+//   off; PS2TxCommit does that once it's all gone out.
 //
 
 static void CheckSendRequest(void)
 {
-  if(PS2State == IDLE && PS2SendRequest) 
-  {  // has to be idle to start sending
-    PS2State = SEND;
-    PS2TransferState = START;
+
+  if ( PS2State != IDLE)
+    return;
+
+  if ( PS2TxFlushPending)
+  { // skip whatever the host doesn't want any more
+    RingRelease( &PS2TxRing, PS2TxFlushTo - PS2TxRing.Out);
+    LatencyFlush( PS2TxRing.Out);
+    PS2TxFlushPending = 0;
+    PS2TxRetrying = 0;
   }
+
+  if ( PS2ResendRequest)
+  { // host's last frame was bad
+    PS2TxSource = TX_RESEND;
+    PS2OutputData = KEY_RESEND;
+  } else if ( PS2ReplayRequest)
+  { // host wants the last one again
+    PS2TxSource = TX_REPLAY;
+    PS2OutputData = PS2LastSent;
+  } else if( !RingEmpty( &PS2TxRing)) 
+  {
+    PS2TxSource = TX_QUEUE;
+    PS2OutputData = RingPeek( &PS2TxRing);	// stays queued
+  } else
+    return;			// nothing to send
+
+  if ( PS2TxRetrying)
+  {
+    PS2TxRetries++;
+    PS2TxRetrying = 0;
+  }
+#ifdef PS2_DMA_TX
+  PS2DmaSend( PS2OutputData);
+#else
+  PS2State = SEND;
+  PS2TransferState = START;
+#endif
   return;
 } // CheckSendRequest
 
@@ -484,7 +1347,8 @@ static void CheckSendRequest(void)
 //  ----------------------------------------------
 //
 //  Invoked from tim2_isr; transitions to IDLE state
-//  if sending complete.
+//  if sending complete.  The next queued byte, if any, is
+//  picked up by CheckSendRequest.
 //
 
 static void SendClear(void)
@@ -493,7 +1357,7 @@ static void SendClear(void)
   if(PS2State == SEND && PS2TransferState == FINISHED) 
   {
     PS2State = IDLE;
-    PS2SendRequest = 0;
+    PS2TxCommit();
   }
   return;
 } // SendClear
@@ -511,6 +1375,7 @@ static void ReceiveClear(void)
   {
     gpio_set( PS2_GPIO, PS2_BIT_CLK | PS2_BIT_DATA);	// release both lines
     PS2State = IDLE;
+    EventPost( EV_HOST);	// PS2Get will now hand it over
   }
   return;
 } // ReceiveClear
@@ -520,23 +1385,52 @@ static void ReceiveClear(void)
 //
 //  Called from tim2_isr
 //
+//  A new frame is only started if the line was idle for the whole of
+//  the last clock as well, so the clock stays high for at least 1.5
+//  periods between frames and after the host lets go of it; the spec
+//  wants 50 us.  Before each falling edge of a frame we're sending,
+//  the clock is checked: if the host has it, the frame is cut off
+//  there, up to and including the 11th clock.
+//
 
 static void ClockIRQHandler(void)
 {
 
+  int
+    wasIdle;
+
   if ( !(TIM_CR1(TIM2) & TIM_CR1_DIR_DOWN))
   { // counter is counting up.
+    wasIdle = (PS2State == IDLE);
     CheckReceiveRequest();
     if(PS2State == SEND || PS2State == RECEIVE) 
+    {
+      PS2_PROBE( 1);
       gpio_set(PS2_GPIO, PS2_BIT_CLK);	// positive CLK
+    }
     if (PS2State == SEND)
       SendClear();
-    CheckSendRequest();
+    if ( PS2NewPeriod && PS2State == IDLE)
+      PS2ApplyRate();
+    if ( wasIdle)
+      CheckSendRequest();
+#ifdef PS2_IDLE_GATING
+    if ( PS2State == IDLE && !PS2TxPending())
+      PS2Sleep();		// nothing doing
+#endif
   } else 
   { // Counter Direction DOWN, CLK Falling Edge 
-    if(PS2State == SEND || PS2State == RECEIVE) 
+    ReceiveClear();		// first, so a finished frame gets no runt clock
+    if ( PS2State == SEND && !gpio_get( PS2_GPIO, PS2_BIT_CLK))
+    { // host has the clock--frame's cut off
+      gpio_set( PS2_GPIO, PS2_BIT_DATA);
+      PS2TxAbort();
+      PS2State = IDLE;
+    } else if(PS2State == SEND || PS2State == RECEIVE) 
+    {
+      PS2_PROBE( 0);
       gpio_clear(PS2_GPIO, PS2_BIT_CLK);  // neagive Clk
-    ReceiveClear();
+    }
   } // if counting down
   return;
 } // ClockIRQHandler
@@ -546,6 +1440,7 @@ static void ClockIRQHandler(void)
 
 void tim2_isr(void)
 {
+  ProfileEnter( PROF_TIM2);
   if ( timer_get_flag(TIM2, TIM_SR_CC1IF)) 
   { // CC1 is the CLK Timer Channel 
    timer_clear_flag(TIM2, TIM_SR_CC1IF);
@@ -555,5 +1450,6 @@ void tim2_isr(void)
     timer_clear_flag(TIM2, TIM_SR_CC2IF);
     DataIRQHandler();
   }
+  ProfileExit( PROF_TIM2);
 } // TIM2_IRQHandler
 
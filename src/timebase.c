@@ -0,0 +1,219 @@
+//  Timekeeping.
+//  ------------
+//
+//	There's no periodic tick; a 1 ms interrupt would cut into the
+//	PS/2 bit timing a thousand times a second and keep us from ever
+//	sleeping for long.  Instead:
+//
+//	  - TimeNow gives milliseconds since startup, worked out from the
+//	    DWT cycle counter when asked.  The counter wraps every 59.6
+//	    seconds at 72 MHz; each read notes a wrap since the last, so
+//	    reads must come at least that often.  TIM1 sees to it.
+//
+//	  - TIM3 channel 4 blinks the heartbeat LED (PB1) in PWM mode: a
+//	    2 kHz count, 4096 counts per period, half of it on.  That's
+//	    1.024 s on and 1.024 s off, as before, with no software.
+//
+//	  - TIM1 is a one-shot, set for the next deadline and posting
+//	    EV_TIMER when it comes.  With no deadline it still goes off
+//	    every TIME_GUARD_MS to read the time.
+//
+
+#include <stdint.h>
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include "globals.h"
+#include "gpiodef.h"
+#include "event.h"
+#include "timebase.h"
+#include "irqprio.h"
+#include "profile.h"
+
+#define TIME_TIMER_HZ 2000	// TIM1 and TIM3 count rate
+#define TIME_PRESCALER (CPU_CLOCK_HZ / TIME_TIMER_HZ)	// 36000
+#define HEARTBEAT_PERIOD 4096	// counts per blink
+#define TIME_GUARD_TICKS (TIME_GUARD_MS * (TIME_TIMER_HZ / 1000))
+
+#if TIME_PRESCALER > 65536
+#error "TIME_TIMER_HZ too low for a 16-bit prescaler"
+#endif
+#if TIME_GUARD_TICKS > 65536
+#error "TIME_GUARD_MS too long for a 16-bit timer"
+#endif
+
+static uint32_t
+  TimeLastCycles,		// cycle count at the last read
+  TimeHighCycles;		// times it's wrapped
+
+static uint32_t
+  TimeDeadline;			// when EV_TIMER is wanted
+
+static int
+  TimeDeadlineSet;		// nonzero if there is one
+
+static void TimeArm( uint32_t Now);
+
+//*	TimeInit - Start timekeeping.
+//	-----------------------------
+//
+//	Starts the DWT cycle counter, the heartbeat and the deadline
+//	timer.  Must come before anything asks the time.
+//
+
+void TimeInit( void)
+{
+
+  dwt_enable_cycle_counter();
+  TimeLastCycles = dwt_read_cycle_counter();
+  TimeHighCycles = 0;
+  TimeDeadlineSet = 0;
+
+//  Heartbeat: TIM3 channel 4, PWM on the LED pin.
+
+  rcc_periph_clock_enable(RCC_TIM3);
+  rcc_periph_reset_pulse(RST_TIM3);
+  gpio_set_mode( LED_GPIO, GPIO_MODE_OUTPUT_2_MHZ,
+      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, LED_BIT);
+  timer_set_mode( TIM3, TIM_CR1_CKD_CK_INT,
+      TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+  timer_set_prescaler( TIM3, TIME_PRESCALER - 1);
+  timer_set_period( TIM3, HEARTBEAT_PERIOD - 1);
+  timer_set_oc_mode( TIM3, TIM_OC4, TIM_OCM_PWM1);
+  timer_set_oc_value( TIM3, TIM_OC4, HEARTBEAT_PERIOD / 2);
+  timer_set_oc_polarity_low( TIM3, TIM_OC4);	// LED on when low
+  timer_enable_oc_output( TIM3, TIM_OC4);
+  timer_generate_event( TIM3, TIM_EGR_UG);	// load the prescaler
+  timer_enable_counter( TIM3);
+
+//  Deadlines: TIM1, one-shot, interrupt on overflow only.
+
+  rcc_periph_clock_enable(RCC_TIM1);
+  rcc_periph_reset_pulse(RST_TIM1);
+  timer_set_mode( TIM1, TIM_CR1_CKD_CK_INT,
+      TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+  timer_set_prescaler( TIM1, TIME_PRESCALER - 1);
+  timer_disable_preload( TIM1);
+  timer_one_shot_mode( TIM1);
+  timer_update_on_overflow( TIM1);
+  timer_generate_event( TIM1, TIM_EGR_UG);	// load the prescaler
+  timer_clear_flag( TIM1, TIM_SR_UIF);
+  timer_enable_irq( TIM1, TIM_DIER_UIE);
+  nvic_set_priority( NVIC_TIM1_UP_IRQ, IRQ_PRIO_TIME);
+  nvic_enable_irq( NVIC_TIM1_UP_IRQ);
+  TimeArm( TimeNow());
+  return;
+} // TimeInit
+
+//*	TimeNow - Return the time.
+//	--------------------------
+//
+//	Milliseconds since TimeInit, wrapping after 49 days; compare
+//	times by subtracting.  Safe from interrupt handlers at
+//	IRQ_PRIO_TIME or below; the more urgent ones aren't held off
+//	while the wrap count is updated, so mustn't call it.
+//
+
+uint32_t TimeNow( void)
+{
+
+  uint32_t
+    cycles,
+    wasMasked;
+
+  uint64_t
+    total;
+
+  wasMasked = IRQ_MASK( IRQ_PRIO_TIME);
+  cycles = dwt_read_cycle_counter();
+  if ( cycles < TimeLastCycles)
+    TimeHighCycles++;		// wrapped since last time
+  TimeLastCycles = cycles;
+  total = ((uint64_t) TimeHighCycles << 32) | cycles;
+  IRQ_UNMASK( wasMasked);
+  return (uint32_t) (total / CYCLES_PER_MS);
+} // TimeNow
+
+//*	TimeSetDeadline - Ask for EV_TIMER at a given time.
+//	---------------------------------------------------
+//
+//	At is a TimeNow time.  If an earlier deadline is already set,
+//	that one stands; either way, EV_TIMER is posted once for the
+//	earliest, and anything later must be asked for again.
+//
+
+void TimeSetDeadline( uint32_t At)
+{
+
+  uint32_t
+    now,
+    wasMasked;
+
+  wasMasked = IRQ_MASK( IRQ_PRIO_TIME);	// tim1_up_isr rearms too
+  now = TimeNow();
+  if ( !TimeDeadlineSet || (int32_t) (At - TimeDeadline) < 0)
+  {
+    TimeDeadline = At;
+    TimeDeadlineSet = 1;
+    TimeArm( now);
+  }
+  IRQ_UNMASK( wasMasked);
+  return;
+} // TimeSetDeadline
+
+//	TimeArm - Set TIM1 for the next deadline or guard read.
+//	-------------------------------------------------------
+//
+//	Called with IRQ_PRIO_TIME held off (or from tim1_up_isr).
+//
+
+static void TimeArm( uint32_t Now)
+{
+
+  uint32_t
+    ticks;
+
+  ticks = TIME_GUARD_TICKS;
+  if ( TimeDeadlineSet)
+  {
+    if ( (int32_t) (TimeDeadline - Now) <= 0)
+      ticks = 2;				// already due
+    else if ( (TimeDeadline - Now) < TIME_GUARD_MS)
+      ticks = (TimeDeadline - Now) * (TIME_TIMER_HZ / 1000);
+  }
+
+  timer_disable_counter( TIM1);
+  timer_set_period( TIM1, ticks - 1);
+  timer_set_counter( TIM1, 0);
+  timer_enable_counter( TIM1);
+  return;
+} // TimeArm
+
+//	TIM1 update interrupt - deadline or guard time reached.
+//	-------------------------------------------------------
+//
+//	Reading the time keeps the wrap count right.  EV_TIMER is posted
+//	every time, so the housekeeping gets done at least every
+//	TIME_GUARD_MS as well.
+//
+
+void tim1_up_isr(void)
+{
+
+  uint32_t
+    now;
+
+  ProfileEnter( PROF_TIM1);
+  timer_clear_flag( TIM1, TIM_SR_UIF);
+  now = TimeNow();
+  if ( TimeDeadlineSet && (int32_t) (TimeDeadline - now) <= 0)
+    TimeDeadlineSet = 0;		// got there
+  EventPost( EV_TIMER);
+  TimeArm( now);
+  ProfileExit( PROF_TIM1);
+  return;
+} // tim1_up_isr
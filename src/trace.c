@@ -0,0 +1,279 @@
+//  Binary trace log.
+//  -----------------
+//
+//	Formatting text with Uprintf takes far too long for the places we
+//	most want to see into, and its buffer drops output when full.  So
+//	instead, Trace just fills in a 12-byte record with an id, two
+//	arguments and the DWT cycle count and puts it in a ring.  DMA1
+//	channel 4 takes the records out USART1 as a run of bytes, as many
+//	as sit together in the ring at a time; when that's done, its
+//	interrupt starts the next run.  The CPU never touches the bytes.
+//
+//	Trace can be called from anywhere, at any priority, so the ring
+//	is updated with interrupts masked--a couple of dozen cycles.  If
+//	it's full, the record is counted as lost, and a TR_LOST record
+//	goes in ahead of the next one that fits.
+//
+//	Uprintf output comes here too (uart.c), packed 4 characters to a
+//	TR_TEXT record, so there's one stream for the host to read.
+//
+
+#include <stdint.h>
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "globals.h"
+#include "debug.h"
+#include "irqprio.h"
+#include "profile.h"
+#include "trace.h"
+
+#ifdef USE_TRACE
+
+#ifndef USE_USART_DEBUG
+#error "USE_TRACE needs USE_USART_DEBUG"
+#endif
+#if !RING_SIZE_OK( TRACE_RECORDS)
+#error "TRACE_RECORDS must be a power of two"
+#endif
+
+static TRACE_RECORD
+  TraceBuffer[ TRACE_RECORDS];
+
+static volatile uint32_t
+  TraceIn,			// records written
+  TraceOut,			// records sent
+  TraceSending,			// records in the current DMA run; 0 if idle
+  TraceLost,			// records lost since the last TR_LOST
+  TraceLostTotal;		// and since TraceInit
+
+static uint32_t
+  TraceTextChars;		// characters waiting for a TR_TEXT
+
+static uint8_t
+  TraceTextCount;
+
+static void TracePut( TRACE_ID Id, uint16_t Arg1, uint32_t Arg2, 
+  uint32_t Stamp);
+static void TraceKick( void);
+static void TraceSent( void);
+
+//*	TraceInit - Set up DMA on USART1 for the trace.
+//	-----------------------------------------------
+//
+//	Must follow InitUART.
+//
+
+void TraceInit( void)
+{
+
+  TraceIn = 0;
+  TraceOut = 0;
+  TraceSending = 0;
+  TraceLost = 0;
+  TraceLostTotal = 0;
+  TraceTextCount = 0;
+  TraceTextChars = 0;
+
+  rcc_periph_clock_enable(RCC_DMA1);
+  dma_channel_reset( DMA1, DMA_CHANNEL4);
+  dma_set_peripheral_address( DMA1, DMA_CHANNEL4, 
+    (uint32_t) &USART_DR(USART1));
+  dma_set_read_from_memory( DMA1, DMA_CHANNEL4);
+  dma_enable_memory_increment_mode( DMA1, DMA_CHANNEL4);
+  dma_set_peripheral_size( DMA1, DMA_CHANNEL4, DMA_CCR_PSIZE_8BIT);
+  dma_set_memory_size( DMA1, DMA_CHANNEL4, DMA_CCR_MSIZE_8BIT);
+  dma_set_priority( DMA1, DMA_CHANNEL4, DMA_CCR_PL_LOW);
+  dma_enable_transfer_complete_interrupt( DMA1, DMA_CHANNEL4);
+  nvic_set_priority( NVIC_DMA1_CHANNEL4_IRQ, IRQ_PRIO_DEBUG);
+  nvic_enable_irq( NVIC_DMA1_CHANNEL4_IRQ);
+  usart_enable_tx_dma( USART1);
+  return;
+} // TraceInit
+
+//*	Trace - Log an event.
+//	---------------------
+//
+//	Safe from any interrupt handler.  tim2_isr logs too, and BASEPRI
+//	can't hold it off, so this takes PRIMASK; only for a record and
+//	maybe a DMA restart, which is short.
+//
+
+void Trace( TRACE_ID Id, uint16_t Arg1, uint32_t Arg2)
+{
+
+  uint32_t
+    stamp,
+    wasMasked;
+
+  stamp = dwt_read_cycle_counter();
+  wasMasked = cm_mask_interrupts( 1);
+  if ( TraceLost && ((TraceIn - TraceOut) <= (TRACE_RECORDS - 2)))
+  { // room again; say what we missed first
+    TracePut( TR_LOST, 0, TraceLost, stamp);
+    TraceLost = 0;
+  }
+  if ( (TraceIn - TraceOut) < TRACE_RECORDS)
+    TracePut( Id, Arg1, Arg2, stamp);
+  else
+  {
+    TraceLost++;
+    TraceLostTotal++;
+  }
+  if ( !TraceSending)
+    TraceKick();
+  cm_mask_interrupts( wasMasked);
+  return;
+} // Trace
+
+//*	TraceText - Log a character of text.
+//	------------------------------------
+//
+//	Characters are held until there are 4 or a newline comes along.
+//	Main line only.
+//
+
+void TraceText( char What)
+{
+
+  TraceTextChars |= (uint32_t) (uint8_t) What << (TraceTextCount * 8);
+  TraceTextCount++;
+  if ( TraceTextCount == 4 || What == '\n')
+  {
+    Trace( TR_TEXT, TraceTextCount, TraceTextChars);
+    TraceTextCount = 0;
+    TraceTextChars = 0;
+  }
+  return;
+} // TraceText
+
+//*	TraceFlush - Wait until the whole trace has gone out.
+//	-----------------------------------------------------
+//
+//	Any text being held goes too.  Works with interrupts off, for
+//	crash dumps; see UFlush.  Otherwise interrupts are off only for
+//	each look at the DMA, not for the whole wait.
+//
+
+void TraceFlush( void)
+{
+
+  uint32_t
+    wasMasked;
+
+  if ( TraceTextCount)
+  {
+    Trace( TR_TEXT, TraceTextCount, TraceTextChars);
+    TraceTextCount = 0;
+    TraceTextChars = 0;
+  }
+
+  while ( TraceIn != TraceOut)
+  {
+    wasMasked = cm_mask_interrupts( 1);
+    if ( !TraceSending)
+      TraceKick();
+    else if ( dma_get_interrupt_flag( DMA1, DMA_CHANNEL4, DMA_TCIF))
+      TraceSent();		// what the interrupt would do
+    cm_mask_interrupts( wasMasked);
+  } // while
+  return;
+} // TraceFlush
+
+//*	TraceLostCount - Return the number of records lost.
+//	---------------------------------------------------
+//
+//	Since TraceInit, text and all; the TR_LOST records in the stream
+//	only say how many went between them.
+//
+
+uint32_t TraceLostCount( void)
+{
+  return TraceLostTotal;
+} // TraceLostCount
+
+//	TracePut - Fill in the next record.
+//	-----------------------------------
+//
+//	Interrupts are off and there's room.
+//
+
+static void TracePut( TRACE_ID Id, uint16_t Arg1, uint32_t Arg2, 
+  uint32_t Stamp)
+{
+
+  TRACE_RECORD
+    *rec;
+
+  rec = &TraceBuffer[ TraceIn & (TRACE_RECORDS - 1)];
+  rec->Sync = TRACE_SYNC;
+  rec->Id = (uint8_t) Id;
+  rec->Arg1 = Arg1;
+  rec->Arg2 = Arg2;
+  rec->Stamp = Stamp;
+  TraceIn++;
+  return;
+} // TracePut
+
+//	TraceKick - Start DMA on the next run of records.
+//	-------------------------------------------------
+//
+//	Interrupts are off (or we're in the DMA interrupt).  A run stops
+//	at the end of the buffer; the rest goes next time.
+//
+
+static void TraceKick( void)
+{
+
+  uint32_t
+    first,
+    count;
+
+  count = TraceIn - TraceOut;
+  if ( !count)
+    return;
+  first = TraceOut & (TRACE_RECORDS - 1);
+  if ( (first + count) > TRACE_RECORDS)
+    count = TRACE_RECORDS - first;	// up to the end for now
+
+  TraceSending = count;
+  dma_disable_channel( DMA1, DMA_CHANNEL4);
+  dma_set_memory_address( DMA1, DMA_CHANNEL4, 
+    (uint32_t) &TraceBuffer[ first]);
+  dma_set_number_of_data( DMA1, DMA_CHANNEL4, 
+    count * sizeof( TRACE_RECORD));
+  dma_enable_channel( DMA1, DMA_CHANNEL4);
+  return;
+} // TraceKick
+
+//	DMA1 channel 4 interrupt - a run of records is out.
+//	---------------------------------------------------
+
+void dma1_channel4_isr(void)
+{
+
+  ProfileEnter( PROF_DMA4);
+  if ( dma_get_interrupt_flag( DMA1, DMA_CHANNEL4, DMA_TCIF))
+    TraceSent();
+  ProfileExit( PROF_DMA4);
+} // dma1_channel4_isr
+
+//	TraceSent - A run of records has gone out.
+//	------------------------------------------
+
+static void TraceSent( void)
+{
+
+  dma_clear_interrupt_flags( DMA1, DMA_CHANNEL4, DMA_TCIF);
+  TraceOut += TraceSending;	// those slots are free now
+  TraceSending = 0;
+  TraceKick();
+  return;
+} // TraceSent
+
+#endif // USE_TRACE
@@ -5,18 +5,52 @@
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
 #include <libopencm3/cm3/nvic.h>
 #include "globals.h"
 #include "uart.h"
+#include "irqprio.h"
+#include "profile.h"
+#include "trace.h"
+#include "event.h"
+
+//	Output goes out by DMA (DMA1 channel 4) from one of two buffers
+//	while Uput fills the other.  When DMA finishes, if there's
+//	anything in the other buffer, the two swap and DMA starts again;
+//	so there's one interrupt per buffer, not one per character.  If
+//	the buffer being filled is full, the character is dropped and
+//	counted.
+//
+//	With the trace on (trace.h), the trace has the DMA channel, and
+//	text goes through it instead.
 
-#define UART_TX_BUF_LEN 64		// transmit buffer length
-
+#ifndef USE_TRACE
 static uint8_t
-  UartTxBuf[ UART_TX_BUF_LEN];
+  UartTxBuf[ 2][ UART_TX_BUF_LEN];
 
 static volatile int
-  UartTxIn,
-  UartTxOut;				// buffer pointers
+  UartTxFill,				// buffer Uput is filling
+  UartTxLen,				// characters in it
+  UartTxBusy;				// DMA is sending the other one
+
+static volatile uint32_t
+  UartTxDropped;			// characters with no room
+
+static void UartTxStart( void);
+static void UartTxDone( void);
+#endif
+
+//	Input is taken by interrupt into a ring, and EV_CONSOLE posted.
+
+#if !RING_SIZE_OK( UART_RX_BUF_LEN)
+#error "UART_RX_BUF_LEN must be a power of two"
+#endif
+
+static uint8_t
+  UartRxBuf[ UART_RX_BUF_LEN];
+
+static RING
+  UartRxRing;				// overflows are characters lost
 
 
 // local prototypes.
@@ -54,17 +88,92 @@ void InitUART (int Baudrate)
   usart_set_flow_control (USART1, USART_FLOWCONTROL_NONE);
   usart_set_mode (USART1, USART_MODE_TX_RX);
 
-//  Set up interrupt on TxE.
-
+//  Set up DMA on transmit.
+
+#ifndef USE_TRACE
+  UartTxDropped = 0;
+  UartTxFill = 0;
+  UartTxLen = 0;
+  UartTxBusy = 0;
+  rcc_periph_clock_enable(RCC_DMA1);
+  dma_channel_reset( DMA1, DMA_CHANNEL4);
+  dma_set_peripheral_address( DMA1, DMA_CHANNEL4, 
+    (uint32_t) &USART_DR(USART1));
+  dma_set_read_from_memory( DMA1, DMA_CHANNEL4);
+  dma_enable_memory_increment_mode( DMA1, DMA_CHANNEL4);
+  dma_set_peripheral_size( DMA1, DMA_CHANNEL4, DMA_CCR_PSIZE_8BIT);
+  dma_set_memory_size( DMA1, DMA_CHANNEL4, DMA_CCR_MSIZE_8BIT);
+  dma_set_priority( DMA1, DMA_CHANNEL4, DMA_CCR_PL_LOW);
+  dma_enable_transfer_complete_interrupt( DMA1, DMA_CHANNEL4);
+  nvic_set_priority( NVIC_DMA1_CHANNEL4_IRQ, IRQ_PRIO_DEBUG);
+  nvic_enable_irq( NVIC_DMA1_CHANNEL4_IRQ);
+  usart_enable_tx_dma( USART1);
+#endif
+
+//  Interrupt on each character received.
+
+  RingInit( &UartRxRing, UartRxBuf, UART_RX_BUF_LEN);
+  USART_CR1(USART1) |= USART_CR1_RXNEIE;
+  nvic_set_priority( NVIC_USART1_IRQ, IRQ_PRIO_DEBUG);
   nvic_enable_irq(NVIC_USART1_IRQ);
 
 // Finally enable the USART. 
 
-  UartTxIn = UartTxOut = 0;	// clear buffer
   usart_enable (USART1);
   return;
 } // InitUART
 
+//*	UDropCount - Return count of output characters dropped.
+//	-------------------------------------------------------
+//
+//	With the trace on, output goes into the trace, so this is the
+//	trace records it had no room for instead.
+//
+
+uint32_t UDropCount( void)
+{
+#ifdef USE_TRACE
+  return TraceLostCount();
+#else
+  return UartTxDropped;
+#endif
+} // UDropCount
+
+//*	UFlush - Wait until all output has gone out.
+//	--------------------------------------------
+//
+//	For crash dumps and the like: works with interrupts off, by
+//	looking at the DMA flag directly.  Otherwise only the debug port's
+//	own interrupts are held off while it waits.
+//
+
+void UFlush( void)
+{
+
+#ifdef USE_TRACE
+  TraceFlush();
+#else
+  uint32_t
+    wasMasked;
+
+  wasMasked = IRQ_MASK( IRQ_PRIO_DEBUG);
+  for (;;)
+  {
+    if ( !UartTxBusy)
+    {
+      if ( !UartTxLen)
+        break;			// all gone
+      UartTxStart();
+    } else if ( dma_get_interrupt_flag( DMA1, DMA_CHANNEL4, DMA_TCIF))
+      UartTxDone();		// what the interrupt would do
+  } // for
+  IRQ_UNMASK( wasMasked);
+#endif
+  while ( !(USART_SR(USART1) & USART_SR_TC))
+    ;				// last character off the wire
+  return;
+} // UFlush
+
 //  Ucharavail - Test if character ready.
 //  -------------------------------------
 //
@@ -73,7 +182,7 @@ void InitUART (int Baudrate)
 
 int Ucharavail( void)
 {
-  return (USART_SR(USART1) & USART_SR_RXNE) ? 1 : 0;
+  return !RingEmpty( &UartRxRing);
 } // Ucharavail
 
 
@@ -85,9 +194,26 @@ int Ucharavail( void)
 
 unsigned char Ugetchar( void)
 {
-  return (usart_recv_blocking( USART1) & 255);
+
+  int
+    c;
+
+  while ( (c = RingGet( &UartRxRing)) < 0)
+    ;				// wait for one
+  return c;
 } // Ugetchar
 
+//  Ureadchar - Get UART character if there is one.
+//  -----------------------------------------------
+//
+//  Returns -1 if nothing has been typed.
+//
+
+int Ureadchar( void)
+{
+  return RingGet( &UartRxRing);
+} // Ureadchar
+
 
 //  Uputchar - Put character out.
 //  -----------------------------
@@ -110,26 +236,29 @@ void Uputchar( unsigned char What)
 //  Put a character to output.
 //  --------------------------
 //
-//  Queue the character and enable TX interrupt.
+//  Add the character to the buffer being filled and start DMA if it's
+//  idle.  If there's no room, count it.  With the trace on, the
+//  character goes into the trace instead.
 //
 
 static void Uput( unsigned char What)
 {
 
-  int rNext;
-  
-  rNext = UartTxIn+1;
-  if ( rNext >= UART_TX_BUF_LEN)
-    rNext = 0;				// handle wrap
-  if ( rNext != UartTxOut)
-  { // if there's room, put it in
-    UartTxBuf[UartTxIn] = What;		// stash the character
-    UartTxIn = rNext;			// and advance the pointer
-  }
-  
-//	Regardless, enable transmit interrupt.
-
-  USART_CR1(USART1) |= USART_CR1_TXEIE;
+#ifdef USE_TRACE
+  TraceText( What);
+#else
+  uint32_t
+    wasMasked;
+
+  wasMasked = IRQ_MASK( IRQ_PRIO_DEBUG);	// the DMA interrupt swaps buffers
+  if ( UartTxLen < UART_TX_BUF_LEN)
+    UartTxBuf[ UartTxFill][ UartTxLen++] = What;
+  else
+    UartTxDropped++;
+  if ( !UartTxBusy)
+    UartTxStart();
+  IRQ_UNMASK( wasMasked);
+#endif
   return;
 } // Uput
 
@@ -150,28 +279,72 @@ void Uputs( char *What)
     Uputchar( c);
 } // Uputs
 
+#ifndef USE_TRACE
+//  UartTxStart - Send the buffer that's been filled.
+//  -------------------------------------------------
+//
+//  DMA is idle and its interrupt is held off.  Uput carries on with
+//  the other buffer.
+//
+
+static void UartTxStart( void)
+{
+
+  if ( !UartTxLen)
+    return;
+  dma_disable_channel( DMA1, DMA_CHANNEL4);
+  dma_set_memory_address( DMA1, DMA_CHANNEL4, 
+    (uint32_t) UartTxBuf[ UartTxFill]);
+  dma_set_number_of_data( DMA1, DMA_CHANNEL4, UartTxLen);
+  dma_enable_channel( DMA1, DMA_CHANNEL4);
+  UartTxBusy = 1;
+  UartTxFill ^= 1;
+  UartTxLen = 0;
+  return;
+} // UartTxStart
+
+//  UartTxDone - A buffer has gone out.
+//  -----------------------------------
+
+static void UartTxDone( void)
+{
+
+  dma_clear_interrupt_flags( DMA1, DMA_CHANNEL4, DMA_TCIF);
+  UartTxBusy = 0;
+  UartTxStart();		// the other one, if there's anything in it
+  return;
+} // UartTxDone
+
+//  DMA1 channel 4 interrupt - a buffer has gone out.
+//  -------------------------------------------------
+
+void dma1_channel4_isr(void)
+{
+
+  ProfileEnter( PROF_DMA4);
+  if ( dma_get_interrupt_flag( DMA1, DMA_CHANNEL4, DMA_TCIF))
+    UartTxDone();
+  ProfileExit( PROF_DMA4);
+} // dma1_channel4_isr
+#endif // USE_TRACE
+
+
 //  Usart_ISR - interrupt servicer.
 //
-//	Currently, transmit only.
+//	Receive only; output goes by DMA.  Reading DR clears an overrun
+//	along with RXNE.
 //
 
 void usart1_isr(void)
 {
 
-  if (((USART_CR1(USART1) & USART_CR1_TXEIE) != 0) &&
-     ((USART_SR(USART1) & USART_SR_TXE) != 0)) 
+  ProfileEnter( PROF_USART1);
+  if ( USART_SR(USART1) & (USART_SR_RXNE | USART_SR_ORE))
   {
-    if ( UartTxIn != UartTxOut)
-    { // only if we have data
-      usart_send( USART1, UartTxBuf[ UartTxOut++]);
-      if (UartTxOut >= UART_TX_BUF_LEN)
-        UartTxOut = 0;		// wrap
-     }
-     if ( UartTxIn != UartTxOut)
-       USART_CR1(USART1) |= USART_CR1_TXEIE;   // ready for next character
-     else
-       USART_CR1(USART1) &= ~USART_CR1_TXEIE;  // disable if queue empty
-  }  // if interrupt was from TX empty
+    RingPut( &UartRxRing, usart_recv( USART1));	// full ring counts it
+    EventPost( EV_CONSOLE);
+  }
+  ProfileExit( PROF_USART1);
 } // usart1_isr
 
 
@@ -242,7 +415,7 @@ void Uprintf( char *Form,...)
         else
         {  
           i = strlen(s) - width;
-          if ( width >= 0)
+          if ( i >= 0)
             Uputs( s+i);       // truncate
           else
           {  // if pad